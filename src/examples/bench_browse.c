@@ -0,0 +1,192 @@
+/***************************************************************************
+ *   Copyright (C) 2015 by OmanTek                                         *
+ *   Author Kyle Hayes  kylehayes@omantek.com                              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+/*
+ * Time reading the tag list of a Logix PLC.  Reading a tag named @tags has
+ * the library read the PLC's symbol table and return it as the tag data.
+ * Then some of the listed tags are created without elem_size, which has
+ * the library size them from the same table, and the sizes are checked
+ * against the list.
+ *
+ * Each round creates the browse tag again so that the table is read again.
+ *
+ * Start plc_sim first with --tags=20000 and some --delay.
+ *
+ * Usage: bench_browse <rounds> <tags to check>
+ *
+ * POSIX only.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "../lib/libplctag.h"
+#include "utils.h"
+
+
+#define BROWSE_PATH "protocol=ab_eip&gateway=127.0.0.1&path=1,0&cpu=LGX&name=@tags"
+#define TAG_PATH "protocol=ab_eip&gateway=127.0.0.1&path=1,0&cpu=LGX&name=%.*s"
+#define DATA_TIMEOUT (30000)
+
+/* each entry is the instance, type, element size, three dimensions and the name length, then the name. */
+#define ENTRY_HEADER (22)
+
+
+/* read the tag list, returns the number of tags or -1. */
+static int read_list(plc_tag *list, int64_t *total_ms)
+{
+    int64_t start_time = time_ms();
+    int count = 0;
+    int size;
+    int rc;
+
+    *list = plc_tag_create(BROWSE_PATH);
+
+    if(!*list) {
+        fprintf(stderr, "Unable to create browse tag!\n");
+        return -1;
+    }
+
+    if((rc = plc_tag_read(*list, DATA_TIMEOUT)) != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "Unable to read the tag list, error %s!\n", plc_tag_decode_error(rc));
+        return -1;
+    }
+
+    *total_ms += time_ms() - start_time;
+
+    size = plc_tag_get_size(*list);
+
+    for(int offset = 0; offset + ENTRY_HEADER <= size; count++) {
+        offset += ENTRY_HEADER + plc_tag_get_uint16(*list, offset + 20);
+    }
+
+    return count;
+}
+
+
+/* create the first few listed tags without elem_size and check their sizes. */
+static int check_sizes(plc_tag list, int num_check, int64_t *total_ms)
+{
+    plc_tag *tags = calloc((size_t)num_check, sizeof(plc_tag));
+    int *expected = calloc((size_t)num_check, sizeof(int));
+    int size = plc_tag_get_size(list);
+    int offset = 0;
+    int64_t start_time = time_ms();
+    int rc = PLCTAG_STATUS_OK;
+    int created = 0;
+
+    if(!tags || !expected) {
+        fprintf(stderr, "Unable to allocate tag arrays!\n");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    for(; created < num_check && offset + ENTRY_HEADER <= size; created++) {
+        char path[256];
+        char name[128];
+        int name_len = plc_tag_get_uint16(list, offset + 20);
+        int count = 1;
+
+        for(int d=0; d < 3 && plc_tag_get_uint32(list, offset + 8 + (d * 4)); d++) {
+            count *= (int)plc_tag_get_uint32(list, offset + 8 + (d * 4));
+        }
+
+        expected[created] = count * plc_tag_get_uint16(list, offset + 6);
+
+        if(name_len >= (int)sizeof(name) || plc_tag_get_bytes(list, offset + ENTRY_HEADER, (uint8_t *)name, name_len) != PLCTAG_STATUS_OK) {
+            fprintf(stderr, "Bad name in the tag list!\n");
+            rc = PLCTAG_ERR_BAD_DATA;
+            break;
+        }
+
+        snprintf_platform(path, sizeof(path), TAG_PATH, name_len, name);
+
+        if(!(tags[created] = plc_tag_create(path))) {
+            fprintf(stderr, "Unable to create tag %.*s!\n", name_len, name);
+            rc = PLCTAG_ERR_CREATE;
+            break;
+        }
+
+        offset += ENTRY_HEADER + name_len;
+    }
+
+    /* the tags are sized once the table is in, then the reads go out. */
+    for(int i=0; rc == PLCTAG_STATUS_OK && i < created; i++) {
+        if((rc = plc_tag_read(tags[i], DATA_TIMEOUT)) != PLCTAG_STATUS_OK) {
+            fprintf(stderr, "Unable to read listed tag %d, error %s!\n", i, plc_tag_decode_error(rc));
+        } else if(plc_tag_get_size(tags[i]) != expected[i]) {
+            fprintf(stderr, "Listed tag %d has %d bytes, expected %d!\n", i, plc_tag_get_size(tags[i]), expected[i]);
+            rc = PLCTAG_ERR_BAD_DATA;
+        }
+    }
+
+    *total_ms += time_ms() - start_time;
+
+    for(int i=0; i < created; i++) {
+        plc_tag_destroy(tags[i]);
+    }
+
+    free(expected);
+    free(tags);
+
+    return rc;
+}
+
+
+int main(int argc, char **argv)
+{
+    int rounds, num_check;
+    int num_listed = 0;
+    int64_t list_ms = 0, check_ms = 0;
+
+    if(argc != 3) {
+        fprintf(stderr, "Usage: bench_browse <rounds> <tags to check>\n");
+        return 1;
+    }
+
+    rounds = atoi(argv[1]);
+    num_check = atoi(argv[2]);
+
+    if(rounds < 1 || num_check < 0) {
+        fprintf(stderr, "Arguments out of range!\n");
+        return 1;
+    }
+
+    for(int r=0; r < rounds; r++) {
+        plc_tag list = NULL;
+
+        num_listed = read_list(&list, &list_ms);
+
+        if(num_listed < 0 || (num_check && check_sizes(list, num_check, &check_ms) != PLCTAG_STATUS_OK)) {
+            return 1;
+        }
+
+        plc_tag_destroy(list);
+    }
+
+    printf("%d tags listed, %d rounds\n", num_listed, rounds);
+    printf("list: %.1fms/round\n", (double)list_ms / rounds);
+
+    if(num_check) {
+        printf("create and read %d listed tags without elem_size: %.1fms/round\n", num_check, (double)check_ms / rounds);
+    }
+
+    return 0;
+}
@@ -0,0 +1,177 @@
+/***************************************************************************
+ *   Copyright (C) 2015 by OmanTek                                         *
+ *   Author Kyle Hayes  kylehayes@omantek.com                              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+/*
+ * Compare reading and writing a set of small tags with plc_tag_read_many()
+ * and plc_tag_write_many() as they are and with the coalesce_reads and
+ * coalesce_writes attributes set, which let the library pack reads and
+ * writes that are waiting to go to the same PLC into CIP Multiple Service
+ * Packets.
+ *
+ * Start plc_sim first, with some --delay to make the round trips show.  All
+ * the tags are on one PLC.  There are two handles on each tag, a plain one
+ * and one with both attributes set.  The values written through one are
+ * checked on the other.  The library counters show how many requests went
+ * out in each packed request.
+ *
+ * Usage: bench_coalesce <num tags> <rounds> [connected]
+ *
+ * Add "connected" to use connected messaging.  Try it with 1000 tags.
+ * POSIX only.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "../lib/libplctag.h"
+#include "utils.h"
+#include "bench_utils.h"
+
+
+#define TAG_PATH "protocol=ab_eip&gateway=127.0.0.1&path=1,0&cpu=LGX&elem_size=4&elem_count=1&name=coalesce_dint[%d]%s%s"
+#define MAX_TAGS (10000)
+
+
+/* run one operation on all the tags and add the time it took and the packets it used. */
+static int timed_op(int (*op)(plc_tag *, int, int, int *), plc_tag *tags, int num_tags, int value, int *statuses, struct bench_counts *counts)
+{
+    struct bench_counts mark;
+    int rc;
+
+    bench_counts_start(&mark);
+
+    rc = op(tags, num_tags, value, statuses);
+
+    bench_counts_add(counts, &mark);
+
+    return rc;
+}
+
+
+static int read_and_check(plc_tag *tags, int num_tags, int value, int *statuses)
+{
+    int rc = bench_read_many(tags, num_tags, statuses);
+
+    if(rc == PLCTAG_STATUS_OK) {
+        rc = bench_check_values(tags, num_tags, value);
+    }
+
+    return rc;
+}
+
+
+int main(int argc, char **argv)
+{
+    plc_tag *plain, *coalesced;
+    int *statuses;
+    int num_tags, rounds;
+    const char *extra = "";
+    struct bench_counts plain_read = {0}, plain_write = {0}, coalesce_read = {0}, coalesce_write = {0};
+
+    if(argc < 3 || argc > 4) {
+        fprintf(stderr, "Usage: bench_coalesce <num tags> <rounds> [connected]\n");
+        return 1;
+    }
+
+    num_tags = atoi(argv[1]);
+    rounds = atoi(argv[2]);
+
+    if(argc == 4) {
+        if(strcmp(argv[3], "connected") != 0) {
+            fprintf(stderr, "Unknown option %s!\n", argv[3]);
+            return 1;
+        }
+
+        extra = "&use_connected_msg=1";
+    }
+
+    if(num_tags < 1 || num_tags > MAX_TAGS || rounds < 1) {
+        fprintf(stderr, "Arguments out of range!\n");
+        return 1;
+    }
+
+    plain = calloc((size_t)num_tags, sizeof(plc_tag));
+    coalesced = calloc((size_t)num_tags, sizeof(plc_tag));
+    statuses = calloc((size_t)num_tags, sizeof(int));
+
+    if(!plain || !coalesced || !statuses) {
+        fprintf(stderr, "Unable to allocate tag arrays!\n");
+        return 1;
+    }
+
+    for(int i=0; i < num_tags; i++) {
+        char path[256];
+
+        snprintf_platform(path, sizeof(path), TAG_PATH, i, "", extra);
+
+        if(!(plain[i] = bench_create_tag(path, i))) {
+            return 1;
+        }
+
+        snprintf_platform(path, sizeof(path), TAG_PATH, i, "&coalesce_reads=1&coalesce_writes=1", extra);
+
+        if(!(coalesced[i] = bench_create_tag(path, i))) {
+            return 1;
+        }
+    }
+
+    /* the first write of a tag reads it to get its type, get that out of the way. */
+    if(bench_read_many(plain, num_tags, statuses) != PLCTAG_STATUS_OK || bench_read_many(coalesced, num_tags, statuses) != PLCTAG_STATUS_OK) {
+        return 1;
+    }
+
+    for(int r=0; r < rounds; r++) {
+        if(timed_op(bench_write_values, plain, num_tags, r * 2, statuses, &plain_write) != PLCTAG_STATUS_OK
+           || timed_op(read_and_check, coalesced, num_tags, r * 2, statuses, &coalesce_read) != PLCTAG_STATUS_OK
+           || timed_op(bench_write_values, coalesced, num_tags, r * 2 + 1, statuses, &coalesce_write) != PLCTAG_STATUS_OK
+           || timed_op(read_and_check, plain, num_tags, r * 2 + 1, statuses, &plain_read) != PLCTAG_STATUS_OK) {
+            return 1;
+        }
+    }
+
+    printf("%d tags, %d rounds: reads plain %.1fms/round, coalesced %.1fms/round\n", num_tags, rounds,
+           (double)plain_read.ms / rounds, (double)coalesce_read.ms / rounds);
+
+    printf("%d tags, %d rounds: writes plain %.1fms/round, coalesced %.1fms/round\n", num_tags, rounds,
+           (double)plain_write.ms / rounds, (double)coalesce_write.ms / rounds);
+
+    printf("plain: %" PRId64 " packets sent\n", plain_read.sent + plain_write.sent);
+
+    /* both coalesced steps together. */
+    coalesce_read.sent += coalesce_write.sent;
+    coalesce_read.packets += coalesce_write.packets;
+    coalesce_read.requests += coalesce_write.requests;
+
+    printf("coalesced: %" PRId64 " packets sent, %" PRId64 " of them carried %" PRId64 " requests, %.2f requests/packet\n",
+           coalesce_read.sent, coalesce_read.packets, coalesce_read.requests,
+           (coalesce_read.packets ? (double)coalesce_read.requests / (double)coalesce_read.packets : 0.0));
+
+    for(int i=0; i < num_tags; i++) {
+        plc_tag_destroy(plain[i]);
+        plc_tag_destroy(coalesced[i]);
+    }
+
+    free(statuses);
+    free(coalesced);
+    free(plain);
+
+    return 0;
+}
@@ -0,0 +1,154 @@
+/***************************************************************************
+ *   Copyright (C) 2015 by OmanTek                                         *
+ *   Author Kyle Hayes  kylehayes@omantek.com                              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+/*
+ * Measure connected read throughput on one connection as the connected
+ * request window changes.
+ *
+ * Start plc_sim first, with some latency so that round trips matter, for
+ * instance "plc_sim --delay=5".  All the tags share one connection to the
+ * PLC.  Each read is restarted as soon as it completes.  Large tags take
+ * several requests to read, and those are pipelined too.
+ *
+ * Usage: bench_conn_window <window> <num tags> <elements per tag> <seconds>
+ *
+ * Run it with windows of 1 through 7 and compare the requests/sec.
+ * POSIX only.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include "../lib/libplctag.h"
+#include "utils.h"
+
+
+#define TAG_PATH "protocol=ab_eip&gateway=127.0.0.1&path=1,0&cpu=LGX&elem_size=4&elem_count=%d&name=window_dint_%d&use_connected_msg=1&connection_window=%d"
+#define CREATE_TIMEOUT (10000)
+#define DATA_TIMEOUT (5000)
+#define MAX_TAGS (10000)
+
+
+int main(int argc, char **argv)
+{
+    plc_tag *tags;
+    int window, num_tags, elems, seconds;
+    int64_t start_time, end_time;
+    int64_t completed = 0;
+    int rc;
+
+    if(argc != 5) {
+        fprintf(stderr, "Usage: bench_conn_window <window> <num tags> <elements per tag> <seconds>\n");
+        return 1;
+    }
+
+    window = atoi(argv[1]);
+    num_tags = atoi(argv[2]);
+    elems = atoi(argv[3]);
+    seconds = atoi(argv[4]);
+
+    if(window < 1 || num_tags < 1 || num_tags > MAX_TAGS || elems < 1 || seconds < 1) {
+        fprintf(stderr, "Arguments out of range!\n");
+        return 1;
+    }
+
+    tags = calloc((size_t)num_tags, sizeof(plc_tag));
+
+    if(!tags) {
+        fprintf(stderr, "Unable to allocate tag array!\n");
+        return 1;
+    }
+
+    for(int i=0; i < num_tags; i++) {
+        char path[256];
+
+        snprintf_platform(path, sizeof(path), TAG_PATH, elems, i, window);
+
+        tags[i] = plc_tag_create(path);
+
+        if(!tags[i]) {
+            fprintf(stderr, "Unable to create tag %d!\n", i);
+            return 1;
+        }
+    }
+
+    rc = plc_tag_wait(tags, num_tags, PLCTAG_WAIT_ALL, CREATE_TIMEOUT, NULL);
+
+    if(rc != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "Tags failed to set up, error %s!\n", plc_tag_decode_error(rc));
+        return 1;
+    }
+
+    /* the first read of a large tag sizes the requests one at a time, get that out of the way. */
+    rc = plc_tag_read_many(tags, num_tags, DATA_TIMEOUT, NULL);
+
+    if(rc != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "First read failed, error %s!\n", plc_tag_decode_error(rc));
+        return 1;
+    }
+
+    plc_tag_read_many(tags, num_tags, 0, NULL);
+
+    start_time = time_ms();
+    end_time = start_time + (seconds * 1000);
+
+    while(time_ms() < end_time) {
+        int index = -1;
+
+        rc = plc_tag_wait(tags, num_tags, PLCTAG_WAIT_ANY, DATA_TIMEOUT, &index);
+
+        if(rc != PLCTAG_STATUS_OK) {
+            fprintf(stderr, "Wait failed, error %s!\n", plc_tag_decode_error(rc));
+            return 1;
+        }
+
+        /* restart everything that is done. */
+        for(int i=index; i < num_tags; i++) {
+            rc = plc_tag_status(tags[i]);
+
+            if(rc == PLCTAG_STATUS_PENDING) {
+                continue;
+            }
+
+            if(rc != PLCTAG_STATUS_OK) {
+                fprintf(stderr, "Read of tag %d failed, error %s!\n", i, plc_tag_decode_error(rc));
+                return 1;
+            }
+
+            completed++;
+            plc_tag_read(tags[i], 0);
+        }
+    }
+
+    end_time = time_ms();
+
+    printf("window=%d tags=%d elements=%d: %.0f tag reads/sec\n", window, num_tags, elems,
+           (double)completed * 1000.0 / (double)(end_time - start_time));
+
+    for(int i=0; i < num_tags; i++) {
+        plc_tag_destroy(tags[i]);
+    }
+
+    free(tags);
+
+    return 0;
+}
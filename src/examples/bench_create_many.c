@@ -0,0 +1,203 @@
+/***************************************************************************
+ *   Copyright (C) 2015 by OmanTek                                         *
+ *   Author Kyle Hayes  kylehayes@omantek.com                              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+/*
+ * Compare creating many tags one call at a time against plc_tag_create_many().
+ *
+ * Start plc_sim first.  The tags are spread across a few simulated PLCs.
+ * Each way starts from nothing, so the sessions and connections are set up
+ * again each time:
+ *
+ *    loop:  plc_tag_create() on every tag, then poll plc_tag_status() on
+ *           every tag until nothing is pending.
+ *    batch: one plc_tag_create_many() call with a timeout.
+ *
+ * Usage: bench_create_many <num tags> [num PLCs] [connected]
+ *
+ * Add "connected" to use connected messaging.  Try it with 10000 tags.
+ * plc_tag_create_many() only uses more threads with more than one CPU, so
+ * on Linux run it again under "taskset -c 0" to time the serial path.
+ * POSIX only.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "../lib/libplctag.h"
+#include "utils.h"
+
+
+#define TAG_PATH "protocol=ab_eip&gateway=127.0.0.%d&path=1,0&cpu=LGX&elem_size=4&elem_count=1&name=create_dint[%d]%s"
+#define CREATE_TIMEOUT (30000)
+#define MAX_TAGS (100000)
+#define MAX_PLCS (250)
+
+
+static int create_loop(char **paths, plc_tag *tags, int num_tags)
+{
+    int64_t timeout_time = time_ms() + CREATE_TIMEOUT;
+    int pending;
+    int rc;
+
+    for(int i=0; i < num_tags; i++) {
+        tags[i] = plc_tag_create(paths[i]);
+
+        if(!tags[i]) {
+            fprintf(stderr, "Unable to create tag %d!\n", i);
+            return PLCTAG_ERR_CREATE;
+        }
+    }
+
+    do {
+        pending = 0;
+
+        for(int i=0; i < num_tags; i++) {
+            rc = plc_tag_status(tags[i]);
+
+            if(rc == PLCTAG_STATUS_PENDING) {
+                pending++;
+            } else if(rc != PLCTAG_STATUS_OK) {
+                fprintf(stderr, "Tag %d failed to set up, error %s!\n", i, plc_tag_decode_error(rc));
+                return rc;
+            }
+        }
+
+        if(pending && time_ms() > timeout_time) {
+            fprintf(stderr, "Timed out with %d tags still setting up!\n", pending);
+            return PLCTAG_ERR_TIMEOUT;
+        }
+
+        if(pending) {
+            sleep_ms(1);
+        }
+    } while(pending);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+static int create_batch(char **paths, plc_tag *tags, int num_tags)
+{
+    int rc = plc_tag_create_many((const char **)paths, num_tags, tags, CREATE_TIMEOUT);
+
+    if(rc != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "Batch create failed, error %s!\n", plc_tag_decode_error(rc));
+    }
+
+    return rc;
+}
+
+
+static void destroy_all(plc_tag *tags, int num_tags)
+{
+    for(int i=0; i < num_tags; i++) {
+        if(tags[i]) {
+            plc_tag_destroy(tags[i]);
+            tags[i] = NULL;
+        }
+    }
+}
+
+
+int main(int argc, char **argv)
+{
+    plc_tag *tags;
+    char **paths;
+    int num_tags, num_plcs = 4;
+    const char *extra = "";
+    int64_t start_time, loop_ms, batch_ms;
+
+    if(argc < 2 || argc > 4) {
+        fprintf(stderr, "Usage: bench_create_many <num tags> [num PLCs] [connected]\n");
+        return 1;
+    }
+
+    num_tags = atoi(argv[1]);
+
+    if(argc >= 3) {
+        num_plcs = atoi(argv[2]);
+    }
+
+    if(argc == 4) {
+        if(strcmp(argv[3], "connected") != 0) {
+            fprintf(stderr, "Unknown option %s!\n", argv[3]);
+            return 1;
+        }
+
+        extra = "&use_connected_msg=1";
+    }
+
+    if(num_tags < 1 || num_tags > MAX_TAGS || num_plcs < 1 || num_plcs > MAX_PLCS) {
+        fprintf(stderr, "Arguments out of range!\n");
+        return 1;
+    }
+
+    tags = calloc((size_t)num_tags, sizeof(plc_tag));
+    paths = calloc((size_t)num_tags, sizeof(char *));
+
+    if(!tags || !paths) {
+        fprintf(stderr, "Unable to allocate tag arrays!\n");
+        return 1;
+    }
+
+    for(int i=0; i < num_tags; i++) {
+        paths[i] = malloc(256);
+
+        if(!paths[i]) {
+            fprintf(stderr, "Unable to allocate tag path!\n");
+            return 1;
+        }
+
+        /* mix the PLCs up so that the batch call has to do the grouping. */
+        snprintf_platform(paths[i], 256, TAG_PATH, (i % num_plcs) + 1, i, extra);
+    }
+
+    start_time = time_ms();
+
+    if(create_loop(paths, tags, num_tags) != PLCTAG_STATUS_OK) {
+        return 1;
+    }
+
+    loop_ms = time_ms() - start_time;
+
+    destroy_all(tags, num_tags);
+
+    start_time = time_ms();
+
+    if(create_batch(paths, tags, num_tags) != PLCTAG_STATUS_OK) {
+        return 1;
+    }
+
+    batch_ms = time_ms() - start_time;
+
+    destroy_all(tags, num_tags);
+
+    printf("%d tags on %d PLCs: loop %" PRId64 "ms, batch %" PRId64 "ms\n", num_tags, num_plcs, loop_ms, batch_ms);
+
+    for(int i=0; i < num_tags; i++) {
+        free(paths[i]);
+    }
+
+    free(paths);
+    free(tags);
+
+    return 0;
+}
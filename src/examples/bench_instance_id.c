@@ -0,0 +1,185 @@
+/***************************************************************************
+ *   Copyright (C) 2015 by OmanTek                                         *
+ *   Author Kyle Hayes  kylehayes@omantek.com                              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+/*
+ * Compare reading a set of tags with long names by name and with the
+ * use_instance_id attribute set, which has the library read the PLC's
+ * symbol table and send the Symbol Object instance ID of each tag instead
+ * of its name.  Both sets of handles pack their reads into CIP Multiple
+ * Service Packets, so the shorter requests show up as more reads in each
+ * packet and fewer packets.
+ *
+ * Start plc_sim first, with some --delay to make the round trips show.  All
+ * the tags are on one PLC.  The plain handles are read first so that the
+ * simulator has the tags in its symbol table.
+ *
+ * Usage: bench_instance_id <num tags> <rounds> [connected]
+ *
+ * Add "connected" to use connected messaging.  Try it with 1000 tags.
+ * POSIX only.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "../lib/libplctag.h"
+#include "utils.h"
+#include "bench_utils.h"
+
+
+#define TAG_PATH "protocol=ab_eip&gateway=127.0.0.1&path=1,0&cpu=LGX&elem_size=4&elem_count=1&coalesce_reads=1&name=Line_3_Conveyor_Motor_Speed_Setpoint_%04d%s%s"
+#define SYMBOLS_TIMEOUT (10000)
+#define MAX_TAGS (10000)
+
+
+/* read all the tags, check the values and add the time it took and the packets it used. */
+static int timed_read(plc_tag *tags, int num_tags, int *statuses, struct bench_counts *counts)
+{
+    struct bench_counts mark;
+    int rc;
+
+    bench_counts_start(&mark);
+
+    rc = bench_read_many(tags, num_tags, statuses);
+
+    bench_counts_add(counts, &mark);
+
+    for(int i=0; rc == PLCTAG_STATUS_OK && i < num_tags; i++) {
+        if(plc_tag_get_int32(tags[i], 0) != 0) {
+            fprintf(stderr, "Tag %d has %d, expected 0!\n", i, (int)plc_tag_get_int32(tags[i], 0));
+            rc = PLCTAG_ERR_BAD_DATA;
+        }
+    }
+
+    return rc;
+}
+
+
+static void print_results(const char *label, int rounds, struct bench_counts *counts)
+{
+    printf("%s: %.1fms/round, %.1f packets/round, %.2f reads/packed packet\n", label,
+           (double)counts->ms / rounds, (double)counts->sent / rounds,
+           (counts->packets ? (double)counts->requests / (double)counts->packets : 0.0));
+}
+
+
+int main(int argc, char **argv)
+{
+    plc_tag *named, *by_id;
+    int *statuses;
+    int num_tags, rounds;
+    const char *extra = "";
+    int64_t start_time, start_switched = 0, switched = 0;
+    struct bench_counts named_counts = {0}, id_counts = {0};
+
+    if(argc < 3 || argc > 4) {
+        fprintf(stderr, "Usage: bench_instance_id <num tags> <rounds> [connected]\n");
+        return 1;
+    }
+
+    num_tags = atoi(argv[1]);
+    rounds = atoi(argv[2]);
+
+    if(argc == 4) {
+        if(strcmp(argv[3], "connected") != 0) {
+            fprintf(stderr, "Unknown option %s!\n", argv[3]);
+            return 1;
+        }
+
+        extra = "&use_connected_msg=1";
+    }
+
+    if(num_tags < 1 || num_tags > MAX_TAGS || rounds < 1) {
+        fprintf(stderr, "Arguments out of range!\n");
+        return 1;
+    }
+
+    named = calloc((size_t)num_tags, sizeof(plc_tag));
+    by_id = calloc((size_t)num_tags, sizeof(plc_tag));
+    statuses = calloc((size_t)num_tags, sizeof(int));
+
+    if(!named || !by_id || !statuses) {
+        fprintf(stderr, "Unable to allocate tag arrays!\n");
+        return 1;
+    }
+
+    for(int i=0; i < num_tags; i++) {
+        char path[256];
+
+        snprintf_platform(path, sizeof(path), TAG_PATH, i, "", extra);
+
+        if(!(named[i] = bench_create_tag(path, i))) {
+            return 1;
+        }
+    }
+
+    if(bench_read_many(named, num_tags, statuses) != PLCTAG_STATUS_OK) {
+        return 1;
+    }
+
+    plc_tag_get_lib_stat("instance_id_tags", &start_switched);
+
+    for(int i=0; i < num_tags; i++) {
+        char path[256];
+
+        snprintf_platform(path, sizeof(path), TAG_PATH, i, "&use_instance_id=1", extra);
+
+        if(!(by_id[i] = bench_create_tag(path, i))) {
+            return 1;
+        }
+    }
+
+    /* the symbol table loads in the background, tags switch over at the start of a read once it is in. */
+    start_time = time_ms();
+
+    while(switched < num_tags && time_ms() < start_time + SYMBOLS_TIMEOUT) {
+        if(bench_read_many(by_id, num_tags, statuses) != PLCTAG_STATUS_OK) {
+            return 1;
+        }
+
+        plc_tag_get_lib_stat("instance_id_tags", &switched);
+        switched -= start_switched;
+    }
+
+    printf("%" PRId64 " of %d tags use instance IDs after %" PRId64 "ms\n", switched, num_tags, time_ms() - start_time);
+
+    for(int r=0; r < rounds; r++) {
+        if(timed_read(named, num_tags, statuses, &named_counts) != PLCTAG_STATUS_OK
+           || timed_read(by_id, num_tags, statuses, &id_counts) != PLCTAG_STATUS_OK) {
+            return 1;
+        }
+    }
+
+    printf("%d tags, %d rounds\n", num_tags, rounds);
+    print_results("by name", rounds, &named_counts);
+    print_results("by instance ID", rounds, &id_counts);
+
+    for(int i=0; i < num_tags; i++) {
+        plc_tag_destroy(named[i]);
+        plc_tag_destroy(by_id[i]);
+    }
+
+    free(statuses);
+    free(by_id);
+    free(named);
+
+    return 0;
+}
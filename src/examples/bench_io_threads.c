@@ -0,0 +1,210 @@
+/***************************************************************************
+ *   Copyright (C) 2015 by OmanTek                                         *
+ *   Author Kyle Hayes  kylehayes@omantek.com                              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+/*
+ * Measure aggregate read throughput across many PLCs as the number of
+ * library IO threads changes.
+ *
+ * Start plc_sim first.  Each simulated PLC gets its own loopback address,
+ * 127.0.0.1, 127.0.0.2 and so on, so each one gets its own session.  All
+ * tags are read asynchronously and restarted as soon as they complete.
+ * The tags are split between the polling threads, one by default.  One
+ * thread polling all the tags can limit the rate on a machine with more
+ * CPUs than that, so give it as many as the IO threads there.
+ *
+ * Usage: bench_io_threads <io threads> <num PLCs> <tags per PLC> <seconds> [polling threads]
+ *
+ * Run it with 1, 2, 4, 8... IO threads and compare the requests/sec.
+ * POSIX only.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include "../lib/libplctag.h"
+#include "utils.h"
+
+
+#define TAG_PATH "protocol=ab_eip&gateway=127.0.%d.%d&path=1,0&cpu=LGX&elem_size=4&elem_count=1&name=bench_dint[%d]&io_threads=%d"
+#define CREATE_TIMEOUT (10000)
+#define MAX_TAGS (100000)
+#define MAX_POLLERS (64)
+
+
+struct poller {
+    pthread_t thread;
+    plc_tag *tags;
+    int num_tags;
+    int num_pollers;
+    int index;
+    int64_t end_time;
+    int64_t completed;
+    int64_t errors;
+};
+
+
+/* restart each of this thread's reads as soon as it finishes. */
+static void *poll_tags(void *arg)
+{
+    struct poller *poller = arg;
+
+    while(time_ms() < poller->end_time) {
+        int num_done = 0;
+
+        for(int i = poller->index; i < poller->num_tags; i += poller->num_pollers) {
+            int rc = plc_tag_status(poller->tags[i]);
+
+            if(rc == PLCTAG_STATUS_PENDING) {
+                continue;
+            }
+
+            if(rc == PLCTAG_STATUS_OK) {
+                poller->completed++;
+            } else {
+                poller->errors++;
+            }
+
+            num_done++;
+            plc_tag_read(poller->tags[i], 0);
+        }
+
+        if(!num_done) {
+            sleep_ms(1);
+        }
+    }
+
+    return NULL;
+}
+
+
+int main(int argc, char **argv)
+{
+    struct poller pollers[MAX_POLLERS];
+    plc_tag *tags;
+    int io_threads, num_plcs, tags_per_plc, seconds;
+    int num_pollers = 1;
+    int num_tags;
+    int64_t start_time, end_time;
+    int64_t completed = 0;
+    int64_t errors = 0;
+    int rc;
+
+    if(argc != 5 && argc != 6) {
+        fprintf(stderr, "Usage: bench_io_threads <io threads> <num PLCs> <tags per PLC> <seconds> [polling threads]\n");
+        return 1;
+    }
+
+    io_threads = atoi(argv[1]);
+    num_plcs = atoi(argv[2]);
+    tags_per_plc = atoi(argv[3]);
+    seconds = atoi(argv[4]);
+    num_tags = num_plcs * tags_per_plc;
+
+    if(argc == 6) {
+        num_pollers = atoi(argv[5]);
+    }
+
+    if(num_pollers < 1 || num_pollers > MAX_POLLERS || io_threads < 1 || num_plcs < 1 || num_plcs > 254*254 || tags_per_plc < 1 || num_tags > MAX_TAGS || seconds < 1) {
+        fprintf(stderr, "Arguments out of range!\n");
+        return 1;
+    }
+
+    tags = calloc((size_t)num_tags, sizeof(plc_tag));
+
+    if(!tags) {
+        fprintf(stderr, "Unable to allocate tag array!\n");
+        return 1;
+    }
+
+    /* create all the tags, spread across the PLCs. */
+    start_time = time_ms();
+
+    for(int i=0; i < num_tags; i++) {
+        char path[256];
+        int plc = i % num_plcs;
+
+        snprintf_platform(path, sizeof(path), TAG_PATH, (plc / 254), (plc % 254) + 1, i / num_plcs, io_threads);
+
+        tags[i] = plc_tag_create(path);
+
+        if(!tags[i]) {
+            fprintf(stderr, "Unable to create tag %d!\n", i);
+            return 1;
+        }
+    }
+
+    for(int i=0; i < num_tags; i++) {
+        while((rc = plc_tag_status(tags[i])) == PLCTAG_STATUS_PENDING && time_ms() < start_time + CREATE_TIMEOUT) {
+            sleep_ms(1);
+        }
+
+        if(rc != PLCTAG_STATUS_OK) {
+            fprintf(stderr, "Tag %d failed to set up, error %s!\n", i, plc_tag_decode_error(rc));
+            return 1;
+        }
+    }
+
+    fprintf(stderr, "Created %d tags on %d PLCs in %dms using %d IO threads.\n", num_tags, num_plcs, (int)(time_ms() - start_time), io_threads);
+
+    /* start everything and restart each read as soon as it finishes. */
+    for(int i=0; i < num_tags; i++) {
+        plc_tag_read(tags[i], 0);
+    }
+
+    start_time = time_ms();
+    end_time = start_time + (seconds * 1000);
+
+    for(int p=0; p < num_pollers; p++) {
+        pollers[p].tags = tags;
+        pollers[p].num_tags = num_tags;
+        pollers[p].num_pollers = num_pollers;
+        pollers[p].index = p;
+        pollers[p].end_time = end_time;
+        pollers[p].completed = 0;
+        pollers[p].errors = 0;
+
+        if(pthread_create(&pollers[p].thread, NULL, poll_tags, &pollers[p])) {
+            fprintf(stderr, "Unable to start polling thread %d!\n", p);
+            return 1;
+        }
+    }
+
+    for(int p=0; p < num_pollers; p++) {
+        pthread_join(pollers[p].thread, NULL);
+        completed += pollers[p].completed;
+        errors += pollers[p].errors;
+    }
+
+    end_time = time_ms();
+
+    printf("io_threads=%d pollers=%d plcs=%d tags=%d: %.0f requests/sec, %" PRId64 " errors\n", io_threads, num_pollers, num_plcs, num_tags,
+           (double)completed * 1000.0 / (double)(end_time - start_time), errors);
+
+    for(int i=0; i < num_tags; i++) {
+        plc_tag_destroy(tags[i]);
+    }
+
+    free(tags);
+
+    return 0;
+}
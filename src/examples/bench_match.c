@@ -0,0 +1,124 @@
+/***************************************************************************
+ *   Copyright (C) 2015 by OmanTek                                         *
+ *   Author Kyle Hayes  kylehayes@omantek.com                              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+/*
+ * Measure how the cost of each response changes with the number of
+ * requests queued on one session.
+ *
+ * Start plc_sim first.  All the tags are on one PLC and are read together
+ * with plc_tag_read_many(), so every request sits in the same session's
+ * request list.  When each response is matched to its request without
+ * walking that list, the time per response stays roughly flat as the
+ * number of tags grows.
+ *
+ * Usage: bench_match <max tags> <rounds>
+ *
+ * The test runs with 1000 tags and doubles until it gets to the maximum.
+ * POSIX only.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "../lib/libplctag.h"
+#include "utils.h"
+
+
+#define TAG_PATH "protocol=ab_eip&gateway=127.0.0.1&path=1,0&cpu=LGX&elem_size=4&elem_count=1&name=match_dint[%d]"
+#define CREATE_TIMEOUT (10000)
+#define DATA_TIMEOUT (30000)
+#define MIN_TAGS (1000)
+#define MAX_TAGS (100000)
+
+
+int main(int argc, char **argv)
+{
+    plc_tag *tags;
+    int max_tags, rounds;
+    int rc;
+
+    if(argc != 3) {
+        fprintf(stderr, "Usage: bench_match <max tags> <rounds>\n");
+        return 1;
+    }
+
+    max_tags = atoi(argv[1]);
+    rounds = atoi(argv[2]);
+
+    if(max_tags < MIN_TAGS || max_tags > MAX_TAGS || rounds < 1) {
+        fprintf(stderr, "Arguments out of range!\n");
+        return 1;
+    }
+
+    tags = calloc((size_t)max_tags, sizeof(plc_tag));
+
+    if(!tags) {
+        fprintf(stderr, "Unable to allocate tag array!\n");
+        return 1;
+    }
+
+    for(int i=0; i < max_tags; i++) {
+        char path[256];
+
+        snprintf_platform(path, sizeof(path), TAG_PATH, i);
+
+        tags[i] = plc_tag_create(path);
+
+        if(!tags[i]) {
+            fprintf(stderr, "Unable to create tag %d!\n", i);
+            return 1;
+        }
+    }
+
+    rc = plc_tag_wait(tags, max_tags, PLCTAG_WAIT_ALL, CREATE_TIMEOUT, NULL);
+
+    if(rc != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "Tags failed to set up, error %s!\n", plc_tag_decode_error(rc));
+        return 1;
+    }
+
+    for(int num_tags = MIN_TAGS; num_tags <= max_tags; num_tags = (num_tags * 2 > max_tags && num_tags < max_tags ? max_tags : num_tags * 2)) {
+        int64_t start_time = time_ms();
+        int64_t elapsed;
+
+        for(int round=0; round < rounds; round++) {
+            rc = plc_tag_read_many(tags, num_tags, DATA_TIMEOUT, NULL);
+
+            if(rc != PLCTAG_STATUS_OK) {
+                fprintf(stderr, "Read of %d tags failed, error %s!\n", num_tags, plc_tag_decode_error(rc));
+                return 1;
+            }
+        }
+
+        elapsed = time_ms() - start_time;
+
+        printf("%6d tags queued: %8.1fms/round, %6.1fus/response\n", num_tags, (double)elapsed / (double)rounds,
+               (double)elapsed * 1000.0 / ((double)rounds * (double)num_tags));
+    }
+
+    for(int i=0; i < max_tags; i++) {
+        plc_tag_destroy(tags[i]);
+    }
+
+    free(tags);
+
+    return 0;
+}
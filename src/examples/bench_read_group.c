@@ -0,0 +1,180 @@
+/***************************************************************************
+ *   Copyright (C) 2015 by OmanTek                                         *
+ *   Author Kyle Hayes  kylehayes@omantek.com                              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+/*
+ * Compare reading a set of tags one at a time, with plc_tag_read_many() and
+ * as a read group.
+ *
+ * Start plc_sim first, with some --delay to make the round trips show.  All
+ * the tags are on one PLC.  There are two handles on each tag, a plain one
+ * and one in the read group "bench":
+ *
+ *    single: plc_tag_read() with a timeout on each plain tag in turn.
+ *    many:   one plc_tag_read_many() call on all the plain tags.
+ *    group:  plc_tag_read() with a timeout on the first grouped tag, then
+ *            get the value of every grouped tag.
+ *
+ * The values written through the plain tags are checked on the grouped ones.
+ *
+ * Usage: bench_read_group <num tags> <rounds> [connected]
+ *
+ * Add "connected" to use connected messaging.  Try it with 200 tags.
+ * POSIX only.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "../lib/libplctag.h"
+#include "utils.h"
+#include "bench_utils.h"
+
+
+#define TAG_PATH "protocol=ab_eip&gateway=127.0.0.1&path=1,0&cpu=LGX&elem_size=4&elem_count=1&name=group_dint[%d]%s%s"
+#define MAX_TAGS (10000)
+
+
+static int read_single(plc_tag *tags, int num_tags)
+{
+    for(int i=0; i < num_tags; i++) {
+        int rc = plc_tag_read(tags[i], BENCH_DATA_TIMEOUT);
+
+        if(rc != PLCTAG_STATUS_OK) {
+            fprintf(stderr, "Read of tag %d failed, error %s!\n", i, plc_tag_decode_error(rc));
+            return rc;
+        }
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+static int read_group(plc_tag *tags, int num_tags, int round)
+{
+    int rc = plc_tag_read(tags[0], BENCH_DATA_TIMEOUT);
+
+    if(rc != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "Group read failed, error %s!\n", plc_tag_decode_error(rc));
+        return rc;
+    }
+
+    /* the other tags pick up their data when they are next used. */
+    return bench_check_values(tags, num_tags, round);
+}
+
+
+int main(int argc, char **argv)
+{
+    plc_tag *plain, *grouped;
+    int *statuses;
+    int num_tags, rounds;
+    const char *extra = "";
+    int64_t start_time, single_ms = 0, many_ms = 0, group_ms = 0;
+
+    if(argc < 3 || argc > 4) {
+        fprintf(stderr, "Usage: bench_read_group <num tags> <rounds> [connected]\n");
+        return 1;
+    }
+
+    num_tags = atoi(argv[1]);
+    rounds = atoi(argv[2]);
+
+    if(argc == 4) {
+        if(strcmp(argv[3], "connected") != 0) {
+            fprintf(stderr, "Unknown option %s!\n", argv[3]);
+            return 1;
+        }
+
+        extra = "&use_connected_msg=1";
+    }
+
+    if(num_tags < 1 || num_tags > MAX_TAGS || rounds < 1) {
+        fprintf(stderr, "Arguments out of range!\n");
+        return 1;
+    }
+
+    plain = calloc((size_t)num_tags, sizeof(plc_tag));
+    grouped = calloc((size_t)num_tags, sizeof(plc_tag));
+    statuses = calloc((size_t)num_tags, sizeof(int));
+
+    if(!plain || !grouped || !statuses) {
+        fprintf(stderr, "Unable to allocate tag arrays!\n");
+        return 1;
+    }
+
+    for(int i=0; i < num_tags; i++) {
+        char path[256];
+
+        snprintf_platform(path, sizeof(path), TAG_PATH, i, "", extra);
+
+        if(!(plain[i] = bench_create_tag(path, i))) {
+            return 1;
+        }
+
+        snprintf_platform(path, sizeof(path), TAG_PATH, i, "&read_group=bench", extra);
+
+        if(!(grouped[i] = bench_create_tag(path, i))) {
+            return 1;
+        }
+    }
+
+    for(int r=0; r < rounds; r++) {
+        if(bench_write_values(plain, num_tags, r, statuses) != PLCTAG_STATUS_OK) {
+            return 1;
+        }
+
+        start_time = time_ms();
+
+        if(read_single(plain, num_tags) != PLCTAG_STATUS_OK) {
+            return 1;
+        }
+
+        single_ms += time_ms() - start_time;
+        start_time = time_ms();
+
+        if(bench_read_many(plain, num_tags, statuses) != PLCTAG_STATUS_OK) {
+            return 1;
+        }
+
+        many_ms += time_ms() - start_time;
+        start_time = time_ms();
+
+        if(read_group(grouped, num_tags, r) != PLCTAG_STATUS_OK) {
+            return 1;
+        }
+
+        group_ms += time_ms() - start_time;
+    }
+
+    printf("%d tags, %d rounds: single %.1fms/round, many %.1fms/round, group %.1fms/round\n", num_tags, rounds,
+           (double)single_ms / rounds, (double)many_ms / rounds, (double)group_ms / rounds);
+
+    for(int i=0; i < num_tags; i++) {
+        plc_tag_destroy(plain[i]);
+        plc_tag_destroy(grouped[i]);
+    }
+
+    free(statuses);
+    free(grouped);
+    free(plain);
+
+    return 0;
+}
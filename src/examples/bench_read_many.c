@@ -0,0 +1,200 @@
+/***************************************************************************
+ *   Copyright (C) 2015 by OmanTek                                         *
+ *   Author Kyle Hayes  kylehayes@omantek.com                              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+/*
+ * Compare refreshing many tags one call at a time against the batch API.
+ *
+ * Start plc_sim first.  The tags are spread across a few simulated PLCs.
+ * Each round refreshes every tag once:
+ *
+ *    loop:  plc_tag_read(tag, 0) on every tag, then poll plc_tag_status()
+ *           on every tag until nothing is pending.
+ *    batch: one plc_tag_read_many() call with a timeout.
+ *
+ * Usage: bench_read_many <num tags> <rounds> [num PLCs]
+ *
+ * Try it with 1000 and 10000 tags.  POSIX only.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include "../lib/libplctag.h"
+#include "utils.h"
+
+
+#define TAG_PATH "protocol=ab_eip&gateway=127.0.0.%d&path=1,0&cpu=LGX&elem_size=4&elem_count=1&name=batch_dint[%d]"
+#define CREATE_TIMEOUT (30000)
+#define DATA_TIMEOUT (10000)
+#define MAX_TAGS (100000)
+#define MAX_PLCS (250)
+
+
+static int read_loop(plc_tag *tags, int num_tags)
+{
+    int64_t timeout_time = time_ms() + DATA_TIMEOUT;
+    int pending;
+    int rc;
+
+    for(int i=0; i < num_tags; i++) {
+        rc = plc_tag_read(tags[i], 0);
+
+        if(rc != PLCTAG_STATUS_OK && rc != PLCTAG_STATUS_PENDING) {
+            fprintf(stderr, "Unable to start read of tag %d, error %s!\n", i, plc_tag_decode_error(rc));
+            return rc;
+        }
+    }
+
+    do {
+        pending = 0;
+
+        for(int i=0; i < num_tags; i++) {
+            rc = plc_tag_status(tags[i]);
+
+            if(rc == PLCTAG_STATUS_PENDING) {
+                pending++;
+            } else if(rc != PLCTAG_STATUS_OK) {
+                fprintf(stderr, "Read of tag %d failed, error %s!\n", i, plc_tag_decode_error(rc));
+                return rc;
+            }
+        }
+
+        if(pending && time_ms() > timeout_time) {
+            fprintf(stderr, "Timed out with %d reads pending!\n", pending);
+            return PLCTAG_ERR_TIMEOUT;
+        }
+    } while(pending);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+static int read_batch(plc_tag *tags, int num_tags, int *statuses)
+{
+    int rc = plc_tag_read_many(tags, num_tags, DATA_TIMEOUT, statuses);
+
+    if(rc != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "Batch read failed, error %s!\n", plc_tag_decode_error(rc));
+    }
+
+    return rc;
+}
+
+
+int main(int argc, char **argv)
+{
+    plc_tag *tags;
+    int *statuses;
+    int num_tags, rounds, num_plcs = 4;
+    int64_t start_time, loop_ms, batch_ms;
+    int rc;
+
+    if(argc < 3 || argc > 4) {
+        fprintf(stderr, "Usage: bench_read_many <num tags> <rounds> [num PLCs]\n");
+        return 1;
+    }
+
+    num_tags = atoi(argv[1]);
+    rounds = atoi(argv[2]);
+
+    if(argc == 4) {
+        num_plcs = atoi(argv[3]);
+    }
+
+    if(num_tags < 1 || num_tags > MAX_TAGS || rounds < 1 || num_plcs < 1 || num_plcs > MAX_PLCS) {
+        fprintf(stderr, "Arguments out of range!\n");
+        return 1;
+    }
+
+    tags = calloc((size_t)num_tags, sizeof(plc_tag));
+    statuses = calloc((size_t)num_tags, sizeof(int));
+
+    if(!tags || !statuses) {
+        fprintf(stderr, "Unable to allocate tag arrays!\n");
+        return 1;
+    }
+
+    start_time = time_ms();
+
+    for(int i=0; i < num_tags; i++) {
+        char path[256];
+
+        snprintf_platform(path, sizeof(path), TAG_PATH, (i % num_plcs) + 1, i);
+
+        tags[i] = plc_tag_create(path);
+
+        if(!tags[i]) {
+            fprintf(stderr, "Unable to create tag %d!\n", i);
+            return 1;
+        }
+    }
+
+    for(int i=0; i < num_tags; i++) {
+        while((rc = plc_tag_status(tags[i])) == PLCTAG_STATUS_PENDING && time_ms() < start_time + CREATE_TIMEOUT) {
+            sleep_ms(1);
+        }
+
+        if(rc != PLCTAG_STATUS_OK) {
+            fprintf(stderr, "Tag %d failed to set up, error %s!\n", i, plc_tag_decode_error(rc));
+            return 1;
+        }
+    }
+
+    fprintf(stderr, "Created %d tags on %d PLCs in %dms.\n", num_tags, num_plcs, (int)(time_ms() - start_time));
+
+    /* warm up both paths. */
+    if(read_loop(tags, num_tags) != PLCTAG_STATUS_OK || read_batch(tags, num_tags, statuses) != PLCTAG_STATUS_OK) {
+        return 1;
+    }
+
+    start_time = time_ms();
+
+    for(int r=0; r < rounds; r++) {
+        if(read_loop(tags, num_tags) != PLCTAG_STATUS_OK) {
+            return 1;
+        }
+    }
+
+    loop_ms = time_ms() - start_time;
+
+    start_time = time_ms();
+
+    for(int r=0; r < rounds; r++) {
+        if(read_batch(tags, num_tags, statuses) != PLCTAG_STATUS_OK) {
+            return 1;
+        }
+    }
+
+    batch_ms = time_ms() - start_time;
+
+    printf("%d tags, %d rounds: loop %.1fms/round, batch %.1fms/round\n", num_tags, rounds,
+           (double)loop_ms / rounds, (double)batch_ms / rounds);
+
+    for(int i=0; i < num_tags; i++) {
+        plc_tag_destroy(tags[i]);
+    }
+
+    free(statuses);
+    free(tags);
+
+    return 0;
+}
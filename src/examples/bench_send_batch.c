@@ -0,0 +1,155 @@
+/***************************************************************************
+ *   Copyright (C) 2015 by OmanTek                                         *
+ *   Author Kyle Hayes  kylehayes@omantek.com                              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+/*
+ * Measure how many packets the IO thread gets through per socket write
+ * and read.
+ *
+ * Start plc_sim first.  Each tag gets its own connection to the PLC, so
+ * every tag can have a request in flight at once.  Each round reads all
+ * the tags with plc_tag_read_many(), which queues all the requests on
+ * the session together.  The library counters give the number of socket
+ * writes and reads, the number of packets they carried and how many
+ * request buffers came from the pool.
+ *
+ * Usage: bench_send_batch <num tags> <rounds>
+ *
+ * POSIX only.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include "../lib/libplctag.h"
+#include "utils.h"
+
+
+#define TAG_PATH "protocol=ab_eip&gateway=127.0.0.1&path=1,0&cpu=LGX&elem_size=4&elem_count=1&name=batch_dint_%d&use_connected_msg=1&share_connection=0"
+#define CREATE_TIMEOUT (10000)
+#define DATA_TIMEOUT (5000)
+#define MAX_TAGS (1000)
+
+
+int main(int argc, char **argv)
+{
+    plc_tag *tags;
+    int num_tags, rounds;
+    int64_t start_time, end_time;
+    int64_t start_syscalls = 0, start_packets = 0;
+    int64_t syscalls = 0, packets = 0;
+    int64_t start_reads = 0, start_recv_packets = 0;
+    int64_t reads = 0, recv_packets = 0;
+    int64_t start_hits = 0, start_misses = 0;
+    int64_t hits = 0, misses = 0;
+    int rc;
+
+    if(argc != 3) {
+        fprintf(stderr, "Usage: bench_send_batch <num tags> <rounds>\n");
+        return 1;
+    }
+
+    num_tags = atoi(argv[1]);
+    rounds = atoi(argv[2]);
+
+    if(num_tags < 1 || num_tags > MAX_TAGS || rounds < 1) {
+        fprintf(stderr, "Arguments out of range!\n");
+        return 1;
+    }
+
+    tags = calloc((size_t)num_tags, sizeof(plc_tag));
+
+    if(!tags) {
+        fprintf(stderr, "Unable to allocate tag array!\n");
+        return 1;
+    }
+
+    for(int i=0; i < num_tags; i++) {
+        char path[256];
+
+        snprintf_platform(path, sizeof(path), TAG_PATH, i);
+
+        tags[i] = plc_tag_create(path);
+
+        if(!tags[i]) {
+            fprintf(stderr, "Unable to create tag %d!\n", i);
+            return 1;
+        }
+    }
+
+    rc = plc_tag_wait(tags, num_tags, PLCTAG_WAIT_ALL, CREATE_TIMEOUT, NULL);
+
+    if(rc != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "Tags failed to set up, error %s!\n", plc_tag_decode_error(rc));
+        return 1;
+    }
+
+    plc_tag_get_lib_stat("send_syscalls", &start_syscalls);
+    plc_tag_get_lib_stat("send_packets", &start_packets);
+    plc_tag_get_lib_stat("recv_syscalls", &start_reads);
+    plc_tag_get_lib_stat("recv_packets", &start_recv_packets);
+    plc_tag_get_lib_stat("request_pool_hits", &start_hits);
+    plc_tag_get_lib_stat("request_pool_misses", &start_misses);
+
+    start_time = time_ms();
+
+    for(int round=0; round < rounds; round++) {
+        rc = plc_tag_read_many(tags, num_tags, DATA_TIMEOUT, NULL);
+
+        if(rc != PLCTAG_STATUS_OK) {
+            fprintf(stderr, "Read round %d failed, error %s!\n", round, plc_tag_decode_error(rc));
+            return 1;
+        }
+    }
+
+    end_time = time_ms();
+
+    plc_tag_get_lib_stat("send_syscalls", &syscalls);
+    plc_tag_get_lib_stat("send_packets", &packets);
+    plc_tag_get_lib_stat("recv_syscalls", &reads);
+    plc_tag_get_lib_stat("recv_packets", &recv_packets);
+    plc_tag_get_lib_stat("request_pool_hits", &hits);
+    plc_tag_get_lib_stat("request_pool_misses", &misses);
+
+    syscalls -= start_syscalls;
+    packets -= start_packets;
+    reads -= start_reads;
+    recv_packets -= start_recv_packets;
+    hits -= start_hits;
+    misses -= start_misses;
+
+    printf("tags=%d: %.2fms/round, %" PRId64 " packets in %" PRId64 " writes, %.2f packets/write\n", num_tags,
+           (double)(end_time - start_time) / (double)rounds, packets, syscalls,
+           (syscalls ? (double)packets / (double)syscalls : 0.0));
+
+    printf("tags=%d: %" PRId64 " packets in %" PRId64 " reads, %.2f reads/packet\n", num_tags,
+           recv_packets, reads, (recv_packets ? (double)reads / (double)recv_packets : 0.0));
+
+    printf("tags=%d: %" PRId64 " request buffers from the pool, %" PRId64 " allocated\n", num_tags, hits, misses);
+
+    for(int i=0; i < num_tags; i++) {
+        plc_tag_destroy(tags[i]);
+    }
+
+    free(tags);
+
+    return 0;
+}
@@ -0,0 +1,129 @@
+/***************************************************************************
+ *   Copyright (C) 2016 by OmanTek                                         *
+ *   Author Kyle Hayes  kylehayes@omantek.com                              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*
+ * Helpers shared by the benchmarks that run against plc_sim.  The values
+ * written and checked are (i * 7) + round for tag i.
+ */
+
+
+#include <stdio.h>
+#include "../lib/libplctag.h"
+#include "utils.h"
+#include "bench_utils.h"
+
+
+/* create a tag and wait for it to be set up, NULL if it was not. */
+plc_tag bench_create_tag(const char *path, int index)
+{
+    plc_tag tag;
+    int64_t start_time = time_ms();
+    int rc;
+
+    tag = plc_tag_create(path);
+
+    if(!tag) {
+        fprintf(stderr, "Unable to create tag %d!\n", index);
+        return NULL;
+    }
+
+    while((rc = plc_tag_status(tag)) == PLCTAG_STATUS_PENDING && time_ms() < start_time + BENCH_CREATE_TIMEOUT) {
+        sleep_ms(1);
+    }
+
+    if(rc != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "Tag %d failed to set up, error %s!\n", index, plc_tag_decode_error(rc));
+        plc_tag_destroy(tag);
+        return NULL;
+    }
+
+    return tag;
+}
+
+
+int bench_read_many(plc_tag *tags, int num_tags, int *statuses)
+{
+    int rc = plc_tag_read_many(tags, num_tags, BENCH_DATA_TIMEOUT, statuses);
+
+    if(rc != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "Batch read failed, error %s!\n", plc_tag_decode_error(rc));
+    }
+
+    return rc;
+}
+
+
+int bench_write_values(plc_tag *tags, int num_tags, int round, int *statuses)
+{
+    int rc;
+
+    for(int i=0; i < num_tags; i++) {
+        plc_tag_set_int32(tags[i], 0, (i * 7) + round);
+    }
+
+    rc = plc_tag_write_many(tags, num_tags, BENCH_DATA_TIMEOUT, statuses);
+
+    if(rc != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "Write failed, error %s!\n", plc_tag_decode_error(rc));
+    }
+
+    return rc;
+}
+
+
+int bench_check_values(plc_tag *tags, int num_tags, int round)
+{
+    for(int i=0; i < num_tags; i++) {
+        int32_t val = plc_tag_get_int32(tags[i], 0);
+
+        if(val != (i * 7) + round) {
+            fprintf(stderr, "Tag %d has %d, expected %d!\n", i, (int)val, (i * 7) + round);
+            return PLCTAG_ERR_BAD_DATA;
+        }
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/* note the time and counters before a step. */
+void bench_counts_start(struct bench_counts *mark)
+{
+    mark->ms = time_ms();
+    mark->sent = mark->packets = mark->requests = 0;
+
+    plc_tag_get_lib_stat("send_packets", &mark->sent);
+    plc_tag_get_lib_stat("coalesced_packets", &mark->packets);
+    plc_tag_get_lib_stat("coalesced_requests", &mark->requests);
+}
+
+
+/* add what the step since bench_counts_start() took to the total. */
+void bench_counts_add(struct bench_counts *total, const struct bench_counts *mark)
+{
+    struct bench_counts now;
+
+    bench_counts_start(&now);
+
+    total->ms += now.ms - mark->ms;
+    total->sent += now.sent - mark->sent;
+    total->packets += now.packets - mark->packets;
+    total->requests += now.requests - mark->requests;
+}
@@ -0,0 +1,52 @@
+/***************************************************************************
+ *   Copyright (C) 2016 by OmanTek                                         *
+ *   Author Kyle Hayes  kylehayes@omantek.com                              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*
+ * Helpers shared by the benchmarks that run against plc_sim.  POSIX only.
+ */
+
+#ifndef __EXAMPLE_BENCH_UTILS_H__
+#define __EXAMPLE_BENCH_UTILS_H__
+
+
+#include <stdint.h>
+#include "../lib/libplctag.h"
+
+
+#define BENCH_CREATE_TIMEOUT (30000)
+#define BENCH_DATA_TIMEOUT (10000)
+
+/* time and library packet counters, see bench_counts_start() and bench_counts_add(). */
+struct bench_counts {
+    int64_t ms;
+    int64_t sent;       /* send_packets */
+    int64_t packets;    /* coalesced_packets */
+    int64_t requests;   /* coalesced_requests */
+};
+
+extern plc_tag bench_create_tag(const char *path, int index);
+extern int bench_read_many(plc_tag *tags, int num_tags, int *statuses);
+extern int bench_write_values(plc_tag *tags, int num_tags, int round, int *statuses);
+extern int bench_check_values(plc_tag *tags, int num_tags, int round);
+extern void bench_counts_start(struct bench_counts *mark);
+extern void bench_counts_add(struct bench_counts *total, const struct bench_counts *mark);
+
+
+#endif
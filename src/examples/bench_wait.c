@@ -0,0 +1,217 @@
+/***************************************************************************
+ *   Copyright (C) 2015 by OmanTek                                         *
+ *   Author Kyle Hayes  kylehayes@omantek.com                              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+/*
+ * Compare the CPU used by a scan loop that polls plc_tag_status() against
+ * one that blocks in plc_tag_wait().
+ *
+ * Start plc_sim first, with some latency to look like a real PLC, for
+ * instance "plc_sim --delay=10".  Each scan starts a read on every tag and
+ * waits until all of them are done:
+ *
+ *    poll: call plc_tag_status() on every pending tag, sleep 1ms, repeat.
+ *    wait: call plc_tag_wait() in PLCTAG_WAIT_ALL mode.
+ *
+ * The scan rate and the CPU time the scanning thread spent waiting per scan
+ * are printed for both.  Starting the reads and the library IO thread are
+ * not counted.
+ *
+ * Usage: bench_wait <num tags> <seconds> [num PLCs]
+ *
+ * POSIX only.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../lib/libplctag.h"
+#include "utils.h"
+
+
+#define TAG_PATH "protocol=ab_eip&gateway=127.0.0.%d&path=1,0&cpu=LGX&elem_size=4&elem_count=1&name=wait_dint[%d]"
+#define CREATE_TIMEOUT (30000)
+#define DATA_TIMEOUT (5000)
+#define MAX_TAGS (100000)
+#define MAX_PLCS (250)
+
+
+static int64_t thread_cpu_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+
+    return ((int64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+
+static int scan_poll(plc_tag *tags, int num_tags)
+{
+    int64_t timeout_time = time_ms() + DATA_TIMEOUT;
+    int pending;
+    int rc;
+
+    do {
+        pending = 0;
+
+        for(int i=0; i < num_tags; i++) {
+            rc = plc_tag_status(tags[i]);
+
+            if(rc == PLCTAG_STATUS_PENDING) {
+                pending++;
+            } else if(rc != PLCTAG_STATUS_OK) {
+                fprintf(stderr, "Read of tag %d failed, error %s!\n", i, plc_tag_decode_error(rc));
+                return rc;
+            }
+        }
+
+        if(pending) {
+            if(time_ms() > timeout_time) {
+                fprintf(stderr, "Timed out with %d reads pending!\n", pending);
+                return PLCTAG_ERR_TIMEOUT;
+            }
+
+            sleep_ms(1);
+        }
+    } while(pending);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+static int scan_wait(plc_tag *tags, int num_tags)
+{
+    int rc = plc_tag_wait(tags, num_tags, PLCTAG_WAIT_ALL, DATA_TIMEOUT, NULL);
+
+    if(rc != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "Wait failed, error %s!\n", plc_tag_decode_error(rc));
+    }
+
+    return rc;
+}
+
+
+static int run(const char *name, plc_tag *tags, int num_tags, int seconds, int (*scan)(plc_tag *tags, int num_tags))
+{
+    int64_t end_time = time_ms() + (seconds * 1000);
+    int64_t start_time = time_ms();
+    int64_t wait_cpu = 0;
+    int scans = 0;
+    int rc;
+
+    while(time_ms() < end_time) {
+        rc = plc_tag_read_many(tags, num_tags, 0, NULL);
+
+        if(rc != PLCTAG_STATUS_OK && rc != PLCTAG_STATUS_PENDING) {
+            fprintf(stderr, "Unable to start reads, error %s!\n", plc_tag_decode_error(rc));
+            return rc;
+        }
+
+        wait_cpu -= thread_cpu_us();
+        rc = scan(tags, num_tags);
+        wait_cpu += thread_cpu_us();
+
+        if(rc != PLCTAG_STATUS_OK) {
+            return rc;
+        }
+
+        scans++;
+    }
+
+    printf("%s: %d scans, %.1f scans/sec, %.0fus CPU waiting per scan\n", name, scans,
+           (double)scans * 1000.0 / (double)(time_ms() - start_time),
+           (double)wait_cpu / (scans ? scans : 1));
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+int main(int argc, char **argv)
+{
+    plc_tag *tags;
+    int num_tags, seconds, num_plcs = 1;
+    int64_t start_time;
+    int rc;
+
+    if(argc < 3 || argc > 4) {
+        fprintf(stderr, "Usage: bench_wait <num tags> <seconds> [num PLCs]\n");
+        return 1;
+    }
+
+    num_tags = atoi(argv[1]);
+    seconds = atoi(argv[2]);
+
+    if(argc == 4) {
+        num_plcs = atoi(argv[3]);
+    }
+
+    if(num_tags < 1 || num_tags > MAX_TAGS || seconds < 1 || num_plcs < 1 || num_plcs > MAX_PLCS) {
+        fprintf(stderr, "Arguments out of range!\n");
+        return 1;
+    }
+
+    tags = calloc((size_t)num_tags, sizeof(plc_tag));
+
+    if(!tags) {
+        fprintf(stderr, "Unable to allocate tag array!\n");
+        return 1;
+    }
+
+    start_time = time_ms();
+
+    for(int i=0; i < num_tags; i++) {
+        char path[256];
+
+        snprintf_platform(path, sizeof(path), TAG_PATH, (i % num_plcs) + 1, i);
+
+        tags[i] = plc_tag_create(path);
+
+        if(!tags[i]) {
+            fprintf(stderr, "Unable to create tag %d!\n", i);
+            return 1;
+        }
+    }
+
+    for(int i=0; i < num_tags; i++) {
+        while((rc = plc_tag_status(tags[i])) == PLCTAG_STATUS_PENDING && time_ms() < start_time + CREATE_TIMEOUT) {
+            sleep_ms(1);
+        }
+
+        if(rc != PLCTAG_STATUS_OK) {
+            fprintf(stderr, "Tag %d failed to set up, error %s!\n", i, plc_tag_decode_error(rc));
+            return 1;
+        }
+    }
+
+    if(run("poll", tags, num_tags, seconds, scan_poll) != PLCTAG_STATUS_OK
+       || run("wait", tags, num_tags, seconds, scan_wait) != PLCTAG_STATUS_OK) {
+        return 1;
+    }
+
+    for(int i=0; i < num_tags; i++) {
+        plc_tag_destroy(tags[i]);
+    }
+
+    free(tags);
+
+    return 0;
+}
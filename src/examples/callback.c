@@ -0,0 +1,153 @@
+/***************************************************************************
+ *   Copyright (C) 2015 by OmanTek                                         *
+ *   Author Kyle Hayes  kylehayes@omantek.com                              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+/*
+ * This example reads many tags using completion callbacks instead of polling.
+ *
+ * Each tag gets a callback.  When a read completes, the callback prints the value
+ * and starts the next read of the same tag.  The main thread just waits until all
+ * the reads are done.  All callbacks run on the library's callback thread, so the
+ * counters here are only changed from that one thread.
+ *
+ * The gateway is 127.0.0.1 so that this can be run against plc_sim.  Change it
+ * to match your system.  Cross platform.
+ */
+
+
+#include <stdio.h>
+#include "../lib/libplctag.h"
+#include "utils.h"
+
+
+#define TAG_PATH "protocol=ab_eip&gateway=127.0.0.1&path=1,0&cpu=LGX&elem_size=4&elem_count=1&name=TestDINTArray[%d]"
+#define NUM_TAGS 20
+#define READS_PER_TAG 5
+#define DATA_TIMEOUT 5000
+
+
+static volatile int reads_done = 0;
+static volatile int errors = 0;
+static int reads_left[NUM_TAGS];
+
+
+static void tag_callback(plc_tag tag, int event, int status, void *userdata)
+{
+    int index = (int)(intptr_t)userdata;
+
+    switch(event) {
+        case PLCTAG_EVENT_READ_COMPLETED:
+            fprintf(stderr, "Tag %d data[0]=%d\n", index, plc_tag_get_int32(tag, 0));
+
+            reads_done++;
+            reads_left[index]--;
+
+            if(reads_left[index] > 0) {
+                status = plc_tag_read(tag, 0);
+
+                if(status != PLCTAG_STATUS_OK && status != PLCTAG_STATUS_PENDING) {
+                    fprintf(stderr, "Tag %d unable to start read! %s\n", index, plc_tag_decode_error(status));
+                    errors++;
+                }
+            }
+            break;
+
+        case PLCTAG_EVENT_ABORTED:
+            fprintf(stderr, "Tag %d operation aborted.\n", index);
+            errors++;
+            break;
+
+        default:
+            fprintf(stderr, "Tag %d got event %d with status %s.\n", index, event, plc_tag_decode_error(status));
+            errors++;
+            break;
+    }
+}
+
+
+int main()
+{
+    plc_tag tag[NUM_TAGS];
+    int64_t timeout_time;
+    int rc;
+    int i;
+
+    /* create the tags */
+    for(i=0; i < NUM_TAGS; i++) {
+        char tmp_tag_path[256] = {0,};
+
+        snprintf_platform(tmp_tag_path, sizeof tmp_tag_path, TAG_PATH, i);
+        tag[i] = plc_tag_create(tmp_tag_path);
+
+        if(!tag[i]) {
+            fprintf(stderr, "Error: could not create tag %d\n", i);
+            return 1;
+        }
+    }
+
+    /* let the connect complete */
+    for(i=0; i < NUM_TAGS; i++) {
+        timeout_time = time_ms() + DATA_TIMEOUT;
+
+        while((rc = plc_tag_status(tag[i])) == PLCTAG_STATUS_PENDING && time_ms() < timeout_time) {
+            sleep_ms(1);
+        }
+
+        if(rc != PLCTAG_STATUS_OK) {
+            fprintf(stderr, "Error setting up tag %d: %s\n", i, plc_tag_decode_error(rc));
+            return 1;
+        }
+    }
+
+    /* hook up the callbacks and start the first reads */
+    for(i=0; i < NUM_TAGS; i++) {
+        reads_left[i] = READS_PER_TAG;
+
+        rc = plc_tag_register_callback(tag[i], tag_callback, (void *)(intptr_t)i);
+
+        if(rc != PLCTAG_STATUS_OK) {
+            fprintf(stderr, "Unable to register callback for tag %d: %s\n", i, plc_tag_decode_error(rc));
+            return 1;
+        }
+
+        rc = plc_tag_read(tag[i], 0);
+
+        if(rc != PLCTAG_STATUS_OK && rc != PLCTAG_STATUS_PENDING) {
+            fprintf(stderr, "Unable to start read of tag %d: %s\n", i, plc_tag_decode_error(rc));
+            return 1;
+        }
+    }
+
+    /* the callbacks do all the work. */
+    timeout_time = time_ms() + DATA_TIMEOUT;
+
+    while(reads_done < NUM_TAGS * READS_PER_TAG && !errors && time_ms() < timeout_time) {
+        sleep_ms(10);
+    }
+
+    fprintf(stderr, "%d reads completed with %d errors.\n", reads_done, errors);
+
+    /* we are done */
+    for(i=0; i < NUM_TAGS; i++) {
+        plc_tag_destroy(tag[i]);
+    }
+
+    return (reads_done == NUM_TAGS * READS_PER_TAG && !errors) ? 0 : 1;
+}
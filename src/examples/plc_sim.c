@@ -0,0 +1,906 @@
+/***************************************************************************
+ *   Copyright (C) 2015 by OmanTek                                         *
+ *   Author Kyle Hayes  kylehayes@omantek.com                              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+/*
+ * A very small simulated ControlLogix PLC for benchmarking the library
+ * without hardware.  It speaks just enough EtherNet/IP and CIP to register
+ * a session, open and close connections, and read and write DINT tags with
+ * both unconnected and connected messaging.
+ *
+ * Tags are created the first time they are touched.  Every DINT element
+ * starts out with its own index as the value.  Each tag is also an instance
+ * of the Symbol Object, numbered in the order the tags were created, and
+ * can be listed and addressed by instance ID.  --tags creates that many
+ * tags up front, every tenth one an array of ten, for listing.
+ *
+ * The simulator listens on all addresses.  The library always connects to
+ * port 44818, so use 127.0.0.1, 127.0.0.2, etc. as gateways to make it look
+ * like many different PLCs.
+ *
+ * Usage: plc_sim [--port=<port>] [--delay=<ms>] [--tags=<count>]
+ *
+ * The delay is added to every response to simulate network and PLC latency.
+ * POSIX only.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "utils.h"
+
+
+#define DEFAULT_PORT (44818)
+#define MAX_CLIENTS (1024)
+#define MAX_TAGS (65536)
+#define TAG_HASH_SIZE (MAX_TAGS * 2)
+#define MAX_TAG_NAME (128)
+#define MAX_CONNS (256)
+#define EIP_HEADER_SIZE (24)
+#define MAX_PACKET_SIZE (4096 + EIP_HEADER_SIZE)
+#define MAX_UNCONNECTED_PAYLOAD (480)
+#define IN_BUF_SIZE (65536)
+
+#define EIP_REGISTER_SESSION (0x65)
+#define EIP_UNREGISTER_SESSION (0x66)
+#define EIP_SEND_RR_DATA (0x6F)
+#define EIP_SEND_UNIT_DATA (0x70)
+
+#define CIP_MULTI (0x0A)
+#define CIP_GET_ATTR_SINGLE (0x0E)
+#define CIP_READ (0x4C)
+#define CIP_WRITE (0x4D)
+#define CIP_FORWARD_CLOSE (0x4E)
+#define CIP_READ_FRAG (0x52)
+#define CIP_WRITE_FRAG (0x53)
+#define CIP_FORWARD_OPEN (0x54)
+#define CIP_FORWARD_OPEN_EX (0x5B)
+#define CIP_LIST_INSTANCES (0x55)
+#define CIP_SYMBOL_CLASS (0x6B)
+#define CIP_UNCONNECTED_SEND (0x52)
+
+#define CIP_OK (0x00)
+#define CIP_ERR_PARTIAL (0x06)
+#define CIP_ERR_UNSUPPORTED (0x08)
+
+#define DINT_TYPE (0xC4)
+
+
+struct tag {
+    char name[MAX_TAG_NAME];
+    uint8_t *data;
+    int size;
+};
+
+struct conn {
+    uint32_t our_id;
+    uint32_t their_id;
+    int max_payload;
+};
+
+/* responses waiting to go out, the delay is the same for all so this is FIFO. */
+struct out_packet {
+    struct out_packet *next;
+    int64_t due;
+    int len;
+    int sent;
+    uint8_t data[];
+};
+
+struct client {
+    int fd;
+    uint8_t in_buf[IN_BUF_SIZE];
+    int in_len;
+    struct out_packet *out_head;
+    struct out_packet *out_tail;
+    struct conn conns[MAX_CONNS];
+};
+
+
+static struct tag tags[MAX_TAGS];
+static int num_tags = 0;
+static int tag_hash[TAG_HASH_SIZE]; /* index + 1 into tags, zero is empty */
+static struct client *clients[MAX_CLIENTS];
+static int delay_ms = 0;
+static uint32_t next_conn_id = 0x1000;
+static uint32_t next_session_handle = 0x1234;
+static volatile int done = 0;
+
+
+static uint16_t get16(const uint8_t *p) { return (uint16_t)(p[0] | (p[1] << 8)); }
+static uint32_t get32(const uint8_t *p) { return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24); }
+static void put16(uint8_t *p, uint16_t v) { p[0] = (uint8_t)v; p[1] = (uint8_t)(v >> 8); }
+static void put32(uint8_t *p, uint32_t v) { put16(p, (uint16_t)v); put16(p + 2, (uint16_t)(v >> 16)); }
+
+
+
+static uint32_t hash_name(const char *name)
+{
+    uint32_t hash = 2166136261u;
+
+    while(*name) {
+        hash = (hash ^ (uint8_t)*name++) * 16777619u;
+    }
+
+    return hash;
+}
+
+
+
+static struct tag *find_tag(const char *name, int size)
+{
+    struct tag *tag = NULL;
+    uint32_t slot = hash_name(name) % TAG_HASH_SIZE;
+
+    /* linear probing, the table is never more than half full. */
+    while(tag_hash[slot]) {
+        if(strcmp(tags[tag_hash[slot] - 1].name, name) == 0) {
+            tag = &tags[tag_hash[slot] - 1];
+            break;
+        }
+
+        slot = (slot + 1) % TAG_HASH_SIZE;
+    }
+
+    if(!tag) {
+        if(num_tags >= MAX_TAGS) {
+            return NULL;
+        }
+
+        tag = &tags[num_tags++];
+        snprintf(tag->name, sizeof(tag->name), "%s", name);
+        tag_hash[slot] = num_tags;
+    }
+
+    /* grow the tag if a request wants more of it. */
+    if(tag->size < size) {
+        uint8_t *data = realloc(tag->data, (size_t)size);
+
+        if(!data) {
+            return NULL;
+        }
+
+        for(int i = tag->size/4; i < size/4; i++) {
+            put32(data + (i * 4), (uint32_t)i);
+        }
+
+        tag->data = data;
+        tag->size = size;
+    }
+
+    return tag;
+}
+
+
+
+/*
+ * Decode the IOI path into a tag name.  A Symbol Object instance becomes
+ * the name of that tag, and is also left in *instance, which is -1 if there
+ * is none.  Returns the number of bytes used by the path, including the
+ * path size byte.
+ */
+static int decode_path(const uint8_t *path, int len, char *name, int name_size, int *instance)
+{
+    int path_len;
+    int pos = 1;
+    int name_len = 0;
+    int class_id = 0;
+
+    *instance = -1;
+
+    if(len < 1) {
+        return -1;
+    }
+
+    path_len = 1 + path[0] * 2;
+
+    if(path_len > len) {
+        return -1;
+    }
+
+    name[0] = 0;
+
+    while(pos < path_len && name_len < name_size) {
+        uint8_t seg = path[pos];
+        uint32_t index = 0;
+
+        if(seg == 0x91) {
+            int sym_len = path[pos + 1];
+
+            name_len += snprintf(name + name_len, (size_t)(name_size - name_len), "%s%.*s", (name_len ? "." : ""), sym_len, (const char *)(path + pos + 2));
+            pos += 2 + sym_len + (sym_len & 1);
+            continue;
+        }
+
+        switch(seg) {
+            case 0x20: class_id = path[pos + 1]; pos += 2; continue;
+            case 0x24: index = path[pos + 1]; pos += 2; break;
+            case 0x25: index = get16(path + pos + 2); pos += 4; break;
+            case 0x26: index = get32(path + pos + 2); pos += 6; break;
+            case 0x28: index = path[pos + 1]; pos += 2; break;
+            case 0x29: index = get16(path + pos + 2); pos += 4; break;
+            case 0x2A: index = get32(path + pos + 2); pos += 6; break;
+            default: pos += 2; continue;
+        }
+
+        /* instance segments only mean something for the Symbol Object. */
+        if(seg == 0x24 || seg == 0x25 || seg == 0x26) {
+            if(class_id == CIP_SYMBOL_CLASS) {
+                *instance = (int)index;
+
+                if(index >= 1 && index <= (uint32_t)num_tags) {
+                    name_len += snprintf(name + name_len, (size_t)(name_size - name_len), "%s", tags[index - 1].name);
+                }
+            }
+
+            continue;
+        }
+
+        name_len += snprintf(name + name_len, (size_t)(name_size - name_len), "[%u]", index);
+    }
+
+    return path_len;
+}
+
+
+
+/* handle one CIP request, returns the size of the response. */
+static int handle_cip(const uint8_t *req, int req_len, uint8_t *resp, int max_payload)
+{
+    char name[MAX_TAG_NAME];
+    uint8_t service;
+    int path_len;
+    int instance;
+    struct tag *tag;
+
+    if(req_len < 2) {
+        return 0;
+    }
+
+    service = req[0];
+    path_len = decode_path(req + 1, req_len - 1, name, (int)sizeof(name), &instance);
+
+    resp[0] = (uint8_t)(service | 0x80);
+    resp[1] = 0;
+    resp[2] = CIP_OK;
+    resp[3] = 0;
+
+    if(path_len < 0) {
+        resp[2] = CIP_ERR_UNSUPPORTED;
+        return 4;
+    }
+
+    req += 1 + path_len;
+    req_len -= 1 + path_len;
+
+    switch(service) {
+        case CIP_READ:
+        case CIP_READ_FRAG: {
+            int count = get16(req);
+            int offset = (service == CIP_READ_FRAG ? (int)get32(req + 2) : 0);
+            int room = (max_payload > 16 ? max_payload - 16 : 0);
+            int amount;
+
+            if(!(tag = find_tag(name, count * 4))) {
+                resp[2] = CIP_ERR_UNSUPPORTED;
+                return 4;
+            }
+
+            amount = count * 4 - offset;
+
+            if(amount > room) {
+                amount = room;
+                resp[2] = CIP_ERR_PARTIAL;
+            }
+
+            put16(resp + 4, DINT_TYPE);
+            memcpy(resp + 6, tag->data + offset, (size_t)amount);
+
+            return 6 + amount;
+        }
+
+        case CIP_WRITE:
+        case CIP_WRITE_FRAG: {
+            int type_len = (req[0] == 0xA0 ? 4 : 2);
+            int count = get16(req + type_len);
+            int offset = 0;
+            int data_pos = type_len + 2;
+            int amount;
+
+            if(service == CIP_WRITE_FRAG) {
+                offset = (int)get32(req + data_pos);
+                data_pos += 4;
+            }
+
+            if(!(tag = find_tag(name, count * 4))) {
+                resp[2] = CIP_ERR_UNSUPPORTED;
+                return 4;
+            }
+
+            amount = req_len - data_pos;
+
+            if(amount > count * 4 - offset) {
+                amount = count * 4 - offset;
+            }
+
+            memcpy(tag->data + offset, req + data_pos, (size_t)amount);
+
+            return 4;
+        }
+
+        case CIP_MULTI: {
+            int num_services = get16(req);
+            int resp_pos = 6 + num_services * 2;
+
+            put16(resp + 4, (uint16_t)num_services);
+
+            for(int i=0; i < num_services; i++) {
+                int start = get16(req + 2 + (i * 2));
+                int end = (i + 1 < num_services ? get16(req + 4 + (i * 2)) : req_len);
+
+                put16(resp + 6 + (i * 2), (uint16_t)(resp_pos - 4));
+                /* all the replies have to fit in one packet. */
+                resp_pos += handle_cip(req + start, end - start, resp + resp_pos, max_payload - resp_pos);
+            }
+
+            return resp_pos;
+        }
+
+        case CIP_GET_ATTR_SINGLE: {
+            /* only the Symbol Object class Max Instance, the attribute is not checked. */
+            if(instance != 0) {
+                resp[2] = CIP_ERR_UNSUPPORTED;
+                return 4;
+            }
+
+            put16(resp + 4, (uint16_t)num_tags);
+
+            return 6;
+        }
+
+        case CIP_LIST_INSTANCES: {
+            int resp_pos = 4;
+            int room = (max_payload > 16 ? max_payload - 16 : 0);
+            int num_attrs = (req_len >= 2 ? get16(req) : 0);
+            int entry_size = 4; /* instance */
+
+            /* only the Symbol Object, and the name, type, element size and dimensions. */
+            if(instance < 0 || num_attrs * 2 + 2 > req_len) {
+                resp[2] = CIP_ERR_UNSUPPORTED;
+                return 4;
+            }
+
+            for(int a=0; a < num_attrs; a++) {
+                switch(get16(req + 2 + (a * 2))) {
+                    case 1: entry_size += 2; break;
+                    case 2: entry_size += 2; break;
+                    case 7: entry_size += 2; break;
+                    case 8: entry_size += 12; break;
+                    default:
+                        resp[2] = CIP_ERR_UNSUPPORTED;
+                        return 4;
+                }
+            }
+
+            for(int i = (instance > 0 ? instance - 1 : 0); i < num_tags; i++) {
+                int len = (int)strlen(tags[i].name);
+                int pos;
+
+                /* tags touched through an index or member are not base tags. */
+                if(strpbrk(tags[i].name, "[.")) {
+                    continue;
+                }
+
+                if(resp_pos + entry_size + len > room) {
+                    resp[2] = CIP_ERR_PARTIAL;
+                    break;
+                }
+
+                put32(resp + resp_pos, (uint32_t)(i + 1));
+                pos = resp_pos + 4;
+
+                for(int a=0; a < num_attrs; a++) {
+                    switch(get16(req + 2 + (a * 2))) {
+                        case 1:
+                            put16(resp + pos, (uint16_t)len);
+                            memcpy(resp + pos + 2, tags[i].name, (size_t)len);
+                            pos += 2 + len;
+                            break;
+
+                        case 2:
+                            put16(resp + pos, DINT_TYPE);
+                            pos += 2;
+                            break;
+
+                        case 7:
+                            put16(resp + pos, 4);
+                            pos += 2;
+                            break;
+
+                        case 8:
+                            put32(resp + pos, (uint32_t)(tags[i].size > 4 ? tags[i].size / 4 : 0));
+                            put32(resp + pos + 4, 0);
+                            put32(resp + pos + 8, 0);
+                            pos += 12;
+                            break;
+                    }
+                }
+
+                resp_pos = pos;
+            }
+
+            return resp_pos;
+        }
+
+        default:
+            resp[2] = CIP_ERR_UNSUPPORTED;
+            return 4;
+    }
+}
+
+
+
+static int handle_forward_open(struct client *client, const uint8_t *cip, uint8_t *resp)
+{
+    uint8_t service = cip[0];
+    const uint8_t *p = cip + 8;
+    struct conn *conn = NULL;
+    int size;
+
+    for(int i=0; i < MAX_CONNS; i++) {
+        if(!client->conns[i].our_id) {
+            conn = &client->conns[i];
+            break;
+        }
+    }
+
+    if(service == CIP_FORWARD_OPEN_EX) {
+        size = (int)(get32(p + 24) & 0xFFFF);
+    } else {
+        size = get16(p + 24) & 0x1FF;
+    }
+
+    resp[0] = (uint8_t)(service | 0x80);
+    resp[1] = 0;
+    resp[2] = (conn ? CIP_OK : CIP_ERR_UNSUPPORTED);
+    resp[3] = 0;
+
+    if(!conn) {
+        return 4;
+    }
+
+    conn->our_id = ++next_conn_id;
+    conn->their_id = get32(p + 4);
+    conn->max_payload = size;
+
+    put32(resp + 4, conn->our_id);
+    put32(resp + 8, conn->their_id);
+    memcpy(resp + 12, p + 8, 8);        /* serial number, vendor and originator serial number */
+    put32(resp + 20, 1000000);
+    put32(resp + 24, 1000000);
+    resp[28] = 0;
+    resp[29] = 0;
+
+    return 30;
+}
+
+
+
+static int handle_forward_close(struct client *client, const uint8_t *cip, uint8_t *resp)
+{
+    resp[0] = CIP_FORWARD_CLOSE | 0x80;
+    resp[1] = 0;
+    resp[2] = CIP_OK;
+    resp[3] = 0;
+    memcpy(resp + 4, cip + 8, 8);
+    resp[12] = 0;
+    resp[13] = 0;
+
+    /* we do not know which one, so this only matters if all of them are closed. */
+    (void)client;
+
+    return 14;
+}
+
+
+
+static struct conn *find_conn(struct client *client, uint32_t our_id)
+{
+    for(int i=0; i < MAX_CONNS; i++) {
+        if(client->conns[i].our_id == our_id) {
+            return &client->conns[i];
+        }
+    }
+
+    return NULL;
+}
+
+
+
+static void queue_packet(struct client *client, const uint8_t *data, int len)
+{
+    struct out_packet *pkt = malloc(sizeof(*pkt) + (size_t)len);
+
+    if(!pkt) {
+        return;
+    }
+
+    pkt->next = NULL;
+    pkt->due = time_ms() + delay_ms;
+    pkt->len = len;
+    pkt->sent = 0;
+    memcpy(pkt->data, data, (size_t)len);
+
+    if(client->out_tail) {
+        client->out_tail->next = pkt;
+    } else {
+        client->out_head = pkt;
+    }
+
+    client->out_tail = pkt;
+}
+
+
+
+static void handle_packet(struct client *client, const uint8_t *pkt, int len)
+{
+    uint8_t out[MAX_PACKET_SIZE * 2];
+    uint16_t command = get16(pkt);
+    const uint8_t *body = pkt + EIP_HEADER_SIZE;
+    int body_len = len - EIP_HEADER_SIZE;
+    int out_len = 0;
+
+    /* copy the header, the sender context has to come back unchanged. */
+    memcpy(out, pkt, EIP_HEADER_SIZE);
+    put32(out + 8, 0);
+
+    switch(command) {
+        case EIP_REGISTER_SESSION:
+            put32(out + 4, next_session_handle++);
+            memcpy(out + EIP_HEADER_SIZE, body, 4);
+            out_len = 4;
+            break;
+
+        case EIP_UNREGISTER_SESSION:
+            return;
+
+        case EIP_SEND_RR_DATA: {
+            const uint8_t *cip = body + 16;
+            int cip_len = body_len - 16;
+            uint8_t *resp = out + EIP_HEADER_SIZE + 16;
+            int resp_len;
+
+            if(cip[0] == CIP_UNCONNECTED_SEND && cip[1] == 2) {
+                resp_len = handle_cip(cip + 10, get16(cip + 8), resp, MAX_UNCONNECTED_PAYLOAD);
+            } else if(cip[0] == CIP_FORWARD_OPEN || cip[0] == CIP_FORWARD_OPEN_EX) {
+                resp_len = handle_forward_open(client, cip, resp);
+            } else if(cip[0] == CIP_FORWARD_CLOSE) {
+                resp_len = handle_forward_close(client, cip, resp);
+            } else {
+                resp_len = handle_cip(cip, cip_len, resp, MAX_UNCONNECTED_PAYLOAD);
+            }
+
+            memset(out + EIP_HEADER_SIZE, 0, 16);
+            put16(out + EIP_HEADER_SIZE + 6, 2);
+            put16(out + EIP_HEADER_SIZE + 12, 0xB2);
+            put16(out + EIP_HEADER_SIZE + 14, (uint16_t)resp_len);
+            out_len = 16 + resp_len;
+            break;
+        }
+
+        case EIP_SEND_UNIT_DATA: {
+            struct conn *conn = find_conn(client, get32(body + 12));
+            int cip_len = get16(body + 18) - 2;
+            uint8_t *resp = out + EIP_HEADER_SIZE + 22;
+            int resp_len;
+
+            if(!conn) {
+                fprintf(stderr, "Unknown connection ID %08x!\n", get32(body + 12));
+                return;
+            }
+
+            resp_len = handle_cip(body + 22, cip_len, resp, conn->max_payload);
+
+            memset(out + EIP_HEADER_SIZE, 0, 22);
+            put16(out + EIP_HEADER_SIZE + 6, 2);
+            put16(out + EIP_HEADER_SIZE + 8, 0xA1);
+            put16(out + EIP_HEADER_SIZE + 10, 4);
+            put32(out + EIP_HEADER_SIZE + 12, conn->their_id);
+            put16(out + EIP_HEADER_SIZE + 16, 0xB1);
+            put16(out + EIP_HEADER_SIZE + 18, (uint16_t)(resp_len + 2));
+            memcpy(out + EIP_HEADER_SIZE + 20, body + 20, 2);
+            out_len = 22 + resp_len;
+            break;
+        }
+
+        default:
+            fprintf(stderr, "Unsupported EIP command %04x!\n", command);
+            return;
+    }
+
+    put16(out + 2, (uint16_t)out_len);
+
+    queue_packet(client, out, EIP_HEADER_SIZE + out_len);
+}
+
+
+
+static void close_client(int index)
+{
+    struct client *client = clients[index];
+
+    while(client->out_head) {
+        struct out_packet *pkt = client->out_head;
+        client->out_head = pkt->next;
+        free(pkt);
+    }
+
+    close(client->fd);
+    free(client);
+    clients[index] = NULL;
+}
+
+
+
+/* returns non-zero if the client should be closed. */
+static int read_client(struct client *client)
+{
+    int used = 0;
+    ssize_t rc = read(client->fd, client->in_buf + client->in_len, (size_t)(IN_BUF_SIZE - client->in_len));
+
+    if(rc <= 0) {
+        return (rc == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR));
+    }
+
+    client->in_len += (int)rc;
+
+    /* handle all the complete packets we have. */
+    while(client->in_len - used >= EIP_HEADER_SIZE) {
+        int pkt_len = EIP_HEADER_SIZE + get16(client->in_buf + used + 2);
+
+        if(pkt_len > MAX_PACKET_SIZE) {
+            fprintf(stderr, "Packet too large (%d bytes)!\n", pkt_len);
+            return 1;
+        }
+
+        if(client->in_len - used < pkt_len) {
+            break;
+        }
+
+        handle_packet(client, client->in_buf + used, pkt_len);
+        used += pkt_len;
+    }
+
+    memmove(client->in_buf, client->in_buf + used, (size_t)(client->in_len - used));
+    client->in_len -= used;
+
+    return 0;
+}
+
+
+
+/* returns non-zero if the client should be closed. */
+static int write_client(struct client *client, int64_t now)
+{
+    while(client->out_head && client->out_head->due <= now) {
+        struct out_packet *pkt = client->out_head;
+        ssize_t rc = write(client->fd, pkt->data + pkt->sent, (size_t)(pkt->len - pkt->sent));
+
+        if(rc < 0) {
+            return (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR);
+        }
+
+        pkt->sent += (int)rc;
+
+        if(pkt->sent < pkt->len) {
+            break;
+        }
+
+        client->out_head = pkt->next;
+
+        if(!client->out_head) {
+            client->out_tail = NULL;
+        }
+
+        free(pkt);
+    }
+
+    return 0;
+}
+
+
+
+static void accept_clients(int listen_fd)
+{
+    int fd;
+
+    while((fd = accept(listen_fd, NULL, NULL)) >= 0) {
+        int one = 1;
+        int index;
+
+        for(index = 0; index < MAX_CLIENTS && clients[index]; index++) { }
+
+        if(index >= MAX_CLIENTS || !(clients[index] = calloc(1, sizeof(struct client)))) {
+            fprintf(stderr, "Too many clients!\n");
+            close(fd);
+            continue;
+        }
+
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        clients[index]->fd = fd;
+    }
+}
+
+
+
+static void interrupt_handler(int sig)
+{
+    (void)sig;
+    done = 1;
+}
+
+
+
+int main(int argc, char **argv)
+{
+    static struct pollfd fds[MAX_CLIENTS + 1];
+    static int fd_client[MAX_CLIENTS + 1];
+    struct sockaddr_in addr;
+    int port = DEFAULT_PORT;
+    int listen_fd;
+    int one = 1;
+
+    for(int i=1; i < argc; i++) {
+        if(strncmp(argv[i], "--port=", 7) == 0) {
+            port = atoi(argv[i] + 7);
+        } else if(strncmp(argv[i], "--delay=", 8) == 0) {
+            delay_ms = atoi(argv[i] + 8);
+        } else if(strncmp(argv[i], "--tags=", 7) == 0) {
+            char name[MAX_TAG_NAME];
+            int count = atoi(argv[i] + 7);
+
+            for(int t=0; t < count; t++) {
+                snprintf(name, sizeof(name), "SimTag_%05d", t);
+
+                if(!find_tag(name, (t % 10 == 0 ? 40 : 4))) {
+                    fprintf(stderr, "Unable to create %d tags!\n", count);
+                    return 1;
+                }
+            }
+        } else {
+            fprintf(stderr, "Usage: plc_sim [--port=<port>] [--delay=<ms>] [--tags=<count>]\n");
+            return 1;
+        }
+    }
+
+    signal(SIGINT, interrupt_handler);
+    signal(SIGTERM, interrupt_handler);
+    signal(SIGPIPE, SIG_IGN);
+
+    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    if(listen_fd < 0) {
+        perror("socket");
+        return 1;
+    }
+
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons((uint16_t)port);
+
+    if(bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listen_fd, 1024) < 0) {
+        perror("bind/listen");
+        return 1;
+    }
+
+    fcntl(listen_fd, F_SETFL, fcntl(listen_fd, F_GETFL) | O_NONBLOCK);
+
+    fprintf(stderr, "Simulating a ControlLogix PLC on port %d with %dms delay.\n", port, delay_ms);
+
+    while(!done) {
+        int64_t now = time_ms();
+        int64_t next_due = -1;
+        int num_fds = 1;
+        int timeout;
+
+        fds[0].fd = listen_fd;
+        fds[0].events = POLLIN;
+
+        for(int i=0; i < MAX_CLIENTS; i++) {
+            struct client *client = clients[i];
+
+            if(!client) {
+                continue;
+            }
+
+            fds[num_fds].fd = client->fd;
+            fds[num_fds].events = POLLIN;
+
+            if(client->out_head) {
+                if(client->out_head->due <= now) {
+                    fds[num_fds].events |= POLLOUT;
+                } else if(next_due < 0 || client->out_head->due < next_due) {
+                    next_due = client->out_head->due;
+                }
+            }
+
+            fd_client[num_fds] = i;
+            num_fds++;
+        }
+
+        timeout = (next_due < 0 ? 100 : (int)(next_due - now));
+
+        if(poll(fds, (nfds_t)num_fds, timeout) < 0 && errno != EINTR) {
+            perror("poll");
+            break;
+        }
+
+        if(fds[0].revents & POLLIN) {
+            accept_clients(listen_fd);
+        }
+
+        now = time_ms();
+
+        for(int i=1; i < num_fds; i++) {
+            struct client *client = clients[fd_client[i]];
+            int close_it = 0;
+
+            if(fds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+                close_it = read_client(client);
+            }
+
+            if(!close_it) {
+                close_it = write_client(client, now);
+            }
+
+            if(close_it) {
+                close_client(fd_client[i]);
+            }
+        }
+    }
+
+    for(int i=0; i < MAX_CLIENTS; i++) {
+        if(clients[i]) {
+            close_client(i);
+        }
+    }
+
+    close(listen_fd);
+
+    for(int i=0; i < num_tags; i++) {
+        free(tags[i].data);
+    }
+
+    return 0;
+}
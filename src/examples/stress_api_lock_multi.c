@@ -0,0 +1,263 @@
+/***************************************************************************
+ *   Copyright (C) 2015 by OmanTek                                         *
+ *   Author Kyle Hayes  kylehayes@omantek.com                              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <time.h>
+#include "../lib/libplctag.h"
+#include "utils.h"
+
+#define TAG_PATH "protocol=ab_eip&gateway=127.0.0.%d&path=1,0&cpu=LGX&elem_size=4&elem_count=1&name=TestDINTArray[%d]&io_threads=%d"
+#define CHURN_TAG_PATH "protocol=ab_eip&gateway=127.0.0.1&path=1,0&cpu=LGX&elem_size=4&elem_count=1&name=ChurnDINT[%d]&use_connected_msg=1&share_connection=0&io_threads=%d"
+
+#define DATA_TIMEOUT 1500
+#define CREATE_TIMEOUT 2000
+
+
+
+/*
+ * This is a multi-PLC version of stress_api_lock.c.  Start plc_sim first.
+ *
+ * One thread per PLC reads and writes a tag on its own PLC (127.0.0.2,
+ * 127.0.0.3, ...) as fast as it can.  At the same time, another thread
+ * keeps creating and destroying connected tags on 127.0.0.1.  If the
+ * library serializes everything on one lock, the tag churn on the first
+ * PLC shows up as latency on all the others.
+ *
+ * At the end, the average and worst read/write latency across the
+ * reader threads is printed.  Compare before and after locking changes.
+ */
+
+
+struct reader {
+    pthread_t thread;
+    int plc;
+    plc_tag tag;
+    int64_t iterations;
+    int64_t total_us;
+    int64_t max_us;
+};
+
+/* global to cheat on passing it to threads. */
+volatile int done = 0;
+volatile int failed = 0;
+int io_threads = 1;
+
+
+
+static int64_t time_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((int64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+
+
+static int open_tag(plc_tag *tag, const char *tag_str)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int64_t start_time;
+
+    /* create the tag */
+    start_time = time_ms();
+    *tag = plc_tag_create(tag_str);
+
+    if(! *tag) {
+        fprintf(stderr,"ERROR: Could not create tag!\n");
+        return PLCTAG_ERR_CREATE;
+    }
+
+    /* let the connect succeed we hope */
+    while((start_time + CREATE_TIMEOUT) > time_ms() && (rc = plc_tag_status(*tag)) == PLCTAG_STATUS_PENDING) {
+        sleep_ms(1);
+    }
+
+    if(rc != PLCTAG_STATUS_OK) {
+        fprintf(stderr,"Error %s setting up tag internal state.\n", plc_tag_decode_error(rc));
+        plc_tag_destroy(*tag);
+        *tag = (plc_tag)0;
+        return rc;
+    }
+
+    return rc;
+}
+
+
+
+void *read_write_tag(void *data)
+{
+    struct reader *reader = (struct reader *)data;
+    int rc = PLCTAG_STATUS_OK;
+
+    while(!done) {
+        int64_t start = time_us();
+        int64_t elapsed;
+        int32_t value;
+
+        rc = plc_tag_read(reader->tag, DATA_TIMEOUT);
+
+        if(rc == PLCTAG_STATUS_OK) {
+            value = plc_tag_get_int32(reader->tag, 0);
+            plc_tag_set_int32(reader->tag, 0, (value >= 500 ? 0 : value + 1));
+            rc = plc_tag_write(reader->tag, DATA_TIMEOUT);
+        }
+
+        if(rc != PLCTAG_STATUS_OK) {
+            fprintf(stderr,"PLC %d, terminating test, got error %s\n", reader->plc, plc_tag_decode_error(rc));
+            failed = 1;
+            done = 1;
+            break;
+        }
+
+        elapsed = time_us() - start;
+
+        reader->iterations++;
+        reader->total_us += elapsed;
+
+        if(elapsed > reader->max_us) {
+            reader->max_us = elapsed;
+        }
+    }
+
+    return NULL;
+}
+
+
+
+void *churn_tags(void *data)
+{
+    int64_t *count = (int64_t *)data;
+    int index = 0;
+
+    while(!done) {
+        char tag_path[256];
+        plc_tag tag;
+
+        snprintf_platform(tag_path, sizeof(tag_path), CHURN_TAG_PATH, index++, io_threads);
+
+        if(open_tag(&tag, tag_path) != PLCTAG_STATUS_OK) {
+            fprintf(stderr, "Unable to create churn tag!\n");
+            failed = 1;
+            done = 1;
+            break;
+        }
+
+        plc_tag_destroy(tag);
+
+        (*count)++;
+    }
+
+    return NULL;
+}
+
+
+
+#define MAX_PLCS (200)
+
+int main(int argc, char **argv)
+{
+    struct reader readers[MAX_PLCS] = {{0}};
+    pthread_t churn_thread;
+    int64_t churn_count = 0;
+    int64_t iterations = 0;
+    int64_t total_us = 0;
+    int64_t max_us = 0;
+    int num_plcs;
+    int seconds;
+
+    if(argc < 3 || argc > 4) {
+        fprintf(stderr,"Usage: stress_api_lock_multi <num PLCs> <seconds> [io threads]\n");
+        return 0;
+    }
+
+    num_plcs = atoi(argv[1]);
+    seconds = atoi(argv[2]);
+
+    if(argc == 4) {
+        io_threads = atoi(argv[3]);
+    }
+
+    if(num_plcs < 1 || num_plcs > MAX_PLCS || seconds < 1) {
+        fprintf(stderr, "Arguments out of range!\n");
+        return 1;
+    }
+
+    /* PLC 1 is for the tag churn, the readers use the rest. */
+    for(int i=0; i < num_plcs; i++) {
+        char tag_path[256];
+
+        readers[i].plc = i + 2;
+
+        snprintf_platform(tag_path, sizeof(tag_path), TAG_PATH, readers[i].plc, 4, io_threads);
+
+        if(open_tag(&readers[i].tag, tag_path) != PLCTAG_STATUS_OK) {
+            fprintf(stderr,"Unable to create tag for PLC %d!\n", readers[i].plc);
+            return 1;
+        }
+    }
+
+    for(int i=0; i < num_plcs; i++) {
+        pthread_create(&readers[i].thread, NULL, &read_write_tag, &readers[i]);
+    }
+
+    pthread_create(&churn_thread, NULL, &churn_tags, &churn_count);
+
+    for(int64_t end_time = time_ms() + (seconds * 1000); !done && time_ms() < end_time; ) {
+        sleep_ms(100);
+    }
+
+    done = 1;
+
+    pthread_join(churn_thread, NULL);
+
+    for(int i=0; i < num_plcs; i++) {
+        pthread_join(readers[i].thread, NULL);
+
+        iterations += readers[i].iterations;
+        total_us += readers[i].total_us;
+
+        if(readers[i].max_us > max_us) {
+            max_us = readers[i].max_us;
+        }
+
+        plc_tag_destroy(readers[i].tag);
+    }
+
+    printf("%d PLCs, %d IO threads: %" PRId64 " read/write cycles, avg %" PRId64 "us, max %" PRId64 "us, %" PRId64 " tags created on PLC 1.\n",
+           num_plcs, io_threads, iterations, (iterations ? total_us / iterations : 0), max_us, churn_count);
+
+    if(failed) {
+        fprintf(stderr,"Test FAILED!\n");
+        return 1;
+    }
+
+    fprintf(stderr,"Test SUCCEEDED!\n");
+
+    return 0;
+}
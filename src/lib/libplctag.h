@@ -108,6 +108,7 @@ extern "C" {
     #define PLCTAG_ERR_UNSUPPORTED (-34)
     #define PLCTAG_ERR_WINSOCK (-35)
     #define PLCTAG_ERR_WRITE (-36)
+    #define PLCTAG_ERR_ABORT (-37)
 
 
 
@@ -123,6 +124,29 @@ extern "C" {
 
 
 
+    /*
+     * plc_tag_get_lib_stat
+     *
+     * Read one of the library wide counters by name into *value.  The
+     * counters only ever go up.  Current counters:
+     *
+     *     send_syscalls - socket writes made by the IO threads.
+     *     send_packets  - packets sent by those writes.
+     *     recv_syscalls - socket reads made by the IO threads.
+     *     recv_packets  - packets received by those reads.
+     *     request_pool_hits   - request buffers reused from the pool.
+     *     request_pool_misses - request buffers that had to be allocated.
+     *     coalesced_packets   - packets that carried several packed reads or writes.
+     *     coalesced_requests  - reads and writes carried in those packets.
+     *     instance_id_tags    - tags that switched to Symbol Object instance IDs.
+     *
+     * Returns PLCTAG_ERR_NOT_FOUND for an unknown name.
+     */
+
+    LIB_EXPORT int plc_tag_get_lib_stat(const char *name, int64_t *value);
+
+
+
 
     /*
      * tag functions
@@ -140,6 +164,12 @@ extern "C" {
      * value pair "protocol=XXX" where XXX is one of the supported protocol
      * types.
      *
+     * Logix tags can leave out elem_size.  The library then reads the PLC's
+     * tag list and sizes the tag from it before the first read or write.
+     * A Logix tag named @tags reads that list itself, one entry per
+     * controller scope tag: the uint32 instance ID, uint16 type, uint16
+     * element size, three uint32 dimensions, uint16 name length, then the name.
+     *
      * An opaque pointer is returned on success.  NULL is returned on allocation
      * failure.  Other failures will set the tag status.
      */
@@ -147,6 +177,28 @@ extern "C" {
     LIB_EXPORT plc_tag plc_tag_create(const char *attrib_str);
 
 
+
+    /*
+     * plc_tag_create_many
+     *
+     * Create num_tags tags at once.  The attribute strings are parsed on
+     * several threads and the tags are grouped by gateway and path, so
+     * each session and connection is set up once by one thread.  The
+     * handle for attrib_strs[i] goes in tags[i], or NULL if the tag could
+     * not be created.
+     *
+     * Then this waits until every tag is ready or has failed.  Returns
+     * PLCTAG_STATUS_OK if all the tags are ready, otherwise the first
+     * error found.  If the timeout passes first, PLCTAG_ERR_TIMEOUT is
+     * returned.  A timeout of zero does not wait and returns
+     * PLCTAG_STATUS_PENDING if some tags are still setting up.  Either way
+     * the created tags are kept, so use plc_tag_status() on each one to
+     * find out more and plc_tag_destroy() to get rid of them.
+     */
+
+    LIB_EXPORT int plc_tag_create_many(const char **attrib_strs, int num_tags, plc_tag *tags, int timeout);
+
+
     /*
      * plc_tag_lock
      *
@@ -256,6 +308,85 @@ extern "C" {
 
 
 
+    /*
+     * plc_tag_read_many/plc_tag_write_many
+     *
+     * Start a read or write on each of the tags, then wait for all of them.
+     * Everything is sent before anything is waited on, and the timeout is a
+     * single deadline for the whole set rather than per tag.  A timeout of
+     * zero starts the operations and returns without waiting.
+     *
+     * If statuses is not NULL, it must have room for num_tags entries and
+     * gets the status of each tag.  The return value is PLCTAG_STATUS_OK if
+     * all the tags succeeded, PLCTAG_STATUS_PENDING if some are still in
+     * flight or otherwise the first error found.  Tags that time out are
+     * aborted and get PLCTAG_ERR_TIMEOUT.
+     */
+    LIB_EXPORT int plc_tag_read_many(plc_tag *tags, int num_tags, int timeout, int *statuses);
+    LIB_EXPORT int plc_tag_write_many(plc_tag *tags, int num_tags, int timeout, int *statuses);
+
+
+
+
+    /*
+     * plc_tag_wait
+     *
+     * Block until any (PLCTAG_WAIT_ANY) or all (PLCTAG_WAIT_ALL) of the tags
+     * are no longer PLCTAG_STATUS_PENDING.  The calling thread sleeps on a
+     * single wait object and only the tags that have had IO complete are
+     * checked again when it wakes up.
+     *
+     * Returns PLCTAG_STATUS_OK when the condition is met.  In ANY mode, the
+     * index of a tag that is ready goes in ready_index if it is not NULL.  In
+     * ALL mode, ready_index is set to -1.  A timeout of zero only checks and
+     * returns PLCTAG_STATUS_PENDING if the condition is not met yet.
+     * Otherwise, PLCTAG_ERR_TIMEOUT is returned when the timeout passes.
+     * Nothing is aborted.  Use plc_tag_status() to get the result of each tag.
+     */
+
+    #define PLCTAG_WAIT_ANY     (1)
+    #define PLCTAG_WAIT_ALL     (2)
+
+    LIB_EXPORT int plc_tag_wait(plc_tag *tags, int num_tags, int mode, int timeout, int *ready_index);
+
+
+
+
+    /*
+     * plc_tag_register_callback
+     *
+     * Register a function to be called when an operation on the tag finishes.
+     * Only one callback can be registered per tag.  Passing a NULL callback
+     * removes the current one.
+     *
+     * The callback is called from a library callback thread, never from the
+     * thread that started the operation and never from the IO threads.  By
+     * the time it is called, the data has already been decoded into the tag
+     * buffer so the data accessors can be used directly.  The status is the
+     * tag status at completion.
+     *
+     * Events:
+     *    PLCTAG_EVENT_READ_COMPLETED - a read finished successfully.
+     *    PLCTAG_EVENT_WRITE_COMPLETED - a write finished successfully.
+     *    PLCTAG_EVENT_ABORTED - the operation was aborted, status is PLCTAG_ERR_ABORT.
+     *    PLCTAG_EVENT_ERROR - the operation failed, status holds the error.
+     *
+     * The callback may call other API functions, including on the same tag.
+     * It should not block for long as all callbacks share one thread.
+     */
+
+    #define PLCTAG_EVENT_READ_COMPLETED     (1)
+    #define PLCTAG_EVENT_WRITE_COMPLETED    (2)
+    #define PLCTAG_EVENT_ABORTED            (3)
+    #define PLCTAG_EVENT_ERROR              (4)
+
+    typedef void (*plc_tag_callback_func)(plc_tag tag, int event, int status, void *userdata);
+
+    LIB_EXPORT int plc_tag_register_callback(plc_tag tag, plc_tag_callback_func callback, void *userdata);
+
+
+
+
     /*
      * Tag data accessors.
      */
@@ -287,6 +418,38 @@ extern "C" {
     LIB_EXPORT int plc_tag_set_float32(plc_tag tag, int offset, float val);
 
 
+
+
+    /*
+     * Bulk and array accessors.
+     *
+     * These copy a run of bytes or of count elements starting at the byte
+     * offset in one call, with the tag checked and locked once.  The array
+     * values are in host byte order.  They return PLCTAG_STATUS_OK or an
+     * error, and nothing is copied if the whole run does not fit.
+     */
+
+    LIB_EXPORT int plc_tag_get_bytes(plc_tag tag, int offset, uint8_t *buf, int size);
+    LIB_EXPORT int plc_tag_set_bytes(plc_tag tag, int offset, const uint8_t *buf, int size);
+
+    LIB_EXPORT int plc_tag_get_uint32_array(plc_tag tag, int offset, uint32_t *vals, int count);
+    LIB_EXPORT int plc_tag_set_uint32_array(plc_tag tag, int offset, const uint32_t *vals, int count);
+
+    LIB_EXPORT int plc_tag_get_int32_array(plc_tag tag, int offset, int32_t *vals, int count);
+    LIB_EXPORT int plc_tag_set_int32_array(plc_tag tag, int offset, const int32_t *vals, int count);
+
+
+    LIB_EXPORT int plc_tag_get_uint16_array(plc_tag tag, int offset, uint16_t *vals, int count);
+    LIB_EXPORT int plc_tag_set_uint16_array(plc_tag tag, int offset, const uint16_t *vals, int count);
+
+    LIB_EXPORT int plc_tag_get_int16_array(plc_tag tag, int offset, int16_t *vals, int count);
+    LIB_EXPORT int plc_tag_set_int16_array(plc_tag tag, int offset, const int16_t *vals, int count);
+
+
+    LIB_EXPORT int plc_tag_get_float32_array(plc_tag tag, int offset, float *vals, int count);
+    LIB_EXPORT int plc_tag_set_float32_array(plc_tag tag, int offset, const float *vals, int count);
+
+
 #ifdef __cplusplus
 }
 #endif
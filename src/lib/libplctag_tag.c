@@ -33,6 +33,7 @@
 #define LIBPLCTAGDLL_EXPORTS 1
 
 #include <limits.h>
+#include <stdlib.h>
 #include <float.h>
 #include <lib/libplctag.h>
 #include <lib/libplctag_tag.h>
@@ -41,16 +42,30 @@
 #include <util/attr.h>
 #include <util/debug.h>
 #include <util/rc.h>
+#include <util/stats.h>
 #include <ab/ab.h>
 
 
 
-static plc_tag_p map_id_to_tag(plc_tag tag_id);
+static tag_done_p tag_done_lookup(plc_tag tag_id);
+static plc_tag create_tag_from_attribs(attr attribs);
 static int allocate_new_tag_to_id_mapping(plc_tag_p tag);
+static int tag_map_grow(int old_capacity);
+static int tag_map_reserve(int num_tags);
 static int release_tag_to_id_mapping(plc_tag_p tag);
-static int api_lock(int index);
-static int api_unlock(int index);
+static plc_tag_p api_lock(plc_tag tag_id);
+static plc_tag_p api_unlock(plc_tag tag_id, plc_tag_p tag);
 static int tag_ptr_to_tag_index(plc_tag tag_id_ptr);
+static tag_done_p tag_done_create(void);
+static void tag_done_wait(tag_done_p done, int64_t timeout_time);
+static void tag_done_add_waiter(tag_done_p done, tag_waiter_p waiter);
+static void tag_done_remove_waiter(tag_done_p done, tag_waiter_p waiter);
+static void tag_done_queue(tag_done_p done);
+static void callback_event_queue(int tag_id, int event, int status);
+static void tag_callback_op_started(plc_tag_p tag, int op, int rc);
+static void tag_callback_op_done(plc_tag_p tag, int status);
+static int callback_dispatcher_start(void);
+static void callback_dispatcher_stop(void);
 
 
 
@@ -59,22 +74,87 @@ mutex_p global_library_mutex = NULL;
 
 
 
-#define TAG_ID_MASK (0xFFFFFFF)
-#define TAG_INDEX_MASK (0x3FFF)
+#define TAG_ID_MASK (0x7FFFFFFF)
+#define TAG_INDEX_MASK (0xFFFFF)
 #define MAX_TAG_ENTRIES (TAG_INDEX_MASK + 1)
 #define TAG_ID_ERROR INT_MIN
 
+/* the tag map grows this many entries at a time. */
+#define TAG_MAP_CHUNK_SIZE (256)
+#define TAG_MAP_MAX_CHUNKS (MAX_TAG_ENTRIES / TAG_MAP_CHUNK_SIZE)
+
+/* the longest a blocking call sleeps before looking at the tag status again. */
+#define TAG_DONE_MAX_WAIT_MS (100)
+
+/* how long the callback dispatcher sleeps when the queue is empty. */
+#define CALLBACK_IDLE_WAIT_MS (100)
+
+/* plc_tag_create_many() only starts another thread for at least this many tags. */
+#define CREATE_MANY_MIN_TAGS_PER_THREAD (500)
+#define CREATE_MANY_MAX_THREADS (8)
+
 /* these are only internal to the file */
 
+/*
+ * The low bits of a tag ID are the index of its entry in the tag map,
+ * the rest change each time around the map.  The map is allocated in
+ * chunks as the number of tags grows and the chunks stay until the
+ * library is torn down.  Each entry has the API mutex for its tag.
+ *
+ * The entry keeps the ID of its tag so that a handle can be checked
+ * without touching the tag.  Handles are resolved without a lock; the
+ * lookups count themselves in readers while they look at the tag, see
+ * api_lock() and tag_done_lookup().  The API mutex is only for the tag
+ * state.
+ */
+typedef struct tag_map_entry_t *tag_map_entry_p;
+
+struct tag_map_entry_t {
+    volatile plc_tag_p tag;
+    volatile int tag_id;
+    volatile int64_t readers;
+    mutex_p api_mutex;
+};
+
 static volatile int next_tag_id = MAX_TAG_ENTRIES;
-static volatile plc_tag_p tag_map[MAX_TAG_ENTRIES + 1] = {0,};
-static volatile mutex_p tag_api_mutex[MAX_TAG_ENTRIES + 1] = {0,};
+static volatile int tag_map_capacity = 0;
+static tag_map_entry_p volatile tag_map_chunks[TAG_MAP_MAX_CHUNKS] = {0,};
+
+/* one entry per tag for each thread in plc_tag_wait(). */
+struct tag_waiter_t {
+    tag_waiter_p next;
+    cond_p cond;
+};
+
+/*
+ * callback dispatcher, started when the first callback is registered.  It
+ * has a queue of events to deliver and a queue of tags the IO threads
+ * signalled that need their status checked.
+ */
+typedef struct callback_event_t *callback_event_p;
+
+struct callback_event_t {
+    callback_event_p next;
+    int tag_id;
+    int event;
+    int status;
+};
 
+static thread_p callback_thread = NULL;
+static mutex_p callback_mutex = NULL;
+static cond_p callback_cond = NULL;
+static callback_event_p callback_event_head = NULL;
+static callback_event_p callback_event_tail = NULL;
+static tag_done_p callback_check_head = NULL;
+static tag_done_p callback_check_tail = NULL;
+static volatile int callback_terminate = 0;
 
 
-#define api_block(tag_id)                                              \
-for(int __sync_flag_api_block_foo_##__LINE__ = 1; __sync_flag_api_block_foo_##__LINE__ ; __sync_flag_api_block_foo_##__LINE__ = 0, api_unlock(tag_ptr_to_tag_index(tag_id)))\
-for(int __sync_rc_api_block_foo_##__LINE__ = api_lock(tag_ptr_to_tag_index(tag_id)); __sync_rc_api_block_foo_##__LINE__ == PLCTAG_STATUS_OK && __sync_flag_api_block_foo_##__LINE__ ; __sync_flag_api_block_foo_##__LINE__ = 0)
+
+/* tag is the resolved tag with its API mutex held in the body, NULL if the handle is stale. */
+#define api_block(tag_id, tag)                                         \
+for(int __sync_flag_api_block_foo_##__LINE__ = 1; __sync_flag_api_block_foo_##__LINE__ ; __sync_flag_api_block_foo_##__LINE__ = 0, (tag) = api_unlock(tag_id, tag))\
+for((tag) = api_lock(tag_id); __sync_flag_api_block_foo_##__LINE__ ; __sync_flag_api_block_foo_##__LINE__ = 0)
 
 
 
@@ -100,10 +180,7 @@ int lib_init(void)
         }
     }
 
-    /* initialize the mutex for API protection */
-    for(int i=0; i < (MAX_TAG_ENTRIES + 1); i++) {
-        rc = mutex_create((mutex_p*)&tag_api_mutex[i]);
-    }
+    /* the tag map and the API mutexes are created as tags are. */
 
     pdebug(DEBUG_INFO,"Done.");
 
@@ -114,14 +191,31 @@ void lib_teardown(void)
 {
     pdebug(DEBUG_INFO,"Tearing down library.");
 
-    /* destroy the mutex for API protection */
-    for(int i=0; i < (MAX_TAG_ENTRIES + 1); i++) {
-        mutex_destroy((mutex_p*)&tag_api_mutex[i]);
-        if(tag_map[i]) {
-            pdebug(DEBUG_WARN,"Tag %p at index %d was not destroyed!",tag_map[i],i);
+    callback_dispatcher_stop();
+
+    /* destroy the tag map and the mutexes for API protection */
+    for(int chunk_index=0; chunk_index < TAG_MAP_MAX_CHUNKS; chunk_index++) {
+        tag_map_entry_p chunk = tag_map_chunks[chunk_index];
+
+        if(!chunk) {
+            continue;
+        }
+
+        for(int i=0; i < TAG_MAP_CHUNK_SIZE; i++) {
+            if(chunk[i].tag) {
+                pdebug(DEBUG_WARN,"Tag %p at index %d was not destroyed!",chunk[i].tag,(chunk_index * TAG_MAP_CHUNK_SIZE) + i);
+            }
+
+            mutex_destroy(&chunk[i].api_mutex);
         }
+
+        mem_free(chunk);
+        tag_map_chunks[chunk_index] = NULL;
     }
 
+    tag_map_capacity = 0;
+    next_tag_id = MAX_TAG_ENTRIES;
+
     pdebug(DEBUG_INFO,"Destroying global library mutex.");
     if(global_library_mutex) {
         mutex_destroy((mutex_p*)&global_library_mutex);
@@ -187,6 +281,7 @@ LIB_EXPORT const char* plc_tag_decode_error(int rc)
         case PLCTAG_ERR_UNSUPPORTED: return "PLCTAG_ERR_UNSUPPORTED";
         case PLCTAG_ERR_WINSOCK: return "PLCTAG_ERR_WINSOCK";
         case PLCTAG_ERR_WRITE: return "PLCTAG_ERR_WRITE";
+        case PLCTAG_ERR_ABORT: return "PLCTAG_ERR_ABORT";
 
         default: return "Unknown error."; break;
     }
@@ -196,6 +291,20 @@ LIB_EXPORT const char* plc_tag_decode_error(int rc)
 
 
 
+
+/*
+ * plc_tag_get_lib_stat()
+ *
+ * Read a library wide counter by name.
+ */
+
+LIB_EXPORT int plc_tag_get_lib_stat(const char *name, int64_t *value)
+{
+    return stat_get(name, value);
+}
+
+
+
 /*
  * plc_tag_create()
  *
@@ -204,12 +313,8 @@ LIB_EXPORT const char* plc_tag_decode_error(int rc)
 
 LIB_EXPORT plc_tag plc_tag_create(const char *attrib_str)
 {
-    plc_tag_p tag = PLC_TAG_P_NULL;
-    int tag_id = PLCTAG_ERR_OUT_OF_BOUNDS;
+    plc_tag tag_id = PLC_TAG_NULL;
     attr attribs = NULL;
-    int rc = PLCTAG_STATUS_OK;
-    int read_cache_ms = 0;
-    tag_create_function tag_constructor;
 
     pdebug(DEBUG_INFO,"Starting");
 
@@ -230,6 +335,40 @@ LIB_EXPORT plc_tag plc_tag_create(const char *attrib_str)
         return PLC_TAG_NULL;
     }
 
+    tag_id = create_tag_from_attribs(attribs);
+
+    /*
+     * Release memory for attributes
+     *
+     * some code is commented out that would have kept a pointer
+     * to the attributes in the tag and released the memory upon
+     * tag destruction. To prevent a memory leak without maintaining
+     * that pointer, the memory needs to be released here.
+     */
+    attr_destroy(attribs);
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return tag_id;
+}
+
+
+
+/*
+ * create_tag_from_attribs()
+ *
+ * Everything after parsing the attribute string.  The caller owns the
+ * attributes.
+ */
+
+static plc_tag create_tag_from_attribs(attr attribs)
+{
+    plc_tag_p tag = PLC_TAG_P_NULL;
+    int tag_id = PLCTAG_ERR_OUT_OF_BOUNDS;
+    int rc = PLCTAG_STATUS_OK;
+    int read_cache_ms = 0;
+    tag_create_function tag_constructor;
+
     /* set debug level */
     set_debug_level(attr_get_int(attribs, "debug", DEBUG_NONE));
 
@@ -243,7 +382,6 @@ LIB_EXPORT plc_tag plc_tag_create(const char *attrib_str)
 
     if(!tag_constructor) {
         pdebug(DEBUG_WARN,"Tag creation failed, no tag constructor found for tag type!");
-        attr_destroy(attribs);
         return PLC_TAG_NULL;
     }
 
@@ -255,7 +393,6 @@ LIB_EXPORT plc_tag plc_tag_create(const char *attrib_str)
      */
     if(!tag) {
         pdebug(DEBUG_WARN, "Tag creation failed, skipping mutex creation and other generic setup.");
-        attr_destroy(attribs);
         return PLC_TAG_NULL;
     }
 
@@ -277,26 +414,24 @@ LIB_EXPORT plc_tag plc_tag_create(const char *attrib_str)
         pdebug(DEBUG_ERROR, "Unable to create tag mutex!");
 
         /* this is fatal! */
-        attr_destroy(attribs);
         plc_tag_destroy_mapped(tag);
+
+        return PLC_TAG_NULL;
     }
 
-    /*
-     * Release memory for attributes
-     *
-     * some code is commented out that would have kept a pointer
-     * to the attributes in the tag and released the memory upon
-     * tag destruction. To prevent a memory leak without maintaining
-     * that pointer, the memory needs to be released here.
-     */
-    attr_destroy(attribs);
+    /* the blocking calls wait on this. */
+    tag->done = tag_done_create();
+
+    if(!tag->done) {
+        pdebug(DEBUG_WARN, "Unable to create tag completion signal, blocking calls will poll.");
+    }
 
     /* map the tag to a tag ID */
     tag_id = allocate_new_tag_to_id_mapping(tag);
 
     /* if the mapping failed, then punt */
-    if(tag_id == PLCTAG_ERR_OUT_OF_BOUNDS) {
-        pdebug(DEBUG_ERROR, "Unable to map tag %p to lookup table entry, rc=%d", tag_id);
+    if(tag_id < 0) {
+        pdebug(DEBUG_ERROR, "Unable to map tag %p to lookup table entry, rc=%d", tag, tag_id);
 
         /* need to destroy the tag because we allocated memory etc. */
         plc_tag_destroy_mapped(tag);
@@ -304,6 +439,11 @@ LIB_EXPORT plc_tag plc_tag_create(const char *attrib_str)
         return PLC_TAG_NULL;
     }
 
+    /* the callback dispatcher finds the tag through this. */
+    if(tag->done) {
+        tag->done->tag_id = tag_id;
+    }
+
     pdebug(DEBUG_INFO, "Returning mapped tag %p", (plc_tag)(intptr_t)tag_id);
 
     return (plc_tag)(intptr_t)tag_id;
@@ -311,6 +451,350 @@ LIB_EXPORT plc_tag plc_tag_create(const char *attrib_str)
 
 
 
+/*
+ * plc_tag_create_many()
+ *
+ * With more than one CPU and enough tags, first the attribute strings
+ * are parsed, spread over a few threads.  Then the tags are sorted by
+ * gateway and path and the sorted list is cut into one run per thread,
+ * only between groups.  That way one thread sets up each session and
+ * connection and the others do not wait on it.  Otherwise the tags are
+ * created here in order.  Last, wait for all the tags the same way
+ * plc_tag_wait() does.
+ */
+
+struct create_many_entry_t {
+    attr attribs;
+    const char *gateway;
+    const char *path;
+    int index;
+};
+
+#define CREATE_MANY_PARSE (1)
+#define CREATE_MANY_CREATE (2)
+
+struct create_many_worker_t {
+    thread_p thread;
+    int phase;
+    const char **attrib_strs;
+    struct create_many_entry_t *entries;
+    int first;
+    int count;
+    plc_tag *tags;
+};
+
+
+/* parse the attribute strings of one slice. */
+static void create_many_parse(struct create_many_worker_t *worker)
+{
+    for(int i = worker->first; i < worker->first + worker->count; i++) {
+        struct create_many_entry_t *entry = &worker->entries[i];
+        const char *attrib_str = worker->attrib_strs[i];
+
+        entry->index = i;
+
+        if(!attrib_str || str_length(attrib_str) == 0) {
+            pdebug(DEBUG_WARN,"Tag attribute string %d is null or zero length!", i);
+            continue;
+        }
+
+        entry->attribs = attr_create_from_str(attrib_str);
+
+        if(!entry->attribs) {
+            pdebug(DEBUG_WARN,"Unable to parse attribute string %d!", i);
+            continue;
+        }
+
+        entry->gateway = attr_get_str(entry->attribs, "gateway", "");
+        entry->path = attr_get_str(entry->attribs, "path", "");
+    }
+}
+
+
+/* create the tags of one run of whole groups. */
+static void create_many_create(struct create_many_worker_t *worker)
+{
+    for(int i = worker->first; i < worker->first + worker->count; i++) {
+        struct create_many_entry_t *entry = &worker->entries[i];
+
+        if(entry->attribs) {
+            worker->tags[entry->index] = create_tag_from_attribs(entry->attribs);
+        }
+    }
+}
+
+
+static void create_many_work(struct create_many_worker_t *worker)
+{
+    if(worker->phase == CREATE_MANY_PARSE) {
+        create_many_parse(worker);
+    } else {
+        create_many_create(worker);
+    }
+}
+
+
+static THREAD_FUNC(create_many_thread_func)
+{
+    create_many_work((struct create_many_worker_t *)arg);
+
+    THREAD_RETURN(0);
+}
+
+
+/* run the workers, the calling thread takes the first one.  If a thread cannot start, do its part here. */
+static void create_many_run(struct create_many_worker_t *workers, int num_workers, int phase)
+{
+    for(int i=0; i < num_workers; i++) {
+        workers[i].phase = phase;
+    }
+
+    for(int i=1; i < num_workers; i++) {
+        if(thread_create(&workers[i].thread, create_many_thread_func, 64*1024, &workers[i]) != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to start tag creation thread, doing the work in this thread.");
+            workers[i].thread = NULL;
+        }
+    }
+
+    create_many_work(&workers[0]);
+
+    for(int i=1; i < num_workers; i++) {
+        if(workers[i].thread) {
+            thread_join(workers[i].thread);
+            thread_destroy(&workers[i].thread);
+        } else {
+            create_many_work(&workers[i]);
+        }
+    }
+}
+
+
+static int create_many_compare(const void *first_arg, const void *second_arg)
+{
+    const struct create_many_entry_t *first = (const struct create_many_entry_t *)first_arg;
+    const struct create_many_entry_t *second = (const struct create_many_entry_t *)second_arg;
+    int rc;
+
+    /* entries that did not parse go at the end. */
+    if(!first->attribs || !second->attribs) {
+        if(first->attribs) {
+            return -1;
+        }
+
+        if(second->attribs) {
+            return 1;
+        }
+
+        return first->index - second->index;
+    }
+
+    rc = str_cmp(first->gateway, second->gateway);
+
+    if(rc == 0) {
+        rc = str_cmp(first->path, second->path);
+    }
+
+    /* keep the caller's order within a group. */
+    if(rc == 0) {
+        rc = first->index - second->index;
+    }
+
+    return rc;
+}
+
+
+/* one thread, no grouping to do.  Creating each tag as it is parsed starts each session as early as possible. */
+static void create_many_inline(const char **attrib_strs, int num_tags, plc_tag *tags)
+{
+    for(int i=0; i < num_tags; i++) {
+        attr attribs;
+
+        if(!attrib_strs[i] || str_length(attrib_strs[i]) == 0) {
+            pdebug(DEBUG_WARN,"Tag attribute string %d is null or zero length!", i);
+            continue;
+        }
+
+        attribs = attr_create_from_str(attrib_strs[i]);
+
+        if(!attribs) {
+            pdebug(DEBUG_WARN,"Unable to parse attribute string %d!", i);
+            continue;
+        }
+
+        tags[i] = create_tag_from_attribs(attribs);
+
+        attr_destroy(attribs);
+    }
+}
+
+
+static int create_many_threaded(const char **attrib_strs, int num_tags, plc_tag *tags, int num_workers)
+{
+    struct create_many_entry_t *entries = NULL;
+    struct create_many_worker_t workers[CREATE_MANY_MAX_THREADS];
+    int per_worker;
+    int start;
+
+    entries = (struct create_many_entry_t *)mem_alloc(num_tags * (int)sizeof(struct create_many_entry_t));
+
+    if(!entries) {
+        pdebug(DEBUG_ERROR, "Unable to allocate tag creation entries!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    per_worker = (num_tags + num_workers - 1) / num_workers;
+
+    mem_set(workers, 0, (int)sizeof(workers));
+
+    for(int i=0; i < num_workers; i++) {
+        workers[i].attrib_strs = attrib_strs;
+        workers[i].entries = entries;
+        workers[i].tags = tags;
+    }
+
+    /* parse in even slices. */
+    start = 0;
+
+    for(int i=0; i < num_workers; i++) {
+        workers[i].first = start;
+        workers[i].count = (num_tags - start < per_worker ? num_tags - start : per_worker);
+        start += workers[i].count;
+    }
+
+    create_many_run(workers, num_workers, CREATE_MANY_PARSE);
+
+    /* group by gateway and path, then only cut the list between groups. */
+    qsort(entries, (size_t)num_tags, sizeof(struct create_many_entry_t), create_many_compare);
+
+    start = 0;
+
+    for(int i=0; i < num_workers; i++) {
+        int end = start + per_worker;
+
+        if(end >= num_tags || i == num_workers - 1) {
+            end = num_tags;
+        } else {
+            while(end < num_tags && entries[end].attribs && entries[end - 1].attribs
+                    && str_cmp(entries[end].gateway, entries[end - 1].gateway) == 0
+                    && str_cmp(entries[end].path, entries[end - 1].path) == 0) {
+                end++;
+            }
+        }
+
+        workers[i].first = start;
+        workers[i].count = end - start;
+        start = end;
+    }
+
+    create_many_run(workers, num_workers, CREATE_MANY_CREATE);
+
+    for(int i=0; i < num_tags; i++) {
+        if(entries[i].attribs) {
+            attr_destroy(entries[i].attribs);
+        }
+    }
+
+    mem_free(entries);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+LIB_EXPORT int plc_tag_create_many(const char **attrib_strs, int num_tags, plc_tag *tags, int timeout)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int num_workers;
+    int num_created = 0;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(!attrib_strs || !tags || num_tags <= 0 || timeout < 0) {
+        pdebug(DEBUG_WARN, "Bad attribute string array, tag array, tag count or timeout!");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    for(int i=0; i < num_tags; i++) {
+        tags[i] = PLC_TAG_NULL;
+    }
+
+    if(initialize_modules() != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR,"Unable to initialize the internal library state!");
+        return PLCTAG_ERR_CREATE;
+    }
+
+    /* extra threads only help with enough tags and enough CPUs. */
+    num_workers = (num_tags + CREATE_MANY_MIN_TAGS_PER_THREAD - 1) / CREATE_MANY_MIN_TAGS_PER_THREAD;
+
+    if(num_workers > CREATE_MANY_MAX_THREADS) {
+        num_workers = CREATE_MANY_MAX_THREADS;
+    }
+
+    if(num_workers > cpu_count()) {
+        num_workers = cpu_count();
+    }
+
+    /* grow the map once up front rather than every few hundred tags. */
+    if((rc = tag_map_reserve(num_tags)) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to make room in the tag map, error %s!", plc_tag_decode_error(rc));
+        return rc;
+    }
+
+    if(num_workers > 1) {
+        if((rc = create_many_threaded(attrib_strs, num_tags, tags, num_workers)) != PLCTAG_STATUS_OK) {
+            return rc;
+        }
+    } else {
+        create_many_inline(attrib_strs, num_tags, tags);
+    }
+
+    /* wait for the ones that were created, then collect the results. */
+    for(int i=0; i < num_tags; i++) {
+        if(tags[i]) {
+            num_created++;
+        }
+    }
+
+    if(num_created > 0) {
+        plc_tag *created = (plc_tag *)mem_alloc(num_created * (int)sizeof(plc_tag));
+
+        if(created) {
+            num_created = 0;
+
+            for(int i=0; i < num_tags; i++) {
+                if(tags[i]) {
+                    created[num_created++] = tags[i];
+                }
+            }
+
+            rc = plc_tag_wait(created, num_created, PLCTAG_WAIT_ALL, timeout, NULL);
+
+            mem_free(created);
+
+            if(rc != PLCTAG_STATUS_OK) {
+                pdebug(DEBUG_WARN, "Not all tags are set up yet, rc=%d.", rc);
+                return rc;
+            }
+        } else {
+            /* the tags are created, the caller gets their status and can wait on them. */
+            pdebug(DEBUG_ERROR, "Unable to allocate wait array, not waiting for the tags!");
+        }
+    }
+
+    for(int i=0; i < num_tags && rc == PLCTAG_STATUS_OK; i++) {
+        if(!tags[i]) {
+            rc = PLCTAG_ERR_CREATE;
+        } else {
+            rc = plc_tag_status(tags[i]);
+        }
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return rc;
+}
+
+
+
 /*
  * plc_tag_lock
  *
@@ -331,8 +815,7 @@ LIB_EXPORT int plc_tag_lock(plc_tag tag_id)
 
     pdebug(DEBUG_INFO, "Starting.");
 
-    api_block(tag_id) {
-        tag = map_id_to_tag(tag_id);
+    api_block(tag_id, tag) {
         if(!tag) {
             pdebug(DEBUG_WARN,"Tag not found.");
             rc = PLCTAG_ERR_NOT_FOUND;
@@ -363,8 +846,7 @@ LIB_EXPORT int plc_tag_unlock(plc_tag tag_id)
 
     pdebug(DEBUG_INFO, "Starting.");
 
-    api_block(tag_id) {
-        tag = map_id_to_tag(tag_id);
+    api_block(tag_id, tag) {
         if(!tag) {
             pdebug(DEBUG_WARN,"Tag not found.");
             rc = PLCTAG_ERR_NOT_FOUND;
@@ -409,6 +891,12 @@ int plc_tag_abort_mapped(plc_tag_p tag)
     /* this may be synchronous. */
     rc = tag->vtable->abort(tag);
 
+    /* let the callback know the operation it was waiting on is gone. */
+    if(tag->pending_op != TAG_OP_NONE) {
+        tag->pending_op = TAG_OP_NONE;
+        callback_event_queue(tag->tag_id, PLCTAG_EVENT_ABORTED, PLCTAG_ERR_ABORT);
+    }
+
     pdebug(DEBUG_INFO, "Done.");
 
     return rc;
@@ -422,8 +910,7 @@ LIB_EXPORT int plc_tag_abort(plc_tag tag_id)
 
     pdebug(DEBUG_INFO, "Starting.");
 
-    api_block(tag_id) {
-        tag = map_id_to_tag(tag_id);
+    api_block(tag_id, tag) {
         if(!tag) {
             pdebug(DEBUG_WARN,"Tag not found.");
             rc = PLCTAG_ERR_NOT_FOUND;
@@ -484,6 +971,11 @@ int plc_tag_destroy_mapped(plc_tag_p tag)
     /* destroy the tag's mutex */
     mutex_destroy(&tag->mut);
 
+    /* requests still in flight may hold on to this a little longer. */
+    if(tag->done) {
+        tag->done = rc_dec(tag->done);
+    }
+
     /* abort anything in flight */
     rc = plc_tag_abort_mapped(tag);
 
@@ -513,8 +1005,7 @@ LIB_EXPORT int plc_tag_destroy(plc_tag tag_id)
 
     pdebug(DEBUG_INFO, "Starting.");
 
-    api_block(tag_id) {
-        tag = map_id_to_tag(tag_id);
+    api_block(tag_id, tag) {
         if(!tag) {
             pdebug(DEBUG_WARN,"Tag not found.");
             rc = PLCTAG_ERR_NOT_FOUND;
@@ -532,58 +1023,77 @@ LIB_EXPORT int plc_tag_destroy(plc_tag tag_id)
 
 
 /*
- * plc_tag_read()
- *
- * This function calls through the vtable in the passed tag to call
- * the protocol-specific implementation.  That starts the read operation.
- * If there is a timeout passed, then this routine waits for either
- * a timeout or an error.
- *
- * The status of the operation is returned.
+ * Start a read without waiting for it.  The protocol implementation does
+ * not do the timeout.  Cached data counts as an immediate completion.
  */
 
-LIB_EXPORT int plc_tag_read(plc_tag tag_id, int timeout)
+static int plc_tag_read_start_mapped(plc_tag_p tag)
 {
     int rc = PLCTAG_STATUS_OK;
-    plc_tag_p tag = NULL;
+
+    /* check for null parts */
+    if(!tag->vtable || !tag->vtable->read) {
+        pdebug(DEBUG_WARN, "Tag does not have a read function!");
+        return PLCTAG_ERR_NOT_IMPLEMENTED;
+    }
+
+    /* check read cache, if not expired, return existing data. */
+    if(tag->read_cache_expire > time_ms()) {
+        pdebug(DEBUG_INFO, "Returning cached data.");
+        tag_callback_op_started(tag, TAG_OP_READ, PLCTAG_STATUS_OK);
+        return PLCTAG_STATUS_OK;
+    }
+
+    rc = tag->vtable->read(tag);
+
+    tag_callback_op_started(tag, TAG_OP_READ, rc);
+
+    if(rc != PLCTAG_STATUS_PENDING && rc != PLCTAG_STATUS_OK) {
+        return rc;
+    }
+
+    /* set up the cache time */
+    if(tag->read_cache_ms) {
+        tag->read_cache_expire = time_ms() + tag->read_cache_ms;
+    }
+
+    return rc;
+}
+
+
+
+/*
+ * plc_tag_read()
+ *
+ * This function calls through the vtable in the passed tag to call
+ * the protocol-specific implementation.  That starts the read operation.
+ * If there is a timeout passed, then this routine waits for either
+ * a timeout or an error.
+ *
+ * The status of the operation is returned.
+ */
+
+LIB_EXPORT int plc_tag_read(plc_tag tag_id, int timeout)
+{
+    int rc = PLCTAG_STATUS_OK;
+    plc_tag_p tag = NULL;
 
     pdebug(DEBUG_INFO, "Starting.");
 
-    api_block(tag_id) {
-        tag = map_id_to_tag(tag_id);
+    api_block(tag_id, tag) {
         if(!tag) {
             pdebug(DEBUG_WARN,"Tag not found.");
             rc = PLCTAG_ERR_NOT_FOUND;
             break;
         }
 
-        /* check for null parts */
-        if(!tag->vtable || !tag->vtable->read) {
-            pdebug(DEBUG_WARN, "Tag does not have a read function!");
-            rc = PLCTAG_ERR_NOT_IMPLEMENTED;
-            break;
-        }
-
-        /* check read cache, if not expired, return existing data. */
-        if(tag->read_cache_expire > time_ms()) {
-            pdebug(DEBUG_INFO, "Returning cached data.");
-            rc = PLCTAG_STATUS_OK;
-            break;
-        }
-
-        /* the protocol implementation does not do the timeout. */
-        rc = tag->vtable->read(tag);
+        rc = plc_tag_read_start_mapped(tag);
 
         /* if error, return now */
         if(rc != PLCTAG_STATUS_PENDING && rc != PLCTAG_STATUS_OK) {
             break;
         }
 
-        /* set up the cache time */
-        if(tag->read_cache_ms) {
-            tag->read_cache_expire = time_ms() + tag->read_cache_ms;
-        }
-
         /*
          * if there is a timeout, then loop until we get
          * an error or we timeout.
@@ -603,7 +1113,7 @@ LIB_EXPORT int plc_tag_read(plc_tag tag_id, int timeout)
                     break;
                 }
 
-                sleep_ms(5); /* MAGIC */
+                tag_done_wait(tag->done, timeout_time);
             }
 
             /*
@@ -644,6 +1154,8 @@ LIB_EXPORT int plc_tag_read(plc_tag tag_id, int timeout)
 
 int plc_tag_status_mapped(plc_tag_p tag)
 {
+    int rc = PLCTAG_STATUS_OK;
+
     /* pdebug(DEBUG_DETAIL, "Starting."); */
     if(!tag) {
         pdebug(DEBUG_ERROR,"Null tag passed!");
@@ -655,7 +1167,14 @@ int plc_tag_status_mapped(plc_tag_p tag)
         return PLCTAG_ERR_NOT_IMPLEMENTED;
     }
 
-    return tag->vtable->status(tag);
+    rc = tag->vtable->status(tag);
+
+    /* whoever sees the operation finish tells the callback. */
+    if(tag->pending_op != TAG_OP_NONE && rc != PLCTAG_STATUS_PENDING) {
+        tag_callback_op_done(tag, rc);
+    }
+
+    return rc;
 }
 
 
@@ -667,8 +1186,7 @@ LIB_EXPORT int plc_tag_status(plc_tag tag_id)
 
     pdebug(DEBUG_SPEW, "Starting.");
 
-    api_block(tag_id) {
-        tag = map_id_to_tag(tag_id);
+    api_block(tag_id, tag) {
         if(!tag) {
             pdebug(DEBUG_WARN,"Tag not found.");
             rc = PLCTAG_ERR_NOT_FOUND;
@@ -689,6 +1207,30 @@ LIB_EXPORT int plc_tag_status(plc_tag tag_id)
 
 
 
+/*
+ * Start a write without waiting for it.  The protocol implementation does
+ * not do the timeout.
+ */
+
+static int plc_tag_write_start_mapped(plc_tag_p tag)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    /* check for null parts */
+    if(!tag->vtable || !tag->vtable->write) {
+        pdebug(DEBUG_WARN, "Tag does not have a write function!");
+        return PLCTAG_ERR_NOT_IMPLEMENTED;
+    }
+
+    rc = tag->vtable->write(tag);
+
+    tag_callback_op_started(tag, TAG_OP_WRITE, rc);
+
+    return rc;
+}
+
+
+
 /*
  * plc_tag_write()
  *
@@ -707,23 +1249,14 @@ LIB_EXPORT int plc_tag_write(plc_tag tag_id, int timeout)
 
     pdebug(DEBUG_INFO, "Starting.");
 
-    api_block(tag_id) {
-        tag = map_id_to_tag(tag_id);
+    api_block(tag_id, tag) {
         if(!tag) {
             pdebug(DEBUG_WARN,"Tag not found.");
             rc = PLCTAG_ERR_NOT_FOUND;
             break;
         }
 
-        /* check for null parts */
-        if(!tag->vtable || !tag->vtable->write) {
-            pdebug(DEBUG_WARN, "Tag does not have a write function!");
-            rc = PLCTAG_ERR_NOT_IMPLEMENTED;
-            break;
-        }
-
-        /* the protocol implementation does not do the timeout. */
-        rc = tag->vtable->write(tag);
+        rc = plc_tag_write_start_mapped(tag);
 
         /* if error, return now */
         if(rc != PLCTAG_STATUS_PENDING && rc != PLCTAG_STATUS_OK) {
@@ -750,7 +1283,7 @@ LIB_EXPORT int plc_tag_write(plc_tag tag_id, int timeout)
                     break;
                 }
 
-                sleep_ms(5); /* MAGIC */
+                tag_done_wait(tag->done, timeout_time);
             }
 
             /*
@@ -779,238 +1312,414 @@ LIB_EXPORT int plc_tag_write(plc_tag tag_id, int timeout)
 
 
 /*
- * Tag data accessors.
+ * plc_tag_read_many()/plc_tag_write_many()
+ *
+ * Start the operation on every tag first, then wait for all of them
+ * against one deadline.  Each tag is only locked long enough to start it
+ * or check it, never while waiting, so other threads and the callback
+ * dispatcher are not held up.
+ *
+ * The per-tag results go in statuses, if it is not NULL.  The return value
+ * is PLCTAG_STATUS_OK if every tag succeeded, PLCTAG_STATUS_PENDING if the
+ * timeout is zero and something is still in flight, otherwise the first error.
  */
 
-
-
-LIB_EXPORT int plc_tag_get_size(plc_tag tag_id)
+static int plc_tag_op_many(plc_tag *tags, int num_tags, int timeout, int *statuses, int op)
 {
-    int result = 0;
+    int rc = PLCTAG_STATUS_OK;
     plc_tag_p tag = NULL;
+    int num_pending = 0;
+    int *results = statuses;
+    int64_t timeout_time = time_ms() + timeout;
 
-    pdebug(DEBUG_SPEW, "Starting.");
-
-    api_block(tag_id) {
-        tag = map_id_to_tag(tag_id);
-        if(!tag) {
-            pdebug(DEBUG_WARN,"Tag not found.");
-            result = PLCTAG_ERR_NOT_FOUND;
-            break;
-        }
+    pdebug(DEBUG_INFO, "Starting.");
 
-        result = tag->size;
+    if(!tags || num_tags <= 0 || timeout < 0) {
+        pdebug(DEBUG_WARN, "Bad tag array, tag count or timeout!");
+        return PLCTAG_ERR_BAD_PARAM;
     }
 
-    pdebug(DEBUG_SPEW, "Done.");
-
-    return result;
-}
-
-
+    /* we need somewhere to keep track of which tags are done. */
+    if(!results) {
+        results = (int *)mem_alloc(num_tags * (int)sizeof(int));
 
+        if(!results) {
+            pdebug(DEBUG_ERROR, "Unable to allocate status array!");
+            return PLCTAG_ERR_NO_MEM;
+        }
+    }
 
-LIB_EXPORT uint32_t plc_tag_get_uint32(plc_tag tag_id, int offset)
-{
-    uint32_t res = UINT32_MAX;
-    int rc = PLCTAG_STATUS_OK;
-    plc_tag_p tag = NULL;
+    /* start everything. */
+    for(int i=0; i < num_tags; i++) {
+        results[i] = PLCTAG_ERR_NOT_FOUND;
 
-    pdebug(DEBUG_SPEW, "Starting.");
+        api_block(tags[i], tag) {
+            if(!tag) {
+                pdebug(DEBUG_WARN,"Tag not found.");
+                break;
+            }
 
-    api_block(tag_id) {
-        tag = map_id_to_tag(tag_id);
-        if(!tag) {
-            pdebug(DEBUG_WARN,"Tag not found.");
-            break;
+            if(op == TAG_OP_READ) {
+                results[i] = plc_tag_read_start_mapped(tag);
+            } else {
+                results[i] = plc_tag_write_start_mapped(tag);
+            }
         }
 
-        /* is the tag ready for this operation? */
-        rc = plc_tag_status_mapped(tag);
-        if(rc != PLCTAG_STATUS_OK && rc != PLCTAG_ERR_OUT_OF_BOUNDS) {
-            pdebug(DEBUG_WARN,"Tag not in good state!");
-            break;
+        if(results[i] == PLCTAG_STATUS_PENDING) {
+            num_pending++;
         }
+    }
 
-        /* is there data? */
-        if(!tag->data) {
-            pdebug(DEBUG_WARN,"Tag has no data!");
-            break;
-        }
+    /* wait for everything with one deadline. */
+    while(timeout && num_pending > 0) {
+        tag_done_p done = NULL;
 
-        /* is there enough data */
-        if((offset < 0) || (offset + ((int)sizeof(uint32_t)) > tag->size)) {
-            pdebug(DEBUG_WARN,"Data offset out of bounds.");
-            break;
-        }
+        num_pending = 0;
 
-        res = ((uint32_t)(tag->data[offset])) +
-              ((uint32_t)(tag->data[offset+1]) << 8) +
-              ((uint32_t)(tag->data[offset+2]) << 16) +
-              ((uint32_t)(tag->data[offset+3]) << 24);
-    }
+        for(int i=0; i < num_tags; i++) {
+            if(results[i] != PLCTAG_STATUS_PENDING) {
+                continue;
+            }
 
-    return res;
-}
+            api_block(tags[i], tag) {
+                if(!tag) {
+                    results[i] = PLCTAG_ERR_NOT_FOUND;
+                    break;
+                }
 
+                results[i] = plc_tag_status_mapped(tag);
 
+                if(results[i] != PLCTAG_STATUS_PENDING) {
+                    break;
+                }
 
-LIB_EXPORT int plc_tag_set_uint32(plc_tag tag_id, int offset, uint32_t val)
-{
-    int rc = PLCTAG_STATUS_OK;
-    plc_tag_p tag = NULL;
+                num_pending++;
 
-    pdebug(DEBUG_SPEW, "Starting.");
+                /* responses mostly come back in order, so wait on the last one. */
+                if(tag->done) {
+                    if(done) {
+                        rc_dec(done);
+                    }
 
-    api_block(tag_id) {
-        tag = map_id_to_tag(tag_id);
-        if(!tag) {
-            pdebug(DEBUG_WARN,"Tag not found.");
-            break;
+                    done = rc_inc(tag->done);
+                }
+            }
         }
 
-        /* is the tag ready for this operation? */
-        rc = plc_tag_status_mapped(tag);
-        if(rc != PLCTAG_STATUS_OK && rc != PLCTAG_ERR_OUT_OF_BOUNDS) {
-            pdebug(DEBUG_WARN,"Tag not in good state!");
+        if(num_pending == 0) {
             break;
         }
 
-        /* is there data? */
-        if(!tag->data) {
-            pdebug(DEBUG_WARN,"Tag has no data!");
-            rc = PLCTAG_ERR_NO_DATA;
-            break;
+        if(timeout_time <= time_ms()) {
+            pdebug(DEBUG_WARN, "Timed out waiting for %d tags.", num_pending);
+
+            for(int i=0; i < num_tags; i++) {
+                if(results[i] != PLCTAG_STATUS_PENDING) {
+                    continue;
+                }
+
+                api_block(tags[i], tag) {
+                    if(tag) {
+                        plc_tag_abort_mapped(tag);
+                    }
+                }
+
+                results[i] = PLCTAG_ERR_TIMEOUT;
+            }
+
+            num_pending = 0;
+        } else {
+            tag_done_wait(done, timeout_time);
         }
 
-        /* is there enough data */
-        if((offset < 0) || (offset + ((int)sizeof(uint32_t)) > tag->size)) {
-            pdebug(DEBUG_WARN,"Data offset out of bounds.");
-            rc = PLCTAG_ERR_OUT_OF_BOUNDS;
+        if(done) {
+            rc_dec(done);
+        }
+    }
+
+    /* pick the overall result. */
+    for(int i=0; i < num_tags; i++) {
+        if(results[i] == PLCTAG_STATUS_PENDING) {
+            rc = PLCTAG_STATUS_PENDING;
+        } else if(results[i] != PLCTAG_STATUS_OK) {
+            rc = results[i];
             break;
         }
+    }
 
-        /* write the data. */
-        tag->data[offset]   = (uint8_t)(val & 0xFF);
-        tag->data[offset+1] = (uint8_t)((val >> 8) & 0xFF);
-        tag->data[offset+2] = (uint8_t)((val >> 16) & 0xFF);
-        tag->data[offset+3] = (uint8_t)((val >> 24) & 0xFF);
+    if(results != statuses) {
+        mem_free(results);
     }
 
+    pdebug(DEBUG_INFO, "Done.");
+
     return rc;
 }
 
 
+LIB_EXPORT int plc_tag_read_many(plc_tag *tags, int num_tags, int timeout, int *statuses)
+{
+    return plc_tag_op_many(tags, num_tags, timeout, statuses, TAG_OP_READ);
+}
 
 
-LIB_EXPORT int32_t  plc_tag_get_int32(plc_tag tag_id, int offset)
+LIB_EXPORT int plc_tag_write_many(plc_tag *tags, int num_tags, int timeout, int *statuses)
 {
-    int32_t res = INT32_MIN;
-    int rc = PLCTAG_STATUS_OK;
-    plc_tag_p tag = NULL;
+    return plc_tag_op_many(tags, num_tags, timeout, statuses, TAG_OP_WRITE);
+}
 
-    pdebug(DEBUG_SPEW, "Starting.");
 
-    api_block(tag_id) {
-        tag = map_id_to_tag(tag_id);
-        if(!tag) {
-            pdebug(DEBUG_WARN,"Tag not found.");
-            break;
-        }
 
-        /* is the tag ready for this operation? */
-        rc = plc_tag_status_mapped(tag);
-        if(rc != PLCTAG_STATUS_OK && rc != PLCTAG_ERR_OUT_OF_BOUNDS) {
-            pdebug(DEBUG_WARN,"Tag not in good state!");
-            break;
-        }
 
-        /* is there data? */
-        if(!tag->data) {
-            pdebug(DEBUG_WARN,"Tag has no data!");
-            break;
-        }
 
-        /* is there enough data */
-        if((offset < 0) || (offset + ((int)sizeof(int32_t)) > tag->size)) {
-            pdebug(DEBUG_WARN,"Data offset out of bounds.");
-            break;
-        }
+/*
+ * plc_tag_wait()
+ *
+ * All the tags share one wait object.  Each tag remembers how many times
+ * it was signalled, so after a wake up only the tags that had IO finish
+ * are checked again.  Not everything that changes a tag status signals,
+ * so every tag is checked again at least every TAG_DONE_MAX_WAIT_MS.
+ */
 
-        res = (int32_t)(((uint32_t)(tag->data[offset])) +
-                        ((uint32_t)(tag->data[offset+1]) << 8) +
-                        ((uint32_t)(tag->data[offset+2]) << 16) +
-                        ((uint32_t)(tag->data[offset+3]) << 24));
+struct tag_wait_entry_t {
+    struct tag_waiter_t waiter;
+    tag_done_p done;
+    int generation;
+    int status;
+};
+
+
+static int tag_wait_check(plc_tag tag_id)
+{
+    int rc = PLCTAG_ERR_NOT_FOUND;
+    plc_tag_p tag = NULL;
+
+    api_block(tag_id, tag) {
+        if(tag) {
+            rc = plc_tag_status_mapped(tag);
+        }
     }
 
-    return res;
+    return rc;
 }
 
 
-
-LIB_EXPORT int plc_tag_set_int32(plc_tag tag_id, int offset, int32_t ival)
+LIB_EXPORT int plc_tag_wait(plc_tag *tags, int num_tags, int mode, int timeout, int *ready_index)
 {
-    uint32_t val = (uint32_t)(ival);
     int rc = PLCTAG_STATUS_OK;
-    plc_tag_p tag = NULL;
+    struct tag_wait_entry_t *entries = NULL;
+    cond_p wait_cond = NULL;
+    int64_t timeout_time = time_ms() + timeout;
+    int check_all = 1;
 
     pdebug(DEBUG_SPEW, "Starting.");
 
-    api_block(tag_id) {
-        tag = map_id_to_tag(tag_id);
-        if(!tag) {
-            pdebug(DEBUG_WARN,"Tag not found.");
-            break;
-        }
-
-        /* is the tag ready for this operation? */
-        rc = plc_tag_status_mapped(tag);
-        if(rc != PLCTAG_STATUS_OK && rc != PLCTAG_ERR_OUT_OF_BOUNDS) {
-            pdebug(DEBUG_WARN,"Tag not in good state!");
-            break;
-        }
+    if(ready_index) {
+        *ready_index = -1;
+    }
 
-        /* is there data? */
-        if(!tag->data) {
-            pdebug(DEBUG_WARN,"Tag has no data!");
-            rc = PLCTAG_ERR_NO_DATA;
-            break;
-        }
+    if(!tags || num_tags <= 0 || timeout < 0 || (mode != PLCTAG_WAIT_ANY && mode != PLCTAG_WAIT_ALL)) {
+        pdebug(DEBUG_WARN, "Bad tag array, tag count, mode or timeout!");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
 
-        /* is there enough data */
-        if((offset < 0) || (offset + ((int)sizeof(int32_t)) > tag->size)) {
-            pdebug(DEBUG_WARN,"Data offset out of bounds.");
-            rc = PLCTAG_ERR_OUT_OF_BOUNDS;
-            break;
-        }
+    entries = (struct tag_wait_entry_t *)mem_alloc(num_tags * (int)sizeof(struct tag_wait_entry_t));
 
-        tag->data[offset]   = (uint8_t)(val & 0xFF);
-        tag->data[offset+1] = (uint8_t)((val >> 8) & 0xFF);
-        tag->data[offset+2] = (uint8_t)((val >> 16) & 0xFF);
-        tag->data[offset+3] = (uint8_t)((val >> 24) & 0xFF);
+    if(!entries) {
+        pdebug(DEBUG_ERROR, "Unable to allocate wait entries!");
+        return PLCTAG_ERR_NO_MEM;
     }
 
-    return rc;
-}
+    rc = cond_create(&wait_cond);
 
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to create wait signal!");
+        mem_free(entries);
+        return rc;
+    }
 
+    /*
+     * hook on to every tag before looking at any status so no signal is missed.
+     * This does not take the API mutex, so a blocking call on one of the tags
+     * in another thread does not hold this up.
+     */
+    for(int i=0; i < num_tags; i++) {
+        entries[i].waiter.cond = wait_cond;
+        entries[i].status = PLCTAG_STATUS_PENDING;
+        entries[i].done = tag_done_lookup(tags[i]);
 
+        if(entries[i].done) {
+            tag_done_add_waiter(entries[i].done, &entries[i].waiter);
+        }
+    }
 
+    while(1) {
+        int num_ready = 0;
+        int first_ready = -1;
+        int64_t remaining;
 
+        for(int i=0; i < num_tags; i++) {
+            struct tag_wait_entry_t *entry = &entries[i];
 
+            if(entry->status == PLCTAG_STATUS_PENDING) {
+                /* read the count first, a signal after this means look again. */
+                int generation = (entry->done ? entry->done->generation : 0);
 
+                if(check_all || !entry->done || generation != entry->generation) {
+                    entry->generation = generation;
+                    entry->status = tag_wait_check(tags[i]);
+                }
+            }
 
+            if(entry->status != PLCTAG_STATUS_PENDING) {
+                num_ready++;
 
-LIB_EXPORT uint16_t plc_tag_get_uint16(plc_tag tag_id, int offset)
+                if(first_ready < 0) {
+                    first_ready = i;
+                }
+            }
+        }
+
+        if((mode == PLCTAG_WAIT_ANY && num_ready > 0) || num_ready == num_tags) {
+            if(mode == PLCTAG_WAIT_ANY && ready_index) {
+                *ready_index = first_ready;
+            }
+
+            rc = PLCTAG_STATUS_OK;
+            break;
+        }
+
+        if(!timeout) {
+            rc = PLCTAG_STATUS_PENDING;
+            break;
+        }
+
+        remaining = timeout_time - time_ms();
+
+        if(remaining <= 0) {
+            rc = PLCTAG_ERR_TIMEOUT;
+            break;
+        }
+
+        if(remaining > TAG_DONE_MAX_WAIT_MS) {
+            remaining = TAG_DONE_MAX_WAIT_MS;
+        }
+
+        /* if nothing signalled, look at every tag next time around. */
+        check_all = (cond_wait(wait_cond, (int)remaining) != PLCTAG_STATUS_OK);
+    }
+
+    for(int i=0; i < num_tags; i++) {
+        if(entries[i].done) {
+            tag_done_remove_waiter(entries[i].done, &entries[i].waiter);
+            rc_dec(entries[i].done);
+        }
+    }
+
+    cond_destroy(&wait_cond);
+    mem_free(entries);
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return rc;
+}
+
+
+
+
+
+/*
+ * plc_tag_register_callback()
+ *
+ * Set or clear the completion callback for the tag.  The dispatcher
+ * thread is started the first time any tag gets a callback.
+ */
+
+LIB_EXPORT int plc_tag_register_callback(plc_tag tag_id, plc_tag_callback_func callback, void *userdata)
 {
-    uint16_t res = UINT16_MAX;
+    int rc = PLCTAG_STATUS_OK;
+    plc_tag_p tag = NULL;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(callback) {
+        rc = callback_dispatcher_start();
+
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_ERROR, "Unable to start callback dispatcher!");
+            return rc;
+        }
+    }
+
+    api_block(tag_id, tag) {
+        if(!tag) {
+            pdebug(DEBUG_WARN,"Tag not found.");
+            rc = PLCTAG_ERR_NOT_FOUND;
+            break;
+        }
+
+        if(!tag->done) {
+            pdebug(DEBUG_WARN, "Tag has no completion signal, callbacks are not possible.");
+            rc = PLCTAG_ERR_UNSUPPORTED;
+            break;
+        }
+
+        tag->callback = callback;
+        tag->userdata = userdata;
+        tag->pending_op = TAG_OP_NONE;
+        tag->done->callback_enabled = (callback ? 1 : 0);
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return rc;
+}
+
+
+
+
+
+/*
+ * Tag data accessors.
+ */
+
+
+
+LIB_EXPORT int plc_tag_get_size(plc_tag tag_id)
+{
+    int result = 0;
+    plc_tag_p tag = NULL;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    api_block(tag_id, tag) {
+        if(!tag) {
+            pdebug(DEBUG_WARN,"Tag not found.");
+            result = PLCTAG_ERR_NOT_FOUND;
+            break;
+        }
+
+        result = tag->size;
+    }
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return result;
+}
+
+
+
+
+LIB_EXPORT uint32_t plc_tag_get_uint32(plc_tag tag_id, int offset)
+{
+    uint32_t res = UINT32_MAX;
     int rc = PLCTAG_STATUS_OK;
     plc_tag_p tag = NULL;
 
     pdebug(DEBUG_SPEW, "Starting.");
 
-    api_block(tag_id) {
-        tag = map_id_to_tag(tag_id);
+    api_block(tag_id, tag) {
         if(!tag) {
             pdebug(DEBUG_WARN,"Tag not found.");
             break;
@@ -1030,13 +1739,15 @@ LIB_EXPORT uint16_t plc_tag_get_uint16(plc_tag tag_id, int offset)
         }
 
         /* is there enough data */
-        if((offset < 0) || (offset + ((int)sizeof(uint16_t)) > tag->size)) {
+        if((offset < 0) || (offset + ((int)sizeof(uint32_t)) > tag->size)) {
             pdebug(DEBUG_WARN,"Data offset out of bounds.");
             break;
         }
 
-        res = ((uint16_t)(tag->data[offset])) +
-              ((uint16_t)(tag->data[offset+1]) << 8);
+        res = ((uint32_t)(tag->data[offset])) +
+              ((uint32_t)(tag->data[offset+1]) << 8) +
+              ((uint32_t)(tag->data[offset+2]) << 16) +
+              ((uint32_t)(tag->data[offset+3]) << 24);
     }
 
     return res;
@@ -1044,16 +1755,14 @@ LIB_EXPORT uint16_t plc_tag_get_uint16(plc_tag tag_id, int offset)
 
 
 
-
-LIB_EXPORT int plc_tag_set_uint16(plc_tag tag_id, int offset, uint16_t val)
+LIB_EXPORT int plc_tag_set_uint32(plc_tag tag_id, int offset, uint32_t val)
 {
     int rc = PLCTAG_STATUS_OK;
     plc_tag_p tag = NULL;
 
     pdebug(DEBUG_SPEW, "Starting.");
 
-    api_block(tag_id) {
-        tag = map_id_to_tag(tag_id);
+    api_block(tag_id, tag) {
         if(!tag) {
             pdebug(DEBUG_WARN,"Tag not found.");
             break;
@@ -1074,14 +1783,17 @@ LIB_EXPORT int plc_tag_set_uint16(plc_tag tag_id, int offset, uint16_t val)
         }
 
         /* is there enough data */
-        if((offset < 0) || (offset + ((int)sizeof(uint16_t)) > tag->size)) {
+        if((offset < 0) || (offset + ((int)sizeof(uint32_t)) > tag->size)) {
             pdebug(DEBUG_WARN,"Data offset out of bounds.");
             rc = PLCTAG_ERR_OUT_OF_BOUNDS;
             break;
         }
 
+        /* write the data. */
         tag->data[offset]   = (uint8_t)(val & 0xFF);
         tag->data[offset+1] = (uint8_t)((val >> 8) & 0xFF);
+        tag->data[offset+2] = (uint8_t)((val >> 16) & 0xFF);
+        tag->data[offset+3] = (uint8_t)((val >> 24) & 0xFF);
     }
 
     return rc;
@@ -1090,21 +1802,15 @@ LIB_EXPORT int plc_tag_set_uint16(plc_tag tag_id, int offset, uint16_t val)
 
 
 
-
-
-
-
-
-LIB_EXPORT int16_t  plc_tag_get_int16(plc_tag tag_id, int offset)
+LIB_EXPORT int32_t  plc_tag_get_int32(plc_tag tag_id, int offset)
 {
-    int16_t res = INT16_MIN;
+    int32_t res = INT32_MIN;
     int rc = PLCTAG_STATUS_OK;
     plc_tag_p tag = NULL;
 
     pdebug(DEBUG_SPEW, "Starting.");
 
-    api_block(tag_id) {
-        tag = map_id_to_tag(tag_id);
+    api_block(tag_id, tag) {
         if(!tag) {
             pdebug(DEBUG_WARN,"Tag not found.");
             break;
@@ -1124,13 +1830,15 @@ LIB_EXPORT int16_t  plc_tag_get_int16(plc_tag tag_id, int offset)
         }
 
         /* is there enough data */
-        if((offset < 0) || (offset + ((int)sizeof(int16_t)) > tag->size)) {
+        if((offset < 0) || (offset + ((int)sizeof(int32_t)) > tag->size)) {
             pdebug(DEBUG_WARN,"Data offset out of bounds.");
             break;
         }
 
-        res = (int16_t)(((uint16_t)(tag->data[offset])) +
-                        ((uint16_t)(tag->data[offset+1]) << 8));
+        res = (int32_t)(((uint32_t)(tag->data[offset])) +
+                        ((uint32_t)(tag->data[offset+1]) << 8) +
+                        ((uint32_t)(tag->data[offset+2]) << 16) +
+                        ((uint32_t)(tag->data[offset+3]) << 24));
     }
 
     return res;
@@ -1138,17 +1846,15 @@ LIB_EXPORT int16_t  plc_tag_get_int16(plc_tag tag_id, int offset)
 
 
 
-
-LIB_EXPORT int plc_tag_set_int16(plc_tag tag_id, int offset, int16_t ival)
+LIB_EXPORT int plc_tag_set_int32(plc_tag tag_id, int offset, int32_t ival)
 {
-    uint16_t val = (uint16_t)(ival);
+    uint32_t val = (uint32_t)(ival);
     int rc = PLCTAG_STATUS_OK;
     plc_tag_p tag = NULL;
 
     pdebug(DEBUG_SPEW, "Starting.");
 
-    api_block(tag_id) {
-        tag = map_id_to_tag(tag_id);
+    api_block(tag_id, tag) {
         if(!tag) {
             pdebug(DEBUG_WARN,"Tag not found.");
             break;
@@ -1169,7 +1875,7 @@ LIB_EXPORT int plc_tag_set_int16(plc_tag tag_id, int offset, int16_t ival)
         }
 
         /* is there enough data */
-        if((offset < 0) || (offset + ((int)sizeof(int16_t)) > tag->size)) {
+        if((offset < 0) || (offset + ((int)sizeof(int32_t)) > tag->size)) {
             pdebug(DEBUG_WARN,"Data offset out of bounds.");
             rc = PLCTAG_ERR_OUT_OF_BOUNDS;
             break;
@@ -1177,6 +1883,8 @@ LIB_EXPORT int plc_tag_set_int16(plc_tag tag_id, int offset, int16_t ival)
 
         tag->data[offset]   = (uint8_t)(val & 0xFF);
         tag->data[offset+1] = (uint8_t)((val >> 8) & 0xFF);
+        tag->data[offset+2] = (uint8_t)((val >> 16) & 0xFF);
+        tag->data[offset+3] = (uint8_t)((val >> 24) & 0xFF);
     }
 
     return rc;
@@ -1189,16 +1897,16 @@ LIB_EXPORT int plc_tag_set_int16(plc_tag tag_id, int offset, int16_t ival)
 
 
 
-LIB_EXPORT uint8_t plc_tag_get_uint8(plc_tag tag_id, int offset)
+
+LIB_EXPORT uint16_t plc_tag_get_uint16(plc_tag tag_id, int offset)
 {
-    uint8_t res = UINT8_MAX;
+    uint16_t res = UINT16_MAX;
     int rc = PLCTAG_STATUS_OK;
     plc_tag_p tag = NULL;
 
     pdebug(DEBUG_SPEW, "Starting.");
 
-    api_block(tag_id) {
-        tag = map_id_to_tag(tag_id);
+    api_block(tag_id, tag) {
         if(!tag) {
             pdebug(DEBUG_WARN,"Tag not found.");
             break;
@@ -1218,12 +1926,13 @@ LIB_EXPORT uint8_t plc_tag_get_uint8(plc_tag tag_id, int offset)
         }
 
         /* is there enough data */
-        if((offset < 0) || (offset + ((int)sizeof(uint8_t)) > tag->size)) {
+        if((offset < 0) || (offset + ((int)sizeof(uint16_t)) > tag->size)) {
             pdebug(DEBUG_WARN,"Data offset out of bounds.");
             break;
         }
 
-        res = tag->data[offset];
+        res = ((uint16_t)(tag->data[offset])) +
+              ((uint16_t)(tag->data[offset+1]) << 8);
     }
 
     return res;
@@ -1232,15 +1941,14 @@ LIB_EXPORT uint8_t plc_tag_get_uint8(plc_tag tag_id, int offset)
 
 
 
-LIB_EXPORT int plc_tag_set_uint8(plc_tag tag_id, int offset, uint8_t val)
+LIB_EXPORT int plc_tag_set_uint16(plc_tag tag_id, int offset, uint16_t val)
 {
     int rc = PLCTAG_STATUS_OK;
     plc_tag_p tag = NULL;
 
     pdebug(DEBUG_SPEW, "Starting.");
 
-    api_block(tag_id) {
-        tag = map_id_to_tag(tag_id);
+    api_block(tag_id, tag) {
         if(!tag) {
             pdebug(DEBUG_WARN,"Tag not found.");
             break;
@@ -1261,13 +1969,14 @@ LIB_EXPORT int plc_tag_set_uint8(plc_tag tag_id, int offset, uint8_t val)
         }
 
         /* is there enough data */
-        if((offset < 0) || (offset + ((int)sizeof(uint8_t)) > tag->size)) {
+        if((offset < 0) || (offset + ((int)sizeof(uint16_t)) > tag->size)) {
             pdebug(DEBUG_WARN,"Data offset out of bounds.");
             rc = PLCTAG_ERR_OUT_OF_BOUNDS;
             break;
         }
 
-        tag->data[offset] = val;
+        tag->data[offset]   = (uint8_t)(val & 0xFF);
+        tag->data[offset+1] = (uint8_t)((val >> 8) & 0xFF);
     }
 
     return rc;
@@ -1277,17 +1986,20 @@ LIB_EXPORT int plc_tag_set_uint8(plc_tag tag_id, int offset, uint8_t val)
 
 
 
-LIB_EXPORT int8_t plc_tag_get_int8(plc_tag tag_id, int offset)
+
+
+
+
+LIB_EXPORT int16_t  plc_tag_get_int16(plc_tag tag_id, int offset)
 {
-    int8_t res = INT8_MIN;
+    int16_t res = INT16_MIN;
     int rc = PLCTAG_STATUS_OK;
     plc_tag_p tag = NULL;
 
     pdebug(DEBUG_SPEW, "Starting.");
 
-    api_block(tag_id) {
-        tag = map_id_to_tag(tag_id);
-       if(!tag) {
+    api_block(tag_id, tag) {
+        if(!tag) {
             pdebug(DEBUG_WARN,"Tag not found.");
             break;
         }
@@ -1306,12 +2018,13 @@ LIB_EXPORT int8_t plc_tag_get_int8(plc_tag tag_id, int offset)
         }
 
         /* is there enough data */
-        if((offset < 0) || (offset + ((int)sizeof(int8_t)) > tag->size)) {
+        if((offset < 0) || (offset + ((int)sizeof(int16_t)) > tag->size)) {
             pdebug(DEBUG_WARN,"Data offset out of bounds.");
             break;
         }
 
-        res = (int8_t)(tag->data[offset]);
+        res = (int16_t)(((uint16_t)(tag->data[offset])) +
+                        ((uint16_t)(tag->data[offset+1]) << 8));
     }
 
     return res;
@@ -1320,16 +2033,15 @@ LIB_EXPORT int8_t plc_tag_get_int8(plc_tag tag_id, int offset)
 
 
 
-LIB_EXPORT int plc_tag_set_int8(plc_tag tag_id, int offset, int8_t ival)
+LIB_EXPORT int plc_tag_set_int16(plc_tag tag_id, int offset, int16_t ival)
 {
-    uint8_t val = (uint8_t)(ival);
+    uint16_t val = (uint16_t)(ival);
     int rc = PLCTAG_STATUS_OK;
     plc_tag_p tag = NULL;
 
     pdebug(DEBUG_SPEW, "Starting.");
 
-    api_block(tag_id) {
-        tag = map_id_to_tag(tag_id);
+    api_block(tag_id, tag) {
         if(!tag) {
             pdebug(DEBUG_WARN,"Tag not found.");
             break;
@@ -1350,13 +2062,14 @@ LIB_EXPORT int plc_tag_set_int8(plc_tag tag_id, int offset, int8_t ival)
         }
 
         /* is there enough data */
-        if((offset < 0) || (offset + ((int)sizeof(int8_t)) > tag->size)) {
+        if((offset < 0) || (offset + ((int)sizeof(int16_t)) > tag->size)) {
             pdebug(DEBUG_WARN,"Data offset out of bounds.");
             rc = PLCTAG_ERR_OUT_OF_BOUNDS;
             break;
         }
 
-        tag->data[offset] = (uint8_t)val;
+        tag->data[offset]   = (uint8_t)(val & 0xFF);
+        tag->data[offset+1] = (uint8_t)((val >> 8) & 0xFF);
     }
 
     return rc;
@@ -1369,19 +2082,15 @@ LIB_EXPORT int plc_tag_set_int8(plc_tag tag_id, int offset, int8_t ival)
 
 
 
-
-
-LIB_EXPORT float plc_tag_get_float32(plc_tag tag_id, int offset)
+LIB_EXPORT uint8_t plc_tag_get_uint8(plc_tag tag_id, int offset)
 {
-    uint32_t ures;
-    float res = FLT_MAX;
-    plc_tag_p tag = NULL;
+    uint8_t res = UINT8_MAX;
     int rc = PLCTAG_STATUS_OK;
+    plc_tag_p tag = NULL;
 
     pdebug(DEBUG_SPEW, "Starting.");
 
-    api_block(tag_id) {
-        tag = map_id_to_tag(tag_id);
+    api_block(tag_id, tag) {
         if(!tag) {
             pdebug(DEBUG_WARN,"Tag not found.");
             break;
@@ -1401,37 +2110,28 @@ LIB_EXPORT float plc_tag_get_float32(plc_tag tag_id, int offset)
         }
 
         /* is there enough data */
-        if((offset < 0) || (offset + ((int)sizeof(ures)) > tag->size)) {
+        if((offset < 0) || (offset + ((int)sizeof(uint8_t)) > tag->size)) {
             pdebug(DEBUG_WARN,"Data offset out of bounds.");
             break;
         }
 
-        ures = ((uint32_t)(tag->data[offset])) +
-               ((uint32_t)(tag->data[offset+1]) << 8) +
-               ((uint32_t)(tag->data[offset+2]) << 16) +
-               ((uint32_t)(tag->data[offset+3]) << 24);
+        res = tag->data[offset];
     }
 
-    /* copy the data */
-    mem_copy(&res,&ures,sizeof(res));
-
     return res;
 }
 
 
 
 
-LIB_EXPORT int plc_tag_set_float32(plc_tag tag_id, int offset, float fval)
+LIB_EXPORT int plc_tag_set_uint8(plc_tag tag_id, int offset, uint8_t val)
 {
     int rc = PLCTAG_STATUS_OK;
-    uint32_t val = 0;
     plc_tag_p tag = NULL;
 
-    /* copy the data */
-    mem_copy(&val, &fval, sizeof(val));
+    pdebug(DEBUG_SPEW, "Starting.");
 
-    api_block(tag_id) {
-        tag = map_id_to_tag(tag_id);
+    api_block(tag_id, tag) {
         if(!tag) {
             pdebug(DEBUG_WARN,"Tag not found.");
             break;
@@ -1452,16 +2152,13 @@ LIB_EXPORT int plc_tag_set_float32(plc_tag tag_id, int offset, float fval)
         }
 
         /* is there enough data */
-        if((offset < 0) || (offset + ((int)sizeof(val)) > tag->size)) {
+        if((offset < 0) || (offset + ((int)sizeof(uint8_t)) > tag->size)) {
             pdebug(DEBUG_WARN,"Data offset out of bounds.");
             rc = PLCTAG_ERR_OUT_OF_BOUNDS;
             break;
         }
 
-        tag->data[offset]   = (uint8_t)(val & 0xFF);
-        tag->data[offset+1] = (uint8_t)((val >> 8) & 0xFF);
-        tag->data[offset+2] = (uint8_t)((val >> 16) & 0xFF);
-        tag->data[offset+3] = (uint8_t)((val >> 24) & 0xFF);
+        tag->data[offset] = val;
     }
 
     return rc;
@@ -1469,163 +2166,1136 @@ LIB_EXPORT int plc_tag_set_float32(plc_tag tag_id, int offset, float fval)
 
 
 
-/*****************************************************************************************************
- *****************************  Support routines for extra indirection *******************************
- ****************************************************************************************************/
 
 
-static inline int tag_id_inc(int id)
+LIB_EXPORT int8_t plc_tag_get_int8(plc_tag tag_id, int offset)
 {
-    if(id <= 0 || id == TAG_ID_ERROR) {
-        pdebug(DEBUG_ERROR, "Incoming ID is not valid! Got %d",id);
-        return TAG_ID_ERROR;
-    }
-
-    id = (id + 1) & TAG_ID_MASK;
+    int8_t res = INT8_MIN;
+    int rc = PLCTAG_STATUS_OK;
+    plc_tag_p tag = NULL;
 
-    if(id == 0) {
-        id = 1; /* skip zero intentionally! Can't return an ID of zero because it looks like a NULL pointer */
-    }
+    pdebug(DEBUG_SPEW, "Starting.");
 
-    return id;
-}
+    api_block(tag_id, tag) {
+       if(!tag) {
+            pdebug(DEBUG_WARN,"Tag not found.");
+            break;
+        }
 
-static inline int to_tag_index(int id)
-{
-    if(id <= 0 || id == TAG_ID_ERROR) {
-        pdebug(DEBUG_ERROR, "Incoming ID is not valid! Got %d",id);
-        return TAG_ID_ERROR;
-    }
-    return (id & TAG_INDEX_MASK);
-}
+        /* is the tag ready for this operation? */
+        rc = plc_tag_status_mapped(tag);
+        if(rc != PLCTAG_STATUS_OK && rc != PLCTAG_ERR_OUT_OF_BOUNDS) {
+            pdebug(DEBUG_WARN,"Tag not in good state!");
+            break;
+        }
 
-static inline int tag_ptr_to_tag_index(plc_tag tag_id_ptr)
+        /* is there data? */
+        if(!tag->data) {
+            pdebug(DEBUG_WARN,"Tag has no data!");
+            break;
+        }
+
+        /* is there enough data */
+        if((offset < 0) || (offset + ((int)sizeof(int8_t)) > tag->size)) {
+            pdebug(DEBUG_WARN,"Data offset out of bounds.");
+            break;
+        }
+
+        res = (int8_t)(tag->data[offset]);
+    }
+
+    return res;
+}
+
+
+
+
+LIB_EXPORT int plc_tag_set_int8(plc_tag tag_id, int offset, int8_t ival)
+{
+    uint8_t val = (uint8_t)(ival);
+    int rc = PLCTAG_STATUS_OK;
+    plc_tag_p tag = NULL;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    api_block(tag_id, tag) {
+        if(!tag) {
+            pdebug(DEBUG_WARN,"Tag not found.");
+            break;
+        }
+
+        /* is the tag ready for this operation? */
+        rc = plc_tag_status_mapped(tag);
+        if(rc != PLCTAG_STATUS_OK && rc != PLCTAG_ERR_OUT_OF_BOUNDS) {
+            pdebug(DEBUG_WARN,"Tag not in good state!");
+            break;
+        }
+
+        /* is there data? */
+        if(!tag->data) {
+            pdebug(DEBUG_WARN,"Tag has no data!");
+            rc = PLCTAG_ERR_NO_DATA;
+            break;
+        }
+
+        /* is there enough data */
+        if((offset < 0) || (offset + ((int)sizeof(int8_t)) > tag->size)) {
+            pdebug(DEBUG_WARN,"Data offset out of bounds.");
+            rc = PLCTAG_ERR_OUT_OF_BOUNDS;
+            break;
+        }
+
+        tag->data[offset] = (uint8_t)val;
+    }
+
+    return rc;
+}
+
+
+
+
+
+
+
+
+
+
+LIB_EXPORT float plc_tag_get_float32(plc_tag tag_id, int offset)
+{
+    uint32_t ures;
+    float res = FLT_MAX;
+    plc_tag_p tag = NULL;
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    api_block(tag_id, tag) {
+        if(!tag) {
+            pdebug(DEBUG_WARN,"Tag not found.");
+            break;
+        }
+
+        /* is the tag ready for this operation? */
+        rc = plc_tag_status_mapped(tag);
+        if(rc != PLCTAG_STATUS_OK && rc != PLCTAG_ERR_OUT_OF_BOUNDS) {
+            pdebug(DEBUG_WARN,"Tag not in good state!");
+            break;
+        }
+
+        /* is there data? */
+        if(!tag->data) {
+            pdebug(DEBUG_WARN,"Tag has no data!");
+            break;
+        }
+
+        /* is there enough data */
+        if((offset < 0) || (offset + ((int)sizeof(ures)) > tag->size)) {
+            pdebug(DEBUG_WARN,"Data offset out of bounds.");
+            break;
+        }
+
+        ures = ((uint32_t)(tag->data[offset])) +
+               ((uint32_t)(tag->data[offset+1]) << 8) +
+               ((uint32_t)(tag->data[offset+2]) << 16) +
+               ((uint32_t)(tag->data[offset+3]) << 24);
+    }
+
+    /* copy the data */
+    mem_copy(&res,&ures,sizeof(res));
+
+    return res;
+}
+
+
+
+
+LIB_EXPORT int plc_tag_set_float32(plc_tag tag_id, int offset, float fval)
+{
+    int rc = PLCTAG_STATUS_OK;
+    uint32_t val = 0;
+    plc_tag_p tag = NULL;
+
+    /* copy the data */
+    mem_copy(&val, &fval, sizeof(val));
+
+    api_block(tag_id, tag) {
+        if(!tag) {
+            pdebug(DEBUG_WARN,"Tag not found.");
+            break;
+        }
+
+        /* is the tag ready for this operation? */
+        rc = plc_tag_status_mapped(tag);
+        if(rc != PLCTAG_STATUS_OK && rc != PLCTAG_ERR_OUT_OF_BOUNDS) {
+            pdebug(DEBUG_WARN,"Tag not in good state!");
+            break;
+        }
+
+        /* is there data? */
+        if(!tag->data) {
+            pdebug(DEBUG_WARN,"Tag has no data!");
+            rc = PLCTAG_ERR_NO_DATA;
+            break;
+        }
+
+        /* is there enough data */
+        if((offset < 0) || (offset + ((int)sizeof(val)) > tag->size)) {
+            pdebug(DEBUG_WARN,"Data offset out of bounds.");
+            rc = PLCTAG_ERR_OUT_OF_BOUNDS;
+            break;
+        }
+
+        tag->data[offset]   = (uint8_t)(val & 0xFF);
+        tag->data[offset+1] = (uint8_t)((val >> 8) & 0xFF);
+        tag->data[offset+2] = (uint8_t)((val >> 16) & 0xFF);
+        tag->data[offset+3] = (uint8_t)((val >> 24) & 0xFF);
+    }
+
+    return rc;
+}
+
+
+
+
+/*
+ * Bulk and array accessors.
+ *
+ * These check the tag and lock it once for the whole run of elements.
+ * The elements in the caller's buffer are in host byte order.  If that
+ * is the byte order of the tag data, it is a straight copy.  Otherwise,
+ * the bytes of each element are reversed in a simple loop that the
+ * compiler can turn into vector byte shuffles.
+ */
+
+static int host_data_endian(void)
+{
+    uint16_t val = 1;
+    uint8_t first_byte = 0;
+
+    mem_copy(&first_byte, &val, 1);
+
+    return (first_byte == 1 ? PLCTAG_DATA_LITTLE_ENDIAN : PLCTAG_DATA_BIG_ENDIAN);
+}
+
+
+static void swap_copy_16(uint8_t *dest, const uint8_t *src, int count)
+{
+    for(int i=0; i < count * 2; i += 2) {
+        dest[i]   = src[i+1];
+        dest[i+1] = src[i];
+    }
+}
+
+
+static void swap_copy_32(uint8_t *dest, const uint8_t *src, int count)
+{
+    for(int i=0; i < count * 4; i += 4) {
+        dest[i]   = src[i+3];
+        dest[i+1] = src[i+2];
+        dest[i+2] = src[i+1];
+        dest[i+3] = src[i];
+    }
+}
+
+
+/* copy count elements of elem_size bytes out of the tag data, or into it if to_tag is set. */
+static int tag_array_copy(plc_tag tag_id, int offset, uint8_t *buf, int count, int elem_size, int to_tag)
+{
+    int rc = PLCTAG_STATUS_OK;
+    plc_tag_p tag = NULL;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(!buf || count < 0) {
+        pdebug(DEBUG_WARN, "Null buffer or negative element count!");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    if(count > INT_MAX / elem_size) {
+        pdebug(DEBUG_WARN, "Too many elements!");
+        return PLCTAG_ERR_OUT_OF_BOUNDS;
+    }
+
+    api_block(tag_id, tag) {
+        int size = count * elem_size;
+        uint8_t *data = NULL;
+
+        if(!tag) {
+            pdebug(DEBUG_WARN,"Tag not found.");
+            rc = PLCTAG_ERR_NOT_FOUND;
+            break;
+        }
+
+        /* is the tag ready for this operation? */
+        rc = plc_tag_status_mapped(tag);
+        if(rc != PLCTAG_STATUS_OK && rc != PLCTAG_ERR_OUT_OF_BOUNDS) {
+            pdebug(DEBUG_WARN,"Tag not in good state!");
+            break;
+        }
+
+        rc = PLCTAG_STATUS_OK;
+
+        /* is there data? */
+        if(!tag->data) {
+            pdebug(DEBUG_WARN,"Tag has no data!");
+            rc = PLCTAG_ERR_NO_DATA;
+            break;
+        }
+
+        /* is there enough data */
+        if((offset < 0) || (offset > tag->size - size)) {
+            pdebug(DEBUG_WARN,"Data offset out of bounds.");
+            rc = PLCTAG_ERR_OUT_OF_BOUNDS;
+            break;
+        }
+
+        if(size == 0) {
+            break;
+        }
+
+        data = tag->data + offset;
+
+        if(elem_size == 1 || tag->endian == host_data_endian()) {
+            if(to_tag) {
+                mem_copy(data, buf, size);
+            } else {
+                mem_copy(buf, data, size);
+            }
+        } else if(elem_size == 2) {
+            swap_copy_16((to_tag ? data : buf), (to_tag ? buf : data), count);
+        } else {
+            swap_copy_32((to_tag ? data : buf), (to_tag ? buf : data), count);
+        }
+    }
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return rc;
+}
+
+
+
+LIB_EXPORT int plc_tag_get_bytes(plc_tag tag_id, int offset, uint8_t *buf, int size)
+{
+    return tag_array_copy(tag_id, offset, buf, size, 1, 0);
+}
+
+
+LIB_EXPORT int plc_tag_set_bytes(plc_tag tag_id, int offset, const uint8_t *buf, int size)
+{
+    return tag_array_copy(tag_id, offset, (uint8_t *)buf, size, 1, 1);
+}
+
+
+LIB_EXPORT int plc_tag_get_uint32_array(plc_tag tag_id, int offset, uint32_t *vals, int count)
+{
+    return tag_array_copy(tag_id, offset, (uint8_t *)vals, count, (int)sizeof(uint32_t), 0);
+}
+
+
+LIB_EXPORT int plc_tag_set_uint32_array(plc_tag tag_id, int offset, const uint32_t *vals, int count)
+{
+    return tag_array_copy(tag_id, offset, (uint8_t *)vals, count, (int)sizeof(uint32_t), 1);
+}
+
+
+LIB_EXPORT int plc_tag_get_int32_array(plc_tag tag_id, int offset, int32_t *vals, int count)
+{
+    return tag_array_copy(tag_id, offset, (uint8_t *)vals, count, (int)sizeof(int32_t), 0);
+}
+
+
+LIB_EXPORT int plc_tag_set_int32_array(plc_tag tag_id, int offset, const int32_t *vals, int count)
+{
+    return tag_array_copy(tag_id, offset, (uint8_t *)vals, count, (int)sizeof(int32_t), 1);
+}
+
+
+LIB_EXPORT int plc_tag_get_uint16_array(plc_tag tag_id, int offset, uint16_t *vals, int count)
+{
+    return tag_array_copy(tag_id, offset, (uint8_t *)vals, count, (int)sizeof(uint16_t), 0);
+}
+
+
+LIB_EXPORT int plc_tag_set_uint16_array(plc_tag tag_id, int offset, const uint16_t *vals, int count)
+{
+    return tag_array_copy(tag_id, offset, (uint8_t *)vals, count, (int)sizeof(uint16_t), 1);
+}
+
+
+LIB_EXPORT int plc_tag_get_int16_array(plc_tag tag_id, int offset, int16_t *vals, int count)
+{
+    return tag_array_copy(tag_id, offset, (uint8_t *)vals, count, (int)sizeof(int16_t), 0);
+}
+
+
+LIB_EXPORT int plc_tag_set_int16_array(plc_tag tag_id, int offset, const int16_t *vals, int count)
+{
+    return tag_array_copy(tag_id, offset, (uint8_t *)vals, count, (int)sizeof(int16_t), 1);
+}
+
+
+LIB_EXPORT int plc_tag_get_float32_array(plc_tag tag_id, int offset, float *vals, int count)
+{
+    return tag_array_copy(tag_id, offset, (uint8_t *)vals, count, (int)sizeof(float), 0);
+}
+
+
+LIB_EXPORT int plc_tag_set_float32_array(plc_tag tag_id, int offset, const float *vals, int count)
+{
+    return tag_array_copy(tag_id, offset, (uint8_t *)vals, count, (int)sizeof(float), 1);
+}
+
+
+
+/*****************************************************************************************************
+ *****************************  Completion signals ***************************************************
+ ****************************************************************************************************/
+
+
+static void tag_done_destroy(void *done_arg)
+{
+    tag_done_p done = (tag_done_p)done_arg;
+
+    if(done->cond) {
+        cond_destroy(&done->cond);
+    }
+
+    if(done->waiter_mutex) {
+        mutex_destroy(&done->waiter_mutex);
+    }
+}
+
+
+static tag_done_p tag_done_create(void)
+{
+    tag_done_p done = (tag_done_p)rc_alloc(sizeof(struct tag_done_t), tag_done_destroy);
+
+    if(!done) {
+        return NULL;
+    }
+
+    if(cond_create(&done->cond) != PLCTAG_STATUS_OK) {
+        return rc_dec(done);
+    }
+
+    if(mutex_create(&done->waiter_mutex) != PLCTAG_STATUS_OK) {
+        return rc_dec(done);
+    }
+
+    return done;
+}
+
+
+/*
+ * tag_done_signal
+ *
+ * Called by the protocol layer, usually from an IO thread, when a request
+ * for the tag completes.
+ */
+void tag_done_signal(tag_done_p done)
+{
+    if(done) {
+        cond_signal(done->cond);
+
+        critical_block(done->waiter_mutex) {
+            done->generation++;
+
+            for(tag_waiter_p waiter = done->waiters; waiter; waiter = waiter->next) {
+                cond_signal(waiter->cond);
+            }
+        }
+
+        if(done->callback_enabled) {
+            tag_done_queue(done);
+        }
+    }
+}
+
+
+/*
+ * Sleep until the tag is signalled or the timeout passes.  The caller
+ * checks the status again either way, so a stale signal only costs
+ * an extra pass.
+ */
+static void tag_done_wait(tag_done_p done, int64_t timeout_time)
+{
+    int64_t remaining = timeout_time - time_ms();
+
+    if(remaining <= 0) {
+        return;
+    }
+
+    /* not everything that changes the status signals, so do not sleep forever. */
+    if(remaining > TAG_DONE_MAX_WAIT_MS) {
+        remaining = TAG_DONE_MAX_WAIT_MS;
+    }
+
+    if(done) {
+        cond_wait(done->cond, (int)remaining);
+    } else {
+        sleep_ms(5); /* MAGIC */
+    }
+}
+
+
+
+static void tag_done_add_waiter(tag_done_p done, tag_waiter_p waiter)
+{
+    critical_block(done->waiter_mutex) {
+        waiter->next = done->waiters;
+        done->waiters = waiter;
+    }
+}
+
+
+static void tag_done_remove_waiter(tag_done_p done, tag_waiter_p waiter)
+{
+    critical_block(done->waiter_mutex) {
+        tag_waiter_p *walker = &done->waiters;
+
+        while(*walker && *walker != waiter) {
+            walker = &((*walker)->next);
+        }
+
+        if(*walker) {
+            *walker = waiter->next;
+        }
+    }
+}
+
+
+
+/*****************************************************************************************************
+ *****************************  Callback dispatcher **************************************************
+ ****************************************************************************************************/
+
+
+/*
+ * Queue the tag for the dispatcher thread to check.  This is how the IO
+ * threads hand off, the dispatcher runs the tag status which decodes the
+ * response and queues the event.  A tag is only on this queue once at a
+ * time and the queue holds a reference, so the tag can be destroyed meanwhile.
+ */
+static void tag_done_queue(tag_done_p done)
+{
+    if(!done || !callback_mutex) {
+        return;
+    }
+
+    critical_block(callback_mutex) {
+        if(!done->queued) {
+            done->queued = 1;
+            done->next = NULL;
+
+            if(callback_check_tail) {
+                callback_check_tail->next = done;
+            } else {
+                callback_check_head = done;
+            }
+
+            callback_check_tail = rc_inc(done);
+        }
+    }
+
+    cond_signal(callback_cond);
+}
+
+
+/*
+ * Queue an event for the callback of the tag.  The callback is looked up
+ * again when the event is delivered, in case it changed or the tag is gone.
+ */
+static void callback_event_queue(int tag_id, int event, int status)
+{
+    callback_event_p cb_event;
+
+    if(!callback_mutex) {
+        return;
+    }
+
+    cb_event = (callback_event_p)mem_alloc((int)sizeof(struct callback_event_t));
+
+    if(!cb_event) {
+        pdebug(DEBUG_ERROR, "Unable to allocate callback event, dropping event %d for tag %d!", event, tag_id);
+        return;
+    }
+
+    cb_event->tag_id = tag_id;
+    cb_event->event = event;
+    cb_event->status = status;
+
+    critical_block(callback_mutex) {
+        if(callback_event_tail) {
+            callback_event_tail->next = cb_event;
+        } else {
+            callback_event_head = cb_event;
+        }
+
+        callback_event_tail = cb_event;
+    }
+
+    cond_signal(callback_cond);
+}
+
+
+/*
+ * Called with the API lock held after starting a read or write.  If the
+ * operation did not go asynchronous, it is already done.
+ */
+static void tag_callback_op_started(plc_tag_p tag, int op, int rc)
 {
-    int tag_id = (int)(intptr_t)tag_id_ptr;
-    return to_tag_index(tag_id);
+    if(!tag->callback || !tag->done) {
+        return;
+    }
+
+    tag->pending_op = op;
+
+    if(rc != PLCTAG_STATUS_PENDING) {
+        tag_callback_op_done(tag, rc);
+    }
 }
 
 
+/*
+ * Called with the API lock held when the status shows that the operation
+ * the callback is waiting on has finished, no matter which thread saw it.
+ */
+static void tag_callback_op_done(plc_tag_p tag, int status)
+{
+    int event;
+
+    if(status != PLCTAG_STATUS_OK) {
+        event = PLCTAG_EVENT_ERROR;
+    } else if(tag->pending_op == TAG_OP_READ) {
+        event = PLCTAG_EVENT_READ_COMPLETED;
+    } else {
+        event = PLCTAG_EVENT_WRITE_COMPLETED;
+    }
+
+    tag->pending_op = TAG_OP_NONE;
+
+    callback_event_queue(tag->tag_id, event, status);
+}
+
 
-static int api_lock(int index)
+/* run the status so that a finished operation gets decoded and queues its event. */
+static void dispatch_check(tag_done_p done)
 {
-    int rc = PLCTAG_STATUS_OK;
+    plc_tag tag_id = (plc_tag)(intptr_t)done->tag_id;
+    plc_tag_p tag = NULL;
 
-    pdebug(DEBUG_SPEW,"Starting");
+    api_block(tag_id, tag) {
+        if(tag && tag->pending_op != TAG_OP_NONE) {
+            plc_tag_status_mapped(tag);
+        }
+    }
+}
 
-    if(index < 0 || index > MAX_TAG_ENTRIES) {
-        pdebug(DEBUG_WARN,"Illegal tag index %d",index);
-        return PLCTAG_ERR_OUT_OF_BOUNDS;
+
+static void dispatch_event(callback_event_p cb_event)
+{
+    plc_tag tag_id = (plc_tag)(intptr_t)cb_event->tag_id;
+    plc_tag_callback_func callback = NULL;
+    void *userdata = NULL;
+    plc_tag_p tag = NULL;
+
+    api_block(tag_id, tag) {
+        /* the tag may have been destroyed after the event was queued. */
+        if(tag) {
+            callback = tag->callback;
+            userdata = tag->userdata;
+        }
+    }
+
+    /* call out without the API lock so that the callback can use the tag. */
+    if(callback) {
+        callback(tag_id, cb_event->event, cb_event->status, userdata);
+    }
+}
+
+
+static THREAD_FUNC(callback_dispatcher_func)
+{
+    (void)arg;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    while(!callback_terminate) {
+        callback_event_p cb_event = NULL;
+        tag_done_p done = NULL;
+
+        /* deliver events before checking tags, so they stay in order. */
+        critical_block(callback_mutex) {
+            cb_event = callback_event_head;
+
+            if(cb_event) {
+                callback_event_head = cb_event->next;
+
+                if(!callback_event_head) {
+                    callback_event_tail = NULL;
+                }
+
+                break;
+            }
+
+            done = callback_check_head;
+
+            if(done) {
+                callback_check_head = done->next;
+
+                if(!callback_check_head) {
+                    callback_check_tail = NULL;
+                }
+
+                done->next = NULL;
+                done->queued = 0;
+            }
+        }
+
+        if(cb_event) {
+            dispatch_event(cb_event);
+            mem_free(cb_event);
+        } else if(done) {
+            dispatch_check(done);
+            rc_dec(done);
+        } else {
+            cond_wait(callback_cond, CALLBACK_IDLE_WAIT_MS);
+        }
     }
 
-    rc = mutex_lock(tag_api_mutex[index]);
+    pdebug(DEBUG_INFO, "Done.");
+
+    THREAD_RETURN(0);
+}
+
+
+static int callback_dispatcher_start(void)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    critical_block(global_library_mutex) {
+        if(callback_thread) {
+            break;
+        }
+
+        if(!callback_mutex && (rc = mutex_create(&callback_mutex)) != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_ERROR, "Unable to create callback queue mutex!");
+            break;
+        }
+
+        if(!callback_cond && (rc = cond_create(&callback_cond)) != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_ERROR, "Unable to create callback queue signal!");
+            break;
+        }
+
+        callback_terminate = 0;
+
+        rc = thread_create(&callback_thread, callback_dispatcher_func, 32*1024, NULL);
 
-    pdebug(DEBUG_SPEW,"Done with status %d", rc);
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_ERROR, "Unable to create callback dispatcher thread!");
+            callback_thread = NULL;
+            rc = PLCTAG_ERR_THREAD_CREATE;
+        }
+    }
 
     return rc;
 }
 
 
+static void callback_dispatcher_stop(void)
+{
+    if(callback_thread) {
+        pdebug(DEBUG_INFO, "Stopping callback dispatcher thread.");
+
+        callback_terminate = 1;
+        cond_signal(callback_cond);
+
+        thread_join(callback_thread);
+        thread_destroy(&callback_thread);
+        callback_thread = NULL;
+    }
+
+    /* drop anything that was never dispatched. */
+    if(callback_mutex) {
+        critical_block(callback_mutex) {
+            while(callback_check_head) {
+                tag_done_p done = callback_check_head;
+
+                callback_check_head = done->next;
+                done->queued = 0;
+                rc_dec(done);
+            }
+
+            callback_check_tail = NULL;
+
+            while(callback_event_head) {
+                callback_event_p cb_event = callback_event_head;
+
+                callback_event_head = cb_event->next;
+                mem_free(cb_event);
+            }
+
+            callback_event_tail = NULL;
+        }
+
+        mutex_destroy(&callback_mutex);
+    }
+
+    if(callback_cond) {
+        cond_destroy(&callback_cond);
+    }
+}
+
+
+
+/*****************************************************************************************************
+ *****************************  Support routines for extra indirection *******************************
+ ****************************************************************************************************/
+
+
+static inline int tag_id_inc(int id)
+{
+    if(id <= 0 || id == TAG_ID_ERROR) {
+        pdebug(DEBUG_ERROR, "Incoming ID is not valid! Got %d",id);
+        return TAG_ID_ERROR;
+    }
+
+    id = (int)(((unsigned int)id + 1) & TAG_ID_MASK);
+
+    if(id == 0) {
+        id = 1; /* skip zero intentionally! Can't return an ID of zero because it looks like a NULL pointer */
+    }
+
+    return id;
+}
 
-static int api_unlock(int index)
+static inline int to_tag_index(int id)
 {
-    int rc = PLCTAG_STATUS_OK;
+    if(id <= 0 || id == TAG_ID_ERROR) {
+        pdebug(DEBUG_ERROR, "Incoming ID is not valid! Got %d",id);
+        return TAG_ID_ERROR;
+    }
+    return (id & TAG_INDEX_MASK);
+}
+
+static inline int tag_ptr_to_tag_index(plc_tag tag_id_ptr)
+{
+    int tag_id = (int)(intptr_t)tag_id_ptr;
+    return to_tag_index(tag_id);
+}
+
+
+/* the map entry for a tag index, NULL if that part of the map does not exist. */
+static inline tag_map_entry_p tag_map_entry(int index)
+{
+    tag_map_entry_p chunk = NULL;
+
+    if(index < 0 || index > TAG_INDEX_MASK) {
+        return NULL;
+    }
+
+    chunk = tag_map_chunks[index / TAG_MAP_CHUNK_SIZE];
+
+    if(!chunk) {
+        return NULL;
+    }
+
+    return &chunk[index % TAG_MAP_CHUNK_SIZE];
+}
+
+
+
+/*
+ * Resolve the handle without a lock and take the tag's API mutex.
+ * Returns the tag with the mutex held, or NULL without it.
+ *
+ * The upper bits of a tag ID change each time an entry is reused, so a
+ * stale handle does not match the entry's tag_id.  The readers count keeps
+ * the tag from being freed while it is checked: release_tag_to_id_mapping()
+ * clears the entry and then waits for the count to drop, and
+ * plc_tag_destroy_mapped() only lets go of the tag after that.
+ *
+ * Usually the mutex is free and is taken before the count drops.  Once
+ * it is held the tag cannot be unmapped, and the map's reference keeps it.
+ * If another thread has the mutex, take a reference first so the tag
+ * survives the wait, then check that it was not destroyed meanwhile.
+ * Neither way takes a lock to find the tag, see rc_inc().
+ */
+static plc_tag_p api_lock(plc_tag tag_id_ptr)
+{
+    plc_tag_p tag = NULL;
+    int tag_id = (int)(intptr_t)tag_id_ptr;
+    tag_map_entry_p entry = NULL;
+    int locked = 0;
 
     pdebug(DEBUG_SPEW,"Starting");
 
-    if(index < 0 || index > MAX_TAG_ENTRIES) {
-        pdebug(DEBUG_WARN,"Illegal tag index %d",index);
-        return PLCTAG_ERR_OUT_OF_BOUNDS;
+    entry = (tag_id > 0 ? tag_map_entry(to_tag_index(tag_id)) : NULL);
+
+    if(!entry) {
+        pdebug(DEBUG_WARN,"Bad tag ID passed! %d", tag_id);
+        return NULL;
     }
 
-    rc = mutex_unlock(tag_api_mutex[index]);
+    atomic_add64(&entry->readers, 1);
 
-    pdebug(DEBUG_SPEW,"Done with status %d", rc);
+    if(entry->tag_id == tag_id) {
+        tag = entry->tag;
 
-    return rc;
+        /* the entry could have been reused for another tag after the ID was checked. */
+        if(tag && tag->tag_id != tag_id) {
+            tag = NULL;
+        }
+    }
+
+    if(tag) {
+        if(mutex_try_lock(entry->api_mutex) == PLCTAG_STATUS_OK) {
+            locked = 1;
+        } else {
+            tag = rc_inc(tag);
+        }
+    }
+
+    atomic_add64(&entry->readers, -1);
+
+    if(!tag) {
+        pdebug(DEBUG_WARN, "Not found, tag id %d maps to a different tag", tag_id);
+        return NULL;
+    }
+
+    if(!locked) {
+        int rc = mutex_lock(entry->api_mutex);
+        int mapped = (rc == PLCTAG_STATUS_OK && entry->tag == tag);
+
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN,"Unable to lock the tag API mutex!");
+        } else if(!mapped) {
+            pdebug(DEBUG_WARN,"Tag was destroyed while waiting for the API mutex.");
+            mutex_unlock(entry->api_mutex);
+        }
+
+        /* if it is still mapped, the map's reference keeps it from here on. */
+        rc_dec(tag);
+
+        if(!mapped) {
+            return NULL;
+        }
+    }
+
+    pdebug(DEBUG_SPEW,"Done with tag %p", tag);
+
+    return tag;
+}
+
+
+
+static plc_tag_p api_unlock(plc_tag tag_id, plc_tag_p tag)
+{
+    if(tag) {
+        mutex_unlock(tag_map_entry(tag_ptr_to_tag_index(tag_id))->api_mutex);
+    }
+
+    return NULL;
 }
 
 
 
 
+/*
+ * Walk once around the part of the tag map that exists, looking for a
+ * free entry.  If there is none, grow the map and try again.
+ */
 static int allocate_new_tag_to_id_mapping(plc_tag_p tag)
 {
-    int new_id = next_tag_id;
-    int index = 0;
-    int found = 0;
+    int capacity = tag_map_capacity;
 
-    for(int count=0; !found && count < MAX_TAG_ENTRIES && new_id != TAG_ID_ERROR; count++) {
-        new_id = tag_id_inc(new_id);
+    while(1) {
+        int new_id = next_tag_id;
 
-        /* everything OK? */
-        if(new_id == TAG_ID_ERROR) break;
+        for(int count=0; count < capacity; count++) {
+            tag_map_entry_p entry = NULL;
+            int found = 0;
 
-        index = to_tag_index(new_id);
+            new_id = tag_id_inc(new_id);
+
+            /* everything OK? */
+            if(new_id == TAG_ID_ERROR) {
+                return PLCTAG_ERR_NOT_ALLOWED;
+            }
+
+            /* wrap around to the start of the map at the end of the part that exists. */
+            if(to_tag_index(new_id) >= capacity) {
+                new_id = tag_id_inc(new_id | TAG_INDEX_MASK);
+            }
+
+            entry = tag_map_entry(to_tag_index(new_id));
+
+            /* is the slot empty? */
+            if(!entry || entry->tag) {
+                continue;
+            }
 
-        /* is the slot empty? */
-        if(index != TAG_ID_ERROR && !tag_map[index]) {
             /* Must lock the api mutex so that we can change the mapping. */
-            api_lock(index);
+            critical_block(entry->api_mutex) {
+                /* recheck if the slot is empty. It could have changed while we locked the mutex. */
+                if(!entry->tag) {
+                    next_tag_id = new_id;
+                    tag->tag_id = new_id;
+
+                    entry->tag = tag;
+                    entry->tag_id = new_id;
+
+                    found = 1;
+                }
+            }
+
+            if(found) {
+                return new_id;
+            }
+        }
+
+        capacity = tag_map_grow(capacity);
+
+        if(capacity < 0) {
+            return capacity;
+        }
+    }
+}
+
+
+
+/*
+ * Add a chunk to the tag map, unless another thread already did since
+ * the caller looked.  The entries and their mutexes are all set up before
+ * the chunk is visible to other threads.
+ *
+ * Returns the new size of the map or an error.
+ */
+static int tag_map_grow(int old_capacity)
+{
+    int rc = PLCTAG_STATUS_OK;
+    tag_map_entry_p chunk = NULL;
+
+    critical_block(global_library_mutex) {
+        if(tag_map_capacity != old_capacity) {
+            break;
+        }
+
+        if(tag_map_capacity >= MAX_TAG_ENTRIES) {
+            pdebug(DEBUG_ERROR, "Unable to find empty mapping slot, all %d are in use!", MAX_TAG_ENTRIES);
+            rc = PLCTAG_ERR_NO_MEM; /* not really the right error, but close */
+            break;
+        }
+
+        pdebug(DEBUG_DETAIL, "Growing the tag map to %d entries.", tag_map_capacity + TAG_MAP_CHUNK_SIZE);
+
+        chunk = (tag_map_entry_p)mem_alloc(TAG_MAP_CHUNK_SIZE * (int)sizeof(struct tag_map_entry_t));
+
+        if(!chunk) {
+            pdebug(DEBUG_ERROR, "Unable to allocate tag map chunk!");
+            rc = PLCTAG_ERR_NO_MEM;
+            break;
+        }
 
-            /* recheck if the slot is empty. It could have changed while we locked the mutex. */
-            if(!tag_map[index]) {
-                next_tag_id = new_id;
-                tag->tag_id = new_id;
+        for(int i=0; i < TAG_MAP_CHUNK_SIZE && rc == PLCTAG_STATUS_OK; i++) {
+            rc = mutex_create(&chunk[i].api_mutex);
+        }
 
-                tag_map[index] = tag;
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_ERROR, "Unable to create tag API mutex!");
 
-                found = 1;
+            for(int i=0; i < TAG_MAP_CHUNK_SIZE && chunk[i].api_mutex; i++) {
+                mutex_destroy(&chunk[i].api_mutex);
             }
 
-            api_unlock(index);
+            mem_free(chunk);
+            break;
         }
 
-        if(index == TAG_ID_ERROR) break;
+        /* publish the chunk before anything can hand out an index in it. */
+        atomic_ptr_cas((void * volatile *)&tag_map_chunks[tag_map_capacity / TAG_MAP_CHUNK_SIZE], NULL, chunk);
+
+        tag_map_capacity += TAG_MAP_CHUNK_SIZE;
+    }
+
+    if(rc != PLCTAG_STATUS_OK) {
+        return rc;
     }
 
-    if(found) {
-        return new_id;
+    return tag_map_capacity;
+}
+
+
+
+/*
+ * Grow the tag map until there are at least num_tags unused entries past
+ * the last ID handed out.  Otherwise each time the map fills up, the next
+ * tag walks all the way around it before adding a chunk.
+ */
+static int tag_map_reserve(int num_tags)
+{
+    int capacity = tag_map_capacity;
+    int needed = to_tag_index(next_tag_id) + 1 + num_tags;
+
+    if(needed > MAX_TAG_ENTRIES) {
+        needed = MAX_TAG_ENTRIES;
     }
 
-    if(index != TAG_ID_ERROR) {
-        pdebug(DEBUG_ERROR, "Unable to find empty mapping slot!");
-        return PLCTAG_ERR_NO_MEM; /* not really the right error, but close */
+    while(capacity < needed) {
+        capacity = tag_map_grow(capacity);
+
+        if(capacity < 0) {
+            return capacity;
+        }
     }
 
-    /* this did not work */
-    return PLCTAG_ERR_NOT_ALLOWED;
+    return PLCTAG_STATUS_OK;
 }
 
 
 
 /*
- * This MUST be called while the API mutex for this tag is held!
+ * Find the completion signal of a tag without taking the tag's API mutex
+ * and return it with a reference held, or NULL.  This is for waiting on
+ * tags that another thread may be using.
+ *
+ * The readers count keeps the tag and its signal from being freed while
+ * the reference is taken.  release_tag_to_id_mapping() clears the entry
+ * and then waits for the count to drop, and plc_tag_destroy_mapped()
+ * only lets go of either after that.
  */
 
-static plc_tag_p map_id_to_tag(plc_tag tag_id_ptr)
+static tag_done_p tag_done_lookup(plc_tag tag_id_ptr)
 {
-    plc_tag_p result = NULL;
+    tag_done_p result = NULL;
     int tag_id = (int)(intptr_t)tag_id_ptr;
-    int index = to_tag_index(tag_id);
+    tag_map_entry_p entry = NULL;
+
+    if(tag_id <= 0) {
+        return NULL;
+    }
 
-    pdebug(DEBUG_SPEW, "Starting");
+    entry = tag_map_entry(to_tag_index(tag_id));
 
-    if(index == TAG_ID_ERROR) {
-        pdebug(DEBUG_ERROR,"Bad tag ID passed! %d", tag_id);
-        return (plc_tag_p)0;
+    if(!entry) {
+        return NULL;
     }
 
-    result = tag_map[index];
-    if(result && result->tag_id == tag_id) {
-        pdebug(DEBUG_SPEW, "Correct mapping at index %d for id %d found with tag %p", index, tag_id, result);
-    } else {
-        pdebug(DEBUG_WARN, "Not found, tag id %d maps to a different tag", tag_id);
-        result = NULL;
+    atomic_add64(&entry->readers, 1);
+
+    if(entry->tag_id == tag_id) {
+        plc_tag_p tag = entry->tag;
+
+        /* the entry could have been reused for another tag after the ID was checked. */
+        if(tag && tag->tag_id == tag_id && tag->done) {
+            result = rc_inc(tag->done);
+        }
     }
 
-    pdebug(DEBUG_SPEW,"Done with tag %p", result);
+    atomic_add64(&entry->readers, -1);
 
-    /* either nothing was there or it is the wrong tag. */
     return result;
 }
 
@@ -1639,6 +3309,7 @@ static plc_tag_p map_id_to_tag(plc_tag tag_id_ptr)
 static int release_tag_to_id_mapping(plc_tag_p tag)
 {
     int map_index = 0;
+    tag_map_entry_p entry = NULL;
     int rc = PLCTAG_STATUS_OK;
 
     pdebug(DEBUG_DETAIL, "Starting");
@@ -1649,19 +3320,26 @@ static int release_tag_to_id_mapping(plc_tag_p tag)
     }
 
     map_index = to_tag_index(tag->tag_id);
+    entry = tag_map_entry(map_index);
 
-    if(map_index == TAG_ID_ERROR) {
+    if(!entry) {
         pdebug(DEBUG_ERROR,"Bad tag ID %d!", tag->tag_id);
         return PLCTAG_ERR_BAD_DATA;
     }
 
     /* find the actual slot and check if it is the right tag */
-    if(!tag_map[map_index] || tag_map[map_index] != tag) {
+    if(!entry->tag || entry->tag != tag) {
         pdebug(DEBUG_WARN, "Tag not found or entry is already clear.");
         rc = PLCTAG_ERR_NOT_FOUND;
     } else {
         pdebug(DEBUG_DETAIL,"Releasing tag %p(%d) at location %d",tag, tag->tag_id, map_index);
-        tag_map[map_index] = (plc_tag_p)(intptr_t)0;
+        entry->tag = (plc_tag_p)(intptr_t)0;
+        entry->tag_id = 0;
+
+        /* let any lookup that saw the tag take its reference first. */
+        while(atomic_add64(&entry->readers, 0) > 0) {
+            sleep_ms(1);
+        }
     }
 
     pdebug(DEBUG_DETAIL, "Done.");
@@ -45,6 +45,43 @@ extern mutex_p global_library_mutex;
 typedef struct plc_tag_t *plc_tag_p;
 
 
+/*
+ * Signalled by the protocol layer when an operation on the tag finishes, so
+ * that the blocking API calls do not need to poll.  Requests that are still
+ * in flight can outlive the tag, so this is reference counted.
+ *
+ * If the tag has a callback, the signal also queues this for the callback
+ * dispatcher thread to check the tag.  The queue fields are protected by
+ * the dispatcher mutex.  Threads in plc_tag_wait() hook themselves on to
+ * the waiter list so that one signal wakes them whichever tag finishes.
+ */
+typedef struct tag_done_t *tag_done_p;
+typedef struct tag_waiter_t *tag_waiter_p;
+
+struct tag_done_t {
+    cond_p cond;
+    int tag_id;
+    volatile int callback_enabled;
+
+    /* callback dispatcher queue */
+    tag_done_p next;
+    int queued;
+
+    /* plc_tag_wait() callers, and a count of signals so they can tell which tags changed. */
+    mutex_p waiter_mutex;
+    tag_waiter_p waiters;
+    volatile int generation;
+};
+
+extern void tag_done_signal(tag_done_p done);
+
+
+/* operation a callback is waiting on */
+#define TAG_OP_NONE     (0)
+#define TAG_OP_READ     (1)
+#define TAG_OP_WRITE    (2)
+
+
 /* define tag operation functions */
 typedef int (*tag_abort_func)(plc_tag_p tag);
 typedef int (*tag_destroy_func)(plc_tag_p tag);
@@ -75,6 +112,10 @@ typedef struct tag_vtable_t *tag_vtable_p;
 
 #define TAG_BASE_STRUCT tag_vtable_p vtable; \
                         mutex_p mut; \
+                        tag_done_p done; \
+                        plc_tag_callback_func callback; \
+                        void *userdata; \
+                        int pending_op; \
                         int status; \
                         int endian; \
                         int tag_id; \
@@ -27,6 +27,9 @@
  **************************************************************************/
 
 
+/* for sched_getaffinity() */
+#define _GNU_SOURCE
+
 #include <platform.h>
 #include <unistd.h>
 #include <stdlib.h>
@@ -42,10 +45,16 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <fcntl.h>
 #include <time.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <sched.h>
 
 #include <lib/libplctag.h>
 #include <util/debug.h>
@@ -458,6 +467,27 @@ int mutex_lock(mutex_p m)
 
 
 
+int mutex_try_lock(mutex_p m)
+{
+    if(!m) {
+        pdebug(DEBUG_WARN, "null mutex pointer.");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(!m->initialized) {
+        return PLCTAG_ERR_MUTEX_INIT;
+    }
+
+    /* busy is not worth a message, the caller will wait with mutex_lock(). */
+    if(pthread_mutex_trylock(&(m->p_mutex))) {
+        return PLCTAG_ERR_MUTEX_LOCK;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
 int mutex_unlock(mutex_p m)
 {
     /*pdebug(DEBUG_DETAIL, "unlocking mutex %p",m);*/
@@ -511,6 +541,160 @@ int mutex_destroy(mutex_p *m)
 
 
 
+/***************************************************************************
+ ************************** Condition Variables ****************************
+ **************************************************************************/
+
+/*
+ * These are one-shot signals.  cond_signal() sets a flag and wakes any
+ * waiters.  cond_wait() returns as soon as the flag is set, clearing it,
+ * or PLCTAG_ERR_TIMEOUT.  A signal that arrives before the wait is not lost.
+ */
+
+struct cond_t {
+    pthread_mutex_t p_mutex;
+    pthread_cond_t p_cond;
+    int flag;
+};
+
+int cond_create(cond_p *c)
+{
+    pthread_condattr_t attr;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    *c = (struct cond_t *)mem_alloc(sizeof(struct cond_t));
+
+    if(! *c) {
+        pdebug(DEBUG_ERROR,"Unable to allocate condition variable.");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    if(pthread_mutex_init(&((*c)->p_mutex),NULL)) {
+        mem_free(*c);
+        *c = NULL;
+        pdebug(DEBUG_ERROR,"Error initializing condition variable mutex.");
+        return PLCTAG_ERR_MUTEX_INIT;
+    }
+
+    /* time outs should not jump with the wall clock. */
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+
+    if(pthread_cond_init(&((*c)->p_cond), &attr)) {
+        pthread_condattr_destroy(&attr);
+        pthread_mutex_destroy(&((*c)->p_mutex));
+        mem_free(*c);
+        *c = NULL;
+        pdebug(DEBUG_ERROR,"Error initializing condition variable.");
+        return PLCTAG_ERR_MUTEX_INIT;
+    }
+
+    pthread_condattr_destroy(&attr);
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+int cond_wait(cond_p c, int timeout_ms)
+{
+    struct timespec deadline;
+    int rc = PLCTAG_STATUS_OK;
+
+    if(!c) {
+        pdebug(DEBUG_WARN, "null condition variable pointer.");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+
+    if(deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&(c->p_mutex));
+
+    while(!c->flag) {
+        if(pthread_cond_timedwait(&(c->p_cond), &(c->p_mutex), &deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+
+    if(c->flag) {
+        c->flag = 0;
+    } else {
+        rc = PLCTAG_ERR_TIMEOUT;
+    }
+
+    pthread_mutex_unlock(&(c->p_mutex));
+
+    return rc;
+}
+
+
+int cond_signal(cond_p c)
+{
+    if(!c) {
+        pdebug(DEBUG_WARN, "null condition variable pointer.");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    pthread_mutex_lock(&(c->p_mutex));
+    c->flag = 1;
+    pthread_cond_broadcast(&(c->p_cond));
+    pthread_mutex_unlock(&(c->p_mutex));
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+int cond_clear(cond_p c)
+{
+    if(!c) {
+        pdebug(DEBUG_WARN, "null condition variable pointer.");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    pthread_mutex_lock(&(c->p_mutex));
+    c->flag = 0;
+    pthread_mutex_unlock(&(c->p_mutex));
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+int cond_destroy(cond_p *c)
+{
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(!c || ! *c) {
+        pdebug(DEBUG_WARN, "null condition variable pointer.");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    pthread_cond_destroy(&((*c)->p_cond));
+    pthread_mutex_destroy(&((*c)->p_mutex));
+
+    mem_free(*c);
+
+    *c = NULL;
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+
+
+
 /***************************************************************************
  ******************************* Threads ***********************************
  **************************************************************************/
@@ -695,19 +879,109 @@ extern void lock_release(lock_t *lock)
 }
 
 
+/*
+ * atomic_ptr_cas
+ *
+ * Replace *ptr with new_val only if it still holds old_val.
+ *
+ * Returns non-zero on success.
+ */
+extern int atomic_ptr_cas(void * volatile *ptr, void *old_val, void *new_val)
+{
+    return __sync_bool_compare_and_swap(ptr, old_val, new_val);
+}
+
+
+/*
+ * atomic_ptr_exchange
+ *
+ * Store new_val into *ptr and return what was there before.
+ */
+extern void *atomic_ptr_exchange(void * volatile *ptr, void *new_val)
+{
+    void *old_val;
+
+    /* __sync_lock_test_and_set is only an acquire barrier. */
+    do {
+        old_val = *ptr;
+    } while(!__sync_bool_compare_and_swap(ptr, old_val, new_val));
+
+    return old_val;
+}
+
+
+/*
+ * atomic_add64
+ *
+ * Add val to *ptr and return the new value.
+ */
+extern int64_t atomic_add64(volatile int64_t *ptr, int64_t val)
+{
+    return __sync_add_and_fetch(ptr, val);
+}
+
+
+/*
+ * atomic_int_load
+ *
+ * Read *ptr.  Nothing after this is done before it.
+ */
+extern int atomic_int_load(volatile int *ptr)
+{
+    int val = *ptr;
+
+    __sync_synchronize();
+
+    return val;
+}
+
+
+/*
+ * atomic_int_store
+ *
+ * Write val into *ptr.  Everything before this is done before it.
+ */
+extern void atomic_int_store(volatile int *ptr, int val)
+{
+    __sync_synchronize();
+
+    *ptr = val;
+
+    __sync_synchronize();
+}
+
+
+/*
+ * atomic_int_cas
+ *
+ * Replace *ptr with new_val only if it still holds old_val.
+ *
+ * Returns non-zero on success.
+ */
+extern int atomic_int_cas(volatile int *ptr, int old_val, int new_val)
+{
+    return __sync_bool_compare_and_swap(ptr, old_val, new_val);
+}
+
+
 /***************************************************************************
  ******************************* Sockets ***********************************
  **************************************************************************/
 
+#define MAX_IPS (8)
+
 struct sock_t {
     int fd;
     int port;
     int is_open;
+
+    /* addresses of the host, tried in order by socket_connect_tcp_start() */
+    struct in_addr ips[MAX_IPS];
+    int num_ips;
+    int next_ip;
 };
 
 
-#define MAX_IPS (8)
-
 extern int socket_create(sock_p *s)
 {
     pdebug(DEBUG_DETAIL, "Starting.");
@@ -730,21 +1004,55 @@ extern int socket_create(sock_p *s)
 }
 
 
-extern int socket_connect_tcp(sock_p s, const char *host, int port)
+static int socket_lookup_host(sock_p s, const char *host)
+{
+    struct addrinfo hints;
+    struct addrinfo *res = NULL;
+    struct addrinfo *walker = NULL;
+    int rc = 0;
+
+    /* try a numeric IP address conversion first. */
+    if(inet_pton(AF_INET, host, &s->ips[0]) > 0) {
+        pdebug(DEBUG_DETAIL, "Found numeric IP address: %s",host);
+        s->num_ips = 1;
+        return PLCTAG_STATUS_OK;
+    }
+
+    mem_set(&s->ips, 0, sizeof(s->ips));
+    mem_set(&hints, 0, sizeof(hints));
+
+    hints.ai_socktype = SOCK_STREAM; /* TCP */
+    hints.ai_family = AF_INET; /* IP V4 only */
+
+    if ((rc = getaddrinfo(host, NULL, &hints, &res)) != 0) {
+        pdebug(DEBUG_WARN,"Error looking up PLC IP address %s, error = %d\n", host, rc);
+
+        if(res) {
+            freeaddrinfo(res);
+        }
+
+        return PLCTAG_ERR_BAD_GATEWAY;
+    }
+
+    for(walker = res, s->num_ips = 0; walker && s->num_ips < MAX_IPS; s->num_ips++) {
+        s->ips[s->num_ips].s_addr = ((struct sockaddr_in *)(walker->ai_addr))->sin_addr.s_addr;
+        walker = walker->ai_next;
+    }
+
+    freeaddrinfo(res);
+
+    return (s->num_ips > 0 ? PLCTAG_STATUS_OK : PLCTAG_ERR_BAD_GATEWAY);
+}
+
+
+/* returns a new non-blocking TCP socket or an error code. */
+static int socket_open_tcp(void)
 {
-    struct in_addr ips[MAX_IPS];
-    int num_ips = 0;
-    struct sockaddr_in gw_addr;
     int sock_opt = 1;
-    int i = 0;
-    int done = 0;
     int fd;
     int flags;
-    struct timeval timeout; /* used for timing out connections etc. */
     struct linger so_linger; /* used to set up short/no lingering after connections are close()ed. */
 
-    pdebug(DEBUG_DETAIL,"Starting.");
-
     /* Open a socket for communication with the gateway. */
     fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
 
@@ -763,127 +1071,165 @@ extern int socket_connect_tcp(sock_p s, const char *host, int port)
         return PLCTAG_ERR_OPEN;
     }
 
-    timeout.tv_sec = 10;
-    timeout.tv_usec = 0;
+    /* abort the connection immediately upon close. */
+    so_linger.l_onoff = 1;
+    so_linger.l_linger = 0;
 
-    if(setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, (char*)&timeout, sizeof(timeout))) {
+    if(setsockopt(fd, SOL_SOCKET, SO_LINGER,(char*)&so_linger,sizeof(so_linger))) {
         close(fd);
-        pdebug(DEBUG_ERROR,"Error setting socket receive timeout option, errno: %d",errno);
+        pdebug(DEBUG_ERROR,"Error setting socket close linger option, errno: %d",errno);
         return PLCTAG_ERR_OPEN;
     }
 
-    if(setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, (char*)&timeout, sizeof(timeout))) {
+    /* requests are small and pipelined, do not let Nagle hold them back waiting for ACKs. */
+    sock_opt = 1;
+
+    if(setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (char*)&sock_opt, sizeof(sock_opt))) {
         close(fd);
-        pdebug(DEBUG_ERROR, "Error setting socket set timeout option, errno: %d",errno);
+        pdebug(DEBUG_ERROR,"Error setting socket no delay option, errno: %d",errno);
         return PLCTAG_ERR_OPEN;
     }
 
-    /* abort the connection immediately upon close. */
-    so_linger.l_onoff = 1;
-    so_linger.l_linger = 0;
+    /* everything, including connect(), is non-blocking. */
+    flags=fcntl(fd,F_GETFL,0);
 
-    if(setsockopt(fd, SOL_SOCKET, SO_LINGER,(char*)&so_linger,sizeof(so_linger))) {
+    if(flags<0) {
+        pdebug(DEBUG_ERROR, "Error getting socket options, errno: %d", errno);
         close(fd);
-        pdebug(DEBUG_ERROR,"Error setting socket close linger option, errno: %d",errno);
         return PLCTAG_ERR_OPEN;
     }
 
-    /* figure out what address we are connecting to. */
-
-    /* try a numeric IP address conversion first. */
-    if(inet_pton(AF_INET,host,(struct in_addr *)ips) > 0) {
-        pdebug(DEBUG_DETAIL, "Found numeric IP address: %s",host);
-        num_ips = 1;
-    } else {
-        struct addrinfo hints;
-        struct addrinfo *res=NULL;
-        int rc = 0;
-
-        mem_set(&ips, 0, sizeof(ips));
-        mem_set(&hints, 0, sizeof(hints));
+    flags |= O_NONBLOCK;
 
-        hints.ai_socktype = SOCK_STREAM; /* TCP */
-        hints.ai_family = AF_INET; /* IP V4 only */
+    if(fcntl(fd,F_SETFL,flags)<0) {
+        pdebug(DEBUG_ERROR, "Error setting socket to non-blocking, errno: %d", errno);
+        close(fd);
+        return PLCTAG_ERR_OPEN;
+    }
 
-        if ((rc = getaddrinfo(host, NULL, &hints, &res)) != 0) {
-            pdebug(DEBUG_WARN,"Error looking up PLC IP address %s, error = %d\n", host, rc);
+    return fd;
+}
 
-            if(res) {
-                freeaddrinfo(res);
-            }
 
-            return PLCTAG_ERR_BAD_GATEWAY;
-        }
+/*
+ * socket_connect_tcp_start
+ *
+ * Start connecting to the host without waiting.  Returns PLCTAG_STATUS_PENDING
+ * while the connection is in progress, use socket_connect_tcp_check() once the
+ * socket is writable to see how it went.  If it failed, calling this again
+ * closes the socket and starts on the host's next address.  PLCTAG_ERR_OPEN
+ * means there are no addresses left.
+ *
+ * The host name is looked up on the first call, which can block.
+ */
+extern int socket_connect_tcp_start(sock_p s, const char *host, int port)
+{
+    struct sockaddr_in gw_addr;
+    int rc = PLCTAG_STATUS_OK;
 
-        for(num_ips = 0; res && num_ips < MAX_IPS; num_ips++) {
-            ips[num_ips].s_addr = ((struct sockaddr_in *)(res->ai_addr))->sin_addr.s_addr;
-            res = res->ai_next;
-        }
+    pdebug(DEBUG_DETAIL,"Starting.");
 
-        freeaddrinfo(res);
+    if(!s || !host) {
+        return PLCTAG_ERR_NULL_PTR;
     }
 
+    /* give up on the address we were trying. */
+    if(s->is_open) {
+        close(s->fd);
+        s->fd = -1;
+        s->is_open = 0;
+    }
 
-    /* now try to connect to the remote gateway.  We may need to
-     * try several of the IPs we have.
-     */
+    /* figure out what address we are connecting to. */
+    if(!s->num_ips) {
+        if((rc = socket_lookup_host(s, host)) != PLCTAG_STATUS_OK) {
+            return rc;
+        }
 
-    i = 0;
-    done = 0;
+        s->next_ip = 0;
+    }
 
     memset((void *)&gw_addr,0, sizeof(gw_addr));
     gw_addr.sin_family = AF_INET ;
     gw_addr.sin_port = htons(port);
 
-    do {
-        int rc;
-        /* try each IP until we run out or get a connection. */
-        gw_addr.sin_addr.s_addr = ips[i].s_addr;
+    /* try each IP until we run out or one gets going. */
+    while(s->next_ip < s->num_ips) {
+        int fd = socket_open_tcp();
 
-        pdebug(DEBUG_DETAIL, "Attempting to connect to %s",inet_ntoa(*((struct in_addr *)&ips[i])));
+        if(fd < 0) {
+            return fd;
+        }
+
+        gw_addr.sin_addr.s_addr = s->ips[s->next_ip].s_addr;
+        s->next_ip++;
+
+        pdebug(DEBUG_DETAIL, "Attempting to connect to %s",inet_ntoa(gw_addr.sin_addr));
 
         rc = connect(fd,(struct sockaddr *)&gw_addr,sizeof(gw_addr));
 
-        if( rc == 0) {
-            pdebug(DEBUG_DETAIL, "Attempt to connect to %s succeeded.",inet_ntoa(*((struct in_addr *)&ips[i])));
-            done = 1;
-        } else {
-            pdebug(DEBUG_DETAIL, "Attempt to connect to %s failed, errno: %d",inet_ntoa(*((struct in_addr *)&ips[i])),errno);
-            i++;
+        if(rc == 0 || errno == EINPROGRESS) {
+            s->fd = fd;
+            s->port = port;
+            s->is_open = 1;
+
+            pdebug(DEBUG_DETAIL, "Done.");
+
+            return (rc == 0 ? PLCTAG_STATUS_OK : PLCTAG_STATUS_PENDING);
         }
-    } while(!done && i < num_ips);
 
-    if(!done) {
+        pdebug(DEBUG_DETAIL, "Attempt to connect to %s failed, errno: %d",inet_ntoa(gw_addr.sin_addr),errno);
+
         close(fd);
-        pdebug(DEBUG_ERROR, "Unable to connect to any gateway host IP address!");
-        return PLCTAG_ERR_OPEN;
     }
 
+    pdebug(DEBUG_WARN, "Unable to connect to any gateway host IP address!");
 
-    /* FIXME
-     * connect() is a little easier to handle in blocking mode, for now
-     * we make the socket non-blocking here, after connect(). */
-    flags=fcntl(fd,F_GETFL,0);
+    return PLCTAG_ERR_OPEN;
+}
 
-    if(flags<0) {
-        pdebug(DEBUG_ERROR, "Error getting socket options, errno: %d", errno);
-        close(fd);
+
+/*
+ * socket_connect_tcp_check
+ *
+ * See if a connection started by socket_connect_tcp_start() is done.
+ * Returns PLCTAG_STATUS_OK once connected, PLCTAG_STATUS_PENDING if it
+ * is still going or PLCTAG_ERR_OPEN if it failed.
+ */
+extern int socket_connect_tcp_check(sock_p s)
+{
+    struct pollfd pfd;
+    int sock_err = 0;
+    socklen_t err_len = sizeof(sock_err);
+    int rc;
+
+    if(!s) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(!s->is_open) {
         return PLCTAG_ERR_OPEN;
     }
 
-    flags |= O_NONBLOCK;
+    pfd.fd = s->fd;
+    pfd.events = POLLOUT;
+    pfd.revents = 0;
 
-    if(fcntl(fd,F_SETFL,flags)<0) {
-        pdebug(DEBUG_ERROR, "Error setting socket to non-blocking, errno: %d", errno);
-        close(fd);
-        return PLCTAG_ERR_OPEN;
+    rc = poll(&pfd, 1, 0);
+
+    if(rc == 0 || (rc < 0 && errno == EINTR)) {
+        return PLCTAG_STATUS_PENDING;
     }
 
-    /* save the values */
-    s->fd = fd;
-    s->port = port;
+    if(rc < 0 || getsockopt(s->fd, SOL_SOCKET, SO_ERROR, &sock_err, &err_len)) {
+        pdebug(DEBUG_WARN, "Unable to get socket connection status, errno: %d", errno);
+        return PLCTAG_ERR_OPEN;
+    }
 
-    pdebug(DEBUG_DETAIL, "Done.");
+    if(sock_err) {
+        pdebug(DEBUG_DETAIL, "Connection attempt failed, error: %d", sock_err);
+        return PLCTAG_ERR_OPEN;
+    }
 
     return PLCTAG_STATUS_OK;
 }
@@ -940,6 +1286,47 @@ extern int socket_write(sock_p s, uint8_t *buf, int size)
 
 
 
+/*
+ * socket_write_many
+ *
+ * Write the buffers in order with one system call.  Returns the number
+ * of bytes written, which may stop partway through any buffer.
+ */
+extern int socket_write_many(sock_p s, sock_buf_t *bufs, int num_bufs)
+{
+    struct iovec iov[SOCK_MAX_WRITE_BUFS];
+    ssize_t rc;
+
+    if(!s || !bufs) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(num_bufs < 1 || num_bufs > SOCK_MAX_WRITE_BUFS) {
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    for(int i=0; i < num_bufs; i++) {
+        iov[i].iov_base = bufs[i].data;
+        iov[i].iov_len = (size_t)bufs[i].size;
+    }
+
+    /* The socket is non-blocking. */
+    rc = writev(s->fd, iov, num_bufs);
+
+    if(rc < 0) {
+        if(errno == EAGAIN || errno == EWOULDBLOCK) {
+            return PLCTAG_ERR_NO_DATA;
+        } else {
+            pdebug(DEBUG_WARN, "Socket write error: rc=%d, errno=%d", (int)rc, errno);
+            return PLCTAG_ERR_WRITE;
+        }
+    }
+
+    return (int)rc;
+}
+
+
+
 extern int socket_close(sock_p s)
 {
     /*pdebug(1,"Starting.");*/
@@ -947,6 +1334,13 @@ extern int socket_close(sock_p s)
     if(!s)
         return PLCTAG_ERR_NULL_PTR;
 
+    /* do not close the fd twice, it may have been reused already. */
+    if(!s->is_open) {
+        return PLCTAG_STATUS_OK;
+    }
+
+    s->is_open = 0;
+
     return close(s->fd);
 }
 
@@ -968,6 +1362,285 @@ extern int socket_destroy(sock_p *s)
 
 
 
+/***************************************************************************
+ ************************** Socket Readiness *******************************
+ **************************************************************************/
+
+/*
+ * A sock_poll_t wraps an epoll instance and an eventfd.  Sockets are
+ * registered with a context pointer that is handed back when they become
+ * ready.  The eventfd lets other threads kick a thread blocked in
+ * sock_poll_wait(), for instance when new work is queued.
+ *
+ * Registration is level-triggered.
+ */
+
+struct sock_poll_t {
+    int epoll_fd;
+    int wake_fd;
+};
+
+#define SOCK_POLL_MAX_EVENTS (64)
+
+
+static uint32_t sock_poll_to_epoll_events(int events)
+{
+    uint32_t ep_events = EPOLLRDHUP;
+
+    if(events & SOCK_EVENT_READ) {
+        ep_events |= EPOLLIN;
+    }
+
+    if(events & SOCK_EVENT_WRITE) {
+        ep_events |= EPOLLOUT;
+    }
+
+    return ep_events;
+}
+
+
+extern int sock_poll_create(sock_poll_p *p)
+{
+    struct epoll_event ev;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(!p) {
+        pdebug(DEBUG_WARN, "null poll pointer.");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    *p = (sock_poll_p)mem_alloc(sizeof(struct sock_poll_t));
+
+    if(! *p) {
+        pdebug(DEBUG_ERROR, "Failed to allocate memory for socket poll set.");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    (*p)->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+    if((*p)->epoll_fd < 0) {
+        pdebug(DEBUG_ERROR, "Unable to create epoll instance, errno: %d", errno);
+        mem_free(*p);
+        *p = NULL;
+        return PLCTAG_ERR_CREATE;
+    }
+
+    (*p)->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    if((*p)->wake_fd < 0) {
+        pdebug(DEBUG_ERROR, "Unable to create wake up eventfd, errno: %d", errno);
+        close((*p)->epoll_fd);
+        mem_free(*p);
+        *p = NULL;
+        return PLCTAG_ERR_CREATE;
+    }
+
+    /* the wake up fd has a NULL context so that we can tell it apart. */
+    mem_set(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+
+    if(epoll_ctl((*p)->epoll_fd, EPOLL_CTL_ADD, (*p)->wake_fd, &ev)) {
+        pdebug(DEBUG_ERROR, "Unable to add wake up eventfd to epoll set, errno: %d", errno);
+        close((*p)->wake_fd);
+        close((*p)->epoll_fd);
+        mem_free(*p);
+        *p = NULL;
+        return PLCTAG_ERR_CREATE;
+    }
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+static int sock_poll_ctl(sock_poll_p p, int op, sock_p s, int events, void *context)
+{
+    struct epoll_event ev;
+
+    if(!p || !s) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(!s->is_open) {
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    /* a NULL context is reserved for the wake up fd. */
+    if(!context) {
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    mem_set(&ev, 0, sizeof(ev));
+    ev.events = sock_poll_to_epoll_events(events);
+    ev.data.ptr = context;
+
+    if(epoll_ctl(p->epoll_fd, op, s->fd, &ev)) {
+        pdebug(DEBUG_WARN, "epoll_ctl(%d) failed for fd %d, errno: %d", op, s->fd, errno);
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+extern int sock_poll_add(sock_poll_p p, sock_p s, int events, void *context)
+{
+    return sock_poll_ctl(p, EPOLL_CTL_ADD, s, events, context);
+}
+
+
+extern int sock_poll_modify(sock_poll_p p, sock_p s, int events, void *context)
+{
+    return sock_poll_ctl(p, EPOLL_CTL_MOD, s, events, context);
+}
+
+
+/*
+ * sock_poll_remove
+ *
+ * Once this returns, no later call to sock_poll_wait() will report the socket.
+ * This must be called before the socket is closed.
+ */
+extern int sock_poll_remove(sock_poll_p p, sock_p s)
+{
+    struct epoll_event ev;
+
+    if(!p || !s) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(!s->is_open) {
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    /* old kernels want a non-NULL event pointer even for deletion. */
+    mem_set(&ev, 0, sizeof(ev));
+
+    if(epoll_ctl(p->epoll_fd, EPOLL_CTL_DEL, s->fd, &ev)) {
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/*
+ * sock_poll_wait
+ *
+ * Block until at least one registered socket is ready, another thread calls
+ * sock_poll_wakeup() or the timeout passes.  A negative timeout waits forever.
+ *
+ * Returns the number of socket events stored in the events array, which can be
+ * zero on a wake up or timeout, or an error code.
+ */
+extern int sock_poll_wait(sock_poll_p p, sock_event_t *events, int max_events, int timeout_ms)
+{
+    struct epoll_event ep_events[SOCK_POLL_MAX_EVENTS];
+    int num_ready = 0;
+    int num_events = 0;
+
+    if(!p || !events) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(max_events > SOCK_POLL_MAX_EVENTS) {
+        max_events = SOCK_POLL_MAX_EVENTS;
+    }
+
+    if(max_events <= 0) {
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    num_ready = epoll_wait(p->epoll_fd, ep_events, max_events, timeout_ms);
+
+    if(num_ready < 0) {
+        if(errno == EINTR) {
+            return 0;
+        }
+
+        pdebug(DEBUG_WARN, "epoll_wait failed, errno: %d", errno);
+        return PLCTAG_ERR_READ;
+    }
+
+    for(int i=0; i < num_ready; i++) {
+        if(!ep_events[i].data.ptr) {
+            uint64_t count;
+
+            /* drain the wake up counter, it is level-triggered like everything else. */
+            if(read(p->wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+                pdebug(DEBUG_WARN, "Error draining wake up eventfd, errno: %d", errno);
+            }
+
+            continue;
+        }
+
+        events[num_events].context = ep_events[i].data.ptr;
+        events[num_events].events = SOCK_EVENT_NONE;
+
+        if(ep_events[i].events & EPOLLIN) {
+            events[num_events].events |= SOCK_EVENT_READ;
+        }
+
+        if(ep_events[i].events & EPOLLOUT) {
+            events[num_events].events |= SOCK_EVENT_WRITE;
+        }
+
+        if(ep_events[i].events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) {
+            events[num_events].events |= SOCK_EVENT_ERROR;
+        }
+
+        num_events++;
+    }
+
+    return num_events;
+}
+
+
+/*
+ * sock_poll_wakeup
+ *
+ * Safe to call from any thread.  Multiple wake ups before the waiting thread
+ * runs are collapsed into one.
+ */
+extern int sock_poll_wakeup(sock_poll_p p)
+{
+    uint64_t one = 1;
+
+    if(!p) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(write(p->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        pdebug(DEBUG_WARN, "Unable to signal wake up eventfd, errno: %d", errno);
+        return PLCTAG_ERR_WRITE;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+extern int sock_poll_destroy(sock_poll_p *p)
+{
+    if(!p || !*p) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    close((*p)->wake_fd);
+    close((*p)->epoll_fd);
+
+    mem_free(*p);
+
+    *p = NULL;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+
 
 
 
@@ -1011,3 +1684,44 @@ int64_t time_ms(void)
     return  ((int64_t)tv.tv_sec*1000)+ ((int64_t)tv.tv_usec/1000);
 }
 
+
+/*
+ * cpu_count
+ *
+ * Return the number of CPUs this process may run on, at least one.
+ * taskset and cpusets can make that fewer than are online.
+ */
+int cpu_count(void)
+{
+    cpu_set_t cpus;
+    long count;
+
+    if(sched_getaffinity(0, sizeof(cpus), &cpus) == 0) {
+        count = CPU_COUNT(&cpus);
+    } else {
+        count = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+
+    return (count < 1 ? 1 : (int)count);
+}
+
+
+/*
+ * thread_slot
+ *
+ * Return a small number for the calling thread, handed out in turn as
+ * threads first ask.  Shared counters and free lists use it to spread
+ * threads over separate copies.
+ */
+static volatile int64_t next_thread_slot = 0;
+static THREAD_LOCAL int this_thread_slot = -1;
+
+int thread_slot(void)
+{
+    if(this_thread_slot < 0) {
+        this_thread_slot = (int)((atomic_add64(&next_thread_slot, 1) - 1) & 0x7FFFFFFF);
+    }
+
+    return this_thread_slot;
+}
+
@@ -98,9 +98,18 @@ extern char *str_concat_impl(int num_args, ...);
 typedef struct mutex_t *mutex_p;
 extern int mutex_create(mutex_p *m);
 extern int mutex_lock(mutex_p m);
+extern int mutex_try_lock(mutex_p m); /* PLCTAG_STATUS_OK only if it got the lock without waiting */
 extern int mutex_unlock(mutex_p m);
 extern int mutex_destroy(mutex_p *m);
 
+/* one-shot completion signals */
+typedef struct cond_t *cond_p;
+extern int cond_create(cond_p *c);
+extern int cond_wait(cond_p c, int timeout_ms);
+extern int cond_signal(cond_p c);
+extern int cond_clear(cond_p c);
+extern int cond_destroy(cond_p *c);
+
 
 
 /* macros are evil */
@@ -149,15 +158,58 @@ typedef int lock_t;
 extern int lock_acquire(lock_t *lock);
 extern void lock_release(lock_t *lock);
 
+/* full barrier pointer operations, the CAS returns non-zero when the swap happened */
+extern int atomic_ptr_cas(void * volatile *ptr, void *old_val, void *new_val);
+extern void *atomic_ptr_exchange(void * volatile *ptr, void *new_val);
+extern int64_t atomic_add64(volatile int64_t *ptr, int64_t val);
+
+/* for a flag or status one thread sets after filling in what it covers, and others read without a lock. */
+extern int atomic_int_load(volatile int *ptr);
+extern void atomic_int_store(volatile int *ptr, int val);
+
+/* full barrier, returns non-zero when *ptr held old_val and now holds new_val */
+extern int atomic_int_cas(volatile int *ptr, int old_val, int new_val);
+
 /* socket functions */
 typedef struct sock_t *sock_p;
 extern int socket_create(sock_p *s);
-extern int socket_connect_tcp(sock_p s, const char *host, int port);
+extern int socket_connect_tcp_start(sock_p s, const char *host, int port);
+extern int socket_connect_tcp_check(sock_p s);
 extern int socket_read(sock_p s, uint8_t *buf, int size);
 extern int socket_write(sock_p s, uint8_t *buf, int size);
+
+/* gather write, at most SOCK_MAX_WRITE_BUFS buffers per call */
+#define SOCK_MAX_WRITE_BUFS (64)
+
+typedef struct {
+    uint8_t *data;
+    int size;
+} sock_buf_t;
+
+extern int socket_write_many(sock_p s, sock_buf_t *bufs, int num_bufs);
 extern int socket_close(sock_p s);
 extern int socket_destroy(sock_p *s);
 
+/* socket readiness and wakeup */
+#define SOCK_EVENT_NONE     (0)
+#define SOCK_EVENT_READ     (1)
+#define SOCK_EVENT_WRITE    (2)
+#define SOCK_EVENT_ERROR    (4)
+
+typedef struct {
+    void *context;
+    int events;
+} sock_event_t;
+
+typedef struct sock_poll_t *sock_poll_p;
+extern int sock_poll_create(sock_poll_p *p);
+extern int sock_poll_add(sock_poll_p p, sock_p s, int events, void *context);
+extern int sock_poll_modify(sock_poll_p p, sock_p s, int events, void *context);
+extern int sock_poll_remove(sock_poll_p p, sock_p s);
+extern int sock_poll_wait(sock_poll_p p, sock_event_t *events, int max_events, int timeout_ms);
+extern int sock_poll_wakeup(sock_poll_p p);
+extern int sock_poll_destroy(sock_poll_p *p);
+
 /* serial handling */
 typedef struct serial_port_t *serial_port_p;
 #define PLC_SERIAL_PORT_NULL ((plc_serial_port)NULL)
@@ -171,6 +223,8 @@ extern int plc_lib_serial_port_write(serial_port_p serial_port, uint8_t *data, i
 /* misc functions */
 extern int sleep_ms(int ms);
 extern int64_t time_ms(void);
+extern int cpu_count(void);
+extern int thread_slot(void);
 
 #define snprintf_platform snprintf
 
@@ -492,6 +492,26 @@ int mutex_lock(mutex_p m)
 
 
 
+int mutex_try_lock(mutex_p m)
+{
+    if(!m) {
+        /*pdebug("null mutex pointer.");*/
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(!m->initialized) {
+        return PLCTAG_ERR_MUTEX_INIT;
+    }
+
+    if(WaitForSingleObject(m->h_mutex, 0) != WAIT_OBJECT_0) {
+        return PLCTAG_ERR_MUTEX_LOCK;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
 int mutex_unlock(mutex_p m)
 {
     //pdebug("Starting.");
@@ -540,6 +560,114 @@ int mutex_destroy(mutex_p *m)
 
 
 
+/***************************************************************************
+ ************************** Condition Variables ****************************
+ **************************************************************************/
+
+/*
+ * These are one-shot signals.  cond_signal() sets a flag and wakes any
+ * waiters.  cond_wait() returns as soon as the flag is set, clearing it,
+ * or PLCTAG_ERR_TIMEOUT.  A signal that arrives before the wait is not lost.
+ *
+ * An auto-reset event does exactly this.
+ */
+
+struct cond_t {
+    HANDLE h_event;
+};
+
+int cond_create(cond_p *c)
+{
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    *c = (struct cond_t *)mem_alloc(sizeof(struct cond_t));
+
+    if(! *c) {
+        pdebug(DEBUG_ERROR,"Unable to allocate condition variable.");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    (*c)->h_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+
+    if(!(*c)->h_event) {
+        mem_free(*c);
+        *c = NULL;
+        pdebug(DEBUG_ERROR,"Error initializing condition variable.");
+        return PLCTAG_ERR_MUTEX_INIT;
+    }
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+int cond_wait(cond_p c, int timeout_ms)
+{
+    if(!c) {
+        pdebug(DEBUG_WARN, "null condition variable pointer.");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(WaitForSingleObject(c->h_event, (DWORD)timeout_ms) != WAIT_OBJECT_0) {
+        return PLCTAG_ERR_TIMEOUT;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+int cond_signal(cond_p c)
+{
+    if(!c) {
+        pdebug(DEBUG_WARN, "null condition variable pointer.");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    SetEvent(c->h_event);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+int cond_clear(cond_p c)
+{
+    if(!c) {
+        pdebug(DEBUG_WARN, "null condition variable pointer.");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    ResetEvent(c->h_event);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+int cond_destroy(cond_p *c)
+{
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(!c || ! *c) {
+        pdebug(DEBUG_WARN, "null condition variable pointer.");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    CloseHandle((*c)->h_event);
+
+    mem_free(*c);
+
+    *c = NULL;
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+
+
+
 /***************************************************************************
  ******************************* Threads ***********************************
  **************************************************************************/
@@ -746,6 +874,76 @@ extern void lock_release(lock_t *lock)
 }
 
 
+/*
+ * atomic_ptr_cas
+ *
+ * Replace *ptr with new_val only if it still holds old_val.
+ *
+ * Returns non-zero on success.
+ */
+extern int atomic_ptr_cas(void * volatile *ptr, void *old_val, void *new_val)
+{
+    return InterlockedCompareExchangePointer((PVOID volatile *)ptr, new_val, old_val) == old_val;
+}
+
+
+/*
+ * atomic_ptr_exchange
+ *
+ * Store new_val into *ptr and return what was there before.
+ */
+extern void *atomic_ptr_exchange(void * volatile *ptr, void *new_val)
+{
+    return InterlockedExchangePointer((PVOID volatile *)ptr, new_val);
+}
+
+
+/*
+ * atomic_add64
+ *
+ * Add val to *ptr and return the new value.
+ */
+extern int64_t atomic_add64(volatile int64_t *ptr, int64_t val)
+{
+    return InterlockedExchangeAdd64((LONGLONG volatile *)ptr, val) + val;
+}
+
+
+/*
+ * atomic_int_load
+ *
+ * Read *ptr.  Nothing after this is done before it.
+ */
+extern int atomic_int_load(volatile int *ptr)
+{
+    return (int)InterlockedCompareExchange((LONG volatile *)ptr, 0, 0);
+}
+
+
+/*
+ * atomic_int_store
+ *
+ * Write val into *ptr.  Everything before this is done before it.
+ */
+extern void atomic_int_store(volatile int *ptr, int val)
+{
+    InterlockedExchange((LONG volatile *)ptr, (LONG)val);
+}
+
+
+/*
+ * atomic_int_cas
+ *
+ * Replace *ptr with new_val only if it still holds old_val.
+ *
+ * Returns non-zero on success.
+ */
+extern int atomic_int_cas(volatile int *ptr, int old_val, int new_val)
+{
+    return InterlockedCompareExchange((LONG volatile *)ptr, (LONG)new_val, (LONG)old_val) == (LONG)old_val;
+}
+
+
 
 
 
@@ -758,14 +956,18 @@ extern void lock_release(lock_t *lock)
  **************************************************************************/
 
 
+#define MAX_IPS (8)
+
 struct sock_t {
     int fd;
     int port;
     int is_open;
-};
 
-
-#define MAX_IPS (8)
+    /* addresses of the host, tried in order by socket_connect_tcp_start() */
+    IN_ADDR ips[MAX_IPS];
+    int num_ips;
+    int next_ip;
+};
 
 
 /* windows needs to have the Winsock library initialized
@@ -809,21 +1011,55 @@ extern int socket_create(sock_p *s)
 
 
 
-extern int socket_connect_tcp(sock_p s, const char *host, int port)
+static int socket_lookup_host(sock_p s, const char *host)
+{
+    struct addrinfo hints;
+    struct addrinfo *res = NULL;
+    struct addrinfo *walker = NULL;
+    int rc = 0;
+
+    /* try a numeric IP address conversion first. */
+    if(inet_pton(AF_INET, host, &s->ips[0]) > 0) {
+        pdebug(DEBUG_DETAIL, "Found numeric IP address: %s", host);
+        s->num_ips = 1;
+        return PLCTAG_STATUS_OK;
+    }
+
+    mem_set(&s->ips, 0, sizeof(s->ips));
+    mem_set(&hints, 0, sizeof(hints));
+
+    hints.ai_socktype = SOCK_STREAM; /* TCP */
+    hints.ai_family = AF_INET; /* IP V4 only */
+
+    if ((rc = getaddrinfo(host, NULL, &hints, &res)) != 0) {
+        pdebug(DEBUG_WARN, "Error looking up PLC IP address %s, error = %d\n", host, rc);
+
+        if (res) {
+            freeaddrinfo(res);
+        }
+
+        return PLCTAG_ERR_BAD_GATEWAY;
+    }
+
+    for (walker = res, s->num_ips = 0; walker && s->num_ips < MAX_IPS; s->num_ips++) {
+        s->ips[s->num_ips].s_addr = ((struct sockaddr_in *)(walker->ai_addr))->sin_addr.s_addr;
+        walker = walker->ai_next;
+    }
+
+    freeaddrinfo(res);
+
+    return (s->num_ips > 0 ? PLCTAG_STATUS_OK : PLCTAG_ERR_BAD_GATEWAY);
+}
+
+
+/* returns a new non-blocking TCP socket or an error code. */
+static int socket_open_tcp(void)
 {
-    IN_ADDR ips[MAX_IPS];
-    int num_ips = 0;
-    struct sockaddr_in gw_addr;
     int sock_opt = 1;
     u_long non_blocking=1;
-    int i = 0;
-    int done = 0;
     int fd;
-    struct timeval timeout; /* used for timing out connections etc. */
     struct linger so_linger;
 
-    pdebug(DEBUG_DETAIL, "Starting.");
-
     /* Open a socket for communication with the gateway. */
     fd = socket(AF_INET, SOCK_STREAM, 0/*IPPROTO_TCP*/);
 
@@ -842,126 +1078,161 @@ extern int socket_connect_tcp(sock_p s, const char *host, int port)
         return PLCTAG_ERR_OPEN;
     }
 
-    timeout.tv_sec = 10;
-    timeout.tv_usec = 0;
+    /* abort the connection on close. */
+    so_linger.l_onoff = 1;
+    so_linger.l_linger = 0;
 
-    if(setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, (char*)&timeout, sizeof(timeout))) {
+    if(setsockopt(fd, SOL_SOCKET, SO_LINGER,(char*)&so_linger,sizeof(so_linger))) {
         closesocket(fd);
-        pdebug(DEBUG_WARN,"Error setting socket receive timeout option, errno: %d",errno);
+        pdebug(DEBUG_ERROR,"Error setting socket close linger option, errno: %d",errno);
         return PLCTAG_ERR_OPEN;
     }
 
-    if(setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, (char*)&timeout, sizeof(timeout))) {
+    /* requests are small and pipelined, do not let Nagle hold them back waiting for ACKs. */
+    sock_opt = 1;
+
+    if(setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (char*)&sock_opt, sizeof(sock_opt))) {
         closesocket(fd);
-        pdebug(DEBUG_WARN,"Error setting socket set timeout option, errno: %d",errno);
+        pdebug(DEBUG_ERROR,"Error setting socket no delay option, errno: %d",errno);
         return PLCTAG_ERR_OPEN;
     }
 
-    /* abort the connection on close. */
-    so_linger.l_onoff = 1;
-    so_linger.l_linger = 0;
-
-    if(setsockopt(fd, SOL_SOCKET, SO_LINGER,(char*)&so_linger,sizeof(so_linger))) {
+    /* everything, including connect(), is non-blocking. */
+    if(ioctlsocket(fd,FIONBIO,&non_blocking)) {
+        /*pdebug("Error getting socket options, errno: %d", errno);*/
         closesocket(fd);
-        pdebug(DEBUG_ERROR,"Error setting socket close linger option, errno: %d",errno);
         return PLCTAG_ERR_OPEN;
     }
 
-    /* figure out what address we are connecting to. */
-
-    /* try a numeric IP address conversion first. */
-    if(inet_pton(AF_INET,host,(struct in_addr *)ips) > 0) {
-        pdebug(DEBUG_DETAIL, "Found numeric IP address: %s", host);
-        num_ips = 1;
-    } else {
-        struct addrinfo hints;
-        struct addrinfo *res = NULL;
-        int rc = 0;
+    return fd;
+}
 
-        mem_set(&ips, 0, sizeof(ips));
-        mem_set(&hints, 0, sizeof(hints));
 
-        hints.ai_socktype = SOCK_STREAM; /* TCP */
-        hints.ai_family = AF_INET; /* IP V4 only */
+/*
+ * socket_connect_tcp_start
+ *
+ * Start connecting to the host without waiting.  Returns PLCTAG_STATUS_PENDING
+ * while the connection is in progress, use socket_connect_tcp_check() once the
+ * socket is writable to see how it went.  If it failed, calling this again
+ * closes the socket and starts on the host's next address.  PLCTAG_ERR_OPEN
+ * means there are no addresses left.
+ *
+ * The host name is looked up on the first call, which can block.
+ */
+extern int socket_connect_tcp_start(sock_p s, const char *host, int port)
+{
+    struct sockaddr_in gw_addr;
+    int rc = PLCTAG_STATUS_OK;
 
-        if ((rc = getaddrinfo(host, NULL, &hints, &res)) != 0) {
-            pdebug(DEBUG_WARN, "Error looking up PLC IP address %s, error = %d\n", host, rc);
+    pdebug(DEBUG_DETAIL, "Starting.");
 
-            if (res) {
-                freeaddrinfo(res);
-            }
+    if(!s || !host) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
 
-            return PLCTAG_ERR_BAD_GATEWAY;
-        }
+    /* give up on the address we were trying. */
+    if(s->is_open) {
+        closesocket(s->fd);
+        s->fd = 0;
+        s->is_open = 0;
+    }
 
-        for (num_ips = 0; res && num_ips < MAX_IPS; num_ips++) {
-            ips[num_ips].s_addr = ((struct sockaddr_in *)(res->ai_addr))->sin_addr.s_addr;
-            res = res->ai_next;
+    /* figure out what address we are connecting to. */
+    if(!s->num_ips) {
+        if((rc = socket_lookup_host(s, host)) != PLCTAG_STATUS_OK) {
+            return rc;
         }
 
-        freeaddrinfo(res);
+        s->next_ip = 0;
     }
 
-
-    /* now try to connect to the remote gateway.  We may need to
-     * try several of the IPs we have.
-     */
-
-    i = 0;
-    done = 0;
-
     memset((void *)&gw_addr,0, sizeof(gw_addr));
     gw_addr.sin_family = AF_INET ;
     gw_addr.sin_port = htons(port);
 
-    do {
-        int rc;
-        /* try each IP until we run out or get a connection. */
-        gw_addr.sin_addr.s_addr = ips[i].s_addr;
+    /* try each IP until we run out or one gets going. */
+    while(s->next_ip < s->num_ips) {
+        int fd = socket_open_tcp();
 
-        /*pdebug(DEBUG_DETAIL,"Attempting to connect to %s",inet_ntoa(*((struct in_addr *)&ips[i])));*/
+        if(fd < 0) {
+            return fd;
+        }
+
+        gw_addr.sin_addr.s_addr = s->ips[s->next_ip].s_addr;
+        s->next_ip++;
 
         rc = connect(fd,(struct sockaddr *)&gw_addr,sizeof(gw_addr));
 
-        if( rc == 0) {
-            /* Windows MSVC does not like inet_ntoa(), not safe.
-             * pdebug(DEBUG_DETAIL, "Attempt to connect to %s succeeded.",inet_ntoa(*((struct in_addr *)&ips[i])));
-             */
-            done = 1;
-        } else {
-            /* MSVC does not like inet_ntoa(), not safe.
-             * pdebug(DEBUG_DETAIL, "Attempt to connect to %s failed, errno: %d",inet_ntoa(*((struct in_addr *)&ips[i])),errno);
-             */
-            i++;
+        if(rc == 0 || WSAGetLastError() == WSAEWOULDBLOCK) {
+            s->fd = fd;
+            s->port = port;
+            s->is_open = 1;
+
+            pdebug(DEBUG_DETAIL, "Done.");
+
+            return (rc == 0 ? PLCTAG_STATUS_OK : PLCTAG_STATUS_PENDING);
         }
-    } while(!done && i < num_ips);
 
-    if(!done) {
+        /* MSVC does not like inet_ntoa(), not safe. */
+        pdebug(DEBUG_DETAIL, "Attempt to connect to address %d failed, error: %d", s->next_ip, WSAGetLastError());
+
         closesocket(fd);
-        pdebug(DEBUG_WARN,"Unable to connect to any gateway host IP address!");
+    }
+
+    pdebug(DEBUG_WARN,"Unable to connect to any gateway host IP address!");
+
+    return PLCTAG_ERR_OPEN;
+}
+
+
+/*
+ * socket_connect_tcp_check
+ *
+ * See if a connection started by socket_connect_tcp_start() is done.
+ * Returns PLCTAG_STATUS_OK once connected, PLCTAG_STATUS_PENDING if it
+ * is still going or PLCTAG_ERR_OPEN if it failed.
+ */
+extern int socket_connect_tcp_check(sock_p s)
+{
+    fd_set write_set;
+    fd_set error_set;
+    struct timeval tv;
+    int rc;
+
+    if(!s) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(!s->is_open) {
         return PLCTAG_ERR_OPEN;
     }
 
+    FD_ZERO(&write_set);
+    FD_ZERO(&error_set);
+    FD_SET(s->fd, &write_set);
+    FD_SET(s->fd, &error_set);
 
-    /* FIXME
-     * connect() is a little easier to handle in blocking mode, for now
-     * we make the socket non-blocking here, after connect().
-     */
+    tv.tv_sec = 0;
+    tv.tv_usec = 0;
 
-    if(ioctlsocket(fd,FIONBIO,&non_blocking)) {
-        /*pdebug("Error getting socket options, errno: %d", errno);*/
-        closesocket(fd);
+    /* a failed connect() shows up in the exception set on Windows. */
+    rc = select(0, NULL, &write_set, &error_set, &tv);
+
+    if(rc == SOCKET_ERROR) {
+        pdebug(DEBUG_WARN, "Unable to get socket connection status, error: %d", WSAGetLastError());
         return PLCTAG_ERR_OPEN;
     }
 
-    /* save the values */
-    s->fd = fd;
-    s->port = port;
-    s->is_open = 1;
+    if(FD_ISSET(s->fd, &error_set)) {
+        pdebug(DEBUG_DETAIL, "Connection attempt failed.");
+        return PLCTAG_ERR_OPEN;
+    }
 
-    pdebug(DEBUG_DETAIL, "Done.");
+    if(FD_ISSET(s->fd, &write_set)) {
+        return PLCTAG_STATUS_OK;
+    }
 
-    return PLCTAG_STATUS_OK;
+    return PLCTAG_STATUS_PENDING;
 }
 
 
@@ -1026,6 +1297,50 @@ extern int socket_write(sock_p s, uint8_t *buf, int size)
 
 
 
+/*
+ * socket_write_many
+ *
+ * Write the buffers in order with one system call.  Returns the number
+ * of bytes written, which may stop partway through any buffer.
+ */
+extern int socket_write_many(sock_p s, sock_buf_t *bufs, int num_bufs)
+{
+    WSABUF wsa_bufs[SOCK_MAX_WRITE_BUFS];
+    DWORD sent = 0;
+    int rc;
+    int err;
+
+    if(!s || !bufs) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(num_bufs < 1 || num_bufs > SOCK_MAX_WRITE_BUFS) {
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    for(int i=0; i < num_bufs; i++) {
+        wsa_bufs[i].buf = (char *)bufs[i].data;
+        wsa_bufs[i].len = (ULONG)bufs[i].size;
+    }
+
+    /* The socket is non-blocking. */
+    rc = WSASend(s->fd, wsa_bufs, (DWORD)num_bufs, &sent, 0, NULL, NULL);
+
+    if(rc != 0) {
+        err=WSAGetLastError();
+        if(err == WSAEWOULDBLOCK) {
+            return PLCTAG_ERR_NO_DATA;
+        } else {
+            pdebug(DEBUG_WARN,"socket write error rc=%d, errno=%d", rc, err);
+            return PLCTAG_ERR_WRITE;
+        }
+    }
+
+    return (int)sent;
+}
+
+
+
 extern int socket_close(sock_p s)
 {
     if(!s)
@@ -1066,6 +1381,398 @@ extern int socket_destroy(sock_p *s)
 
 
 
+/***************************************************************************
+ ************************** Socket Readiness *******************************
+ **************************************************************************/
+
+/*
+ * Windows does not have epoll, so this is built on select().  Registered
+ * sockets are kept in a small array under a mutex.  The wake up mechanism
+ * is a UDP socket bound to the loopback interface that sends a byte to
+ * itself.
+ *
+ * select() is limited to FD_SETSIZE sockets per call, so large sets
+ * are checked in chunks.
+ */
+
+struct sock_poll_entry_t {
+    sock_p sock;
+    SOCKET fd;
+    int events;
+    void *context;
+};
+
+struct sock_poll_t {
+    mutex_p mutex;
+    SOCKET wake_fd;
+    struct sockaddr_in wake_addr;
+    int num_entries;
+    int capacity;
+    struct sock_poll_entry_t *entries;
+};
+
+#define SOCK_POLL_CHUNK_SIZE (FD_SETSIZE - 1)
+
+
+extern int sock_poll_create(sock_poll_p *p)
+{
+    int addr_len = sizeof(struct sockaddr_in);
+    u_long non_blocking=1;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(!p) {
+        pdebug(DEBUG_WARN, "null poll pointer.");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(!socket_lib_init()) {
+        pdebug(DEBUG_WARN,"error initializing Windows Sockets.");
+        return PLCTAG_ERR_WINSOCK;
+    }
+
+    *p = (sock_poll_p)mem_alloc(sizeof(struct sock_poll_t));
+
+    if(! *p) {
+        pdebug(DEBUG_ERROR, "Unable to allocate memory for socket poll set!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    if(mutex_create(&((*p)->mutex)) != PLCTAG_STATUS_OK) {
+        mem_free(*p);
+        *p = NULL;
+        return PLCTAG_ERR_CREATE;
+    }
+
+    (*p)->wake_fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+
+    if((*p)->wake_fd == INVALID_SOCKET) {
+        pdebug(DEBUG_ERROR, "Unable to create wake up socket, error: %d", WSAGetLastError());
+        mutex_destroy(&((*p)->mutex));
+        mem_free(*p);
+        *p = NULL;
+        return PLCTAG_ERR_CREATE;
+    }
+
+    /* bind to an ephemeral loopback port and find out which one we got. */
+    mem_set(&((*p)->wake_addr), 0, sizeof((*p)->wake_addr));
+    (*p)->wake_addr.sin_family = AF_INET;
+    (*p)->wake_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    (*p)->wake_addr.sin_port = 0;
+
+    if(bind((*p)->wake_fd, (struct sockaddr *)&((*p)->wake_addr), sizeof((*p)->wake_addr))
+       || getsockname((*p)->wake_fd, (struct sockaddr *)&((*p)->wake_addr), &addr_len)
+       || ioctlsocket((*p)->wake_fd, FIONBIO, &non_blocking)) {
+        pdebug(DEBUG_ERROR, "Unable to set up wake up socket, error: %d", WSAGetLastError());
+        closesocket((*p)->wake_fd);
+        mutex_destroy(&((*p)->mutex));
+        mem_free(*p);
+        *p = NULL;
+        return PLCTAG_ERR_CREATE;
+    }
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+static int sock_poll_find_unsafe(sock_poll_p p, sock_p s)
+{
+    for(int i=0; i < p->num_entries; i++) {
+        if(p->entries[i].sock == s) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+
+extern int sock_poll_add(sock_poll_p p, sock_p s, int events, void *context)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    if(!p || !s) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(!context || !s->is_open) {
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    critical_block(p->mutex) {
+        if(sock_poll_find_unsafe(p, s) >= 0) {
+            rc = PLCTAG_ERR_DUPLICATE;
+            break;
+        }
+
+        if(p->num_entries >= p->capacity) {
+            int new_capacity = (p->capacity ? p->capacity * 2 : 16);
+            struct sock_poll_entry_t *new_entries = (struct sock_poll_entry_t *)mem_alloc(new_capacity * (int)sizeof(struct sock_poll_entry_t));
+
+            if(!new_entries) {
+                rc = PLCTAG_ERR_NO_MEM;
+                break;
+            }
+
+            if(p->entries) {
+                mem_copy(new_entries, p->entries, p->num_entries * (int)sizeof(struct sock_poll_entry_t));
+                mem_free(p->entries);
+            }
+
+            p->entries = new_entries;
+            p->capacity = new_capacity;
+        }
+
+        p->entries[p->num_entries].sock = s;
+        p->entries[p->num_entries].fd = (SOCKET)s->fd;
+        p->entries[p->num_entries].events = events;
+        p->entries[p->num_entries].context = context;
+        p->num_entries++;
+    }
+
+    return rc;
+}
+
+
+extern int sock_poll_modify(sock_poll_p p, sock_p s, int events, void *context)
+{
+    int rc = PLCTAG_ERR_NOT_FOUND;
+
+    if(!p || !s) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(!context) {
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    critical_block(p->mutex) {
+        int index = sock_poll_find_unsafe(p, s);
+
+        if(index >= 0) {
+            p->entries[index].events = events;
+            p->entries[index].context = context;
+            rc = PLCTAG_STATUS_OK;
+        }
+    }
+
+    return rc;
+}
+
+
+/*
+ * sock_poll_remove
+ *
+ * The waiting thread works on a snapshot of the set taken under the mutex, so
+ * once this returns, no later call to sock_poll_wait() will report the socket.
+ */
+extern int sock_poll_remove(sock_poll_p p, sock_p s)
+{
+    int rc = PLCTAG_ERR_NOT_FOUND;
+
+    if(!p || !s) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    critical_block(p->mutex) {
+        int index = sock_poll_find_unsafe(p, s);
+
+        if(index >= 0) {
+            p->entries[index] = p->entries[p->num_entries - 1];
+            p->num_entries--;
+            rc = PLCTAG_STATUS_OK;
+        }
+    }
+
+    return rc;
+}
+
+
+static void sock_poll_drain_wakeup(sock_poll_p p)
+{
+    char buf[16];
+
+    while(recv(p->wake_fd, buf, (int)sizeof(buf), 0) > 0) { }
+}
+
+
+extern int sock_poll_wait(sock_poll_p p, sock_event_t *events, int max_events, int timeout_ms)
+{
+    int num_events = 0;
+    int start = 0;
+    int64_t end_time = 0;
+
+    if(!p || !events) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(max_events <= 0) {
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    end_time = (timeout_ms < 0 ? 0 : time_ms() + timeout_ms);
+
+    do {
+        fd_set read_set;
+        fd_set write_set;
+        fd_set error_set;
+        struct timeval tv;
+        struct timeval *tv_p = NULL;
+        struct sock_poll_entry_t chunk[SOCK_POLL_CHUNK_SIZE];
+        int num_chunk = 0;
+        int num_total = 0;
+        int rc;
+
+        FD_ZERO(&read_set);
+        FD_ZERO(&write_set);
+        FD_ZERO(&error_set);
+
+        FD_SET(p->wake_fd, &read_set);
+
+        /* snapshot one chunk of the set. */
+        critical_block(p->mutex) {
+            num_total = p->num_entries;
+
+            if(start >= num_total) {
+                start = 0;
+            }
+
+            for(int i=start; i < num_total && num_chunk < SOCK_POLL_CHUNK_SIZE; i++) {
+                chunk[num_chunk] = p->entries[i];
+                num_chunk++;
+            }
+        }
+
+        for(int i=0; i < num_chunk; i++) {
+            SOCKET fd = chunk[i].fd;
+
+            if(chunk[i].events & SOCK_EVENT_READ) {
+                FD_SET(fd, &read_set);
+            }
+
+            if(chunk[i].events & SOCK_EVENT_WRITE) {
+                FD_SET(fd, &write_set);
+            }
+
+            FD_SET(fd, &error_set);
+        }
+
+        /* only block for real if the whole set fits in one select() call. */
+        if(num_total <= SOCK_POLL_CHUNK_SIZE) {
+            if(timeout_ms >= 0) {
+                int64_t remaining = end_time - time_ms();
+
+                if(remaining < 0) {
+                    remaining = 0;
+                }
+
+                tv.tv_sec = (long)(remaining / 1000);
+                tv.tv_usec = (long)((remaining % 1000) * 1000);
+                tv_p = &tv;
+            }
+        } else {
+            tv.tv_sec = 0;
+            tv.tv_usec = 1000;
+            tv_p = &tv;
+        }
+
+        rc = select(0, &read_set, &write_set, &error_set, tv_p);
+
+        if(rc == SOCKET_ERROR) {
+            int err = WSAGetLastError();
+
+            /* a socket was removed and closed after we took the snapshot. */
+            if(err == WSAENOTSOCK) {
+                continue;
+            }
+
+            pdebug(DEBUG_WARN, "select() failed, error: %d", err);
+            return PLCTAG_ERR_READ;
+        }
+
+        if(FD_ISSET(p->wake_fd, &read_set)) {
+            sock_poll_drain_wakeup(p);
+            return num_events;
+        }
+
+        for(int i=0; i < num_chunk && num_events < max_events; i++) {
+            SOCKET fd = chunk[i].fd;
+            int ev = SOCK_EVENT_NONE;
+
+            if(FD_ISSET(fd, &read_set)) {
+                ev |= SOCK_EVENT_READ;
+            }
+
+            if(FD_ISSET(fd, &write_set)) {
+                ev |= SOCK_EVENT_WRITE;
+            }
+
+            if(FD_ISSET(fd, &error_set)) {
+                ev |= SOCK_EVENT_ERROR;
+            }
+
+            if(ev != SOCK_EVENT_NONE) {
+                events[num_events].context = chunk[i].context;
+                events[num_events].events = ev;
+                num_events++;
+            }
+        }
+
+        start += num_chunk;
+    } while(num_events == 0 && (timeout_ms < 0 || time_ms() < end_time));
+
+    return num_events;
+}
+
+
+extern int sock_poll_wakeup(sock_poll_p p)
+{
+    char one = 1;
+
+    if(!p) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(sendto(p->wake_fd, &one, 1, 0, (struct sockaddr *)&(p->wake_addr), sizeof(p->wake_addr)) == SOCKET_ERROR) {
+        int err = WSAGetLastError();
+
+        /* a full buffer means a wake up is already pending. */
+        if(err != WSAEWOULDBLOCK) {
+            pdebug(DEBUG_WARN, "Unable to send wake up, error: %d", err);
+            return PLCTAG_ERR_WRITE;
+        }
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+extern int sock_poll_destroy(sock_poll_p *p)
+{
+    if(!p || !*p) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    closesocket((*p)->wake_fd);
+    mutex_destroy(&((*p)->mutex));
+
+    if((*p)->entries) {
+        mem_free((*p)->entries);
+    }
+
+    mem_free(*p);
+    *p = NULL;
+
+    WSACleanup();
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+
 
 
 
@@ -1378,6 +2085,41 @@ int64_t time_ms(void)
 }
 
 
+/*
+ * cpu_count
+ *
+ * Return the number of CPUs, at least one.
+ */
+int cpu_count(void)
+{
+    SYSTEM_INFO info;
+
+    GetSystemInfo(&info);
+
+    return (info.dwNumberOfProcessors < 1 ? 1 : (int)info.dwNumberOfProcessors);
+}
+
+
+/*
+ * thread_slot
+ *
+ * Return a small number for the calling thread, handed out in turn as
+ * threads first ask.  Shared counters and free lists use it to spread
+ * threads over separate copies.
+ */
+static volatile int64_t next_thread_slot = 0;
+static THREAD_LOCAL int this_thread_slot = -1;
+
+int thread_slot(void)
+{
+    if(this_thread_slot < 0) {
+        this_thread_slot = (int)((atomic_add64(&next_thread_slot, 1) - 1) & 0x7FFFFFFF);
+    }
+
+    return this_thread_slot;
+}
+
+
 struct tm *localtime_r(const time_t *timep, struct tm *result)
 {
     time_t t = *timep;
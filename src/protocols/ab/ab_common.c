@@ -39,10 +39,13 @@
 #include <ab/eip_dhp_pccc.h>
 #include <ab/session.h>
 #include <ab/connection.h>
+#include <ab/symbols.h>
 #include <ab/tag.h>
 #include <ab/request.h>
 #include <util/attr.h>
 #include <util/debug.h>
+#include <util/hash.h>
+#include <util/stats.h>
 #include <util/vector.h>
 
 
@@ -56,8 +59,10 @@ volatile mutex_p global_session_mut = NULL;
 volatile vector_p read_group_tags = NULL;
 
 
-/* request/response handling thread */
-volatile thread_p io_handler_thread = NULL;
+/* request/response handling threads, set up when the first tag is created */
+static struct ab_io_worker_t *io_workers = NULL;
+static volatile int num_io_workers = 0;
+static int io_workers_status = PLCTAG_STATUS_OK;
 
 volatile int library_terminating = 0;
 
@@ -74,21 +79,29 @@ volatile int library_terminating = 0;
 #define DEFAULT_NUM_RETRIES (5)
 #define DEFAULT_RETRY_INTERVAL (300)
 
+/* how many readiness events to pull at once and how often a worker looks at every session anyway. */
+#define IO_THREAD_MAX_EVENTS (64)
+#define IO_THREAD_FULL_SCAN_INTERVAL_MS (100)
+
 
 /* vtables for different kinds of tags */
 struct tag_vtable_t default_vtable = {0}/*= { NULL, ab_tag_destroy, NULL, NULL }*/;
 struct tag_vtable_t cip_vtable = {0}/*= { ab_tag_abort, ab_tag_destroy, eip_cip_tag_read_start, eip_cip_tag_status, eip_cip_tag_write_start }*/;
 struct tag_vtable_t plc_vtable = {0}/*= { ab_tag_abort, ab_tag_destroy, eip_pccc_tag_read_start, eip_pccc_tag_status, eip_pccc_tag_write_start }*/;
 struct tag_vtable_t plc_dhp_vtable = {0}/*= { ab_tag_abort, ab_tag_destroy, eip_dhp_pccc_tag_read_start, eip_dhp_pccc_tag_status, eip_dhp_pccc_tag_write_start}*/;
+struct tag_vtable_t browse_vtable = {0}/*= { ab_tag_abort, ab_tag_destroy, symbols_browse_read_start, symbols_browse_status, NULL }*/;
 
 
 /* forward declarations*/
 static void ab_tag_destroy(ab_tag_p tag);
 static int session_check_incoming_data_unsafe(ab_session_p session);
+static ab_request_p session_coalesce_unsafe(ab_session_p session, ab_request_p first);
+static void session_split_coalesced_unsafe(ab_session_p session, ab_request_p carrier);
 //int request_check_outgoing_data_unsafe(ab_session_p session, ab_request_p req);
 static tag_vtable_p set_tag_vtable(ab_tag_p tag);
 static int insert_read_group_tag(ab_tag_p tag);
 static int remove_read_group_tag(ab_tag_p tag);
+static void teardown_io_workers(void);
 
 
 //int setup_session_mutex(void);
@@ -127,6 +140,11 @@ int ab_init(void)
     cip_vtable.status       = (tag_status_func)eip_cip_tag_status;
     cip_vtable.write        = (tag_write_func)eip_cip_tag_write_start;
 
+    /* the tag list is read only. */
+    browse_vtable.abort     = (tag_abort_func)ab_tag_abort;
+    browse_vtable.read      = (tag_read_func)symbols_browse_read_start;
+    browse_vtable.status    = (tag_status_func)symbols_browse_status;
+
     read_group_tags = vector_create(100,50); /* MAGIC */
     if(!read_group_tags) {
         pdebug(DEBUG_ERROR,"Unable to create read group vector!");
@@ -141,13 +159,7 @@ int ab_init(void)
         return rc;
     }
 
-    /* create the background IO handler thread */
-    rc = thread_create((thread_p*)&io_handler_thread, request_handler_func, 32*1024, NULL);
-
-    if(rc != PLCTAG_STATUS_OK) {
-        pdebug(DEBUG_ERROR,"Unable to create request handler thread!");
-        return rc;
-    }
+    /* the IO worker threads are started by the first tag, see setup_io_workers(). */
 
 
     pdebug(DEBUG_INFO,"Finished initializing AB protocol library.");
@@ -162,13 +174,11 @@ void ab_teardown(void)
 {
     pdebug(DEBUG_INFO,"Releasing global AB protocol resources.");
 
-    pdebug(DEBUG_INFO,"Terminating IO thread.");
-    /* kill the IO thread first. */
+    pdebug(DEBUG_INFO,"Terminating IO threads.");
+    /* kill the IO threads first. */
     library_terminating = 1;
 
-    /* wait for the thread to die */
-    thread_join(io_handler_thread);
-    thread_destroy((thread_p*)&io_handler_thread);
+    teardown_io_workers();
 
     pdebug(DEBUG_INFO,"Freeing global session mutex.");
     /* clean up the mutex */
@@ -177,6 +187,9 @@ void ab_teardown(void)
     pdebug(DEBUG_INFO, "Removing the read group vector.");
     vector_destroy(read_group_tags);
 
+    pdebug(DEBUG_INFO, "Freeing pooled request buffers.");
+    request_pool_teardown();
+
     pdebug(DEBUG_INFO,"Done.");
 }
 
@@ -188,6 +201,7 @@ plc_tag_p ab_tag_create(attr attribs)
     const char *path;
     int num_retries;
     int default_retry_interval;
+    int rc;
 
     pdebug(DEBUG_INFO,"Starting.");
 
@@ -233,16 +247,15 @@ plc_tag_p ab_tag_create(attr attribs)
     tag->elem_size = attr_get_int(attribs,"elem_size",0);
     tag->size = (tag->elem_count) * (tag->elem_size);
 
-    if(tag->size == 0) {
+    if(tag->size == 0 && tag->protocol_type == AB_PROTOCOL_LGX && !tag->elem_size) {
+        /* Logix tags can get their size from the PLC's symbol table, see symbols_size_tag(). */
+        tag->elem_count = attr_get_int(attribs,"elem_count",0);
+    } else if(tag->size == 0) {
         /* failure! Need data_size! */
         pdebug(DEBUG_WARN,"Tag size is zero!");
         tag->status = PLCTAG_ERR_BAD_PARAM;
         return (plc_tag_p)tag;
-    }
-
-    tag->data = (uint8_t*)mem_alloc(tag->size);
-
-    if(tag->data == NULL) {
+    } else if((tag->data = (uint8_t*)mem_alloc(tag->size)) == NULL) {
         pdebug(DEBUG_WARN,"Unable to allocate tag data!");
         tag->status = PLCTAG_ERR_NO_MEM;
         return (plc_tag_p)tag;
@@ -251,8 +264,24 @@ plc_tag_p ab_tag_create(attr attribs)
     /* special features for Logix tags. */
     if(tag->protocol_type == AB_PROTOCOL_LGX) {
         tag->needs_connection = attr_get_int(attribs,"use_connected_msg", 0);
+        tag->coalesce_reads = attr_get_int(attribs,"coalesce_reads", 0);
+        tag->coalesce_writes = attr_get_int(attribs,"coalesce_writes", 0);
+        tag->use_instance_id = attr_get_int(attribs,"use_instance_id", 0);
+        tag->browse = (str_cmp_i(attr_get_str(attribs,"name",""), SYMBOLS_BROWSE_NAME) == 0);
+
+        /* the tag list is read with its own unconnected requests. */
+        if(tag->browse) {
+            tag->needs_connection = 0;
+        }
 
         if(attr_get_str(attribs,"read_group",NULL)) {
+            /* other tags fill in this tag's data before it could be sized. */
+            if(!tag->size) {
+                pdebug(DEBUG_WARN,"Tags in read groups need elem_size!");
+                tag->status = PLCTAG_ERR_BAD_PARAM;
+                return (plc_tag_p)tag;
+            }
+
             tag->read_group = str_dup(attr_get_str(attribs,"read_group",NULL));
 
             if(!tag->read_group) {
@@ -260,8 +289,6 @@ plc_tag_p ab_tag_create(attr attribs)
                 tag->status = PLCTAG_ERR_BAD_PARAM;
                 return (plc_tag_p)tag;
             }
-
-            insert_read_group_tag(tag);
         }
     }
 
@@ -357,6 +384,13 @@ plc_tag_p ab_tag_create(attr attribs)
     tag->default_retry_interval = attr_get_int(attribs,"default_retry_interval", default_retry_interval);
     tag->num_retries = attr_get_int(attribs, "num_retries", num_retries);
 
+    /* the first tag starts the IO threads, later tags cannot ask for a different number. */
+    if((rc = setup_io_workers(attr_get_int(attribs, "io_threads", 0))) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to start IO threads!");
+        tag->status = (rc == PLCTAG_ERR_BAD_PARAM ? rc : PLCTAG_ERR_THREAD_CREATE);
+        return (plc_tag_p)tag;
+    }
+
     /*
      * Find or create a session.
      *
@@ -381,16 +415,46 @@ plc_tag_p ab_tag_create(attr attribs)
         //connection_add_tag(tag->connection, tag);
     }
 
+    if(tag->use_instance_id && tag->read_group) {
+        /* other tags build group reads from this tag's name. */
+        pdebug(DEBUG_WARN,"Tags in read groups keep using their names.");
+        tag->use_instance_id = 0;
+    }
+
+    /*
+     * tags swap their base name for its instance ID once the PLC's symbol table
+     * is in, tags without a size look it up there and browse tags return it.
+     */
+    if(tag->use_instance_id || tag->browse || (tag->protocol_type == AB_PROTOCOL_LGX && !tag->size)) {
+        if((tag->status = symbols_find_or_create(tag, attribs)) != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_INFO,"Unable to set up symbol table! Status=%d",tag->status);
+            return (plc_tag_p)tag;
+        }
+    }
+
     /*
      * check the tag name, this is protocol specific.
      */
 
-    if(check_tag_name(tag, attr_get_str(attribs,"name",NULL)) != PLCTAG_STATUS_OK) {
+    if(!tag->browse && check_tag_name(tag, attr_get_str(attribs,"name",NULL)) != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_INFO,"Bad tag name!");
         tag->status = PLCTAG_ERR_BAD_PARAM;
         return (plc_tag_p)tag;
     }
 
+    /* other tags in the read group can find this one now that it is all set up. */
+    if(tag->read_group) {
+        tag->group_data = (uint8_t*)mem_alloc(tag->size);
+
+        if(!tag->group_data || mutex_create(&tag->group_mutex) != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN,"Unable to set up read group data!");
+            tag->status = PLCTAG_ERR_NO_MEM;
+            return (plc_tag_p)tag;
+        }
+
+        insert_read_group_tag(tag);
+    }
+
     pdebug(DEBUG_INFO,"Done.");
 
     return (plc_tag_p)tag;
@@ -458,6 +522,10 @@ tag_vtable_p set_tag_vtable(ab_tag_p tag)
                 //~ cip_vtable.write     = (tag_write_func)eip_cip_tag_write_start;
             //~ }
 
+            if(tag->browse) {
+                return &browse_vtable;
+            }
+
             return &cip_vtable;
 
             break;
@@ -496,8 +564,37 @@ int ab_tag_abort(ab_tag_p tag)
         }
     }
 
+    /*
+     * if the first read was cut short, the request sizes are only partly
+     * known and the slots are gone.  Start sizing again on the next read.
+     * Any write waiting on that read is gone too.
+     */
+    if (tag->first_read) {
+        tag->num_read_requests = 0;
+        tag->pre_write_read = 0;
+    }
+
+    /* let go of the tags a group read was reading along with this one. */
+    if (tag->group_reqs) {
+        for (i = 0; i < vector_length(tag->group_reqs); i++) {
+            vector_p members = vector_get(tag->group_reqs, i);
+
+            if (members) {
+                for (int j = 0; j < vector_length(members); j++) {
+                    rc_dec(vector_get(members, j));
+                }
+
+                vector_destroy(members);
+            }
+        }
+
+        vector_destroy(tag->group_reqs);
+        tag->group_reqs = NULL;
+    }
+
     tag->read_in_progress = 0;
     tag->write_in_progress = 0;
+    tag->held_op = TAG_OP_NONE;
 
     return PLCTAG_STATUS_OK;
 }
@@ -541,6 +638,11 @@ void ab_tag_destroy(ab_tag_p tag)
         tag->connection = NULL;
     }
 
+    if(tag->symbols) {
+        rc_dec(tag->symbols);
+        tag->symbols = NULL;
+    }
+
     /* tags should always have a session.  Release it. */
     pdebug(DEBUG_DETAIL,"Getting ready to release tag session %p",tag->session);
     if(session) {
@@ -571,6 +673,15 @@ void ab_tag_destroy(ab_tag_p tag)
         tag->data = NULL;
     }
 
+    if (tag->group_data) {
+        mem_free(tag->group_data);
+        tag->group_data = NULL;
+    }
+
+    if (tag->group_mutex) {
+        mutex_destroy(&tag->group_mutex);
+    }
+
     pdebug(DEBUG_INFO,"Finished releasing all tag resources.");
 
     pdebug(DEBUG_INFO, "done");
@@ -720,18 +831,45 @@ static void receive_response_unsafe(ab_session_p session, ab_request_p request)
     //update_resend_samples(session, time_ms() - request->time_sent);
 
     /* set the packet ready for processing. */
-    pdebug(DEBUG_INFO, "got full packet of size %d", session->recv_offset);
-    pdebug_dump_bytes(DEBUG_INFO, session->recv_data, session->recv_offset);
+    pdebug(DEBUG_INFO, "got full packet of size %d", session->resp_size);
+    pdebug_dump_bytes(DEBUG_INFO, session->recv_data + session->recv_start, session->resp_size);
+
+    /* packed requests get their own responses, nothing keeps this one. */
+    if(request->riders) {
+        session_split_coalesced_unsafe(session, request);
+
+        request->resp_received = 1;
+        request->send_in_progress = 0;
+        request->send_request = 0;
+        request->recv_in_progress = 0;
+
+        session_remove_request_unsafe(session, request);
 
-    /* copy the data from the session's buffer */
-    mem_copy(request->data, session->recv_data, session->recv_offset);
-    request->request_size = session->recv_offset;
+        return;
+    }
+
+    /*
+     * hand the response over where it sits instead of copying it.  The request
+     * keeps the receive buffer alive until it is done with it.
+     */
+    if(request->resp_buf) {
+        rc_dec(request->resp_buf);
+    }
+
+    request->resp_buf = rc_inc(session->recv_data);
+    request->data = session->recv_data + session->recv_start;
+    request->data_size = (int)session->resp_size;
+
+    session->recv_lent = 1;
 
     request->resp_received = 1;
     request->send_in_progress = 0;
     request->send_request = 0;
     request->recv_in_progress = 0;
 
+    /* wake up anyone blocked on the tag. */
+    tag_done_signal(request->tag_done);
+
     /* clear the request from the session as it is done. Note we hold the mutex here.
      *
      * This must be done last since we release the reference to the request here!  That could
@@ -796,19 +934,20 @@ int ok_to_resend(ab_session_p session, ab_request_p request)
 int process_response_packet_unsafe(ab_session_p session)
 {
     int rc = PLCTAG_STATUS_OK;
-    eip_cip_co_resp *response = (eip_cip_co_resp*)(&session->recv_data[0]);
-    ab_request_p request = session->requests;
+    eip_cip_co_resp *response = (eip_cip_co_resp*)(session->recv_data + session->recv_start);
+    ab_request_p request = NULL;
 
     /* find the request for which there is a response pending. */
-    while(request) {
-        /* need to get the next request now because we might be removing it in receive_response_unsafe */
-        ab_request_p next_req = request->next;
-
-        if(match_request_and_response(request, response)) {
-            receive_response_unsafe(session, request);
-        }
+    if(le2h16(response->encap_command) == AB_EIP_CONNECTED_SEND) {
+        request = session_find_request_unsafe(session, SESSION_MATCH_KEY_CONNECTED(le2h32(response->cpf_orig_conn_id), le2h16(response->cpf_conn_seq_num)));
+    } else if(le2h64(response->encap_sender_context) != (uint64_t)0) {
+        request = session_find_request_unsafe(session, SESSION_MATCH_KEY_UNCONNECTED(le2h64(response->encap_sender_context)));
+    }
 
-        request = next_req;
+    if(request && match_request_and_response(request, response)) {
+        receive_response_unsafe(session, request);
+    } else {
+        pdebug(DEBUG_DETAIL, "No request is waiting for this response.");
     }
 
     return rc;
@@ -819,6 +958,7 @@ int process_response_packet_unsafe(ab_session_p session)
 int session_check_incoming_data_unsafe(ab_session_p session)
 {
     int rc = PLCTAG_STATUS_OK;
+    int packets = 0;
 
     /*
      * check for data.
@@ -827,21 +967,27 @@ int session_check_incoming_data_unsafe(ab_session_p session)
      * request it is for.  Repeat while there is data.
      */
 
+    /* the socket may have more data since the last time we looked. */
+    session->recv_drained = 0;
+
     do {
         rc = recv_eip_response_unsafe(session);
 
         /* did we get a packet? */
         if(rc == PLCTAG_STATUS_OK && session->has_response) {
             rc = process_response_packet_unsafe(session);
+            packets++;
 
-            /* reset the session's buffer */
-            mem_set(session->recv_data, 0, session->recv_capacity);
-            session->recv_offset = 0;
+            /* step over the packet, the rest of the buffer may hold more. */
+            session->recv_start += session->resp_size;
+            session->resp_size = 0;
             session->resp_seq_id = 0;
             session->has_response = 0;
         }
     } while(rc == PLCTAG_STATUS_OK);
 
+    stat_add(STAT_RECV_PACKETS, packets);
+
     /* No data is not an error */
     if(rc == PLCTAG_ERR_NO_DATA) {
         rc = PLCTAG_STATUS_OK;
@@ -855,41 +1001,503 @@ int session_check_incoming_data_unsafe(ab_session_p session)
 }
 
 
-static int session_send_current_request(ab_session_p session)
+/*
+ * coalesce_service_unsafe
+ *
+ * Find the CIP service in a request and, for unconnected requests,
+ * the route to the PLC that follows it.
+ */
+static uint8_t *coalesce_service_unsafe(ab_request_p req, int *service_size, uint8_t **route, int *route_size)
 {
+    uint8_t *service = NULL;
+
+    if(req->connection) {
+        service = req->data + sizeof(eip_cip_co_req);
+        *service_size = req->request_size - (int)sizeof(eip_cip_co_req);
+        *route = NULL;
+        *route_size = 0;
+    } else {
+        service = req->data + sizeof(eip_cip_uc_req);
+        *service_size = le2h16(((eip_cip_uc_req*)(req->data))->uc_cmd_length);
+        *route = service + *service_size;
+        *route_size = req->request_size - (int)sizeof(eip_cip_uc_req) - *service_size;
+    }
+
+    return service;
+}
+
+
+/* can req ride along with first?  It must not have been near the wire yet. */
+static int coalesce_match_unsafe(ab_request_p first, ab_request_p req, uint8_t *route, int route_size)
+{
+    uint8_t *req_route = NULL;
+    int req_route_size = 0;
+    int req_service_size = 0;
+
+    if(!req->coalesce_size || !req->send_request || req->send_in_progress || req->recv_in_progress
+       || req->resp_received || req->abort_request || req->send_count) {
+        return 0;
+    }
+
+    if(req->connection != first->connection) {
+        return 0;
+    }
+
+    if(req->connection) {
+        return 1;
+    }
+
+    /* unconnected requests must go to the same place. */
+    coalesce_service_unsafe(req, &req_service_size, &req_route, &req_route_size);
+
+    return (req_route_size == route_size && (route_size == 0 || !mem_cmp(req_route, route_size, route, route_size)));
+}
+
+
+/*
+ * session_coalesce_unsafe
+ *
+ * Called when first is about to be queued.  If other small reads or
+ * writes to the same connection, or the same PLC for unconnected ones,
+ * are waiting behind it, build one Multiple Service Packet that carries
+ * them all and return that instead.  The PLC runs the services in order.
+ * The carrier goes in the request list right after first and holds a
+ * reference to each request it carries.  Those stay in the list, but are
+ * not sent themselves.  When the reply comes in, session_split_coalesced_unsafe()
+ * hands each one its own response so that the tag code never knows.
+ *
+ * Returns first if there is nothing to pack it with.
+ */
+static ab_request_p session_coalesce_unsafe(ab_session_p session, ab_request_p first)
+{
+    ab_request_p riders[SESSION_MAX_COALESCE];
+    ab_request_p carrier = NULL;
+    ab_request_p req = NULL;
+    uint8_t *route = NULL;
+    uint8_t *service = NULL;
+    uint8_t *data = NULL;
+    uint8_t *embed_start = NULL;
+    int route_size = 0;
+    int service_size = 0;
+    int header_size = (first->connection ? (int)sizeof(eip_cip_co_req) : (int)sizeof(eip_cip_uc_req));
+    int max_size = 0;
+    int req_size = 0;
+    int resp_size = 0;
+    int num_riders = 0;
     int rc = PLCTAG_STATUS_OK;
 
-    if(!session->current_request) {
-        return PLCTAG_STATUS_OK;
+    coalesce_service_unsafe(first, &service_size, &route, &route_size);
+
+    if(first->connection) {
+        max_size = first->connection->max_payload_size - CIP_MSP_FUDGE;
+    } else {
+        max_size = MAX_CIP_MSG_SIZE - route_size - CIP_MSP_FUDGE;
+    }
+
+    req_size = CIP_MSP_REQ_HEADER;
+    resp_size = CIP_MSP_RESP_HEADER;
+
+    for(req = first; req && num_riders < SESSION_MAX_COALESCE; req = req->next) {
+        int size = 0;
+        uint8_t *unused_route = NULL;
+        int unused_route_size = 0;
+
+        if(req != first && !coalesce_match_unsafe(first, req, route, route_size)) {
+            continue;
+        }
+
+        coalesce_service_unsafe(req, &size, &unused_route, &unused_route_size);
+
+        if(req_size + CIP_MSP_OFFSET_SIZE + size > max_size || resp_size + CIP_MSP_OFFSET_SIZE + req->coalesce_size > max_size) {
+            /* the first one not fitting does not mean a smaller one will not. */
+            if(req == first) {
+                break;
+            }
+
+            continue;
+        }
+
+        req_size += CIP_MSP_OFFSET_SIZE + size;
+        resp_size += CIP_MSP_OFFSET_SIZE + req->coalesce_size;
+
+        riders[num_riders] = req;
+        num_riders++;
+    }
+
+    if(num_riders < 2) {
+        return first;
+    }
+
+    rc = request_create(&carrier, (first->connection ? first->connection->max_payload_size : MAX_CIP_MSG_SIZE));
+
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to get new request, sending the request alone.  rc=%d", rc);
+        return first;
+    }
+
+    carrier->riders = mem_alloc((int)sizeof(ab_request_p) * num_riders);
+
+    if(!carrier->riders) {
+        pdebug(DEBUG_WARN, "Unable to allocate packed request list, sending the request alone.");
+        rc_dec(carrier);
+        return first;
+    }
+
+    /* the header is the same as for the first request. */
+    mem_copy(carrier->data, first->data, header_size);
+
+    embed_start = carrier->data + header_size;
+
+    data = cip_msp_encode_header(embed_start, num_riders);
+
+    for(int i=0; i < num_riders; i++) {
+        uint8_t *unused_route = NULL;
+        int unused_route_size = 0;
+
+        service = coalesce_service_unsafe(riders[i], &service_size, &unused_route, &unused_route_size);
+
+        cip_msp_set_offset(embed_start, i, data);
+
+        mem_copy(data, service, service_size);
+        data += service_size;
+
+        /* the carrier sends it now. */
+        riders[i]->send_request = 0;
+        carrier->riders[i] = rc_inc(riders[i]);
+        session_activate_request_unsafe(session, riders[i]);
+    }
+
+    carrier->num_riders = num_riders;
+
+    if(first->connection) {
+        eip_cip_co_req *cip = (eip_cip_co_req*)(carrier->data);
+
+        cip->cpf_cdi_item_length = h2le16(data - (uint8_t*)(&cip->cpf_conn_seq_num));
+
+        carrier->connection = first->connection;
+        carrier->connected_request = 1;
+    } else {
+        eip_cip_uc_req *cip = (eip_cip_uc_req*)(carrier->data);
+
+        cip->uc_cmd_length = h2le16(data - embed_start);
+
+        mem_copy(data, route, route_size);
+        data += route_size;
+
+        cip->cpf_udi_item_length = h2le16(data - (uint8_t*)(&cip->cm_service_code));
+    }
+
+    carrier->request_size = (int)(data - carrier->data);
+    carrier->num_retries_left = first->num_retries_left;
+    carrier->retry_interval = first->retry_interval;
+    carrier->resp_timeout = first->resp_timeout;
+    carrier->send_request = 1;
+
+    /* the list has its own reference.  Near first, so passes over the list do not have to go to the end for it. */
+    session_insert_request_unsafe(session, first, carrier);
+    rc_dec(carrier);
+
+    stat_add(STAT_COALESCED_PACKETS, 1);
+    stat_add(STAT_COALESCED_REQUESTS, num_riders);
+
+    pdebug(DEBUG_DETAIL, "Packed %d requests into one of %d bytes.", num_riders, carrier->request_size);
+
+    return carrier;
+}
+
+
+/*
+ * session_split_coalesced_unsafe
+ *
+ * Give each request in a packed one the response it would have had on
+ * its own: the header of the carrier's response and its own reply.  The
+ * response goes in the request's own buffer.  If the PLC did not take the
+ * packed request, they go out one at a time from now on.
+ */
+static void session_split_coalesced_unsafe(ab_session_p session, ab_request_p carrier)
+{
+    uint8_t *packet = session->recv_data + session->recv_start;
+    uint8_t *packet_end = packet + session->resp_size;
+    eip_encap_t *encap = (eip_encap_t*)packet;
+    uint8_t *reply = NULL;
+    uint8_t *count_field = NULL;
+    int header_size = 0;
+    int ok = 1;
+
+    if(carrier->connection) {
+        reply = &((eip_cip_co_resp*)packet)->reply_service;
+    } else {
+        reply = &((eip_cip_uc_resp*)packet)->reply_service;
+    }
+
+    header_size = (int)(reply - packet);
+
+    if(le2h32(encap->encap_status) != AB_EIP_OK) {
+        pdebug(DEBUG_WARN, "Bad response to packed request!");
+        ok = 0;
+    } else if(cip_msp_check_reply(reply, packet_end, carrier->num_riders, &count_field) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "PLC did not take packed request!");
+        ok = 0;
+    }
+
+    if(!ok) {
+        pdebug(DEBUG_WARN, "Sending requests to %s one at a time from now on.", session->host);
+        session->no_coalesce = 1;
+    }
+
+    for(int i=0; i < carrier->num_riders; i++) {
+        ab_request_p rider = carrier->riders[i];
+        uint8_t *sub = NULL;
+        uint8_t *sub_end = NULL;
+        int sub_size = 0;
+
+        if(rider->abort_request) {
+            continue;
+        }
+
+        if(!ok || cip_msp_get_reply(count_field, packet_end, carrier->num_riders, i, &sub, &sub_end) != PLCTAG_STATUS_OK) {
+            /* send it on its own. */
+            rider->send_request = 1;
+            continue;
+        }
+
+        sub_size = (int)(sub_end - sub);
+
+        if(header_size + sub_size > rider->request_capacity) {
+            /* send it on its own. */
+            rider->send_request = 1;
+            continue;
+        }
+
+        mem_copy(rider->data, packet, header_size);
+        mem_copy(rider->data + header_size, sub, sub_size);
+
+        rider->data_size = header_size + sub_size;
+
+        ((eip_encap_t*)(rider->data))->encap_length = h2le16((uint16_t)(rider->data_size - (int)sizeof(eip_encap_t)));
+
+        if(carrier->connection) {
+            ((eip_cip_co_resp*)(rider->data))->cpf_cdi_item_length = h2le16((uint16_t)(sub_size + 2));
+        } else {
+            ((eip_cip_uc_resp*)(rider->data))->cpf_udi_item_length = h2le16((uint16_t)sub_size);
+        }
+
+        rider->time_sent = carrier->time_sent;
+        rider->send_count = carrier->send_count;
+        rider->resp_received = 1;
+        rider->send_in_progress = 0;
+        rider->send_request = 0;
+        rider->recv_in_progress = 0;
+
+        tag_done_signal(rider->tag_done);
+
+        /* the carrier still holds a reference. */
+        session_remove_request_unsafe(session, rider);
+    }
+}
+
+
+/*
+ * session_queue_request_unsafe
+ *
+ * Ready the request for sending and add it to the send batch.  The batch
+ * keeps a reference to the request until it has been completely written.
+ */
+static int session_queue_request_unsafe(ab_session_p session, ab_request_p request)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    /* small reads waiting behind this one may go out with it. */
+    if(request->coalesce_size && !session->no_coalesce) {
+        request = session_coalesce_unsafe(session, request);
     }
 
-    rc = send_eip_request_unsafe(session->current_request);
+    rc = prepare_eip_request_unsafe(request);
 
     if(rc != PLCTAG_STATUS_OK) {
-        /*error sending packet!*/
         return rc;
     }
 
-    /* if we are done, then clean up */
-    if(!session->current_request->send_in_progress) {
+    session_activate_request_unsafe(session, request);
+
+    /* increment the refcount since we are storing a pointer to the request */
+    rc_inc(request);
+    session->send_queue[session->send_queue_count] = request;
+    session->send_queue_count++;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/*
+ * session_flush_send_queue_unsafe
+ *
+ * Write as much of the send batch as the socket will take in one call.
+ * Anything left over stays queued until the socket is writable again.
+ */
+static int session_flush_send_queue_unsafe(ab_session_p session)
+{
+    sock_buf_t bufs[SESSION_MAX_SEND_BATCH];
+    int count = session->send_queue_count;
+    int done = 0;
+    int written;
+    int rc;
+
+    if(!count) {
+        return PLCTAG_STATUS_OK;
+    }
+
+    for(int i=0; i < count; i++) {
+        ab_request_p request = session->send_queue[i];
+
+        bufs[i].data = request->data + request->current_offset;
+        bufs[i].size = request->request_size - request->current_offset;
+    }
+
+    rc = socket_write_many(session->sock, bufs, count);
+
+    if(rc == PLCTAG_ERR_NO_DATA) {
+        /* the socket is full, try again when it is writable. */
+        return PLCTAG_STATUS_OK;
+    }
+
+    if(rc < 0) {
+        /* oops, error of some sort.  Nothing in the batch can be sent now. */
+        for(int i=0; i < count; i++) {
+            ab_request_p request = session->send_queue[i];
+
+            request->status = rc;
+            request->send_request = 0;
+            request->send_in_progress = 0;
+            request->recv_in_progress = 0;
+
+            rc_dec(request);
+            session->send_queue[i] = NULL;
+        }
+
+        session->send_queue_count = 0;
+
+        return rc;
+    }
+
+    /* mark off the requests that are completely written. */
+    written = rc;
+
+    while(done < count) {
+        ab_request_p request = session->send_queue[done];
+        int remaining = request->request_size - request->current_offset;
+
+        if(written < remaining) {
+            request->current_offset += written;
+            break;
+        }
+
+        written -= remaining;
+
+        eip_request_sent_unsafe(request);
+
         /* release the refcount on the request, we are not referencing it anymore */
-        rc_dec(session->current_request);
-        session->current_request = NULL;
+        rc_dec(request);
+        session->send_queue[done] = NULL;
+        done++;
     }
 
-    return rc;
+    stat_add(STAT_SEND_SYSCALLS, 1);
+    stat_add(STAT_SEND_PACKETS, done);
+
+    pdebug(DEBUG_DETAIL, "Wrote %d of %d queued packets in one call.", done, count);
+
+    /* move anything not completely sent to the front. */
+    for(int i=done; i < count; i++) {
+        session->send_queue[i - done] = session->send_queue[i];
+        session->send_queue[i] = NULL;
+    }
+
+    session->send_queue_count = count - done;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/*
+ * Can any request that was never sent go out on this pass?  Only good
+ * once every active request has been counted in the windows.
+ */
+static int session_can_send_waiting_unsafe(ab_session_p session, int connected_in_flight, int unconnected_in_flight)
+{
+    if(session->send_queue_count >= SESSION_MAX_SEND_BATCH) {
+        return 0;
+    }
+
+    if(session->waiting_unconnected > 0 && unconnected_in_flight < SESSION_MAX_UNCONNECTED_REQUESTS_IN_FLIGHT) {
+        return 1;
+    }
+
+    if(session->waiting_connected > 0 && connected_in_flight < SESSION_MAX_CONNECTED_REQUESTS_IN_FLIGHT) {
+        return 1;
+    }
+
+    for(ab_connection_p connection = session->connections; connection; connection = connection->next) {
+        if(connection->requests_waiting > 0 &&
+           (connection->in_flight_pass != session->in_flight_pass || connection->requests_in_flight < connection->max_requests_in_flight)) {
+            return 1;
+        }
+    }
+
+    return 0;
 }
 
 
+/*
+ * Requests that were sent or packed need a look on every pass, for time
+ * outs, resends and to count the windows.  The rest are waiting their
+ * turn, so the pass stops once it has seen all of the first kind and
+ * nothing more can be sent.  Otherwise every response would cost a walk
+ * over all the queued requests.
+ */
 static int session_check_outgoing_data_unsafe(ab_session_p session)
 {
     int rc = PLCTAG_STATUS_OK;
     ab_request_p request = session->requests;
     int connected_requests_in_flight = 0;
     int unconnected_requests_in_flight = 0;
+    int can_queue = 0;
+    int active_seen = 0;
+
+    /* finish any batch left over from the last pass first. */
+    rc = session_flush_send_queue_unsafe(session);
+
+    /* only start a new batch once the old one is completely out. */
+    can_queue = (session->send_queue_count == 0);
+
+    /* start a new count of the requests in flight on each connection. */
+    session->in_flight_pass++;
 
     /* loop over the requests and process them one at a time. */
     while(request && rc == PLCTAG_STATUS_OK) {
+        if(active_seen >= session->requests_active &&
+           (!can_queue || !session_can_send_waiting_unsafe(session, connected_requests_in_flight, unconnected_requests_in_flight))) {
+            break;
+        }
+
+        /* nobody else watches some requests, so give up on them here. */
+        if(request->resp_timeout && request->recv_in_progress && time_ms() > request->time_sent + request->resp_timeout) {
+            pdebug(DEBUG_WARN, "Timed out waiting for response to request %p.", request);
+            request->abort_request = 1;
+        }
+
+        /* a packed request is only waited on through the requests it carries. */
+        if(request->riders && !request->abort_request) {
+            int i;
+
+            for(i=0; i < request->num_riders && request->riders[i]->abort_request; i++) { }
+
+            if(i == request->num_riders) {
+                pdebug(DEBUG_DETAIL, "All requests in packed request %p were aborted.", request);
+                request->abort_request = 1;
+            }
+        }
+
         if(request->abort_request) {
             ab_request_p old_request = request;
 
@@ -918,9 +1526,18 @@ static int session_check_outgoing_data_unsafe(ab_session_p session)
             request->send_request = 1;
         }
 
+        /* connected data requests are limited per connection rather than per session. */
+        if(request->connection && request->connection->in_flight_pass != session->in_flight_pass) {
+            request->connection->in_flight_pass = session->in_flight_pass;
+            request->connection->requests_in_flight = 0;
+        }
+
         /* count requests in flight */
         if(request->recv_in_progress) {
-            if(request->connected_request) {
+            if(request->connection) {
+                request->connection->requests_in_flight++;
+                pdebug(DEBUG_SPEW,"%d requests in flight on connection.", request->connection->requests_in_flight);
+            } else if(request->connected_request) {
                 connected_requests_in_flight++;
                 pdebug(DEBUG_SPEW,"%d connected requests in flight.", connected_requests_in_flight);
             } else {
@@ -931,14 +1548,22 @@ static int session_check_outgoing_data_unsafe(ab_session_p session)
 
 
         /* is there a request ready to send and can we send? */
-        if(!session->current_request && request->send_request) {
-            if(request->connected_request) {
+        if(can_queue && session->send_queue_count < SESSION_MAX_SEND_BATCH && request->send_request && !request->send_in_progress) {
+            if(request->connection) {
+                if(request->connection->requests_in_flight < request->connection->max_requests_in_flight) {
+                    pdebug(DEBUG_INFO,"Readying connected packet to send.");
+
+                    rc = session_queue_request_unsafe(session, request);
+
+                    request->connection->requests_in_flight++;
+
+                    pdebug(DEBUG_INFO,"sending packet, so %d requests in flight on connection.", request->connection->requests_in_flight);
+                }
+            } else if(request->connected_request) {
                 if(connected_requests_in_flight < SESSION_MAX_CONNECTED_REQUESTS_IN_FLIGHT) {
                     pdebug(DEBUG_INFO,"Readying connected packet to send.");
 
-                    /* increment the refcount since we are storing a pointer to the request */
-                    rc_inc(request);
-                    session->current_request = request;
+                    rc = session_queue_request_unsafe(session, request);
 
                     connected_requests_in_flight++;
 
@@ -948,9 +1573,7 @@ static int session_check_outgoing_data_unsafe(ab_session_p session)
                 if(unconnected_requests_in_flight < SESSION_MAX_UNCONNECTED_REQUESTS_IN_FLIGHT) {
                     pdebug(DEBUG_INFO,"Readying unconnected packet to send.");
 
-                    /* increment the refcount since we are storing a pointer to the request */
-                    rc_inc(request);
-                    session->current_request = request;
+                    rc = session_queue_request_unsafe(session, request);
 
                     unconnected_requests_in_flight++;
 
@@ -959,43 +1582,142 @@ static int session_check_outgoing_data_unsafe(ab_session_p session)
             }
         }
 
-        /* call this often to make sure we get the data out. */
-        rc = session_send_current_request(session);
+        if(request->active) {
+            active_seen++;
+        }
 
         /* get the next request to process */
         request = request->next;
     }
 
+    /* send everything we picked up with one write. */
+    if(rc == PLCTAG_STATUS_OK) {
+        rc = session_flush_send_queue_unsafe(session);
+    }
+
     return rc;
 }
 
 
-static void process_session_tasks_unsafe(ab_session_p session)
+/*
+ * session_update_poll_events_unsafe
+ *
+ * We always want to know about incoming data.  We only want to know
+ * when the socket is writable while it is connecting or if a send got
+ * stuck partway.
+ */
+static void session_update_poll_events_unsafe(ab_session_p session)
+{
+    int events = SOCK_EVENT_READ;
+
+    if(!session->is_connected || session->reg_unsent || session->send_queue_count) {
+        events |= SOCK_EVENT_WRITE;
+    }
+
+    if(events != session->poll_events) {
+        if(sock_poll_modify(session->worker->poller, session->sock, events, session) == PLCTAG_STATUS_OK) {
+            session->poll_events = events;
+        }
+    }
+}
+
+
+static void session_stop_polling_unsafe(ab_session_p session, int rc)
+{
+    pdebug(DEBUG_WARN, "Session %p socket failed, rc=%d, removing it from the IO thread.", session, rc);
+
+    sock_poll_remove(session->worker->poller, session->sock);
+
+    session->poll_events = SOCK_EVENT_NONE;
+    session->is_connected = 0;
+    session->status = rc;
+}
+
+
+static void process_session_tasks_unsafe(ab_session_p session, int check_all)
 {
     int rc = PLCTAG_STATUS_OK;
 
     pdebug(DEBUG_SPEW, "Checking for things to do with session %p", session);
 
+    /* pick up anything API threads queued since the last pass. */
+    session_take_submitted_requests_unsafe(session);
 
-    if(!session->registered) {
+    /* nothing more to do once the session has failed. */
+    if(session->status != PLCTAG_STATUS_OK && session->status != PLCTAG_STATUS_PENDING) {
         return;
     }
 
-    /* check for incoming data. */
-    rc = session_check_incoming_data_unsafe(session);
+    /* still opening, only look when the socket says something happened or on a full scan. */
+    if(!session->registered) {
+        if(!check_all && session->ready_events == SOCK_EVENT_NONE) {
+            return;
+        }
+
+        session->ready_events = SOCK_EVENT_NONE;
+
+        rc = session_check_open_unsafe(session);
+
+        if(rc == PLCTAG_STATUS_PENDING) {
+            session_update_poll_events_unsafe(session);
+            return;
+        }
+
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to open session to %s! %d", session->host, rc);
+            session_stop_polling_unsafe(session, rc);
+            return;
+        }
+
+        pdebug(DEBUG_INFO, "Session to %s is ready.", session->host);
+
+        session->status = PLCTAG_STATUS_OK;
+
+        /* the gateway may have sent more after the registration response. */
+        check_all = 1;
+    }
+
+    /* check for incoming data if the socket said it had some. */
+    if(check_all || (session->ready_events & (SOCK_EVENT_READ | SOCK_EVENT_ERROR))) {
+        rc = session_check_incoming_data_unsafe(session);
 
-    if (rc != PLCTAG_STATUS_OK) {
-        pdebug(DEBUG_WARN, "Error when checking for incoming session data! %d", rc);
-        /* FIXME - do something useful with this error */
+        if (rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Error when checking for incoming session data! %d", rc);
+            /* FIXME - do something useful with this error */
+            session_stop_polling_unsafe(session, rc);
+            return;
+        }
     }
 
-    /* check for incoming data. */
+    session->ready_events = SOCK_EVENT_NONE;
+
+    /* move along any connections waiting on a ForwardOpen. */
+    if(session->connections_opening) {
+        for(ab_connection_p connection = session->connections; connection; connection = connection->next) {
+            if(connection->connect_in_progress) {
+                connection_check_open_unsafe(connection);
+            }
+        }
+    }
+
+    /* move along any symbol tables that are loading. */
+    if(session->symbols_loading) {
+        for(ab_symbols_p symbols = session->symbols; symbols; symbols = symbols->next) {
+            if(symbols->status == PLCTAG_STATUS_PENDING) {
+                symbols_check_load_unsafe(symbols);
+            }
+        }
+    }
+
+    /* check for outgoing data.  This does no syscalls unless something is ready to send. */
     rc = session_check_outgoing_data_unsafe(session);
 
     if (rc != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_WARN, "Error when checking for outgoing session data! %d", rc);
         /* FIXME - do something useful with this error */
     }
+
+    session_update_poll_events_unsafe(session);
 }
 
 
@@ -1003,49 +1725,68 @@ static void process_session_tasks_unsafe(ab_session_p session)
 
 THREAD_FUNC(request_handler_func)
 {
+    ab_io_worker_p worker = (ab_io_worker_p)arg;
     ab_session_p cur_sess;
+    sock_event_t events[IO_THREAD_MAX_EVENTS];
+    int num_events = 0;
+    int generation = 0;
+    int64_t next_full_scan = 0;
 
-    (void)arg;
-
-    /* garbage code to stop compiler from whining about unused variables */
-    pdebug(DEBUG_DETAIL,"Starting.");
+    pdebug(DEBUG_DETAIL,"Starting IO thread %d.", worker->index);
 
     while (!library_terminating) {
-        /* we need the mutex */
-        if (global_session_mut == NULL) {
-            pdebug(DEBUG_ERROR, "global_session_mut is NULL!");
-            break;
-        }
+        /*pdebug(DEBUG_INFO,"entering critical block %p",worker->mutex);*/
+        critical_block(worker->mutex) {
+            int check_all = 0;
 
-        /*pdebug(DEBUG_INFO,"entering critical block %p",global_session_mut);*/
-        critical_block(global_session_mut) {
             /*
-             * loop over the sessions.  For each session, see if we can read some
-             * data.  If we can, read it in and try to update a request.  If the
-             * session has outstanding requests that need to be sent, try to send
-             * them.
+             * If a session was removed while we were waiting, the events could
+             * point to freed memory.  Throw them away and look at everything.
+             * Do the same once in a while to catch anything that fell through.
+             */
+            if(num_events < 0 || generation != worker->generation || time_ms() >= next_full_scan) {
+                check_all = 1;
+                next_full_scan = time_ms() + IO_THREAD_FULL_SCAN_INTERVAL_MS;
+            } else {
+                for(int i=0; i < num_events; i++) {
+                    ((ab_session_p)(events[i].context))->ready_events |= events[i].events;
+                }
+            }
+
+            /*
+             * loop over this worker's sessions.  Only read from the ones the poll
+             * set said were readable.  If the session has outstanding requests that
+             * need to be sent, try to send them.
              */
 
-            cur_sess = sessions;
+            cur_sess = worker->sessions;
 
             while (cur_sess) {
-                /* process incoming and outgoing data for the session. */
-                process_session_tasks_unsafe(cur_sess);
+                /*
+                 * process incoming and outgoing data for the session.  Only this
+                 * session is locked so other threads can queue requests on the rest.
+                 */
+                critical_block(cur_sess->mutex) {
+                    process_session_tasks_unsafe(cur_sess, check_all);
+                }
 
                 /*  move to the next session */
-                /*pdebug(DEBUG_INFO,"cur_sess=%p, cur_sess->next=%p",cur_sess, cur_sess->next);*/
-                cur_sess = cur_sess->next;
+                cur_sess = cur_sess->worker_next;
             }
+
+            generation = worker->generation;
         } /* end synchronized block */
-        /*pdebug(DEBUG_INFO,"leaving critical block %p",global_session_mut);*/
+        /*pdebug(DEBUG_INFO,"leaving critical block %p",worker->mutex);*/
 
         /*
-         * give up the CPU. 1ms is not really going to happen.  Usually it is more based on the OS
-         * default time and is usually around 10ms.  But, this sleep usually causes context switch.
+         * sleep until a socket is ready, a request is queued or it is time
+         * for a full scan.
          */
-        sleep_ms(1);
+        num_events = sock_poll_wait(worker->poller, events, IO_THREAD_MAX_EVENTS, IO_THREAD_FULL_SCAN_INTERVAL_MS);
     }
 
+    pdebug(DEBUG_DETAIL,"IO thread %d done.", worker->index);
+
     thread_stop();
 
     THREAD_RETURN(0);
@@ -1053,6 +1794,231 @@ THREAD_FUNC(request_handler_func)
 
 
 
+/***********************************************************************
+ *                            IO WORKER HANDLING                       *
+ ***********************************************************************/
+
+
+/*
+ * setup_io_workers
+ *
+ * Start the pool of IO threads if it is not running yet.  The number of
+ * threads is a library-wide setting, zero means the tag did not ask for
+ * a number.  Once the threads are running, asking for a different number
+ * is an error.
+ */
+int setup_io_workers(int num_workers)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    if(num_workers < 0 || num_workers > AB_MAX_IO_THREADS) {
+        pdebug(DEBUG_WARN, "Number of IO threads must be between 1 and %d, got %d.", AB_MAX_IO_THREADS, num_workers);
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    critical_block(global_session_mut) {
+        if(io_workers) {
+            if(num_workers && num_workers != num_io_workers) {
+                pdebug(DEBUG_WARN, "IO threads already running, io_threads=%d does not match the %d running.", num_workers, num_io_workers);
+                rc = PLCTAG_ERR_BAD_PARAM;
+                break;
+            }
+
+            /* if the setup failed, keep failing rather than use a broken worker. */
+            rc = io_workers_status;
+            break;
+        }
+
+        if(!num_workers) {
+            num_workers = AB_DEFAULT_IO_THREADS;
+        }
+
+        pdebug(DEBUG_INFO, "Starting %d IO threads.", num_workers);
+
+        io_workers = (struct ab_io_worker_t *)mem_alloc(num_workers * (int)sizeof(struct ab_io_worker_t));
+
+        if(!io_workers) {
+            pdebug(DEBUG_ERROR, "Unable to allocate IO workers!");
+            rc = PLCTAG_ERR_NO_MEM;
+            break;
+        }
+
+        /* the memory is zeroed, so teardown can tell which parts got set up. */
+        num_io_workers = num_workers;
+
+        for(int i=0; i < num_workers && rc == PLCTAG_STATUS_OK; i++) {
+            ab_io_worker_p worker = &io_workers[i];
+
+            worker->index = i;
+
+            if((rc = mutex_create(&worker->mutex)) != PLCTAG_STATUS_OK) {
+                pdebug(DEBUG_ERROR, "Unable to create IO thread %d mutex!", i);
+                break;
+            }
+
+            /* the worker sleeps on this until there is something to do */
+            if((rc = sock_poll_create(&worker->poller)) != PLCTAG_STATUS_OK) {
+                pdebug(DEBUG_ERROR, "Unable to create IO thread %d poll set!", i);
+                break;
+            }
+
+            if((rc = thread_create(&worker->thread, request_handler_func, 32*1024, worker)) != PLCTAG_STATUS_OK) {
+                pdebug(DEBUG_ERROR, "Unable to create IO thread %d!", i);
+                break;
+            }
+        }
+
+        io_workers_status = rc;
+    }
+
+    return rc;
+}
+
+
+static void teardown_io_workers(void)
+{
+    if(!io_workers) {
+        return;
+    }
+
+    /* they are probably asleep waiting for socket events. */
+    for(int i=0; i < num_io_workers; i++) {
+        if(io_workers[i].poller) {
+            sock_poll_wakeup(io_workers[i].poller);
+        }
+    }
+
+    /* a worker that failed part way through setup may not have everything. */
+    for(int i=0; i < num_io_workers; i++) {
+        if(io_workers[i].thread) {
+            thread_join(io_workers[i].thread);
+            thread_destroy(&io_workers[i].thread);
+        }
+
+        if(io_workers[i].poller) {
+            sock_poll_destroy(&io_workers[i].poller);
+        }
+
+        if(io_workers[i].mutex) {
+            mutex_destroy(&io_workers[i].mutex);
+        }
+    }
+
+    mem_free(io_workers);
+    io_workers = NULL;
+    num_io_workers = 0;
+    io_workers_status = PLCTAG_STATUS_OK;
+}
+
+
+/*
+ * io_worker_for_host
+ *
+ * Sessions to the same host always land on the same worker.
+ */
+ab_io_worker_p io_worker_for_host(const char *host)
+{
+    uint32_t host_hash;
+
+    if(!io_workers || num_io_workers < 1) {
+        return AB_IO_WORKER_NULL;
+    }
+
+    host_hash = hash((uint8_t *)host, (size_t)str_length(host), 0);
+
+    return &io_workers[host_hash % (uint32_t)num_io_workers];
+}
+
+
+/*
+ * io_worker_add_session
+ *
+ * Hand a session that has started connecting over to its worker.  From
+ * here on, the worker owns the socket and finishes opening the session.
+ */
+int io_worker_add_session(ab_session_p session)
+{
+    ab_io_worker_p worker = session->worker;
+    int rc = PLCTAG_STATUS_OK;
+
+    critical_block(worker->mutex) {
+        /* the socket becomes writable when the connection is made. */
+        session->poll_events = SOCK_EVENT_READ | SOCK_EVENT_WRITE;
+
+        rc = sock_poll_add(worker->poller, session->sock, session->poll_events, session);
+
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to add session socket to IO thread %d poll set!", worker->index);
+            break;
+        }
+
+        session->worker_next = worker->sessions;
+        worker->sessions = session;
+    }
+
+    /* the worker may be waiting on a poll set that does not have the new socket yet. */
+    if(rc == PLCTAG_STATUS_OK) {
+        sock_poll_wakeup(worker->poller);
+    }
+
+    return rc;
+}
+
+
+/*
+ * io_worker_remove_session
+ *
+ * After this returns, the worker will not touch the session again.
+ */
+int io_worker_remove_session(ab_session_p session)
+{
+    ab_io_worker_p worker = session->worker;
+    int rc = PLCTAG_ERR_NOT_FOUND;
+
+    if(!worker) {
+        return rc;
+    }
+
+    critical_block(worker->mutex) {
+        ab_session_p *walker = &worker->sessions;
+
+        while(*walker && *walker != session) {
+            walker = &((*walker)->worker_next);
+        }
+
+        if(*walker) {
+            *walker = session->worker_next;
+            session->worker_next = NULL;
+            rc = PLCTAG_STATUS_OK;
+        }
+
+        /*
+         * stop the worker from seeing this session's socket.  Readiness events
+         * it already pulled out of the poll set could still point at the session,
+         * so tell it that the list changed.
+         */
+        if(session->sock) {
+            sock_poll_remove(worker->poller, session->sock);
+        }
+
+        worker->generation++;
+    }
+
+    return rc;
+}
+
+
+int io_worker_wakeup(ab_io_worker_p worker)
+{
+    if(!worker) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    return sock_poll_wakeup(worker->poller);
+}
+
+
+
 /***********************************************************************
  *                           READ GROUP HANDLING                       *
  ***********************************************************************/
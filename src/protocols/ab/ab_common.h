@@ -44,10 +44,48 @@ typedef struct ab_session_t *ab_session_p;
 typedef struct ab_request_t *ab_request_p;
 #define AB_REQUEST_NULL ((ab_request_p)NULL)
 
+typedef struct ab_symbols_t *ab_symbols_p;
+#define AB_SYMBOLS_NULL ((ab_symbols_p)NULL)
+
+
+typedef struct ab_io_worker_t *ab_io_worker_p;
+#define AB_IO_WORKER_NULL ((ab_io_worker_p)NULL)
+
+/*
+ * IO worker threads.  Each session is pinned to one worker by a hash
+ * of the gateway host.  The worker mutex protects the worker's session
+ * list.  Each session has its own mutex for its request queue.
+ *
+ * Lock order: global_session_mut, then worker mutex, then session mutex.
+ */
+
+#define AB_DEFAULT_IO_THREADS (1)
+#define AB_MAX_IO_THREADS (64)
+
+struct ab_io_worker_t {
+    int index;
+    thread_p thread;
+    mutex_p mutex;
+
+    /* socket readiness for this worker and a way to wake it up */
+    sock_poll_p poller;
+
+    /* sessions serviced by this worker, linked through worker_next */
+    ab_session_p sessions;
+
+    /* bumped under the worker mutex whenever a session leaves the list */
+    volatile int generation;
+};
 
 extern volatile ab_session_p sessions;
+/* only protects the session registry above. */
 extern volatile mutex_p global_session_mut;
-extern volatile thread_p io_handler_thread;
+
+extern int setup_io_workers(int num_workers);
+extern ab_io_worker_p io_worker_for_host(const char *host);
+extern int io_worker_add_session(ab_session_p session);
+extern int io_worker_remove_session(ab_session_p session);
+extern int io_worker_wakeup(ab_io_worker_p worker);
 
 
 int ab_tag_abort(ab_tag_p tag);
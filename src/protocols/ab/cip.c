@@ -34,6 +34,7 @@
 #include <ab/cip.h>
 #include <ab/tag.h>
 #include <ab/defs.h>
+#include <ab/error_codes.h>
 #include <util/debug.h>
 
 
@@ -555,3 +556,117 @@ int cip_encode_tag_name(ab_tag_p tag,const char *name)
 
     return 1;
 }
+
+
+
+/*
+ * cip_msp_encode_header
+ *
+ * Start a Multiple Service Packet at data.  The format is:
+ *
+ * uint8_t cmd
+ * path to the Message Router
+ * uint16_t number of services
+ * uint16_t offset of each service from the number of services
+ * the services
+ *
+ * Returns where the first service goes.  Set the offset of each one with
+ * cip_msp_set_offset() as it is added.
+ */
+uint8_t *cip_msp_encode_header(uint8_t *data, int num_services)
+{
+    *data = AB_EIP_CMD_CIP_MULTI;
+    data++;
+
+    *data = 2; /* path size in 16-bit words */
+    data++;
+    *data = 0x20; /* class */
+    data++;
+    *data = 0x02; /* Message Router */
+    data++;
+    *data = 0x24; /* instance */
+    data++;
+    *data = 0x01; /* instance 1 */
+    data++;
+
+    *((uint16_le*)data) = h2le16((uint16_t)num_services);
+    data += sizeof(uint16_le);
+
+    /* skip the offsets. */
+    return data + (num_services * CIP_MSP_OFFSET_SIZE);
+}
+
+
+/* msp is where cip_msp_encode_header() started. */
+void cip_msp_set_offset(uint8_t *msp, int index, uint8_t *service)
+{
+    uint8_t *count_field = msp + CIP_MSP_REQ_HEADER - sizeof(uint16_le);
+
+    *((uint16_le*)(count_field + sizeof(uint16_le) * (index + 1))) = h2le16((uint16_t)(service - count_field));
+}
+
+
+/*
+ * cip_msp_check_reply
+ *
+ * Check the header of a Multiple Service Packet reply that should have
+ * num_services replies in it.  Some of the services failing is fine, that
+ * shows up in their own replies.  Sets count_field for cip_msp_get_reply().
+ */
+int cip_msp_check_reply(uint8_t *reply, uint8_t *reply_end, int num_services, uint8_t **count_field)
+{
+    if(reply + 4 > reply_end) {
+        pdebug(DEBUG_WARN, "Multiple Service Packet reply is too short!");
+        return PLCTAG_ERR_BAD_DATA;
+    }
+
+    if(reply[0] != (AB_EIP_CMD_CIP_MULTI | AB_EIP_CMD_CIP_OK)) {
+        pdebug(DEBUG_WARN, "CIP response reply service unexpected: %d", reply[0]);
+        return PLCTAG_ERR_BAD_DATA;
+    }
+
+    if(reply[2] != AB_CIP_STATUS_OK && reply[2] != AB_CIP_ERR_EMBEDDED_SERVICE) {
+        pdebug(DEBUG_WARN, "CIP Multiple Service Packet failed with status: 0x%x %s", reply[2], decode_cip_error_short(reply + 2));
+        pdebug(DEBUG_INFO, decode_cip_error_long(reply + 2));
+        return decode_cip_error_code(reply + 2);
+    }
+
+    *count_field = reply + 4 + (reply[3] * 2);
+
+    if(*count_field + sizeof(uint16_le) * (num_services + 1) > reply_end) {
+        pdebug(DEBUG_WARN, "Multiple Service Packet reply is too short!");
+        return PLCTAG_ERR_BAD_DATA;
+    }
+
+    if(le2h16(*((uint16_le*)*count_field)) != num_services) {
+        pdebug(DEBUG_WARN, "Got %d replies for %d services!", le2h16(*((uint16_le*)*count_field)), num_services);
+        return PLCTAG_ERR_BAD_DATA;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/*
+ * cip_msp_get_reply
+ *
+ * Find the reply to one service in a Multiple Service Packet reply that
+ * passed cip_msp_check_reply().  It runs from sub up to sub_end and has
+ * at least the reply service, status and status size.
+ */
+int cip_msp_get_reply(uint8_t *count_field, uint8_t *reply_end, int num_services, int index, uint8_t **sub, uint8_t **sub_end)
+{
+    *sub = count_field + le2h16(*((uint16_le*)(count_field + sizeof(uint16_le) * (index + 1))));
+    *sub_end = reply_end;
+
+    if(index + 1 < num_services) {
+        *sub_end = count_field + le2h16(*((uint16_le*)(count_field + sizeof(uint16_le) * (index + 2))));
+    }
+
+    if(*sub < count_field || *sub + 4 > *sub_end || *sub_end > reply_end) {
+        pdebug(DEBUG_WARN, "Reply %d is outside the packet!", index);
+        return PLCTAG_ERR_BAD_DATA;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
@@ -35,6 +35,23 @@ int cip_encode_path(ab_tag_p tag, const char *path);
 //~ char *cip_decode_status(int status);
 int cip_encode_tag_name(ab_tag_p tag,const char *name);
 
+/*
+ * Multiple Service Packets, used by read groups and by the session to pack
+ * small requests.  The request header is the service, the path to the
+ * Message Router and the service count, the reply header is the reply
+ * service, status and the service count.  Each service also has a 16-bit
+ * offset.
+ */
+#define CIP_MSP_REQ_HEADER   (8)
+#define CIP_MSP_RESP_HEADER  (6)
+#define CIP_MSP_OFFSET_SIZE  (2)
+#define CIP_MSP_FUDGE        (32) /* MAGIC fudge factor, status words and room the PLC keeps for itself */
+
+uint8_t *cip_msp_encode_header(uint8_t *data, int num_services);
+void cip_msp_set_offset(uint8_t *msp, int index, uint8_t *service);
+int cip_msp_check_reply(uint8_t *reply, uint8_t *reply_end, int num_services, uint8_t **count_field);
+int cip_msp_get_reply(uint8_t *count_field, uint8_t *reply_end, int num_services, int index, uint8_t **sub, uint8_t **sub_end);
+
 
 
 #endif
@@ -55,9 +55,9 @@ extern "C"
 
 //~ static ab_connection_p session_find_connection_by_path_unsafe(ab_session_p session,const char *path);
 static ab_connection_p connection_create_unsafe(const char* path, ab_tag_p tag, int shared);
-static int connection_perform_forward_open(ab_connection_p connection);
-static int try_forward_open_ex(ab_connection_p connection);
-static int try_forward_open(ab_connection_p connection);
+static int connection_start_forward_open(ab_connection_p connection);
+static void connection_open_done_unsafe(ab_connection_p connection, int status);
+static void connection_release_held_tags_unsafe(ab_connection_p connection);
 static int guess_max_packet_size(ab_connection_p connection, int alternate);
 static int send_forward_open_req(ab_connection_p connection, ab_request_p req);
 static int send_forward_open_req_ex(ab_connection_p connection, ab_request_p req);
@@ -70,9 +70,8 @@ static int recv_forward_open_resp(ab_connection_p connection, ab_request_p req);
 //~ static int connection_is_empty(ab_connection_p connection);
 //static int connection_destroy_unsafe(ab_connection_p connection);
 static void connection_destroy(void *connection);
-static int connection_close(ab_connection_p connection);
+static int connection_close_unsafe(ab_connection_p connection);
 static int send_forward_close_req(ab_connection_p connection, ab_request_p req);
-static int recv_forward_close_resp(ab_connection_p connection, ab_request_p req);
 
 
 /*
@@ -87,17 +86,27 @@ int connection_find_or_create(ab_tag_p tag, attr attribs)
     const char* path = attr_get_str(attribs, "path", "");
     ab_connection_p connection = AB_CONNECTION_NULL;
     int rc = PLCTAG_STATUS_OK;
-    int is_new = 0;
     int shared_connection = attr_get_int(attribs, "share_connection", 1); /* share the session by default. */
+    int window = attr_get_int(attribs, "connection_window", CONNECTION_DEFAULT_IN_FLIGHT);
 
     pdebug(DEBUG_INFO, "Starting.");
 
+    if(window < 1 || window > CONNECTION_MAX_IN_FLIGHT) {
+        pdebug(DEBUG_WARN, "connection_window must be between 1 and %d, using %d.", CONNECTION_MAX_IN_FLIGHT, CONNECTION_DEFAULT_IN_FLIGHT);
+        window = CONNECTION_DEFAULT_IN_FLIGHT;
+    }
+
+    /* DH+ bridging is strictly one request at a time. */
+    if(tag->use_dhp_direct) {
+        window = 1;
+    }
+
     /* lock the session while this is happening because we do not
      * want a race condition where two tags try to create the same
      * connection at the same time.
      */
 
-    critical_block(global_session_mut) {
+    critical_block(tag->session->mutex) {
         if(shared_connection) {
             connection = session_find_connection_by_path_unsafe(tag->session, path);
         } else {
@@ -107,7 +116,30 @@ int connection_find_or_create(ab_tag_p tag, attr attribs)
         /* if we find one but it is in the process of disconnection, create a new one */
         if (connection == AB_CONNECTION_NULL) {
             connection = connection_create_unsafe(path, tag, shared_connection);
-            is_new = 1;
+
+            /* the first tag on a shared connection sets the window. */
+            if(connection) {
+                connection->max_requests_in_flight = window;
+
+                /*
+                 * start the ForwardOpen.  The IO thread finishes it, so the
+                 * tag does not wait here.  Do it under the mutex so the IO
+                 * thread never sees the connection without its request.
+                 */
+                connection->fo_extended = 1;
+                connection->max_payload_size = guess_max_packet_size(connection, 1);
+
+                rc = connection_start_forward_open(connection);
+
+                if(rc == PLCTAG_STATUS_PENDING) {
+                    connection->connect_in_progress = 1;
+                    connection->session->connections_opening++;
+                    rc = PLCTAG_STATUS_OK;
+                } else {
+                    pdebug(DEBUG_WARN, "Unable to start ForwardOpen to set up connection with PLC!");
+                    connection->status = rc;
+                }
+            }
 
             if(shared_connection) {
                 pdebug(DEBUG_INFO, "Creating new connection.");
@@ -125,11 +157,6 @@ int connection_find_or_create(ab_tag_p tag, attr attribs)
         pdebug(DEBUG_ERROR, "unable to create or find a connection!");
         rc = PLCTAG_ERR_BAD_GATEWAY;
         return rc;
-    } else if(is_new) {
-        /* do the ForwardOpen call to set up the connection */
-        if((rc = connection_perform_forward_open(connection)) != PLCTAG_STATUS_OK) {
-            pdebug(DEBUG_WARN, "Unable to perform ForwardOpen to set up connection with PLC!");
-        }
     }
 
     tag->connection = connection;
@@ -140,6 +167,144 @@ int connection_find_or_create(ab_tag_p tag, attr attribs)
 }
 
 
+/*
+ * connection_check_open_unsafe
+ *
+ * Called by the IO thread, with the session mutex held, while the
+ * connection is opening.  When the ForwardOpen response is in, this
+ * either finishes the connection or sends the next ForwardOpen: the
+ * same kind with the size the PLC asked for, or the old kind if the
+ * PLC does not support ForwardOpenEx.  Tags waiting on the connection
+ * are woken when it is done, whether it worked or not.
+ *
+ * Returns PLCTAG_STATUS_PENDING while the connection is still opening.
+ */
+int connection_check_open_unsafe(ab_connection_p connection)
+{
+    ab_request_p req = connection->fo_request;
+    int rc = PLCTAG_STATUS_OK;
+
+    if(!req->resp_received) {
+        /* the session drops the request if the response does not come in time. */
+        if(!req->abort_request) {
+            return PLCTAG_STATUS_PENDING;
+        }
+
+        pdebug(DEBUG_WARN,"Timed out waiting for ForwardOpen response!");
+        rc = PLCTAG_ERR_TIMEOUT;
+    } else {
+        rc = recv_forward_open_resp(connection, req);
+
+        if(rc == PLCTAG_ERR_TOO_LARGE && !connection->fo_resized) {
+            /* the PLC supports the command, but we need to use a smaller size. */
+            pdebug(DEBUG_DETAIL,"%s is supported but the packet size is not, trying %d.", (connection->fo_extended ? "ForwardOpenEx" : "ForwardOpen"), connection->max_payload_size);
+
+            connection->fo_resized = 1;
+
+            rc = connection_start_forward_open(connection);
+        } else if(rc == PLCTAG_ERR_UNSUPPORTED && connection->fo_extended) {
+            /* the PLC does not support Forward Open Extended, use the old one. */
+            pdebug(DEBUG_DETAIL,"ForwardOpenEx is not supported, trying ForwardOpen.");
+
+            connection->fo_extended = 0;
+            connection->fo_resized = 0;
+            connection->max_payload_size = guess_max_packet_size(connection, 0);
+
+            rc = connection_start_forward_open(connection);
+        }
+    }
+
+    if(rc == PLCTAG_STATUS_PENDING) {
+        return rc;
+    }
+
+    if(rc == PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_DETAIL, "ForwardOpen succeeded and maximum CIP packet size is %d.", connection->max_payload_size);
+    } else {
+        pdebug(DEBUG_WARN,"Unable to open connection to PLC (%s)!", plc_tag_decode_error(rc));
+    }
+
+    connection_open_done_unsafe(connection, rc);
+
+    return rc;
+}
+
+
+/*
+ * connection_hold_op
+ *
+ * Called at the start of a read or write on a connected tag.  While the
+ * connection is still opening, the operation is remembered on the tag
+ * and PLCTAG_STATUS_PENDING is returned.  The tag status function starts
+ * it once the connection is open.  Returns PLCTAG_STATUS_OK if the
+ * operation can go ahead now, or the error that the connection failed with.
+ */
+int connection_hold_op(ab_tag_p tag, int op)
+{
+    ab_connection_p connection = tag->connection;
+    int rc = PLCTAG_STATUS_OK;
+
+    /* the usual case, no lock needed. */
+    if(!connection || connection->status == PLCTAG_STATUS_OK) {
+        return PLCTAG_STATUS_OK;
+    }
+
+    critical_block(connection->session->mutex) {
+        rc = connection->status;
+
+        if(rc != PLCTAG_STATUS_PENDING) {
+            break;
+        }
+
+        /* the IO thread wakes the tag when the connection is done opening. */
+        if(!tag->held_op && tag->done) {
+            if(!connection->held_tags) {
+                connection->held_tags = vector_create(8, 8); /* MAGIC */
+            }
+
+            if(connection->held_tags && vector_put(connection->held_tags, vector_length(connection->held_tags), tag->done) == PLCTAG_STATUS_OK) {
+                rc_inc(tag->done);
+            } else {
+                /* the tag still wakes up to check now and then. */
+                pdebug(DEBUG_WARN, "Unable to add tag to the connection wait list!");
+            }
+        }
+
+        tag->held_op = op;
+    }
+
+    if(rc == PLCTAG_STATUS_PENDING) {
+        pdebug(DEBUG_DETAIL, "Holding operation until the connection is open.");
+    }
+
+    return rc;
+}
+
+
+/*
+ * connection_held_op_status
+ *
+ * Called by the tag status functions when the tag has a held operation.
+ * Returns PLCTAG_STATUS_PENDING while the session or connection is still
+ * opening and PLCTAG_STATUS_OK when the operation in tag->held_op can be
+ * started.  If either failed, the hold is dropped and the error returned.
+ */
+int connection_held_op_status(ab_tag_p tag)
+{
+    int rc = tag->session->status;
+
+    if(rc == PLCTAG_STATUS_OK && tag->connection) {
+        rc = tag->connection->status;
+    }
+
+    if(rc != PLCTAG_STATUS_OK && rc != PLCTAG_STATUS_PENDING) {
+        tag->held_op = TAG_OP_NONE;
+    }
+
+    return rc;
+}
+
+
 //int connection_acquire(ab_connection_p connection)
 //{
 //    if(!connection) {
@@ -253,166 +418,90 @@ int guess_max_packet_size(ab_connection_p connection, int alternate)
 }
 
 
-int connection_perform_forward_open(ab_connection_p connection)
+/*
+ * connection_start_forward_open
+ *
+ * Queue a ForwardOpen of the current kind and size.  The response is
+ * picked up by connection_check_open_unsafe() in the IO thread.  Must
+ * be called with the session mutex held.
+ *
+ * Returns PLCTAG_STATUS_PENDING if the request was queued.
+ */
+int connection_start_forward_open(ab_connection_p connection)
 {
     int rc = PLCTAG_STATUS_OK;
+    ab_request_p req = NULL;
 
-    pdebug(DEBUG_INFO, "Starting.");
-
-    do {
-        /* Try Forward Open Extended first with a large connection size */
-        connection->max_payload_size=guess_max_packet_size(connection, 1);
-
-        rc = try_forward_open_ex(connection);
-        if(rc == PLCTAG_ERR_TOO_LARGE) {
-            /* we support the Forward Open Extended command, but we need to use a smaller size. */
-            pdebug(DEBUG_DETAIL,"ForwardOpenEx is supported but packet size of %d is not, trying %d.", MAX_CIP_MSG_SIZE_EX, connection->max_payload_size);
-
-            rc = try_forward_open_ex(connection);
-            if(rc != PLCTAG_STATUS_OK) {
-                pdebug(DEBUG_WARN,"Unable to open connection to PLC (%s)!", plc_tag_decode_error(rc));
-            } else {
-                pdebug(DEBUG_DETAIL,"ForwardOpenEx succeeded with packet size %d.", connection->max_payload_size);
-            }
-        } else if(rc == PLCTAG_ERR_UNSUPPORTED) {
-            /* the PLC does not support Forward Open Extended, use the old one. */
-            connection->max_payload_size = guess_max_packet_size(connection, 0);
-
-            rc = try_forward_open(connection);
-            if(rc == PLCTAG_ERR_TOO_LARGE) {
-                /* we support the Forward Open Extended command, but we need to use a smaller size. */
-                pdebug(DEBUG_DETAIL,"ForwardOpen is supported but packet size of %d is not, trying %d.", MAX_CIP_MSG_SIZE, connection->max_payload_size);
-
-                rc = try_forward_open_ex(connection);
-                if(rc != PLCTAG_STATUS_OK) {
-                    pdebug(DEBUG_WARN,"Unable to open connection to PLC (%s)!", plc_tag_decode_error(rc));
-                } else {
-                    pdebug(DEBUG_DETAIL,"ForwardOpen succeeded with packet size %d.", connection->max_payload_size);
-                }
-            }
-        }
-    } while(0);
+    pdebug(DEBUG_INFO,"Starting.");
 
-    if(rc == PLCTAG_STATUS_OK) {
-        pdebug(DEBUG_DETAIL, "ForwardOpen succeeded and maximum CIP packet size is %d.", connection->max_payload_size);
+    /* the last request is done, the response has been used. */
+    if(connection->fo_request) {
+        connection->fo_request = rc_dec(connection->fo_request);
     }
 
-    connection->status = rc;
-
-    pdebug(DEBUG_INFO, "Done.");
-
-    return rc;
-}
-
-
-int try_forward_open_ex(ab_connection_p connection)
-{
-    int rc = PLCTAG_STATUS_OK;
-    int64_t timeout_time = 0;
-    ab_request_p req=NULL;
-
-    pdebug(DEBUG_INFO,"Starting.");
-
     /* get a request buffer */
     rc = request_create(&req, MAX_CIP_MSG_SIZE);
 
-    do {
-        if(rc != PLCTAG_STATUS_OK) {
-            pdebug(DEBUG_WARN,"Unable to get new request.  rc=%d",rc);
-            rc = 0;
-            break;
-        }
-
-        /* send the ForwardOpenEx command to the PLC */
-        if((rc = send_forward_open_req_ex(connection, req)) != PLCTAG_STATUS_OK) {
-            pdebug(DEBUG_WARN,"Unable to send ForwardOpenEx packet!");
-            break;
-        }
-
-        /* wait for a response */
-        timeout_time = time_ms() + CONNECTION_SETUP_TIMEOUT;
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN,"Unable to get new request.  rc=%d",rc);
+        return rc;
+    }
 
-        while (timeout_time > time_ms() && !req->resp_received) {
-            sleep_ms(1);
-        }
+    /* give up if the PLC does not answer. */
+    req->resp_timeout = CONNECTION_SETUP_TIMEOUT;
 
-        /* timeout? */
-        if(!req->resp_received) {
-            pdebug(DEBUG_WARN,"Timed out waiting for ForwardOpen response!");
-            rc = PLCTAG_ERR_TIMEOUT;
-            break;
-        }
-
-        /* check for the ForwardOpen response. */
-        if((rc = recv_forward_open_resp(connection, req)) != PLCTAG_STATUS_OK) {
-            pdebug(DEBUG_WARN,"Unable to use ForwardOpen response!");
-            break;
-        }
-    } while(0);
+    /* send the ForwardOpen command to the PLC */
+    if(connection->fo_extended) {
+        rc = send_forward_open_req_ex(connection, req);
+    } else {
+        rc = send_forward_open_req(connection, req);
+    }
 
-    if(req) {
-        req = rc_dec(req);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN,"Unable to send ForwardOpen packet!");
+        rc_dec(req);
+        return rc;
     }
 
+    connection->fo_request = req;
+
     pdebug(DEBUG_INFO,"Done.");
 
-    return rc;
+    return PLCTAG_STATUS_PENDING;
 }
 
 
-
-int try_forward_open(ab_connection_p connection)
+/* the connection is open or failed, let the tags waiting on it know. */
+void connection_open_done_unsafe(ab_connection_p connection, int status)
 {
-    int rc = PLCTAG_STATUS_OK;
-    int64_t timeout_time = 0;
-    ab_request_p req=NULL;
-
-    pdebug(DEBUG_INFO,"Starting.");
-
-    /* get a request buffer */
-    rc = request_create(&req, MAX_CIP_MSG_SIZE);
+    connection->status = status;
+    connection->connect_in_progress = 0;
+    connection->session->connections_opening--;
 
-    do {
-        if(rc != PLCTAG_STATUS_OK) {
-            pdebug(DEBUG_WARN,"Unable to get new request.  rc=%d",rc);
-            rc = 0;
-            break;
-        }
-
-        /* send the ForwardOpen command to the PLC */
-        if((rc = send_forward_open_req(connection, req)) != PLCTAG_STATUS_OK) {
-            pdebug(DEBUG_WARN,"Unable to send ForwardOpenEx packet!");
-            break;
-        }
+    if(connection->fo_request) {
+        connection->fo_request = rc_dec(connection->fo_request);
+    }
 
-        /* wait for a response */
-        timeout_time = time_ms() + CONNECTION_SETUP_TIMEOUT;
+    connection_release_held_tags_unsafe(connection);
+}
 
-        while (timeout_time > time_ms() && !req->resp_received) {
-            sleep_ms(1);
-        }
 
-        /* timeout? */
-        if(!req->resp_received) {
-            pdebug(DEBUG_WARN,"Timed out waiting for ForwardOpen response!");
-            rc = PLCTAG_ERR_TIMEOUT;
-            break;
-        }
+/* wake any tags waiting on the connection and drop our references to them. */
+void connection_release_held_tags_unsafe(ab_connection_p connection)
+{
+    if(!connection->held_tags) {
+        return;
+    }
 
-        /* check for the ForwardOpen response. */
-        if((rc = recv_forward_open_resp(connection, req)) != PLCTAG_STATUS_OK) {
-            pdebug(DEBUG_WARN,"Unable to use ForwardOpen response!");
-            break;
-        }
-    } while(0);
+    for(int i=0; i < vector_length(connection->held_tags); i++) {
+        tag_done_p done = vector_get(connection->held_tags, i);
 
-    if(req) {
-        req = rc_dec(req);
+        tag_done_signal(done);
+        rc_dec(done);
     }
 
-    pdebug(DEBUG_INFO,"Done.");
-
-    return rc;
+    vector_destroy(connection->held_tags);
+    connection->held_tags = NULL;
 }
 
 
@@ -656,7 +745,6 @@ int recv_forward_open_resp(ab_connection_p connection, ab_request_p req)
 void connection_destroy(void *connection_arg)
 {
     ab_connection_p connection = connection_arg;
-//    int really_destroy = 1;
 
     pdebug(DEBUG_INFO, "Starting.");
 
@@ -665,70 +753,51 @@ void connection_destroy(void *connection_arg)
         return;
     }
 
-    /* do not destroy the connection if there are
-     * connections still */
-
-    /* removed due to refcount code
-    if (connection->tags) {
-        pdebug(DEBUG_WARN, "Attempt to destroy connection while open tags exist!");
-        return 0;
-    }
-    */
-
     /*
-     * This needs to be done carefully.  We can have a race condition here.
-     *
-     * If there is another thread that just looked up the connection and got
-     * a reference (and thus a ref count increment), then we have another
-     * reference and thus cannot delete this connection yet.
+     * Nothing waits for the PLC here.  The ForwardOpen is dropped if it
+     * is still going and the ForwardClose goes out on its own.
      */
-    critical_block(global_session_mut) {
-//        if(refcount_get_count(&connection->rc) > 0) {
-//            pdebug(DEBUG_WARN,"Some other thread took a reference to this connection before we could delete it.  Aborting deletion.");
-//            really_destroy = 0;
-//            break;
-//        }
-
+    critical_block(connection->session->mutex) {
         /* make sure the session does not reference the connection */
         session_remove_connection_unsafe(connection->session, connection);
 
         /* now no one can get a reference to this connection. */
-    }
 
-//    if(really_destroy) {
+        if(connection->connect_in_progress) {
+            connection->fo_request->abort_request = 1;
+            connection->session->connections_opening--;
+        }
+
         /* clean up connection with the PLC, ignore return code, we can't do anything about it. */
-        connection_close(connection);
+        if(connection->is_connected || (connection->connect_in_progress && connection->fo_request->send_count)) {
+            connection_close_unsafe(connection);
+        }
 
-        rc_dec(connection->session);
+        if(connection->fo_request) {
+            connection->fo_request = rc_dec(connection->fo_request);
+        }
 
-        /* do final clean up */
-        //mem_free(connection);
-//    }
+        connection_release_held_tags_unsafe(connection);
+    }
+
+    rc_dec(connection->session);
 
     pdebug(DEBUG_INFO, "Done.");
 
     return;
 }
 
+
 /*
- * This should never be called directly.  It should only be called
- * as a result of the reference count hitting zero.
+ * connection_close_unsafe
+ *
+ * Queue a ForwardClose for the connection.  Nothing owns the request
+ * after this, the session drops it when the response comes in or when
+ * it has waited too long.  Must be called with the session mutex held.
  */
-/* not called due to refcount code
-void connection_destroy(void conn_arg)
-{
-    ab_connection_p connection = conn_arg;
-
-    critical_block(global_session_mut) {
-        connection_destroy_unsafe(connection);
-    }
-}
-*/
-
-int connection_close(ab_connection_p connection)
+int connection_close_unsafe(ab_connection_p connection)
 {
-    ab_request_p req;
-    int64_t timeout_time = 0L;
+    ab_request_p req = NULL;
     int rc = PLCTAG_STATUS_OK;
 
     pdebug(DEBUG_INFO, "Starting.");
@@ -736,52 +805,21 @@ int connection_close(ab_connection_p connection)
     /* get a request buffer */
     rc = request_create(&req, MAX_CIP_MSG_SIZE);
 
-    do {
-        if(rc != PLCTAG_STATUS_OK) {
-            pdebug(DEBUG_WARN,"Unable to get new request.  rc=%d",rc);
-            rc = 0;
-            break;
-        }
-
-        req->num_retries_left = 5; /* MAGIC! */
-        req->retry_interval = 900; /* MAGIC! */
-
-        /* send the ForwardClose command to the PLC */
-        if((rc = send_forward_close_req(connection, req)) != PLCTAG_STATUS_OK) {
-            pdebug(DEBUG_WARN,"Unable to send ForwardClose packet!");
-            break;
-        }
-
-        /* wait for a response */
-        timeout_time = time_ms() + CONNECTION_TEARDOWN_TIMEOUT;
-
-        while (timeout_time > time_ms() && !req->resp_received) {
-            sleep_ms(1);
-        }
-
-        /* timeout? */
-        if(!req->resp_received) {
-            pdebug(DEBUG_WARN,"Timed out waiting for ForwardClose response!");
-            rc = PLCTAG_ERR_TIMEOUT;
-            break;
-        }
-
-        /* check for the ForwardClose response. */
-        if((rc = recv_forward_close_resp(connection, req)) != PLCTAG_STATUS_OK) {
-            pdebug(DEBUG_WARN,"Unable to use ForwardClose response!");
-            rc = PLCTAG_ERR_REMOTE_ERR;
-            break;
-        }
-
-    } while(0);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN,"Unable to get new request.  rc=%d",rc);
+        return rc;
+    }
 
-    connection->status = rc;
+    req->resp_timeout = CONNECTION_TEARDOWN_TIMEOUT;
 
-    if(req) {
-        //session_remove_request(connection->session,req);
-        req = rc_dec(req);
+    /* send the ForwardClose command to the PLC */
+    if((rc = send_forward_close_req(connection, req)) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN,"Unable to send ForwardClose packet!");
     }
 
+    /* the session has its own reference. */
+    rc_dec(req);
+
     pdebug(DEBUG_INFO, "Done.");
 
     return rc;
@@ -856,43 +894,3 @@ int send_forward_close_req(ab_connection_p connection, ab_request_p req)
 
     return rc;
 }
-
-
-int recv_forward_close_resp(ab_connection_p connection, ab_request_p req)
-{
-    eip_forward_close_resp_t *fo_resp;
-    int rc = PLCTAG_STATUS_OK;
-
-    pdebug(DEBUG_INFO,"Starting");
-
-    fo_resp = (eip_forward_close_resp_t*)(req->data);
-
-    do {
-        if(le2h16(fo_resp->encap_command) != AB_EIP_READ_RR_DATA) {
-            pdebug(DEBUG_WARN,"Unexpected EIP packet type received: %d!",fo_resp->encap_command);
-            rc = PLCTAG_ERR_BAD_DATA;
-            break;
-        }
-
-        if(le2h32(fo_resp->encap_status) != AB_EIP_OK) {
-            pdebug(DEBUG_WARN,"EIP command failed, response code: %d",fo_resp->encap_status);
-            rc = PLCTAG_ERR_REMOTE_ERR;
-            break;
-        }
-
-        if(fo_resp->general_status != AB_EIP_OK) {
-            pdebug(DEBUG_WARN,"Forward Close command failed, response code: %d",fo_resp->general_status);
-            rc = PLCTAG_ERR_REMOTE_ERR;
-            break;
-        }
-
-        pdebug(DEBUG_DETAIL,"Connection close succeeded.");
-
-        connection->status = PLCTAG_STATUS_OK;
-        rc = PLCTAG_STATUS_OK;
-    } while(0);
-
-    pdebug(DEBUG_INFO,"Done.");
-
-    return rc;
-}
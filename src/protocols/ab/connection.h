@@ -34,6 +34,7 @@
 #include <ab/ab_common.h>
 #include <util/attr.h>
 #include <util/rc.h>
+#include <util/vector.h>
 #include <ab/session.h>
 #include <ab/tag.h>
 
@@ -41,6 +42,12 @@
 #define CONNECTION_SETUP_TIMEOUT (1500)
 #define CONNECTION_TEARDOWN_TIMEOUT (1500)
 
+/*
+ * how many connected requests can be outstanding on one connection at once.
+ * The sequence number in each packet matches the response to the request.
+ * Set with the connection_window attribute.
+ */
+#define CONNECTION_DEFAULT_IN_FLIGHT (4)
 #define CONNECTION_MAX_IN_FLIGHT (7)
 
 struct ab_connection_t {
@@ -75,9 +82,19 @@ struct ab_connection_t {
     int exclusive;
     int status;
 
-    /* flag to avoid packet loss */
-    //int request_in_flight[CONNECTION_MAX_IN_FLIGHT];
-    //uint16_t seq_in_flight[CONNECTION_MAX_IN_FLIGHT];
+    /* ForwardOpen in progress, the IO thread moves it along. */
+    ab_request_p fo_request;
+    int fo_extended; /* using ForwardOpenEx */
+    int fo_resized; /* already retried with the size the PLC asked for */
+
+    /* done signals of tags with an operation waiting for the connection to open. */
+    vector_p held_tags;
+
+    /* in flight window, the count is redone on each pass over the session requests. */
+    int max_requests_in_flight;
+    int requests_in_flight;
+    unsigned int in_flight_pass;
+    int requests_waiting; /* in the session list but never sent */
 
     /* maintain a ref count. */
     //refcount rc;
@@ -89,6 +106,9 @@ struct ab_connection_t {
 
 
 extern int connection_find_or_create(ab_tag_p tag, attr attribs);
+extern int connection_check_open_unsafe(ab_connection_p connection);
+extern int connection_hold_op(ab_tag_p tag, int op);
+extern int connection_held_op_status(ab_tag_p tag);
 //extern int connection_acquire(ab_connection_p connection);
 //extern int connection_acquire(ab_connection_p connection);
 //extern int connection_release(ab_connection_p connection);
@@ -94,14 +94,23 @@
 #define AB_EIP_CMD_CIP_WRITE            ((uint8_t)0x4D)
 #define AB_EIP_CMD_CIP_READ_FRAG        ((uint8_t)0x52)
 #define AB_EIP_CMD_CIP_WRITE_FRAG       ((uint8_t)0x53)
+#define AB_EIP_CMD_CIP_MULTI            ((uint8_t)0x0A)
+#define AB_EIP_CMD_CIP_GET_ATTR_SINGLE  ((uint8_t)0x0E)
+#define AB_EIP_CMD_CIP_LIST_INSTANCES   ((uint8_t)0x55) /* Get_Instance_Attribute_List */
+
+/* Symbol Object, one instance per tag in the controller. */
+#define AB_CIP_SYMBOL_CLASS             ((uint8_t)0x6B)
 
 /* flag set when command is OK */
 #define AB_EIP_CMD_CIP_OK               ((uint8_t)0x80)
 
 #define AB_CIP_STATUS_OK                ((uint8_t)0x00)
+#define AB_CIP_ERR_PATH_SEGMENT         ((uint8_t)0x04)
+#define AB_CIP_ERR_PATH_DEST            ((uint8_t)0x05)
 #define AB_CIP_STATUS_FRAG              ((uint8_t)0x06)
 
 #define AB_CIP_ERR_UNSUPPORTED_SERVICE  ((uint8_t)0x08)
+#define AB_CIP_ERR_EMBEDDED_SERVICE     ((uint8_t)0x1E)
 
 /* PCCC commands */
 #define AB_EIP_PCCC_TYPED_CMD ((uint8_t)0x0F)
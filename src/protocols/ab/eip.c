@@ -33,13 +33,21 @@
 #include <ab/connection.h>
 #include <ab/request.h>
 #include <util/debug.h>
+#include <util/rc.h>
+#include <util/stats.h>
 
 
-/* this must be called with the session mutex held */
-int send_eip_request_unsafe(ab_request_p req)
+/*
+ * prepare_eip_request_unsafe
+ *
+ * Fill in the sequence IDs and encapsulation header so that the request
+ * is ready to go on the wire.  The session does the actual write so
+ * that it can gather several requests into one.
+ *
+ * This must be called with the session mutex held.
+ */
+int prepare_eip_request_unsafe(ab_request_p req)
 {
-    int rc;
-
     pdebug(DEBUG_DETAIL, "Starting.");
 
     if(!req) {
@@ -60,6 +68,8 @@ int send_eip_request_unsafe(ab_request_p req)
             req->session_seq_id = req->session->session_seq_id;
             encap->encap_sender_context = h2le64(req->session->session_seq_id); /* link up the request seq ID and the packet seq ID */
 
+            session_index_request_unsafe(req->session, req, SESSION_MATCH_KEY_UNCONNECTED(req->session_seq_id));
+
             /* mark the session as being used if this is a serialized packet */
             //~ mark_session_for_request(req);
 
@@ -75,6 +85,8 @@ int send_eip_request_unsafe(ab_request_p req)
             conn_req->cpf_conn_seq_num = h2le16(req->connection->conn_seq_num);
             req->conn_seq = req->connection->conn_seq_num;
 
+            session_index_request_unsafe(req->session, req, SESSION_MATCH_KEY_CONNECTED(req->conn_id, req->conn_seq));
+
             /* mark the connection as being used. */
             //~ mark_connection_for_request(req);
 
@@ -97,53 +109,50 @@ int send_eip_request_unsafe(ab_request_p req)
         req->send_in_progress = 1;
     }
 
-    /* send the packet */
-    rc = socket_write(req->session->sock, req->data + req->current_offset, req->request_size - req->current_offset);
+    pdebug(DEBUG_DETAIL, "Done.");
 
-    if (rc >= 0) {
-        req->current_offset += rc;
+    return PLCTAG_STATUS_OK;
+}
 
-        /* are we done? */
-        if (req->current_offset >= req->request_size) {
-            req->send_request = 0;
-            req->send_in_progress = 0;
-            req->current_offset = 0;
 
-            req->time_sent = time_ms();
-            req->send_count++;
 
-            /* set this request up for a receive action */
-            if(req->abort_after_send) {
-                req->abort_request = 1; /* for one shots */
-            } else {
-                req->recv_in_progress = 1;
-            }
-        }
+/*
+ * eip_request_sent_unsafe
+ *
+ * The last byte of the request has been written.  Set it up to wait for
+ * its response.
+ *
+ * This must be called with the session mutex held.
+ */
+void eip_request_sent_unsafe(ab_request_p req)
+{
+    req->send_request = 0;
+    req->send_in_progress = 0;
+    req->current_offset = 0;
 
-        rc = PLCTAG_STATUS_OK;
+    req->time_sent = time_ms();
+    req->send_count++;
+
+    /* set this request up for a receive action */
+    if(req->abort_after_send) {
+        req->abort_request = 1; /* for one shots */
     } else {
-        /* oops, error of some sort. */
-        req->status = rc;
-        req->send_request = 0;
-        req->send_in_progress = 0;
-        req->recv_in_progress = 0;
+        req->recv_in_progress = 1;
     }
-
-    pdebug(DEBUG_DETAIL, "Done.");
-
-    return rc;
 }
 
+
 /*
  * recv_eip_response
  *
  * Look at the passed session and read any data we can
- * to fill in a packet.  If we already have a full packet,
- * punt.
+ * to fill in a packet.  Each read takes as much as the socket
+ * has, so one read can bring in several packets.  They are
+ * framed in place one per call.  If we already have a full
+ * packet, punt.
  */
 int recv_eip_response_unsafe(ab_session_p session)
 {
-    uint32_t data_needed = 0;
     int rc = PLCTAG_STATUS_OK;
 
     if(!session) {
@@ -158,72 +167,103 @@ int recv_eip_response_unsafe(ab_session_p session)
 
     /*pdebug(DEBUG_DETAIL,"Starting.");*/
 
-    /*
-     * Determine the amount of data to get.  At a minimum, we
-     * need to get an encap header.  This will determine
-     * whether we need to get more data or not.
-     */
-    data_needed = (session->recv_offset < sizeof(eip_encap_t)) ?
-                                            sizeof(eip_encap_t) :
-                                            sizeof(eip_encap_t) + le2h16(((eip_encap_t*)(session->recv_data))->encap_length);
-
-    if(data_needed >= session->recv_capacity) {
-        pdebug(DEBUG_WARN,"Packet response (%d) is larger than possible buffer size (%d)!", data_needed, session->recv_capacity);
-        pdebug_dump_bytes(DEBUG_WARN, session->recv_data, session->recv_offset);
-        return PLCTAG_ERR_TOO_LARGE;
-    }
+    do {
+        uint32_t available = session->recv_end - session->recv_start;
+        uint32_t room;
+
+        /* frame the next packet in place if we already have all of it. */
+        if(available >= sizeof(eip_encap_t)) {
+            eip_encap_t *encap = (eip_encap_t*)(session->recv_data + session->recv_start);
+            uint32_t packet_size = sizeof(eip_encap_t) + le2h16(encap->encap_length);
+
+            if(packet_size > SESSION_MAX_PACKET_SIZE) {
+                pdebug(DEBUG_WARN,"Packet response (%d) is larger than possible buffer size (%d)!", packet_size, SESSION_MAX_PACKET_SIZE);
+                pdebug_dump_bytes(DEBUG_WARN, session->recv_data + session->recv_start, available);
+                return PLCTAG_ERR_TOO_LARGE;
+            }
+
+            if(available >= packet_size) {
+                session->resp_size = packet_size;
+                session->resp_seq_id = le2h64(encap->encap_sender_context);
+                session->has_response = 1;
 
-    if (session->recv_offset < data_needed) {
-        /* read everything we can */
-        do {
-            rc = socket_read(session->sock, session->recv_data + session->recv_offset,
-                             data_needed - session->recv_offset);
+                pdebug(DEBUG_DETAIL, "request received all needed data (%d bytes).", packet_size);
 
-            /*pdebug(DEBUG_DETAIL,"socket_read rc=%d",rc);*/
+                pdebug_dump_bytes(DEBUG_DETAIL, (uint8_t *)encap, packet_size);
 
-            if (rc < 0) {
-                if (rc != PLCTAG_ERR_NO_DATA) {
-                    /* error! */
-                    pdebug(DEBUG_WARN,"Error reading socket! rc=%d",rc);
-                    return rc;
+                if(le2h16(encap->encap_command) == AB_EIP_READ_RR_DATA) {
+                    pdebug(DEBUG_INFO,"Received unconnected packet with session sequence ID %llx",encap->encap_sender_context);
+                } else {
+                    eip_cip_co_resp *resp = (eip_cip_co_resp*)encap;
+                    pdebug(DEBUG_INFO,"Received connected packet with connection ID %x and sequence ID %u(%x)",le2h32(resp->cpf_orig_conn_id), le2h16(resp->cpf_conn_seq_num), le2h16(resp->cpf_conn_seq_num));
                 }
-            } else {
-                session->recv_offset += rc;
 
-                /*pdebug_dump_bytes(session->debug, session->recv_data, session->recv_offset);*/
+                return PLCTAG_STATUS_OK;
+            }
+        }
 
-                /* recalculate the amount of data needed if we have just completed the read of an encap header */
-                if (session->recv_offset >= sizeof(eip_encap_t)) {
-                    data_needed = sizeof(eip_encap_t) + le2h16(((eip_encap_t*)(session->recv_data))->encap_length);
+        /* the last read came up short, so the socket has nothing more for us. */
+        if(session->recv_drained) {
+            return PLCTAG_ERR_NO_DATA;
+        }
 
-                    if(data_needed >= session->recv_capacity) {
-                        pdebug(DEBUG_WARN,"Packet response (%d) is larger than possible buffer size (%d)!", data_needed, session->recv_capacity);
-                        return PLCTAG_ERR_TOO_LARGE;
-                    }
+        /*
+         * keep room for a whole packet after the partial one, moving it to the front if needed.
+         * If requests are still using the buffer, move to a new one instead.
+         */
+        if(!available && !session->recv_lent) {
+            session->recv_start = 0;
+            session->recv_end = 0;
+        } else if(session->recv_capacity - session->recv_start < SESSION_MAX_PACKET_SIZE) {
+            if(session->recv_lent) {
+                uint8_t *new_data = rc_alloc((int)session->recv_capacity, NULL);
+
+                if(!new_data) {
+                    pdebug(DEBUG_WARN,"Unable to allocate a new receive buffer!");
+                    return PLCTAG_ERR_NO_MEM;
                 }
+
+                mem_copy(new_data, session->recv_data + session->recv_start, (int)available);
+
+                rc_dec(session->recv_data);
+                session->recv_data = new_data;
+                session->recv_lent = 0;
+            } else {
+                mem_move(session->recv_data, session->recv_data + session->recv_start, (int)available);
             }
-        } while (rc > 0 && session->recv_offset < data_needed);
-    }
 
-    /* did we get all the data? */
-    if (session->recv_offset >= data_needed) {
-        session->resp_seq_id = le2h64(((eip_encap_t*)(session->recv_data))->encap_sender_context);
-        session->has_response = 1;
+            session->recv_start = 0;
+            session->recv_end = available;
+        }
+
+        /* read everything the socket has that fits. */
+        room = session->recv_capacity - session->recv_end;
 
-        rc = PLCTAG_STATUS_OK;
+        rc = socket_read(session->sock, session->recv_data + session->recv_end, (int)room);
 
-        pdebug(DEBUG_DETAIL, "request received all needed data (%d bytes of %d).", session->recv_offset, data_needed);
+        stat_add(STAT_RECV_SYSCALLS, 1);
 
-        pdebug_dump_bytes(DEBUG_DETAIL, session->recv_data, session->recv_offset);
+        /*pdebug(DEBUG_DETAIL,"socket_read rc=%d",rc);*/
 
-        if(le2h16(((eip_encap_t*)(session->recv_data))->encap_command) == AB_EIP_READ_RR_DATA) {
-            eip_encap_t *encap = (eip_encap_t*)(session->recv_data);
-            pdebug(DEBUG_INFO,"Received unconnected packet with session sequence ID %llx",encap->encap_sender_context);
+        if(rc < 0) {
+            if(rc != PLCTAG_ERR_NO_DATA) {
+                /* error! */
+                pdebug(DEBUG_WARN,"Error reading socket! rc=%d",rc);
+            }
+        } else if(rc == 0) {
+            /* the other end closed the connection. */
+            pdebug(DEBUG_WARN,"Gateway closed the connection!");
+            rc = PLCTAG_ERR_READ;
         } else {
-            eip_cip_co_resp *resp = (eip_cip_co_resp*)(session->recv_data);
-            pdebug(DEBUG_INFO,"Received connected packet with connection ID %x and sequence ID %u(%x)",le2h32(resp->cpf_orig_conn_id), le2h16(resp->cpf_conn_seq_num), le2h16(resp->cpf_conn_seq_num));
+            session->recv_end += (uint32_t)rc;
+
+            if((uint32_t)rc < room) {
+                session->recv_drained = 1;
+            }
+
+            rc = PLCTAG_STATUS_OK;
         }
-    }
+    } while(rc == PLCTAG_STATUS_OK);
 
     return rc;
 }
@@ -33,7 +33,8 @@
 #include <ab/session.h>
 
 
-int send_eip_request_unsafe(ab_request_p req);
+int prepare_eip_request_unsafe(ab_request_p req);
+void eip_request_sent_unsafe(ab_request_p req);
 int recv_eip_response_unsafe(ab_session_p session);
 
 
@@ -42,17 +42,35 @@
 #include <ab/cip.h>
 #include <ab/tag.h>
 #include <ab/session.h>
+#include <ab/symbols.h>
 #include <ab/eip_cip.h>
 #include <ab/error_codes.h>
 #include <util/attr.h>
 #include <util/debug.h>
 #include <util/vector.h>
 
+/*
+ * Group reads and writes of grouped tags take a stamp from this when they
+ * start, so that a group read that started before a tag's write does not
+ * hand that tag data from before the write.
+ */
+static volatile int64_t group_stamp = 0;
+
 
 int allocate_request_slot(ab_tag_p tag);
 int allocate_read_request_slot(ab_tag_p tag);
 int allocate_write_request_slot(ab_tag_p tag);
 int multi_tag_read_start(ab_tag_p tag);
+static int group_read_packet_size(ab_tag_p tag);
+static int group_read_req_size(ab_tag_p tag);
+static int group_read_resp_size(ab_tag_p tag);
+static int group_read_fits(ab_tag_p tag);
+static int build_group_read_request(ab_tag_p tag, vector_p members);
+static int check_group_read_status(ab_tag_p tag);
+static int group_read_response(ab_tag_p tag, ab_request_p req, vector_p members);
+static int group_read_done(ab_tag_p tag, ab_tag_p member, int status, uint8_t *type_info, int type_info_size, uint8_t *data, int data_size);
+static int group_read_apply(ab_tag_p tag);
+static void group_write_stamp(ab_tag_p tag);
 int build_read_request_connected(ab_tag_p tag, int slot, int byte_offset);
 int build_read_request_unconnected(ab_tag_p tag, int slot, int byte_offset);
 int build_write_request_connected(ab_tag_p tag, int slot, int byte_offset);
@@ -61,6 +79,7 @@ static int check_read_status_connected(ab_tag_p tag);
 static int check_read_status_unconnected(ab_tag_p tag);
 static int check_write_status_connected(ab_tag_p tag);
 static int check_write_status_unconnected(ab_tag_p tag);
+static int retry_by_name(ab_tag_p tag, int op);
 int calculate_write_sizes(ab_tag_p tag);
 
 /*************************************************************************
@@ -79,8 +98,35 @@ int eip_cip_tag_status(ab_tag_p tag)
     int session_rc = PLCTAG_STATUS_OK;
     int connection_rc = PLCTAG_STATUS_OK;
 
+    /* tags created without elem_size get it from the PLC's symbol table. */
+    if (!tag->size && (rc = symbols_size_tag(tag)) != PLCTAG_STATUS_OK) {
+        return rc;
+    }
+
+    /* start an operation that was waiting for the connection to open or the tag to be sized. */
+    if (tag->held_op) {
+        int op = tag->held_op;
+
+        if((rc = connection_held_op_status(tag)) != PLCTAG_STATUS_OK) {
+            return rc;
+        }
+
+        tag->held_op = TAG_OP_NONE;
+
+        return (op == TAG_OP_WRITE ? eip_cip_tag_write_start(tag) : eip_cip_tag_read_start(tag));
+    }
+
+    /* pick up data that a group read by another tag left for this one. */
+    if (tag->group_fresh && !tag->read_in_progress && !tag->write_in_progress && !tag->held_op) {
+        if((rc = group_read_apply(tag)) != PLCTAG_STATUS_OK) {
+            return rc;
+        }
+    }
+
     if (tag->read_in_progress) {
-        if(tag->connection) {
+        if(tag->group_reqs) {
+            rc = check_group_read_status(tag);
+        } else if(tag->connection) {
             rc = check_read_status_connected(tag);
         } else {
             rc = check_read_status_unconnected(tag);
@@ -129,8 +175,8 @@ int eip_cip_tag_status(ab_tag_p tag)
     if (tag->session) {
         session_rc = tag->session->status;
     } else {
-        /* this is not OK.  This is fatal! */
-        session_rc = PLCTAG_ERR_CREATE;
+        /* this is not OK.  This is fatal!  Creation may have failed before the session, say why. */
+        session_rc = (tag->status != PLCTAG_STATUS_OK ? tag->status : PLCTAG_ERR_CREATE);
     }
 
     if(tag->needs_connection) {
@@ -175,9 +221,30 @@ int eip_cip_tag_read_start(ab_tag_p tag)
 
     pdebug(DEBUG_INFO, "Starting");
 
+    if((rc = connection_hold_op(tag, TAG_OP_READ)) != PLCTAG_STATUS_OK) {
+        return rc;
+    }
+
+    /* the tag status function starts it once the tag has its size. */
+    if(!tag->size) {
+        tag->held_op = TAG_OP_READ;
+        return PLCTAG_STATUS_PENDING;
+    }
+
+    if(tag->use_instance_id && !tag->symbols_checked) {
+        symbols_encode_tag_name(tag);
+    }
+
     if(tag->read_group) {
-        pdebug(DEBUG_DETAIL,"Redirecting to the multi-tag read code.");
-        return multi_tag_read_start(tag);
+        if(group_read_fits(tag)) {
+            pdebug(DEBUG_DETAIL,"Redirecting to the multi-tag read code.");
+            return multi_tag_read_start(tag);
+        }
+
+        /* group reads do not leave request sizes behind, find them again. */
+        if(!tag->num_read_requests) {
+            tag->first_read = 1;
+        }
     }
 
     /* is this the first read? */
@@ -255,101 +322,583 @@ int eip_cip_tag_read_start(ab_tag_p tag)
 }
 
 
+/*
+ * multi_tag_read_start
+ *
+ * Read all the tags in this tag's read group that use the same session
+ * and connection, packed into as few CIP Multiple Service Packet requests
+ * as the packet size allows.  This tag's data is copied in as usual when
+ * the replies come back.  The data for the other tags is left with them
+ * and picked up by their own status calls, see group_read_apply().
+ *
+ * Tags that cannot fit in one reply on their own are left out and read
+ * as usual when they are read directly.
+ */
+
 int multi_tag_read_start(ab_tag_p tag)
 {
     int rc = PLCTAG_STATUS_OK;
     int i;
-    int byte_offset = 0;
+    int packet_size = group_read_packet_size(tag);
+    int req_size = 0;
+    int resp_size = 0;
     vector_p read_tags = NULL;
+    vector_p members = NULL;
 
     pdebug(DEBUG_INFO, "Starting");
 
+    /* a group read that is still going is replaced, drop its requests and tags. */
+    if(tag->group_reqs) {
+        ab_tag_abort(tag);
+    }
+
     pdebug(DEBUG_DETAIL,"Getting read group tags for group %s.", tag->read_group);
 
+    tag->group_read_stamp = atomic_add64(&group_stamp, 1);
+
     read_tags = find_read_group_tags(tag);
-    if(!read_tags || vector_length(read_tags) == 0) {
-        pdebug(DEBUG_WARN,"Something wrong, no tags found for read group %s.",tag->read_group);
+    tag->group_reqs = vector_create(4, 4); /* MAGIC */
+
+    if(!read_tags || !tag->group_reqs) {
+        pdebug(DEBUG_WARN,"Unable to allocate read group vectors!");
+        rc = PLCTAG_ERR_NO_MEM;
+    }
+
+    /* this tag goes in the first packet, then everything else that fits. */
+    tag->num_read_requests = 0;
+
+    for(i = -1; read_tags && i < vector_length(read_tags); i++) {
+        ab_tag_p member = (i < 0 ? rc_inc(tag) : vector_get(read_tags, i));
+
+        if(rc != PLCTAG_STATUS_OK || (i >= 0 && member == tag)
+           || member->session != tag->session || member->connection != tag->connection
+           || !group_read_fits(member)) {
+            rc_dec(member);
+            continue;
+        }
+
+        /* is the current packet full? */
+        if(members && (req_size + group_read_req_size(member) > packet_size || resp_size + group_read_resp_size(member) > packet_size)) {
+            rc = build_group_read_request(tag, members);
+            members = NULL;
+        }
+
+        if(rc == PLCTAG_STATUS_OK && !members) {
+            members = vector_create(16, 16); /* MAGIC */
+            req_size = CIP_MSP_REQ_HEADER;
+            resp_size = CIP_MSP_RESP_HEADER;
+
+            if(!members) {
+                pdebug(DEBUG_WARN,"Unable to allocate read group packet vector!");
+                rc = PLCTAG_ERR_NO_MEM;
+            }
+        }
+
+        if(rc != PLCTAG_STATUS_OK || vector_put(members, vector_length(members), member) != PLCTAG_STATUS_OK) {
+            rc = (rc == PLCTAG_STATUS_OK ? PLCTAG_ERR_NO_MEM : rc);
+            rc_dec(member);
+            continue;
+        }
+
+        req_size += group_read_req_size(member);
+        resp_size += group_read_resp_size(member);
+    }
+
+    if(read_tags) {
         vector_destroy(read_tags);
-        return PLCTAG_ERR_BAD_DATA;
     }
 
-    /* now these cannot go away since we are holding the ref. */
-    pdebug(DEBUG_DETAIL,"Found %d tags in read group %s.",vector_length(read_tags), tag->read_group);
+    /* send the last packet. */
+    if(members) {
+        if(rc == PLCTAG_STATUS_OK) {
+            rc = build_group_read_request(tag, members);
+        } else {
+            for(i = 0; i < vector_length(members); i++) {
+                rc_dec(vector_get(members, i));
+            }
 
+            vector_destroy(members);
+        }
+    }
 
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN,"Unable to start read of group %s!", tag->read_group);
+        ab_tag_abort(tag);
+        return rc;
+    }
 
-    /* is this the first read? */
-    if (1 || tag->first_read) {
-        /*
-         * On a new tag, the first time we read, we go through and
-         * request the maximum possible (up to the size of the tag)
-         * each time.  We record what we actually get back in the
-         * tag->read_req_sizes array.  The next time we read, we
-         * use that array to make the new requests.
-         */
+    pdebug(DEBUG_DETAIL,"Reading group %s in %d requests.", tag->read_group, tag->num_read_requests);
 
-        rc = allocate_read_request_slot(tag);
+    /* mark the tag read in progress */
+    tag->read_in_progress = 1;
 
-        if (rc != PLCTAG_STATUS_OK) {
-            pdebug(DEBUG_WARN,"Unable to allocate read request slot!");
-            return rc;
+    pdebug(DEBUG_INFO, "Done.");
+
+    return PLCTAG_STATUS_PENDING;
+}
+
+
+/* the largest request or reply a group read packet can have. */
+static int group_read_packet_size(ab_tag_p tag)
+{
+    if(tag->connection) {
+        return tag->connection->max_payload_size - CIP_MSP_FUDGE;
+    }
+
+    /* unconnected requests carry the device path too. */
+    return MAX_CIP_MSG_SIZE - (tag->conn_path_size + 2) - CIP_MSP_FUDGE;
+}
+
+
+/* space taken in a group read request by the read of one tag. */
+static int group_read_req_size(ab_tag_p tag)
+{
+    return CIP_MSP_OFFSET_SIZE          /* offset of the service */
+           + 1                          /* service request, one byte */
+           + tag->encoded_name_size     /* full encoded name */
+           + 2                          /* element count, 16-bit int */
+           + 4;                         /* byte offset, 32-bit int */
+}
+
+
+/* space taken in a group read reply by the data of one tag. */
+static int group_read_resp_size(ab_tag_p tag)
+{
+    /* until the first read we do not know the type, most are 2 bytes, abbreviated structs are 4. */
+    int type_info_size = (tag->encoded_type_info_size ? tag->encoded_type_info_size : 4);
+
+    return CIP_MSP_OFFSET_SIZE          /* offset of the reply */
+           + 4                          /* reply service, reserved, status and status size */
+           + type_info_size             /* encoded type */
+           + tag->size;                 /* the data */
+}
+
+
+/* can the tag be read in a group read packet on its own? */
+static int group_read_fits(ab_tag_p tag)
+{
+    int packet_size = group_read_packet_size(tag);
+
+    return (CIP_MSP_REQ_HEADER + group_read_req_size(tag) <= packet_size)
+           && (CIP_MSP_RESP_HEADER + group_read_resp_size(tag) <= packet_size);
+}
+
+
+/*
+ * build_group_read_request
+ *
+ * Queue a Multiple Service Packet with a fragmented read for each tag in
+ * members.  The members vector and the references in it belong to the tag
+ * after this, even if it fails.
+ */
+static int build_group_read_request(ab_tag_p tag, vector_p members)
+{
+    uint8_t* data = NULL;
+    uint8_t* embed_start = NULL;
+    ab_request_p req = NULL;
+    int num_members = vector_length(members);
+    int slot = 0;
+    int i;
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    rc = allocate_read_request_slot(tag);
+
+    if(rc == PLCTAG_STATUS_OK) {
+        slot = tag->num_read_requests - 1;
+        rc = vector_put(tag->group_reqs, slot, members);
+    }
+
+    if (rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN,"Unable to allocate read request slot!");
+
+        for(i = 0; i < num_members; i++) {
+            rc_dec(vector_get(members, i));
         }
 
-        /*
-         * The PLC may not send back as much data as we would like.
-         * So, we attempt to determine what the size will be by
-         * single-stepping through the requests the first time.
-         * This will be slow, but subsequent reads will be pipelined.
-         */
+        vector_destroy(members);
 
-        /* determine the byte offset this time. */
-        byte_offset = 0;
+        return rc;
+    }
 
-        /* scan and add the byte offsets */
-        for (i = 0; i < tag->num_read_requests && tag->reqs[i]; i++) {
-            byte_offset += tag->read_req_sizes[i];
+    /* get a request buffer */
+    rc = request_create(&req, (tag->connection ? tag->connection->max_payload_size : MAX_CIP_MSG_SIZE));
+
+    if (rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to get new request.  rc=%d", rc);
+        return rc;
+    }
+
+    req->num_retries_left = tag->num_retries;
+    req->retry_interval = tag->default_retry_interval;
+
+    /* point to the end of the header struct */
+    data = (req->data) + (tag->connection ? sizeof(eip_cip_co_req) : sizeof(eip_cip_uc_req));
+
+    /* set up the Multiple Service Packet, each service is a fragmented read. */
+    embed_start = data;
+
+    data = cip_msp_encode_header(data, num_members);
+
+    for(i = 0; i < num_members; i++) {
+        ab_tag_p member = vector_get(members, i);
+
+        cip_msp_set_offset(embed_start, i, data);
+
+        *data = AB_EIP_CMD_CIP_READ_FRAG;
+        data++;
+
+        mem_copy(data, member->encoded_name, member->encoded_name_size);
+        data += member->encoded_name_size;
+
+        *((uint16_le*)data) = h2le16((uint16_t)member->elem_count);
+        data += sizeof(uint16_le);
+
+        *((uint32_le*)data) = h2le32(0);
+        data += sizeof(uint32_le);
+    }
+
+    if(tag->connection) {
+        eip_cip_co_req* cip = (eip_cip_co_req*)(req->data);
+
+        cip->encap_command = h2le16(AB_EIP_CONNECTED_SEND);
+        cip->router_timeout = h2le16(1); /* one second timeout, enough? */
+
+        cip->cpf_item_count = h2le16(2);                 /* ALWAYS 2 */
+        cip->cpf_cai_item_type = h2le16(AB_EIP_ITEM_CAI);/* ALWAYS 0x00A1 connected address item */
+        cip->cpf_cai_item_length = h2le16(4);            /* ALWAYS 4, size of connection ID*/
+        cip->cpf_cdi_item_type = h2le16(AB_EIP_ITEM_CDI);/* ALWAYS 0x00B1 - connected Data Item */
+        cip->cpf_cdi_item_length = h2le16(data - (uint8_t*)(&cip->cpf_conn_seq_num));
+
+        req->connection = tag->connection;
+        req->connected_request = 1;
+    } else {
+        eip_cip_uc_req* cip = (eip_cip_uc_req*)(req->data);
+
+        /* size of embedded packet */
+        cip->uc_cmd_length = h2le16(data - embed_start);
+
+        /* the routing information for the embedded message */
+        if(tag->conn_path_size > 0) {
+            *data = (tag->conn_path_size) / 2; /* in 16-bit words */
+            data++;
+            *data = 0; /* reserved/pad */
+            data++;
+            mem_copy(data, tag->conn_path, tag->conn_path_size);
+            data += tag->conn_path_size;
         }
 
-        pdebug(DEBUG_DETAIL, "First read tag->num_read_requests=%d, byte_offset=%d.", tag->num_read_requests, byte_offset);
+        cip->encap_command = h2le16(AB_EIP_READ_RR_DATA);
+        cip->router_timeout = h2le16(1); /* one second timeout, enough? */
 
-        /* i is the index of the first new request */
-        if(tag->connection) {
-            rc = build_read_request_connected(tag, i, byte_offset);
-        } else {
-            rc = build_read_request_unconnected(tag, i, byte_offset);
+        cip->cpf_item_count = h2le16(2);                  /* ALWAYS 2 */
+        cip->cpf_nai_item_type = h2le16(AB_EIP_ITEM_NAI); /* ALWAYS 0 */
+        cip->cpf_nai_item_length = h2le16(0);             /* ALWAYS 0 */
+        cip->cpf_udi_item_type = h2le16(AB_EIP_ITEM_UDI); /* ALWAYS 0x00B2 - Unconnected Data Item */
+        cip->cpf_udi_item_length = h2le16(data - (uint8_t*)(&cip->cm_service_code));
+
+        cip->cm_service_code = AB_EIP_CMD_UNCONNECTED_SEND; /* 0x52 Unconnected Send */
+        cip->cm_req_path_size = 2;                          /* 2, size in 16-bit words of path, next field */
+        cip->cm_req_path[0] = 0x20;                         /* class */
+        cip->cm_req_path[1] = 0x06;                         /* Connection Manager */
+        cip->cm_req_path[2] = 0x24;                         /* instance */
+        cip->cm_req_path[3] = 0x01;                         /* instance 1 */
+
+        cip->secs_per_tick = AB_EIP_SECS_PER_TICK; /* seconds per tick */
+        cip->timeout_ticks = AB_EIP_TIMEOUT_TICKS; /* timeout = src_secs_per_tick * src_timeout_ticks */
+    }
+
+    /* set the size of the request */
+    req->request_size = data - (req->data);
+
+    /* mark it as ready to send */
+    req->send_request = 1;
+
+    request_set_tag_done(req, tag->done);
+
+    /* add the request to the session's list. */
+    rc = session_add_request(tag->session, req);
+
+    if (rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to add request to session! rc=%d", rc);
+        rc_dec(req);
+        return rc;
+    }
+
+    /* save the request for later */
+    tag->reqs[slot] = req;
+
+    pdebug(DEBUG_DETAIL, "Group read request %d reads %d tags in %d bytes.", slot, num_members, req->request_size);
+
+    pdebug(DEBUG_INFO, "Done");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/*
+ * check_group_read_status
+ *
+ * Wait for all the packets of a group read, then hand each tag its data.
+ * Must be called with the tag's API mutex held, like the other status
+ * functions.
+ */
+static int check_group_read_status(ab_tag_p tag)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int i;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    for (i = 0; i < tag->num_read_requests; i++) {
+        if (tag->reqs[i] && !tag->reqs[i]->resp_received) {
+            return PLCTAG_STATUS_PENDING;
         }
+    }
 
-        if (rc != PLCTAG_STATUS_OK) {
-            pdebug(DEBUG_WARN,"Unable to build read request!");
-            return rc;
+    for (i = 0; i < tag->num_read_requests; i++) {
+        int req_rc = group_read_response(tag, tag->reqs[i], vector_get(tag->group_reqs, i));
+
+        if(rc == PLCTAG_STATUS_OK) {
+            rc = req_rc;
         }
+    }
 
+    if (rc == PLCTAG_STATUS_OK) {
+        tag->first_read = 0;
     } else {
-        /* this is not the first read, so just set up all the requests at once. */
-        byte_offset = 0;
+        pdebug(DEBUG_WARN, "Error received!");
+    }
 
-        for (i = 0; i < tag->num_read_requests; i++) {
-            if(tag->connection) {
-                rc = build_read_request_connected(tag, i, byte_offset);
+    /* have the IO thread take care of the request buffers and drop the other tags. */
+    ab_tag_abort(tag);
+
+    /* the request slots were packets, not pieces of this tag. */
+    tag->num_read_requests = 0;
+
+    /* if this is a pre-read for a write, then pass off the the write routine */
+    if (rc == PLCTAG_STATUS_OK && tag->pre_write_read) {
+        pdebug(DEBUG_DETAIL, "Restarting write call now.");
+
+        tag->pre_write_read = 0;
+        rc = eip_cip_tag_write_start(tag);
+    }
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return rc;
+}
+
+
+/*
+ * group_read_response
+ *
+ * Split up one Multiple Service Packet reply.  Returns the status of the
+ * read of tag itself, or PLCTAG_STATUS_OK if it was not in this packet.
+ */
+static int group_read_response(ab_tag_p tag, ab_request_p req, vector_p members)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int tag_rc = PLCTAG_STATUS_OK;
+    eip_encap_t *encap = NULL;
+    uint8_t *reply = NULL;
+    uint8_t *count_field = NULL;
+    uint8_t *data_end = NULL;
+    int i;
+
+    if(!req || !members) {
+        pdebug(DEBUG_WARN,"Read in progress, but no requests in flight!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    encap = (eip_encap_t*)(req->data);
+    data_end = (req->data + le2h16(encap->encap_length) + sizeof(eip_encap_t));
+
+    if(tag->connection) {
+        reply = &((eip_cip_co_resp*)(req->data))->reply_service;
+    } else {
+        reply = &((eip_cip_uc_resp*)(req->data))->reply_service;
+    }
+
+    /* check the status */
+    if (le2h16(encap->encap_command) != (tag->connection ? AB_EIP_CONNECTED_SEND : AB_EIP_READ_RR_DATA)) {
+        pdebug(DEBUG_WARN, "Unexpected EIP packet type received: %d!", encap->encap_command);
+        rc = PLCTAG_ERR_BAD_DATA;
+    } else if (le2h32(encap->encap_status) != AB_EIP_OK) {
+        pdebug(DEBUG_WARN, "EIP command failed, response code: %d", le2h32(encap->encap_status));
+        rc = PLCTAG_ERR_REMOTE_ERR;
+    } else {
+        rc = cip_msp_check_reply(reply, data_end, vector_length(members), &count_field);
+    }
+
+    for(i = 0; i < vector_length(members); i++) {
+        ab_tag_p member = vector_get(members, i);
+        uint8_t *data = NULL;
+        uint8_t *end = data_end;
+        uint8_t *type_info = NULL;
+        int type_info_size = 0;
+        int member_rc = rc;
+
+        if(member_rc == PLCTAG_STATUS_OK) {
+            member_rc = cip_msp_get_reply(count_field, data_end, vector_length(members), i, &data, &end);
+        }
+
+        if(member_rc == PLCTAG_STATUS_OK) {
+            if(data[0] != (AB_EIP_CMD_CIP_READ_FRAG | AB_EIP_CMD_CIP_OK)) {
+                pdebug(DEBUG_WARN, "CIP response reply service unexpected: %d", data[0]);
+                member_rc = PLCTAG_ERR_BAD_DATA;
+            } else if(data[2] == AB_CIP_STATUS_FRAG) {
+                /* the reply did not all fit. */
+                pdebug(DEBUG_WARN, "Read of tag in group %s did not fit in the reply!", tag->read_group);
+                member_rc = PLCTAG_ERR_TOO_LARGE;
+            } else if(data[2] != AB_CIP_STATUS_OK) {
+                pdebug(DEBUG_WARN, "CIP read failed with status: 0x%x %s", data[2], decode_cip_error_short(data + 2));
+                member_rc = decode_cip_error_code(data + 2);
             } else {
-                rc = build_read_request_unconnected(tag, i, byte_offset);
+                data += 4 + (data[3] * 2);
+                type_info = data;
+
+                /* same types as a single read, see check_read_status_connected(). */
+                if (data < end && (*data) >= AB_CIP_DATA_BIT && (*data) <= AB_CIP_DATA_STRINGI) {
+                    type_info_size = 2;
+                } else if (data + 1 < end && ((*data) == AB_CIP_DATA_ABREV_STRUCT || (*data) == AB_CIP_DATA_ABREV_ARRAY ||
+                           (*data) == AB_CIP_DATA_FULL_STRUCT || (*data) == AB_CIP_DATA_FULL_ARRAY)) {
+                    type_info_size = *(data + 1) + 2; /* MAGIC, add the type and length bytes */
+                } else {
+                    pdebug(DEBUG_WARN, "Unsupported data type returned, type byte=%d", (data < end ? *data : -1));
+                    member_rc = PLCTAG_ERR_UNSUPPORTED;
+                }
+
+                if(member_rc == PLCTAG_STATUS_OK && (type_info_size > MAX_TAG_TYPE_INFO || data + type_info_size > end)) {
+                    pdebug(DEBUG_WARN, "Read data type info is too long (%d)!", type_info_size);
+                    member_rc = PLCTAG_ERR_TOO_LARGE;
+                }
+
+                data += type_info_size;
             }
+        }
 
-            if (rc != PLCTAG_STATUS_OK) {
-                pdebug(DEBUG_WARN,"Unable to build read request!");
-                return rc;
+        member_rc = group_read_done(tag, member, member_rc, type_info, type_info_size, data, (data ? (int)(end - data) : 0));
+
+        if(member == tag) {
+            tag_rc = member_rc;
+        }
+    }
+
+    return tag_rc;
+}
+
+
+/*
+ * group_read_done
+ *
+ * Hand one tag its part of a group read.  The tag doing the read gets
+ * its data right away.  Any other tag may be in use by another thread,
+ * so its data is left in its group buffer for group_read_apply().
+ */
+static int group_read_done(ab_tag_p tag, ab_tag_p member, int status, uint8_t *type_info, int type_info_size, uint8_t *data, int data_size)
+{
+    if(status == PLCTAG_STATUS_OK && data_size != member->size) {
+        pdebug(DEBUG_WARN, "Read of %d bytes for a tag of %d bytes in group %s!", data_size, member->size, tag->read_group);
+        status = (data_size > member->size ? PLCTAG_ERR_TOO_LARGE : PLCTAG_ERR_READ);
+    }
+
+    if(member == tag) {
+        if(status == PLCTAG_STATUS_OK) {
+            if (tag->encoded_type_info_size == 0) {
+                tag->encoded_type_info_size = type_info_size;
+                mem_copy(tag->encoded_type_info, type_info, type_info_size);
             }
 
-            byte_offset += tag->read_req_sizes[i];
+            /* do not overwrite data set up for a write. */
+            if (!tag->pre_write_read) {
+                mem_copy(tag->data, data, data_size);
+            }
         }
+
+        /* this is newer than anything another tag's group read left. */
+        critical_block(tag->group_mutex) {
+            tag->group_fresh = 0;
+        }
+
+        return status;
     }
 
-    /* mark the tag read in progress */
-    tag->read_in_progress = 1;
+    critical_block(member->group_mutex) {
+        /* the member wrote since this read went out, the data may be from before the write. */
+        if(member->group_write_stamp > tag->group_read_stamp) {
+            pdebug(DEBUG_DETAIL, "Dropping group data from before a write.");
+            break;
+        }
 
-    pdebug(DEBUG_INFO, "Done.");
+        if(status == PLCTAG_STATUS_OK) {
+            member->group_type_info_size = type_info_size;
+            mem_copy(member->group_type_info, type_info, type_info_size);
+            mem_copy(member->group_data, data, data_size);
+        }
 
-    return PLCTAG_STATUS_PENDING;
+        member->group_status = status;
+        member->group_fresh = 1;
+    }
+
+    return status;
+}
+
+
+/*
+ * group_read_apply
+ *
+ * Copy in the data a group read by another tag left for this one.  Only
+ * called when the tag has no read or write of its own going.  Returns the
+ * status of that read.
+ */
+static int group_read_apply(ab_tag_p tag)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    critical_block(tag->group_mutex) {
+        if(!tag->group_fresh) {
+            break;
+        }
+
+        rc = tag->group_status;
+
+        if(rc == PLCTAG_STATUS_OK) {
+            if (tag->encoded_type_info_size == 0) {
+                tag->encoded_type_info_size = tag->group_type_info_size;
+                mem_copy(tag->encoded_type_info, tag->group_type_info, tag->group_type_info_size);
+            }
+
+            mem_copy(tag->data, tag->group_data, tag->size);
+
+            tag->first_read = 0;
+        }
+
+        tag->group_fresh = 0;
+    }
+
+    return rc;
+}
+
+
+/*
+ * group_write_stamp
+ *
+ * Called when a grouped tag starts or finishes a write.  Anything a group
+ * read left for the tag is older than the write, and so is anything from
+ * group reads still in flight.
+ */
+static void group_write_stamp(ab_tag_p tag)
+{
+    if(!tag->group_mutex) {
+        return;
+    }
+
+    critical_block(tag->group_mutex) {
+        tag->group_write_stamp = atomic_add64(&group_stamp, 1);
+        tag->group_fresh = 0;
+    }
 }
 
 
@@ -370,6 +919,22 @@ int eip_cip_tag_write_start(ab_tag_p tag)
 
     pdebug(DEBUG_INFO, "Starting");
 
+    if((rc = connection_hold_op(tag, TAG_OP_WRITE)) != PLCTAG_STATUS_OK) {
+        return rc;
+    }
+
+    /* the tag status function starts it once the tag has its size. */
+    if(!tag->size) {
+        tag->held_op = TAG_OP_WRITE;
+        return PLCTAG_STATUS_PENDING;
+    }
+
+    if(tag->use_instance_id && !tag->symbols_checked) {
+        symbols_encode_tag_name(tag);
+    }
+
+    group_write_stamp(tag);
+
     /*
      * if the tag has not been read yet, read it.
      *
@@ -548,6 +1113,11 @@ int build_read_request_connected(ab_tag_p tag, int slot, int byte_offset)
     req->num_retries_left = tag->num_retries;
     req->retry_interval = tag->default_retry_interval;
 
+    /* the IO thread may pack this read with others, the reply has a header, the type and the data. */
+    if(tag->coalesce_reads) {
+        req->coalesce_size = 4 + (tag->encoded_type_info_size ? tag->encoded_type_info_size : 4) + (tag->size - byte_offset);
+    }
+
     /* point the request struct at the buffer */
     cip = (eip_cip_co_req*)(req->data);
 
@@ -608,6 +1178,8 @@ int build_read_request_connected(ab_tag_p tag, int slot, int byte_offset)
     /* this request is connected, so it needs the session exclusively */
     req->connected_request = 1;
 
+    request_set_tag_done(req, tag->done);
+
     /* add the request to the session's list. */
     rc = session_add_request(tag->session, req);
 
@@ -649,6 +1221,11 @@ int build_read_request_unconnected(ab_tag_p tag, int slot, int byte_offset)
     req->num_retries_left = tag->num_retries;
     req->retry_interval = tag->default_retry_interval;
 
+    /* the IO thread may pack this read with others, the reply has a header, the type and the data. */
+    if(tag->coalesce_reads) {
+        req->coalesce_size = 4 + (tag->encoded_type_info_size ? tag->encoded_type_info_size : 4) + (tag->size - byte_offset);
+    }
+
     /* point the request struct at the buffer */
     cip = (eip_cip_uc_req*)(req->data);
 
@@ -738,6 +1315,8 @@ int build_read_request_unconnected(ab_tag_p tag, int slot, int byte_offset)
     /* mark it as ready to send */
     req->send_request = 1;
 
+    request_set_tag_done(req, tag->done);
+
     /* add the request to the session's list. */
     rc = session_add_request(tag->session, req);
 
@@ -779,6 +1358,11 @@ int build_write_request_connected(ab_tag_p tag, int slot, int byte_offset)
     req->num_retries_left = tag->num_retries;
     req->retry_interval = tag->default_retry_interval;
 
+    /* the IO thread may pack a write that fits in one request with others, the reply is only a header. */
+    if(tag->coalesce_writes && tag->num_write_requests == 1) {
+        req->coalesce_size = 4;
+    }
+
     cip = (eip_cip_co_req*)(req->data);
 
     /* point to the end of the struct */
@@ -865,6 +1449,8 @@ int build_write_request_connected(ab_tag_p tag, int slot, int byte_offset)
     /* mark the request as a connected request */
     req->connected_request = 1;
 
+    request_set_tag_done(req, tag->done);
+
     /* add the request to the session's list. */
     rc = session_add_request(tag->session, req);
 
@@ -905,6 +1491,11 @@ int build_write_request_unconnected(ab_tag_p tag, int slot, int byte_offset)
     req->num_retries_left = tag->num_retries;
     req->retry_interval = tag->default_retry_interval;
 
+    /* the IO thread may pack a write that fits in one request with others, the reply is only a header. */
+    if(tag->coalesce_writes && tag->num_write_requests == 1) {
+        req->coalesce_size = 4;
+    }
+
     /* point the request struct at the buffer */
     cip = (eip_cip_uc_req*)(req->data);
 
@@ -1019,6 +1610,8 @@ int build_write_request_unconnected(ab_tag_p tag, int slot, int byte_offset)
     /* mark it as ready to send */
     req->send_request = 1;
 
+    request_set_tag_done(req, tag->done);
+
     /* add the request to the session's list. */
     rc = session_add_request(tag->session, req);
 
@@ -1052,6 +1645,7 @@ int build_write_request_unconnected(ab_tag_p tag, int slot, int byte_offset)
 static int check_read_status_connected(ab_tag_p tag)
 {
     int rc = PLCTAG_STATUS_OK;
+    int retry = 0;
     eip_cip_co_resp* cip_resp;
     uint8_t* data;
     uint8_t* data_end;
@@ -1138,6 +1732,7 @@ static int check_read_status_connected(ab_tag_p tag)
             pdebug(DEBUG_INFO, decode_cip_error_long((uint8_t *)&cip_resp->status));
 
             rc = decode_cip_error_code((uint8_t *)&cip_resp->status);
+            retry = symbols_path_error(tag, cip_resp->status);
 
             break;
         }
@@ -1273,6 +1868,8 @@ static int check_read_status_connected(ab_tag_p tag)
                 rc = eip_cip_tag_write_start(tag);
             }
         }
+    } else if (retry) {
+        rc = retry_by_name(tag, TAG_OP_READ);
     } else {
         /* error ! */
         pdebug(DEBUG_WARN, "Error received!");
@@ -1288,6 +1885,7 @@ static int check_read_status_connected(ab_tag_p tag)
 static int check_read_status_unconnected(ab_tag_p tag)
 {
     int rc = PLCTAG_STATUS_OK;
+    int retry = 0;
     eip_cip_uc_resp* cip_resp;
     uint8_t* data;
     uint8_t* data_end;
@@ -1379,6 +1977,7 @@ static int check_read_status_unconnected(ab_tag_p tag)
             pdebug(DEBUG_INFO, decode_cip_error_long((uint8_t *)&cip_resp->status));
 
             rc = decode_cip_error_code((uint8_t *)&cip_resp->status);
+            retry = symbols_path_error(tag, cip_resp->status);
 
             break;
         }
@@ -1515,6 +2114,8 @@ static int check_read_status_unconnected(ab_tag_p tag)
                 rc = eip_cip_tag_write_start(tag);
             }
         }
+    } else if (retry) {
+        rc = retry_by_name(tag, TAG_OP_READ);
     } else {
         /* error ! */
         pdebug(DEBUG_WARN, "Error received!");
@@ -1538,6 +2139,7 @@ static int check_write_status_connected(ab_tag_p tag)
 {
     eip_cip_co_resp* cip_resp;
     int rc = PLCTAG_STATUS_OK;
+    int retry = 0;
     int i;
     ab_request_p req;
 
@@ -1605,6 +2207,7 @@ static int check_write_status_connected(ab_tag_p tag)
             pdebug(DEBUG_WARN, "CIP read failed with status: 0x%x %s", cip_resp->status, decode_cip_error_short((uint8_t *)&cip_resp->status));
             pdebug(DEBUG_INFO, decode_cip_error_long((uint8_t *)&cip_resp->status));
             rc = decode_cip_error_code((uint8_t *)&cip_resp->status);
+            retry = symbols_path_error(tag, cip_resp->status);
             break;
         }
     }
@@ -1614,6 +2217,12 @@ static int check_write_status_connected(ab_tag_p tag)
 
     tag->write_in_progress = 0;
 
+    group_write_stamp(tag);
+
+    if (retry) {
+        rc = retry_by_name(tag, TAG_OP_WRITE);
+    }
+
     pdebug(DEBUG_DETAIL, "Done.");
 
     return rc;
@@ -1624,6 +2233,7 @@ int check_write_status_unconnected(ab_tag_p tag)
 {
     eip_cip_uc_resp* cip_resp;
     int rc = PLCTAG_STATUS_OK;
+    int retry = 0;
     int i;
     ab_request_p req;
 
@@ -1686,6 +2296,7 @@ int check_write_status_unconnected(ab_tag_p tag)
             pdebug(DEBUG_WARN, "CIP read failed with status: 0x%x %s", cip_resp->status, decode_cip_error_short((uint8_t *)&cip_resp->status));
             pdebug(DEBUG_INFO, decode_cip_error_long((uint8_t *)&cip_resp->status));
             rc = decode_cip_error_code((uint8_t *)&cip_resp->status);
+            retry = symbols_path_error(tag, cip_resp->status);
             break;
         }
     }
@@ -1695,12 +2306,34 @@ int check_write_status_unconnected(ab_tag_p tag)
 
     tag->write_in_progress = 0;
 
+    group_write_stamp(tag);
+
+    if (retry) {
+        rc = retry_by_name(tag, TAG_OP_WRITE);
+    }
+
     pdebug(DEBUG_DETAIL, "Done.");
 
     return rc;
 }
 
 
+/* the PLC's tags changed under the instance ID, send the request again by name. */
+static int retry_by_name(ab_tag_p tag, int op)
+{
+    int pre_write_read = tag->pre_write_read;
+
+    pdebug(DEBUG_DETAIL, "Sending the request again with the tag name.");
+
+    ab_tag_abort(tag);
+
+    tag->read_in_progress = 0;
+    tag->write_in_progress = 0;
+    tag->pre_write_read = pre_write_read;
+
+    return (op == TAG_OP_WRITE ? eip_cip_tag_write_start(tag) : eip_cip_tag_read_start(tag));
+}
+
 
 int calculate_write_sizes(ab_tag_p tag)
 {
@@ -56,6 +56,19 @@ int eip_dhp_pccc_tag_status(ab_tag_p tag)
     int session_rc = PLCTAG_STATUS_OK;
     int connection_rc = PLCTAG_STATUS_OK;
 
+    /* start an operation that was waiting for the connection to open. */
+    if(tag->held_op) {
+        int op = tag->held_op;
+
+        if((rc = connection_held_op_status(tag)) != PLCTAG_STATUS_OK) {
+            return rc;
+        }
+
+        tag->held_op = TAG_OP_NONE;
+
+        return (op == TAG_OP_WRITE ? eip_dhp_pccc_tag_write_start(tag) : eip_dhp_pccc_tag_read_start(tag));
+    }
+
     if(tag->read_in_progress) {
         rc = check_read_status(tag);
 
@@ -72,8 +85,8 @@ int eip_dhp_pccc_tag_status(ab_tag_p tag)
     if (tag->session) {
         session_rc = tag->session->status;
     } else {
-        /* this is not OK.  This is fatal! */
-        session_rc = PLCTAG_ERR_CREATE;
+        /* this is not OK.  This is fatal!  Creation may have failed before the session, say why. */
+        session_rc = (tag->status != PLCTAG_STATUS_OK ? tag->status : PLCTAG_ERR_CREATE);
     }
 
     if(tag->needs_connection) {
@@ -119,6 +132,10 @@ int eip_dhp_pccc_tag_read_start(ab_tag_p tag)
 
     pdebug(DEBUG_INFO,"Starting");
 
+    if((rc = connection_hold_op(tag, TAG_OP_READ)) != PLCTAG_STATUS_OK) {
+        return rc;
+    }
+
     /* how many packets will we need? How much overhead? */
     overhead =   2  /* size of sequence num */
                 +8  /* DH+ routing */
@@ -218,6 +235,8 @@ int eip_dhp_pccc_tag_read_start(ab_tag_p tag)
     /* mark the request ready for sending */
     req->send_request = 1;
 
+    request_set_tag_done(req, tag->done);
+
     /* add the request to the session's list. */
     rc = session_add_request(tag->session, req);
 
@@ -256,6 +275,10 @@ int eip_dhp_pccc_tag_write_start(ab_tag_p tag)
 
     pdebug(DEBUG_INFO,"Starting");
 
+    if((rc = connection_hold_op(tag, TAG_OP_WRITE)) != PLCTAG_STATUS_OK) {
+        return rc;
+    }
+
     /* how many packets will we need? How much overhead? */
     overhead = 2        /* size of sequence num */
               +8        /* DH+ routing */
@@ -398,6 +421,8 @@ int eip_dhp_pccc_tag_write_start(ab_tag_p tag)
     /* this request is connected, so it needs the session exclusively */
     req->connected_request = 1;
 
+    request_set_tag_done(req, tag->done);
+
     /* add the request to the session's list. */
     rc = session_add_request(tag->session, req);
 
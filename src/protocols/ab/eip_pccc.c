@@ -70,8 +70,8 @@ int eip_pccc_tag_status(ab_tag_p tag)
     if (tag->session) {
         session_rc = tag->session->status;
     } else {
-        /* this is not OK.  This is fatal! */
-        session_rc = PLCTAG_ERR_CREATE;
+        /* this is not OK.  This is fatal!  Creation may have failed before the session, say why. */
+        session_rc = (tag->status != PLCTAG_STATUS_OK ? tag->status : PLCTAG_ERR_CREATE);
     }
 
     if(tag->needs_connection) {
@@ -258,6 +258,8 @@ int eip_pccc_tag_read_start_standard(ab_tag_p tag)
     /* mark it as ready to send */
     req->send_request = 1;
 
+    request_set_tag_done(req, tag->done);
+
     /* add the request to the session's list. */
     rc = session_add_request(tag->session, req);
 
@@ -453,6 +455,8 @@ int eip_pccc_tag_read_start_ucmm(ab_tag_p tag)
     /* mark it as ready to send */
     req->send_request = 1;
 
+    request_set_tag_done(req, tag->done);
+
     /* add the request to the session's list. */
     rc = session_add_request(tag->session, req);
 
@@ -764,6 +768,8 @@ int eip_pccc_tag_write_start(ab_tag_p tag)
     req->send_request = 1;
     req->conn_seq = conn_seq_id;
 
+    request_set_tag_done(req, tag->done);
+
     /* add the request to the session's list. */
     rc = session_add_request(tag->session, req);
 
@@ -32,16 +32,190 @@
 #include <ab/session.h>
 #include <util/debug.h>
 #include <util/rc.h>
+#include <util/stats.h>
 
 void request_destroy(void *request_arg);
 
+/*
+ * Request buffer pool.
+ *
+ * Every read and write fragment needs a request buffer, and the big
+ * ones are about 4KB.  Rather than allocate and free one each time,
+ * released buffers go onto a free list for their size class.  The
+ * classes match the PCCC, CIP and CIP-Ex payload sizes.  Requests are
+ * created on API threads and released on whichever thread drops the
+ * last reference, so the lists are shared and each one has a spin lock.
+ * So that threads do not all fight over the same locks, there is a set
+ * of lists for each thread slot.  A buffer goes back to the lists it
+ * came from, which keeps them filled for the thread that takes from them.
+ *
+ * The request builders count on a zeroed buffer.  A pooled buffer only
+ * has the bytes its last user wrote cleared again, plus enough to cover
+ * any fixed header.
+ */
+
+#define REQUEST_BUF_MIN_CLEAR (128)
+
+#define REQUEST_POOL_SHARDS (8)
+#define REQUEST_POOL_CACHE_LINE (64)
+
+struct request_buf_t {
+    request_buf_p next;
+    int pool_class; /* -1 if too big for any class */
+    int pool_shard;
+    int capacity;
+    int dirty;
+
+    /* keep the data aligned */
+    union {
+        uint64_t dummy_u64;
+        double dummy_double;
+        void *dummy_ptr;
+    } dummy_align;
+
+    uint8_t data[];
+};
+
+static const int request_pool_capacity[] = {
+    EIP_CIP_PREFIX_SIZE + MAX_PCCC_PACKET_SIZE,
+    EIP_CIP_PREFIX_SIZE + MAX_CIP_MSG_SIZE,
+    EIP_CIP_PREFIX_SIZE + MAX_CIP_MSG_SIZE_EX
+};
+
+#define REQUEST_POOL_NUM_CLASSES ((int)(sizeof(request_pool_capacity)/sizeof(request_pool_capacity[0])))
+
+static struct {
+    lock_t lock;
+    request_buf_p free_list;
+    int free_count;
+    uint8_t pad[REQUEST_POOL_CACHE_LINE]; /* keep the locks of different lists off each other's lines */
+} request_pool[REQUEST_POOL_SHARDS][REQUEST_POOL_NUM_CLASSES];
+
+
+
+static request_buf_p request_buf_get(int capacity)
+{
+    request_buf_p buf = NULL;
+    int pool_class = 0;
+    int pool_shard = thread_slot() % REQUEST_POOL_SHARDS;
+
+    /* find the smallest class that fits. */
+    while(pool_class < REQUEST_POOL_NUM_CLASSES && request_pool_capacity[pool_class] < capacity) {
+        pool_class++;
+    }
+
+    if(pool_class < REQUEST_POOL_NUM_CLASSES) {
+        while(!lock_acquire(&request_pool[pool_shard][pool_class].lock)) {
+            ; /* do nothing, just spin */
+        }
+
+            buf = request_pool[pool_shard][pool_class].free_list;
+
+            if(buf) {
+                request_pool[pool_shard][pool_class].free_list = buf->next;
+                request_pool[pool_shard][pool_class].free_count--;
+            }
+
+        lock_release(&request_pool[pool_shard][pool_class].lock);
+
+        if(buf) {
+            stat_add(STAT_REQUEST_POOL_HITS, 1);
+
+            mem_set(buf->data, 0, buf->dirty);
+            buf->next = NULL;
+            buf->dirty = 0;
+
+            return buf;
+        }
+
+        capacity = request_pool_capacity[pool_class];
+    } else {
+        pool_class = -1;
+    }
+
+    stat_add(STAT_REQUEST_POOL_MISSES, 1);
+
+    buf = mem_alloc((int)sizeof(struct request_buf_t) + capacity);
+
+    if(buf) {
+        buf->pool_class = pool_class;
+        buf->pool_shard = pool_shard;
+        buf->capacity = capacity;
+    }
+
+    return buf;
+}
+
+
+
+static void request_buf_release(request_buf_p buf, int used)
+{
+    int pool_class = buf->pool_class;
+    int pool_shard = buf->pool_shard;
+
+    if(pool_class >= 0) {
+        buf->dirty = (used > REQUEST_BUF_MIN_CLEAR ? used : REQUEST_BUF_MIN_CLEAR);
+
+        if(buf->dirty > buf->capacity) {
+            buf->dirty = buf->capacity;
+        }
+
+        while(!lock_acquire(&request_pool[pool_shard][pool_class].lock)) {
+            ; /* do nothing, just spin */
+        }
+
+            if(request_pool[pool_shard][pool_class].free_count < REQUEST_POOL_MAX_FREE) {
+                buf->next = request_pool[pool_shard][pool_class].free_list;
+                request_pool[pool_shard][pool_class].free_list = buf;
+                request_pool[pool_shard][pool_class].free_count++;
+                buf = NULL;
+            }
+
+        lock_release(&request_pool[pool_shard][pool_class].lock);
+    }
+
+    /* not pooled or the pool is full. */
+    if(buf) {
+        mem_free(buf);
+    }
+}
+
+
+
+/*
+ * request_pool_teardown
+ *
+ * Free all the pooled buffers.  Called when the library shuts down.
+ */
+void request_pool_teardown(void)
+{
+    for(int shard=0; shard < REQUEST_POOL_SHARDS; shard++) {
+        for(int i=0; i < REQUEST_POOL_NUM_CLASSES; i++) {
+            while(!lock_acquire(&request_pool[shard][i].lock)) {
+                ; /* do nothing, just spin */
+            }
+
+                while(request_pool[shard][i].free_list) {
+                    request_buf_p buf = request_pool[shard][i].free_list;
+
+                    request_pool[shard][i].free_list = buf->next;
+                    mem_free(buf);
+                }
+
+                request_pool[shard][i].free_count = 0;
+
+            lock_release(&request_pool[shard][i].lock);
+        }
+    }
+}
+
+
+
 /*
  * request_create
  *
- * This does not do much for now other than allocate memory.  In the future
- * it may be desired to keep a pool of request buffers instead.  This shim
- * is here so that such a change can be done without major code changes
- * elsewhere.
+ * Allocate a request with a buffer from the pool that can hold the
+ * given payload.
  */
 int request_create(ab_request_p* req, int max_payload_size)
 {
@@ -49,13 +223,23 @@ int request_create(ab_request_p* req, int max_payload_size)
     ab_request_p res;
     int request_capacity = EIP_CIP_PREFIX_SIZE + max_payload_size;
 
-    res = (ab_request_p)rc_alloc(sizeof(struct ab_request_t) + request_capacity, request_destroy);
+    res = (ab_request_p)rc_alloc(sizeof(struct ab_request_t), request_destroy);
+
+    if (res) {
+        res->buf = request_buf_get(request_capacity);
+
+        if(!res->buf) {
+            rc_dec(res);
+            res = NULL;
+        }
+    }
 
     if (!res) {
         *req = NULL;
         rc = PLCTAG_ERR_NO_MEM;
     } else {
-        res->request_capacity = request_capacity;
+        res->request_capacity = res->buf->capacity;
+        res->data = res->buf->data;
 
         //res->rc = refcount_init(1, res, request_destroy);
 
@@ -70,6 +254,21 @@ int request_create(ab_request_p* req, int max_payload_size)
 
 
 
+/*
+ * request_set_tag_done
+ *
+ * Blocking calls on the tag sleep until the response for this request
+ * arrives.  The request keeps its own reference since it can outlive the tag.
+ */
+void request_set_tag_done(ab_request_p req, tag_done_p done)
+{
+    if(done) {
+        req->tag_done = rc_inc(done);
+    }
+}
+
+
+
 /*
  * request_destroy
  *
@@ -78,11 +277,41 @@ int request_create(ab_request_p* req, int max_payload_size)
 //int request_destroy_unsafe(ab_request_p* req_pp)
 void request_destroy(void *req_arg)
 {
-    (void)req_arg;
+    ab_request_p req = (ab_request_p)req_arg;
 
     pdebug(DEBUG_DETAIL, "Starting.");
 
-    /* nothing to do. */
+    if(req->tag_done) {
+        req->tag_done = rc_dec(req->tag_done);
+    }
+
+    if(req->resp_buf) {
+        req->resp_buf = rc_dec(req->resp_buf);
+    }
+
+    if(req->riders) {
+        for(int i=0; i < req->num_riders; i++) {
+            rc_dec(req->riders[i]);
+        }
+
+        mem_free(req->riders);
+        req->riders = NULL;
+    }
+
+    /*
+     * responses only land in our own buffer when they were split out of a
+     * packed read, otherwise only the request was written there.
+     */
+    if(req->buf) {
+        int used = req->request_size;
+
+        if(req->resp_received && !req->resp_buf && req->data_size > used) {
+            used = req->data_size;
+        }
+
+        request_buf_release(req->buf, used);
+        req->buf = NULL;
+    }
 
     pdebug(DEBUG_DETAIL, "Done.");
 }
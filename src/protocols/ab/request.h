@@ -35,6 +35,12 @@
 
 //#define MAX_REQ_RESP_SIZE   (MAX_EIP_CIP_PACKET_SIZE_EX) /* enough? */
 
+/* request buffers come from a pool, see request.c. */
+typedef struct request_buf_t *request_buf_p;
+
+/* most free buffers kept for each size class in each set of pool lists. */
+#define REQUEST_POOL_MAX_FREE (256)
+
 /*
  * this structure contains data necessary to set up a request and hold
  * the resulting response.
@@ -42,6 +48,7 @@
 
 struct ab_request_t {
     ab_request_p next;  /* for linked list */
+    ab_request_p prev;  /* so a request leaves the session list without a walk */
 
     int req_id;         /* which request is this for the tag? */
     int data_size;      /* how many bytes did we get? */
@@ -55,6 +62,7 @@ struct ab_request_t {
     int abort_after_send; /* for one shot packets */
     int no_resend; /* do not resend if this is set. */
     int connected_request; /* serialize this packet with respect to other serialized packets. */
+    int active; /* queued at least once or packed into another, see session_activate_request_unsafe() */
 
     int status;
 
@@ -67,14 +75,25 @@ struct ab_request_t {
     ab_session_p session;
     ab_connection_p connection;
 
+    /* signalled when the response arrives, may be NULL */
+    tag_done_p tag_done;
+
     uint64_t session_seq_id;
     uint32_t conn_id;
     uint16_t conn_seq;
 
+    /* response lookup, set while the request is in the session's match index */
+    uint64_t match_key;
+    int match_indexed;
+    ab_request_p match_next;
+
     /* time stamps for rate calculations */
     int64_t time_sent;
     int send_count;
 
+    /* if set, the IO thread drops the request this many ms after sending it if no response came */
+    int resp_timeout;
+
     int num_retries_left;
     int retry_interval;
 
@@ -82,7 +101,25 @@ struct ab_request_t {
     int current_offset;
     int request_size; /* total bytes, not just data */
     int request_capacity;
-    uint8_t data[];
+
+    /*
+     * data points at the request's own pooled buffer until the response comes
+     * in.  Then it points at the response where it sits in the session's receive
+     * buffer, and resp_buf holds a reference to that buffer.
+     */
+    uint8_t *data;
+    uint8_t *resp_buf;
+    request_buf_p buf;
+
+    /*
+     * a read or write that may be packed into a Multiple Service Packet with others
+     * sets coalesce_size to the most its reply can take.  The packet that
+     * carries them holds references to them in riders.  See
+     * session_coalesce_unsafe().
+     */
+    int coalesce_size;
+    ab_request_p *riders;
+    int num_riders;
 };
 
 
@@ -90,6 +127,8 @@ struct ab_request_t {
 
 
 int request_create(ab_request_p *req, int max_payload_size);
+void request_set_tag_done(ab_request_p req, tag_done_p done);
+void request_pool_teardown(void);
 //int request_acquire(ab_request_p req);
 //int request_release(ab_request_p req);
 //~ int request_destroy_unsafe(ab_request_p* req_pp);
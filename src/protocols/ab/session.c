@@ -53,7 +53,8 @@ static int session_connect(ab_session_p session);
 //~ static int session_destroy_unsafe(ab_session_p session);
 static void session_destroy(void *session);
 //~ static int session_is_empty(ab_session_p session);
-static int session_register(ab_session_p session);
+static void session_register_start(ab_session_p session);
+static int session_check_register_unsafe(ab_session_p session);
 static int session_unregister_unsafe(ab_session_p session);
 
 
@@ -82,11 +83,11 @@ uint64_t session_get_new_seq_id(ab_session_p sess)
 {
     uint16_t res = 0;
 
-    //pdebug(DEBUG_DETAIL, "entering critical block %p",global_session_mut);
-    critical_block(global_session_mut) {
+    //pdebug(DEBUG_DETAIL, "entering critical block %p",sess->mutex);
+    critical_block(sess->mutex) {
         res = (uint16_t)session_get_new_seq_id_unsafe(sess);
     }
-    //pdebug(DEBUG_DETAIL, "leaving critical block %p", global_session_mut);
+    //pdebug(DEBUG_DETAIL, "leaving critical block %p", sess->mutex);
 
     return res;
 }
@@ -173,7 +174,7 @@ int session_add_connection(ab_session_p session, ab_connection_p connection)
     pdebug(DEBUG_DETAIL, "Starting");
 
     if(session) {
-        critical_block(global_session_mut) {
+        critical_block(session->mutex) {
             rc = session_add_connection_unsafe(session, connection);
         }
     } else {
@@ -186,7 +187,7 @@ int session_add_connection(ab_session_p session, ab_connection_p connection)
     return rc;
 }
 
-/* must have the session mutex held here. */
+/* must have the session's mutex held here. */
 int session_remove_connection_unsafe(ab_session_p session, ab_connection_p connection)
 {
     ab_connection_p cur;
@@ -228,7 +229,7 @@ int session_remove_connection(ab_session_p session, ab_connection_p connection)
     pdebug(DEBUG_DETAIL, "Starting");
 
     if(session) {
-        critical_block(global_session_mut) {
+        critical_block(session->mutex) {
             rc = session_remove_connection_unsafe(session, connection);
         }
     } else {
@@ -279,7 +280,8 @@ int session_find_or_create(ab_session_p *tag_session, attr attribs)
 
     /*
      * do this OUTSIDE the mutex in order to let other threads not block if
-     * the session creation process blocks.
+     * the host name lookup blocks.  The session stays pending until its
+     * IO thread has it connected and registered.
      */
 
     if(new_session) {
@@ -290,9 +292,6 @@ int session_find_or_create(ab_session_p *tag_session, attr attribs)
             //session_destroy(session);
             rc_dec(session);
             session = AB_SESSION_NULL;
-        } else {
-            /* save the status */
-            session->status = rc;
         }
     }
 
@@ -449,6 +448,8 @@ ab_session_p find_session_by_host_unsafe(const char* host)
 ab_session_p session_create_unsafe(const char* host, int gw_port)
 {
     ab_session_p session = AB_SESSION_NULL;
+    mutex_p mutex = NULL;
+    uint8_t *recv_data = NULL;
     static volatile uint32_t srand_setup = 0;
     static volatile uint32_t connection_id = 0;
 
@@ -456,17 +457,39 @@ ab_session_p session_create_unsafe(const char* host, int gw_port)
 
     pdebug(DEBUG_DETAIL, "Warning: not using passed port %d", gw_port);
 
+    /* make this first, we are holding the global mutex and cannot destroy the session here. */
+    if(mutex_create(&mutex) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to create session mutex!");
+        return AB_SESSION_NULL;
+    }
+
+    recv_data = rc_alloc(SESSION_RECV_BUF_SIZE, NULL);
+
+    if(!recv_data) {
+        pdebug(DEBUG_WARN, "Unable to allocate session receive buffer!");
+        mutex_destroy(&mutex);
+        return AB_SESSION_NULL;
+    }
+
     session = (ab_session_p)rc_alloc(sizeof(struct ab_session_t), session_destroy);
 
     if (!session) {
         pdebug(DEBUG_WARN, "Error allocating new session.");
+        rc_dec(recv_data);
+        mutex_destroy(&mutex);
         return AB_SESSION_NULL;
     }
 
-    session->recv_capacity = EIP_CIP_PREFIX_SIZE + MAX_CIP_MSG_SIZE_EX;
+    session->mutex = mutex;
+
+    session->recv_capacity = SESSION_RECV_BUF_SIZE;
+    session->recv_data = recv_data;
 
     str_copy(session->host, MAX_SESSION_HOST, host);
 
+    /* all sessions to the same host are serviced by the same IO thread. */
+    session->worker = io_worker_for_host(session->host);
+
     session->status = PLCTAG_STATUS_PENDING;
 
     /* check for ID set up */
@@ -520,8 +543,9 @@ ab_session_p session_create_unsafe(const char* host, int gw_port)
 /*
  * session_init
  *
- * This calls several blocking methods and so must not keep the main mutex
- * locked during them.
+ * Start connecting to the gateway and hand the session to its IO thread,
+ * which finishes connecting and registers the session.  Nothing here waits
+ * for the network, only looking up a host name can block.
  */
 int session_init(ab_session_p session)
 {
@@ -536,8 +560,11 @@ int session_init(ab_session_p session)
         return rc;
     }
 
-    if ((rc = session_register(session)) != PLCTAG_STATUS_OK) {
-        pdebug(DEBUG_WARN, "session registration failed!");
+    session_register_start(session);
+
+    /* the IO thread owns the socket from here on. */
+    if ((rc = io_worker_add_session(session)) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to hand session to its IO thread!");
         session->status = rc;
         return rc;
     }
@@ -550,7 +577,7 @@ int session_init(ab_session_p session)
 /*
  * session_connect()
  *
- * Connect to the host/port passed via TCP.
+ * Start a TCP connection to the host.  It finishes in the IO thread.
  */
 
 int session_connect(ab_session_p session)
@@ -564,22 +591,89 @@ int session_connect(ab_session_p session)
 
     if (rc) {
         pdebug(DEBUG_WARN, "Unable to create socket for session!");
-        return 0;
+        return rc;
     }
 
-    rc = socket_connect_tcp(session->sock, session->host, AB_EIP_DEFAULT_PORT);
+    rc = socket_connect_tcp_start(session->sock, session->host, AB_EIP_DEFAULT_PORT);
 
-    if (rc != PLCTAG_STATUS_OK) {
+    if (rc != PLCTAG_STATUS_OK && rc != PLCTAG_STATUS_PENDING) {
         pdebug(DEBUG_WARN, "Unable to connect socket for session!");
         return rc;
     }
 
-    /* everything is OK.  We have a TCP stream open to a gateway. */
-    session->is_connected = 1;
+    session->open_timeout = time_ms() + SESSION_CONNECT_TIMEOUT;
 
     pdebug(DEBUG_INFO, "Done.");
 
-    return rc;
+    return PLCTAG_STATUS_OK;
+}
+
+
+/* still waiting on the socket, unless the current open step took too long. */
+static int session_open_pending(ab_session_p session)
+{
+    if(time_ms() > session->open_timeout) {
+        pdebug(DEBUG_WARN, "Timed out %s session to %s!", (session->is_connected ? "registering" : "connecting"), session->host);
+        return PLCTAG_ERR_TIMEOUT;
+    }
+
+    return PLCTAG_STATUS_PENDING;
+}
+
+
+/*
+ * session_check_open_unsafe
+ *
+ * Called by the IO thread, with the session mutex held, until the session
+ * is registered.  It finishes the TCP connection, moving on to the next
+ * address of the host if one fails, then sends the RegisterSession request
+ * and checks the response.  None of it blocks.
+ *
+ * Returns PLCTAG_STATUS_OK when the session is ready, PLCTAG_STATUS_PENDING
+ * while waiting for the socket, or an error if the session cannot be opened.
+ */
+int session_check_open_unsafe(ab_session_p session)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    if(!session->is_connected) {
+        rc = socket_connect_tcp_check(session->sock);
+
+        if(rc == PLCTAG_STATUS_PENDING) {
+            return session_open_pending(session);
+        }
+
+        if(rc != PLCTAG_STATUS_OK) {
+            /* that address did not work.  The next one gets a new socket, so move the poll registration. */
+            sock_poll_remove(session->worker->poller, session->sock);
+
+            rc = socket_connect_tcp_start(session->sock, session->host, AB_EIP_DEFAULT_PORT);
+
+            if(rc != PLCTAG_STATUS_OK && rc != PLCTAG_STATUS_PENDING) {
+                pdebug(DEBUG_WARN, "Unable to connect to %s!", session->host);
+                return rc;
+            }
+
+            if(sock_poll_add(session->worker->poller, session->sock, session->poll_events, session) != PLCTAG_STATUS_OK) {
+                pdebug(DEBUG_WARN, "Unable to add session socket to the IO thread poll set!");
+                return PLCTAG_ERR_OPEN;
+            }
+
+            session->open_timeout = time_ms() + SESSION_CONNECT_TIMEOUT;
+
+            if(rc == PLCTAG_STATUS_PENDING) {
+                return rc;
+            }
+        }
+
+        /* everything is OK.  We have a TCP stream open to a gateway. */
+        pdebug(DEBUG_DETAIL, "Connected to %s.", session->host);
+
+        session->is_connected = 1;
+        session->open_timeout = time_ms() + SESSION_REGISTRATION_TIMEOUT;
+    }
+
+    return session_check_register_unsafe(session);
 }
 
 /* must have the session mutex held here */
@@ -624,6 +718,9 @@ void session_destroy(void *session_arg)
         remove_session_unsafe(session);
     }
 
+    /* make sure the IO thread is done with it too. */
+    io_worker_remove_session(session);
+
     /*
      * if we are really destroying the session then we know that this is
      * the last reference.  So, we can use the unsafe variants.
@@ -635,6 +732,8 @@ void session_destroy(void *session_arg)
         session_unregister_unsafe(session);
 
         /* remove any remaining requests, they are dead */
+        session_take_submitted_requests_unsafe(session);
+
         req = session->requests;
 
         while(req) {
@@ -644,31 +743,50 @@ void session_destroy(void *session_arg)
             req = session->requests;
         }
 
+        /* drop any batch that never made it out. */
+        for(int i=0; i < session->send_queue_count; i++) {
+            rc_dec(session->send_queue[i]);
+            session->send_queue[i] = NULL;
+        }
+
+        session->send_queue_count = 0;
+
+        if(session->match_buckets) {
+            mem_free(session->match_buckets);
+            session->match_buckets = NULL;
+        }
+
+        if(session->recv_data) {
+            session->recv_data = rc_dec(session->recv_data);
+        }
+
         //mem_free(session);
     }
 
+    if(session->mutex) {
+        mutex_destroy(&session->mutex);
+    }
+
     pdebug(DEBUG_INFO, "Done.");
 
     return;
 }
 
 
-int session_register(ab_session_p session)
+/*
+ * session_register_start
+ *
+ * Put the RegisterSession request in the receive buffer.  Nothing else
+ * uses the buffer until the session is registered.  The IO thread sends
+ * it once the socket is connected.
+ */
+void session_register_start(ab_session_p session)
 {
     eip_session_reg_req* req;
-    eip_encap_t* resp;
-    int rc = PLCTAG_STATUS_OK;
-    uint32_t data_size = 0;
-    int64_t timeout_time;
 
     pdebug(DEBUG_INFO, "Starting.");
 
-    /*
-     * clear the session data.
-     *
-     * We use the receiving buffer because we do not have a request and nothing can
-     * be coming in (we hope) on the socket yet.
-     */
+    /* clear the session data. */
     mem_set(session->recv_data, 0, sizeof(eip_session_reg_req));
 
     req = (eip_session_reg_req*)(session->recv_data);
@@ -684,99 +802,77 @@ int session_register(ab_session_p session)
     req->eip_version = h2le16(AB_EIP_VERSION);
     req->option_flags = h2le16(0);
 
-    /*
-     * socket ops here are _ASYNCHRONOUS_!
-     *
-     * This is done this way because we do not have everything
-     * set up for a request to be handled by the thread.  I think.
-     */
+    session->reg_unsent = (int)sizeof(eip_session_reg_req);
+
+    pdebug(DEBUG_INFO, "Done.");
+}
+
+
+/*
+ * session_check_register_unsafe
+ *
+ * Write what is left of the RegisterSession request, then look for the
+ * response.  Returns PLCTAG_STATUS_PENDING until the whole exchange is done.
+ */
+int session_check_register_unsafe(ab_session_p session)
+{
+    eip_encap_t* resp;
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
 
     /* send registration to the gateway */
-    data_size = sizeof(eip_session_reg_req);
-    session->recv_offset = 0;
-    timeout_time = time_ms() + SESSION_REGISTRATION_TIMEOUT;
+    while(session->reg_unsent > 0) {
+        int offset = (int)sizeof(eip_session_reg_req) - session->reg_unsent;
 
-    pdebug(DEBUG_INFO, "sending data:");
-    pdebug_dump_bytes(DEBUG_INFO, session->recv_data, data_size);
+        rc = socket_write(session->sock, session->recv_data + offset, session->reg_unsent);
 
-    while (timeout_time > time_ms() && session->recv_offset < data_size) {
-        rc = socket_write(session->sock, session->recv_data + session->recv_offset, data_size - session->recv_offset);
+        if(rc == PLCTAG_ERR_NO_DATA) {
+            return session_open_pending(session);
+        }
 
         if (rc < 0) {
             pdebug(DEBUG_WARN, "Unable to send session registration packet! rc=%d", rc);
-            session->recv_offset = 0;
             return rc;
         }
 
-        session->recv_offset += rc;
+        session->reg_unsent -= rc;
 
-        /* don't hog the CPU */
-        if (session->recv_offset < data_size) {
-            sleep_ms(1);
-        }
-    }
+        if(session->reg_unsent == 0) {
+            pdebug(DEBUG_INFO, "sent data:");
+            pdebug_dump_bytes(DEBUG_INFO, session->recv_data, (int)sizeof(eip_session_reg_req));
 
-    if (session->recv_offset != data_size) {
-        session->recv_offset = 0;
-        return PLCTAG_ERR_TIMEOUT;
+            /* the request is out, the response can have the buffer. */
+            session->recv_start = 0;
+            session->recv_end = 0;
+        }
     }
 
     /* get the response from the gateway */
+    session->recv_drained = 0;
 
-    /* ready the input buffer */
-    session->recv_offset = 0;
-    mem_set(session->recv_data, 0, session->recv_capacity);
-
-    timeout_time = time_ms() + SESSION_REGISTRATION_TIMEOUT;
+    rc = recv_eip_response_unsafe(session);
 
-    while (timeout_time > time_ms()) {
-        if (session->recv_offset < sizeof(eip_encap_t)) {
-            data_size = sizeof(eip_encap_t);
-        } else {
-            data_size = sizeof(eip_encap_t) + le2h16(((eip_encap_t*)(session->recv_data))->encap_length);
-        }
-
-        if (session->recv_offset < data_size) {
-            rc = socket_read(session->sock, session->recv_data + session->recv_offset, data_size - session->recv_offset);
-
-            if (rc < 0) {
-                if (rc != PLCTAG_ERR_NO_DATA) {
-                    /* error! */
-                    pdebug(DEBUG_WARN, "Error reading socket! rc=%d", rc);
-                    return rc;
-                }
-            } else {
-                session->recv_offset += rc;
-
-                /* recalculate the amount of data needed if we have just completed the read of an encap header */
-                if (session->recv_offset >= sizeof(eip_encap_t)) {
-                    data_size = sizeof(eip_encap_t) + le2h16(((eip_encap_t*)(session->recv_data))->encap_length);
-                }
-            }
-        }
-
-        /* did we get all the data? */
-        if (session->recv_offset == data_size) {
-            break;
-        } else {
-            /* do not hog the CPU */
-            sleep_ms(1);
-        }
+    if(rc == PLCTAG_ERR_NO_DATA || (rc == PLCTAG_STATUS_OK && !session->has_response)) {
+        return session_open_pending(session);
     }
 
-    if (session->recv_offset != data_size) {
-        session->recv_offset = 0;
-        return PLCTAG_ERR_TIMEOUT;
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Error reading session registration response! rc=%d", rc);
+        return rc;
     }
 
-    /* set the offset back to zero for the next packet */
-    session->recv_offset = 0;
-
     pdebug(DEBUG_INFO, "received response:");
-    pdebug_dump_bytes(DEBUG_INFO, session->recv_data, data_size);
+    pdebug_dump_bytes(DEBUG_INFO, session->recv_data + session->recv_start, (int)session->resp_size);
 
-    /* encap header is at the start of the buffer */
-    resp = (eip_encap_t*)(session->recv_data);
+    /* encap header is at the start of the packet */
+    resp = (eip_encap_t*)(session->recv_data + session->recv_start);
+
+    /* step over it, anything after it is for the IO thread. */
+    session->recv_start += session->resp_size;
+    session->resp_size = 0;
+    session->resp_seq_id = 0;
+    session->has_response = 0;
 
     /* check the response status */
     if (le2h16(resp->encap_command) != AB_EIP_REGISTER_SESSION) {
@@ -816,16 +912,69 @@ int session_unregister_unsafe(ab_session_p session)
 
 
 
+/* count a request that has not been sent against the limit that holds it. */
+static void session_count_waiting_unsafe(ab_session_p sess, ab_request_p req, int amount)
+{
+    if(req->connection) {
+        req->connection->requests_waiting += amount;
+    } else if(req->connected_request) {
+        sess->waiting_connected += amount;
+    } else {
+        sess->waiting_unconnected += amount;
+    }
+}
+
+
+/* the caller already holds a reference for the list.  The request goes after the given one, or on the end. */
+static void link_request_unsafe(ab_session_p sess, ab_request_p after, ab_request_p req)
+{
+    if(!after) {
+        after = sess->requests_tail;
+    }
+
+    req->prev = after;
+
+    if(after) {
+        req->next = after->next;
+        after->next = req;
+    } else {
+        req->next = sess->requests;
+        sess->requests = req;
+    }
+
+    if(req->next) {
+        req->next->prev = req;
+    } else {
+        sess->requests_tail = req;
+    }
+
+    req->active = 0;
+    session_count_waiting_unsafe(sess, req, 1);
+}
+
+
 /*
  * session_add_request_unsafe
  *
  * You must hold the mutex before calling this!
  */
 int session_add_request_unsafe(ab_session_p sess, ab_request_p req)
+{
+    return session_insert_request_unsafe(sess, NULL, req);
+}
+
+
+/*
+ * session_insert_request_unsafe
+ *
+ * Put the request in the list right after another one, or on the end if
+ * after is NULL.
+ *
+ * You must hold the mutex before calling this!
+ */
+int session_insert_request_unsafe(ab_session_p sess, ab_request_p after, ab_request_p req)
 {
     int rc = PLCTAG_STATUS_OK;
-    ab_request_p cur, prev;
-    int total_requests = 0;
 
     pdebug(DEBUG_INFO, "Starting.");
 
@@ -837,50 +986,111 @@ int session_add_request_unsafe(ab_session_p sess, ab_request_p req)
     /* make sure the request points to the session */
     req->session = sess;
 
-    /* we add the request to the end of the list. */
-    cur = sess->requests;
-    prev = NULL;
+    link_request_unsafe(sess, after, rc_inc(req));
 
-    while (cur) {
-        prev = cur;
-        cur = cur->next;
-        total_requests++;
-    }
-
-    if (!prev) {
-        sess->requests = rc_inc(req);
-    } else {
-        prev->next = rc_inc(req);
-    }
+    pdebug(DEBUG_INFO, "Done.");
 
-    /* update the request's refcount as we point to it. */
-//    rc_inc(req);
+    return rc;
+}
 
-    pdebug(DEBUG_INFO,"Total requests in the queue: %d",total_requests);
 
-    pdebug(DEBUG_INFO, "Done.");
+/*
+ * session_activate_request_unsafe
+ *
+ * Called when a request in the list is sent or packed for the first time.
+ * From then on every pass over the list looks at it.
+ *
+ * You must hold the mutex before calling this!
+ */
+void session_activate_request_unsafe(ab_session_p sess, ab_request_p req)
+{
+    if(req->active) {
+        return;
+    }
 
-    return rc;
+    req->active = 1;
+    sess->requests_active++;
+    session_count_waiting_unsafe(sess, req, -1);
 }
 
 /*
  * session_add_request
  *
- * This is a thread-safe version of the above routine.
+ * Queue a request from any thread without taking the session mutex.  The
+ * request is pushed onto the session's submission stack and the IO thread
+ * moves it into the request list the next time it looks at the session.
  */
 int session_add_request(ab_session_p sess, ab_request_p req)
 {
-    int rc = PLCTAG_STATUS_OK;
+    ab_request_p head;
 
     pdebug(DEBUG_DETAIL, "Starting. sess=%p, req=%p", sess, req);
 
-    critical_block(global_session_mut) {
-        rc = session_add_request_unsafe(sess, req);
+    if(!sess) {
+        pdebug(DEBUG_WARN, "Session is null!");
+        return PLCTAG_ERR_NULL_PTR;
     }
 
+    /* make sure the request points to the session */
+    req->session = sess;
+
+    /* the submission stack holds a reference. */
+    rc_inc(req);
+
+    do {
+        head = sess->submitted_requests;
+        req->next = head;
+    } while(!atomic_ptr_cas((void * volatile *)&sess->submitted_requests, head, req));
+
+    /* kick the IO thread so that it sends the request now. */
+    io_worker_wakeup(sess->worker);
+
     pdebug(DEBUG_DETAIL, "Done.");
 
-    return rc;
+    return PLCTAG_STATUS_OK;
+}
+
+
+/*
+ * session_take_submitted_requests_unsafe
+ *
+ * Move everything API threads have submitted onto the end of the request
+ * list, oldest first.  Returns the number of requests moved.
+ *
+ * You must hold the mutex before calling this!
+ */
+int session_take_submitted_requests_unsafe(ab_session_p sess)
+{
+    ab_request_p submitted;
+    ab_request_p reversed = NULL;
+    int count = 0;
+
+    if(!sess->submitted_requests) {
+        return 0;
+    }
+
+    submitted = atomic_ptr_exchange((void * volatile *)&sess->submitted_requests, NULL);
+
+    /* the stack is newest first. */
+    while(submitted) {
+        ab_request_p next = submitted->next;
+
+        submitted->next = reversed;
+        reversed = submitted;
+        submitted = next;
+    }
+
+    while(reversed) {
+        ab_request_p next = reversed->next;
+
+        link_request_unsafe(sess, NULL, reversed);
+        reversed = next;
+        count++;
+    }
+
+    pdebug(DEBUG_DETAIL, "Took %d submitted requests.", count);
+
+    return count;
 }
 
 
@@ -892,7 +1102,6 @@ int session_add_request(ab_session_p sess, ab_request_p req)
 int session_remove_request_unsafe(ab_session_p sess, ab_request_p req)
 {
     int rc = PLCTAG_STATUS_OK;
-    ab_request_p cur, prev;
 
     pdebug(DEBUG_DETAIL, "Starting.");
 
@@ -900,24 +1109,34 @@ int session_remove_request_unsafe(ab_session_p sess, ab_request_p req)
         return rc;
     }
 
-    /* find the request and remove it from the list. */
-    cur = sess->requests;
-    prev = NULL;
+    /* unlink the request if it is on the list. */
+    if(req->prev || sess->requests == req) {
+        if(req->prev) {
+            req->prev->next = req->next;
+        } else {
+            sess->requests = req->next;
+        }
 
-    while (cur && cur != req) {
-        prev = cur;
-        cur = cur->next;
-    }
+        if(req->next) {
+            req->next->prev = req->prev;
+        } else {
+            sess->requests_tail = req->prev;
+        }
 
-    if (cur == req) {
-        if (!prev) {
-            sess->requests = cur->next;
+        if(req->active) {
+            sess->requests_active--;
         } else {
-            prev->next = cur->next;
+            session_count_waiting_unsafe(sess, req, -1);
         }
+
+        req->active = 0;
     } /* else not found */
 
+    /* no response can find it now. */
+    session_unindex_request_unsafe(sess, req);
+
     req->next = NULL;
+    req->prev = NULL;
     req->session = NULL;
 
     /* release the request refcount */
@@ -930,6 +1149,129 @@ int session_remove_request_unsafe(ab_session_p sess, ab_request_p req)
 
 
 
+/*
+ * Response match index.
+ *
+ * Requests that have been given a session sequence ID or a connection
+ * sequence number are hashed on the key their response will carry, so
+ * that finding the request for a response does not mean walking the
+ * whole request list.  The chains run through the requests themselves
+ * and the table doubles as it fills.
+ *
+ * You must hold the mutex before calling any of these!
+ */
+
+static int match_bucket(uint64_t key, int num_buckets)
+{
+    /* Fibonacci hashing, the table size is always a power of two. */
+    return (int)((key * UINT64_C(0x9E3779B97F4A7C15)) >> 32) & (num_buckets - 1);
+}
+
+
+static void match_index_grow_unsafe(ab_session_p sess)
+{
+    int new_num_buckets = (sess->match_num_buckets ? sess->match_num_buckets * 2 : SESSION_MATCH_MIN_BUCKETS);
+    ab_request_p *new_buckets = mem_alloc((int)sizeof(ab_request_p) * new_num_buckets);
+
+    if(!new_buckets) {
+        /* we can live with longer chains. */
+        pdebug(DEBUG_WARN, "Unable to grow the response match index to %d buckets!", new_num_buckets);
+        return;
+    }
+
+    for(int i=0; i < sess->match_num_buckets; i++) {
+        ab_request_p req = sess->match_buckets[i];
+
+        while(req) {
+            ab_request_p next = req->match_next;
+            int bucket = match_bucket(req->match_key, new_num_buckets);
+
+            req->match_next = new_buckets[bucket];
+            new_buckets[bucket] = req;
+
+            req = next;
+        }
+    }
+
+    if(sess->match_buckets) {
+        mem_free(sess->match_buckets);
+    }
+
+    sess->match_buckets = new_buckets;
+    sess->match_num_buckets = new_num_buckets;
+}
+
+
+void session_index_request_unsafe(ab_session_p sess, ab_request_p req, uint64_t match_key)
+{
+    int bucket;
+
+    /* a resend gets new IDs. */
+    session_unindex_request_unsafe(sess, req);
+
+    req->match_key = match_key;
+
+    if(sess->match_count >= sess->match_num_buckets * 2) {
+        match_index_grow_unsafe(sess);
+    }
+
+    if(!sess->match_buckets) {
+        return;
+    }
+
+    bucket = match_bucket(req->match_key, sess->match_num_buckets);
+
+    req->match_next = sess->match_buckets[bucket];
+    sess->match_buckets[bucket] = req;
+    req->match_indexed = 1;
+
+    sess->match_count++;
+}
+
+
+void session_unindex_request_unsafe(ab_session_p sess, ab_request_p req)
+{
+    ab_request_p *walker;
+
+    if(!req->match_indexed) {
+        return;
+    }
+
+    walker = &sess->match_buckets[match_bucket(req->match_key, sess->match_num_buckets)];
+
+    while(*walker && *walker != req) {
+        walker = &((*walker)->match_next);
+    }
+
+    if(*walker) {
+        *walker = req->match_next;
+        sess->match_count--;
+    }
+
+    req->match_next = NULL;
+    req->match_indexed = 0;
+}
+
+
+ab_request_p session_find_request_unsafe(ab_session_p sess, uint64_t match_key)
+{
+    ab_request_p req;
+
+    if(!sess->match_buckets) {
+        return NULL;
+    }
+
+    req = sess->match_buckets[match_bucket(match_key, sess->match_num_buckets)];
+
+    while(req && req->match_key != match_key) {
+        req = req->match_next;
+    }
+
+    return req;
+}
+
+
+
 /*
  * session_remove_request
  *
@@ -945,7 +1287,10 @@ int session_remove_request(ab_session_p sess, ab_request_p req)
         return rc;
     }
 
-    critical_block(global_session_mut) {
+    critical_block(sess->mutex) {
+        /* it might not have made it off the submission stack yet. */
+        session_take_submitted_requests_unsafe(sess);
+
         rc = session_remove_request_unsafe(sess, req);
     }
 
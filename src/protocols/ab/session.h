@@ -48,16 +48,37 @@
 
 #define SESSION_NUM_ROUND_TRIP_SAMPLES (5)
 
+/* how long to wait for the TCP connection to each address of the gateway. In milliseconds. */
+#define SESSION_CONNECT_TIMEOUT (10000)
+
 /* how long to wait for session registration before timing out. In milliseconds. */
 #define SESSION_REGISTRATION_TIMEOUT (1500)
 
 /*
- * the queue depth depends on the type of the request.
+ * the queue depth depends on the type of the request.  Connected requests
+ * on an open connection use the connection window instead.  The connected
+ * limit here is for connection setup and teardown, as the connection manager
+ * cannot take more than one at a time.
  */
 
 #define SESSION_MAX_CONNECTED_REQUESTS_IN_FLIGHT (1)
 #define SESSION_MAX_UNCONNECTED_REQUESTS_IN_FLIGHT (4)
 
+/* largest packet we can receive, and the receive buffer that holds several. */
+#define SESSION_MAX_PACKET_SIZE (EIP_CIP_PREFIX_SIZE + MAX_CIP_MSG_SIZE_EX)
+#define SESSION_RECV_BUF_SIZE (4 * SESSION_MAX_PACKET_SIZE)
+
+/* response match index, see session_index_request_unsafe() */
+#define SESSION_MATCH_MIN_BUCKETS (64)
+#define SESSION_MATCH_KEY_UNCONNECTED(seq_id) ((uint64_t)(seq_id) & ~((uint64_t)1 << 63))
+#define SESSION_MATCH_KEY_CONNECTED(conn_id, conn_seq) (((uint64_t)1 << 63) | ((uint64_t)(uint32_t)(conn_id) << 16) | (uint64_t)(uint16_t)(conn_seq))
+
+/* most requests gathered into one socket write. */
+#define SESSION_MAX_SEND_BATCH (32)
+
+/* most requests packed into one Multiple Service Packet, see session_coalesce_unsafe() */
+#define SESSION_MAX_COALESCE (128)
+
 struct ab_session_t {
     ab_session_p next;
     ab_session_p prev;
@@ -73,14 +94,57 @@ struct ab_session_t {
     uint32_t session_handle;
     int registered;
 
+    /*
+     * opening is done by the IO thread, see session_check_open_unsafe().
+     * reg_unsent is how much of the RegisterSession request in the receive
+     * buffer still has to be written.  open_timeout is when the current
+     * step gives up.
+     */
+    int reg_unsent;
+    int64_t open_timeout;
+
     /* Sequence ID for requests. */
     uint64_t session_seq_id;
 
-    /* current request being sent, only one at a time */
-    ab_request_p current_request;
+    /*
+     * requests being written to the socket, in order.  All of them are
+     * written with one call when possible.  New requests are only added
+     * once the whole batch is out.
+     */
+    ab_request_p send_queue[SESSION_MAX_SEND_BATCH];
+    int send_queue_count;
 
-    /* list of outstanding requests for this session */
+    /* list of outstanding requests for this session, only the IO thread walks it */
     ab_request_p requests;
+    ab_request_p requests_tail;
+
+    /*
+     * requests in the list that were sent or packed, and those never sent
+     * that are held by the session wide limits.  Connections count their
+     * own waiting requests.  See session_check_outgoing_data_unsafe().
+     */
+    int requests_active;
+    int waiting_connected;
+    int waiting_unconnected;
+
+    /* requests that have IDs assigned, hashed by the key their response will carry */
+    ab_request_p *match_buckets;
+    int match_num_buckets;
+    int match_count;
+
+    /* requests queued by API threads without locking, newest first */
+    ab_request_p volatile submitted_requests;
+
+    /* protects the request list, the connection list and the sequence IDs. */
+    mutex_p mutex;
+
+    /* the IO thread that services this session. */
+    ab_io_worker_p worker;
+    ab_session_p worker_next;
+
+    /* socket readiness, only touched by the IO thread once registered */
+    int poll_events;
+    int ready_events;
 
     /* counter for number of messages in flight */
     int num_reqs_in_flight;
@@ -97,12 +161,25 @@ struct ab_session_t {
     //~ int serial_request_in_flight;
     //~ uint64_t serial_seq_in_flight;
 
-    /* data for receiving messages */
+    /*
+     * data for receiving messages.  Bytes from recv_start up to recv_end
+     * have been read but not processed yet.  When has_response is set, a
+     * complete packet of resp_size bytes starts at recv_start.  recv_drained
+     * is set when a read came up short, so the socket has nothing more.
+     *
+     * Responses are handed to their requests in place, so recv_data is a
+     * reference counted buffer.  Once recv_lent is set, requests may still
+     * point into it and the space behind recv_end must not be reused.
+     */
     uint64_t resp_seq_id;
     int has_response;
-    uint32_t recv_offset;
+    uint32_t resp_size;
+    uint32_t recv_start;
+    uint32_t recv_end;
     uint32_t recv_capacity;
-    uint8_t recv_data[EIP_CIP_PREFIX_SIZE + MAX_CIP_MSG_SIZE_EX];
+    int recv_drained;
+    int recv_lent;
+    uint8_t *recv_data;
 
     /*int recv_size;*/
 
@@ -114,22 +191,37 @@ struct ab_session_t {
 
     /* connections for this session */
     ab_connection_p connections;
+    int connections_opening; /* how many are waiting on a ForwardOpen */
     uint32_t conn_serial_number; /* id for the next connection */
+    unsigned int in_flight_pass; /* bumped on each pass to reset the connection windows */
+
+    /* symbol tables for this session */
+    ab_symbols_p symbols;
+    int symbols_loading; /* how many are waiting on a page of the symbol list */
+
+    int no_coalesce; /* set if the PLC did not take a packed request, see session_coalesce_unsafe() */
 };
 
 uint64_t session_get_new_seq_id_unsafe(ab_session_p sess);
 uint64_t session_get_new_seq_id(ab_session_p sess);
 
 extern int session_find_or_create(ab_session_p *session, attr attribs);
+extern int session_check_open_unsafe(ab_session_p session);
 ab_connection_p session_find_connection_by_path_unsafe(ab_session_p session,const char *path);
 extern int session_add_connection_unsafe(ab_session_p session, ab_connection_p connection);
 extern int session_add_connection(ab_session_p session, ab_connection_p connection);
 extern int session_remove_connection_unsafe(ab_session_p session, ab_connection_p connection);
 extern int session_remove_connection(ab_session_p session, ab_connection_p connection);
 extern int session_add_request_unsafe(ab_session_p sess, ab_request_p req);
+extern int session_insert_request_unsafe(ab_session_p sess, ab_request_p after, ab_request_p req);
+extern void session_activate_request_unsafe(ab_session_p sess, ab_request_p req);
+extern int session_take_submitted_requests_unsafe(ab_session_p sess);
 extern int session_add_request(ab_session_p sess, ab_request_p req);
 extern int session_remove_request_unsafe(ab_session_p sess, ab_request_p req);
 extern int session_remove_request(ab_session_p sess, ab_request_p req);
+extern void session_index_request_unsafe(ab_session_p sess, ab_request_p req, uint64_t match_key);
+extern void session_unindex_request_unsafe(ab_session_p sess, ab_request_p req);
+extern ab_request_p session_find_request_unsafe(ab_session_p sess, uint64_t match_key);
 //extern int session_acquire(ab_session_p session);
 //extern int session_release(ab_session_p session);
 
@@ -0,0 +1,1286 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Library General Public License for more details.                  *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*
+ * symbols.c
+ *
+ * Logix controllers keep every controller scope tag as an instance of the
+ * Symbol Object.  A request can name the tag by class and instance ID in
+ * place of the symbolic name, which is shorter and saves the PLC from
+ * matching strings.
+ *
+ * The first tag that needs it starts reading the list of instances with
+ * Get_Instance_Attribute_List.  The PLC sends the list a page at a time
+ * and each page says where the next one starts, so the instance IDs are
+ * split into ranges first, using the highest ID in use, and the pages of
+ * each range go out side by side.  The IO thread moves them along.
+ *
+ * Tags with use_instance_id keep using their names until the list is in,
+ * then switch over the next time they start a read or write.  Tags created
+ * without elem_size wait for the list to find their size.  Reading a tag
+ * named @tags returns the whole list, see symbols_browse_status().  If
+ * the PLC's tags change, the next path error reads the list again, see
+ * symbols_path_error().
+ */
+
+#include <ctype.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <platform.h>
+#include <lib/libplctag.h>
+#include <lib/libplctag_tag.h>
+#include <ab/ab_common.h>
+#include <ab/symbols.h>
+#include <ab/session.h>
+#include <ab/request.h>
+#include <ab/defs.h>
+#include <ab/error_codes.h>
+#include <util/attr.h>
+#include <util/debug.h>
+#include <util/hash.h>
+#include <util/rc.h>
+#include <util/stats.h>
+
+
+static ab_symbols_p symbols_find_or_create_unsafe(const char *path, ab_tag_p tag);
+static ab_symbols_p session_find_symbols_unsafe(ab_session_p session, const char *path);
+static void session_remove_symbols_unsafe(ab_session_p session, ab_symbols_p symbols);
+static ab_symbols_p symbols_create_unsafe(const char *path, ab_tag_p tag);
+static void symbols_destroy(void *symbols_arg);
+static int symbols_wait(ab_tag_p tag);
+static void symbols_release_held_tags_unsafe(ab_symbols_p symbols);
+static int symbols_find_base(ab_tag_p tag, ab_symbol_p *symbol, int *rest);
+static int symbols_send_request(ab_symbols_p symbols, uint8_t *embed, int embed_size, ab_request_p *req_out);
+static int symbols_start_max(ab_symbols_p symbols);
+static int symbols_check_max_unsafe(ab_symbols_p symbols);
+static int symbols_start_ranges(ab_symbols_p symbols, uint32_t max_instance);
+static int symbols_start_page(ab_symbols_p symbols, struct ab_symbols_range_t *range);
+static int symbols_check_range_unsafe(ab_symbols_p symbols, struct ab_symbols_range_t *range);
+static int symbols_read_page(ab_symbols_p symbols, struct ab_symbols_range_t *range, ab_request_p req);
+static void symbols_load_done_unsafe(ab_symbols_p symbols, int status);
+static int symbols_add(ab_symbols_p symbols, uint32_t instance, uint8_t *entry, int name_len);
+static void symbols_sort(ab_symbols_p symbols);
+static int symbols_compare(const void *first, const void *second);
+static void symbols_grow(ab_symbols_p symbols);
+static uint32_t symbols_hash(const char *name, int name_len);
+static int symbols_browse_fill(ab_tag_p tag);
+
+
+/*
+ * symbols_find_or_create
+ *
+ * Give the tag the symbol table for its PLC, starting to read it if no
+ * other tag has.  The table is shared by all tags with the same path
+ * on the session.
+ */
+int symbols_find_or_create(ab_tag_p tag, attr attribs)
+{
+    const char *path = attr_get_str(attribs, "path", "");
+    ab_symbols_p symbols = AB_SYMBOLS_NULL;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    critical_block(tag->session->mutex) {
+        symbols = symbols_find_or_create_unsafe(path, tag);
+    }
+
+    if(!symbols) {
+        pdebug(DEBUG_ERROR, "Unable to create or find a symbol table!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    tag->symbols = symbols;
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/*
+ * symbols_check_load_unsafe
+ *
+ * Called by the IO thread, with the session mutex held, while the table
+ * is loading.  When a response is in, the entries are added and the next
+ * page of its range is asked for if the PLC has more.  Tags waiting on
+ * the table are woken when it is done, whether it worked or not.
+ *
+ * Returns PLCTAG_STATUS_PENDING while the table is still loading.
+ */
+int symbols_check_load_unsafe(ab_symbols_p symbols)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    if(symbols->max_request) {
+        rc = symbols_check_max_unsafe(symbols);
+    } else {
+        int loading = 0;
+
+        for(int i=0; i < symbols->num_ranges && rc == PLCTAG_STATUS_OK; i++) {
+            if(symbols->ranges[i].request) {
+                rc = symbols_check_range_unsafe(symbols, &symbols->ranges[i]);
+
+                if(rc == PLCTAG_STATUS_PENDING) {
+                    loading = 1;
+                    rc = PLCTAG_STATUS_OK;
+                }
+            }
+        }
+
+        if(rc == PLCTAG_STATUS_OK && loading) {
+            rc = PLCTAG_STATUS_PENDING;
+        }
+    }
+
+    if(rc == PLCTAG_STATUS_PENDING) {
+        return rc;
+    }
+
+    symbols_load_done_unsafe(symbols, rc);
+
+    return rc;
+}
+
+
+/*
+ * symbols_find
+ *
+ * Look up a controller scope tag.  Logix names do not care about case.
+ * Only call this once the table status is PLCTAG_STATUS_OK, after that
+ * nothing changes the table and no lock is needed.
+ */
+ab_symbol_p symbols_find(ab_symbols_p symbols, const char *name, int name_len)
+{
+    ab_symbol_p symbol;
+    uint32_t name_hash;
+
+    if(name_len <= 0 || name_len >= MAX_TAG_NAME || !symbols->buckets) {
+        return NULL;
+    }
+
+    name_hash = symbols_hash(name, name_len);
+
+    for(symbol = symbols->buckets[name_hash & (uint32_t)(symbols->num_buckets - 1)]; symbol; symbol = symbol->next) {
+        int i;
+
+        if(symbol->name_hash != name_hash || symbol->name_len != name_len) {
+            continue;
+        }
+
+        for(i=0; i < name_len && tolower((unsigned char)symbol->name[i]) == tolower((unsigned char)name[i]); i++) { }
+
+        if(i == name_len) {
+            break;
+        }
+    }
+
+    return symbol;
+}
+
+
+/*
+ * symbols_encode_tag_name
+ *
+ * Called at the start of each read or write until the tag has been
+ * checked against the symbol table.  When the base tag is in the table,
+ * its symbolic segment is swapped for the Symbol Object class and
+ * instance.  Array indexes and member names after it stay as they are.
+ *
+ * Returns PLCTAG_STATUS_PENDING while the table is loading,
+ * PLCTAG_STATUS_OK if the tag now uses its instance ID.
+ */
+int symbols_encode_tag_name(ab_tag_p tag)
+{
+    ab_symbol_p symbol = NULL;
+    uint8_t encoded[MAX_TAG_NAME];
+    int rest = 0;
+    int size = 1; /* word count */
+    int rc = atomic_int_load(&tag->symbols->status);
+
+    /* still loading, keep using the name for now. */
+    if(rc == PLCTAG_STATUS_PENDING) {
+        return rc;
+    }
+
+    tag->symbols_checked = 1;
+
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_DETAIL, "No symbol table, using the tag name.");
+        return rc;
+    }
+
+    if((rc = symbols_find_base(tag, &symbol, &rest)) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_DETAIL, "Base tag is not in the symbol table, using the tag name.");
+        return rc;
+    }
+
+    /* class segment, then the smallest instance segment that holds the ID. */
+    encoded[size++] = 0x20;
+    encoded[size++] = AB_CIP_SYMBOL_CLASS;
+
+    if(symbol->instance <= 0xFF) {
+        encoded[size++] = 0x24;
+        encoded[size++] = (uint8_t)symbol->instance;
+    } else if(symbol->instance <= 0xFFFF) {
+        encoded[size++] = 0x25;
+        encoded[size++] = 0x00; /* pad */
+        encoded[size++] = (uint8_t)(symbol->instance & 0xFF);
+        encoded[size++] = (uint8_t)((symbol->instance >> 8) & 0xFF);
+    } else {
+        encoded[size++] = 0x26;
+        encoded[size++] = 0x00; /* pad */
+        encoded[size++] = (uint8_t)(symbol->instance & 0xFF);
+        encoded[size++] = (uint8_t)((symbol->instance >> 8) & 0xFF);
+        encoded[size++] = (uint8_t)((symbol->instance >> 16) & 0xFF);
+        encoded[size++] = (uint8_t)((symbol->instance >> 24) & 0xFF);
+    }
+
+    /* very short names are already as small. */
+    if(size + (tag->encoded_name_size - rest) >= tag->encoded_name_size) {
+        return PLCTAG_ERR_TOO_LARGE;
+    }
+
+    mem_copy(&encoded[size], &tag->encoded_name[rest], tag->encoded_name_size - rest);
+    size += tag->encoded_name_size - rest;
+
+    encoded[0] = (uint8_t)((size - 1) / 2);
+
+    /* kept in case the PLC's tags change under us, see symbols_path_error(). */
+    mem_copy(tag->symbolic_name, tag->encoded_name, tag->encoded_name_size);
+    tag->symbolic_name_size = tag->encoded_name_size;
+
+    mem_copy(tag->encoded_name, encoded, size);
+    tag->encoded_name_size = size;
+
+    stat_add(STAT_INSTANCE_ID_TAGS, 1);
+
+    pdebug(DEBUG_DETAIL, "Using instance %u for the base tag.", (unsigned int)symbol->instance);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/*
+ * symbols_path_error
+ *
+ * Called with the tag's mutex held when a read or write fails with a CIP
+ * status.  If the tag was using an instance ID and the PLC says the path
+ * is bad, the PLC's tags have likely changed since the table was read,
+ * e.g. after a download.  The tag goes back to its name, and the table is
+ * marked stale so that it is read again for the next tag to look.  Other
+ * tags keep their instance IDs until they get the same error.  A tag only
+ * reads the table again once, after that it keeps its name.
+ *
+ * Returns 1 if the request should be sent again.
+ */
+int symbols_path_error(ab_tag_p tag, uint8_t cip_status)
+{
+    ab_symbols_p old_symbols = tag->symbols;
+    ab_symbols_p symbols = AB_SYMBOLS_NULL;
+
+    if(!tag->symbolic_name_size || (cip_status != AB_CIP_ERR_PATH_SEGMENT && cip_status != AB_CIP_ERR_PATH_DEST)) {
+        return 0;
+    }
+
+    pdebug(DEBUG_WARN, "Path error with the instance ID, going back to the tag name.");
+
+    mem_copy(tag->encoded_name, tag->symbolic_name, tag->symbolic_name_size);
+    tag->encoded_name_size = tag->symbolic_name_size;
+    tag->symbolic_name_size = 0;
+
+    /* the name is longer, so the write fragments need to be worked out again. */
+    tag->num_write_requests = 0;
+
+    if(tag->symbols_reloaded) {
+        pdebug(DEBUG_WARN, "Path error after reading the table again, keeping the tag name.");
+        return 1;
+    }
+
+    tag->symbols_reloaded = 1;
+
+    critical_block(tag->session->mutex) {
+        old_symbols->stale = 1;
+        symbols = symbols_find_or_create_unsafe(old_symbols->path, tag);
+    }
+
+    if(symbols) {
+        /* only loaded tables are used for instance IDs, so the tag is not on the old wait list. */
+        tag->symbols = symbols;
+        tag->symbols_checked = 0;
+        tag->symbols_held = 0;
+        rc_dec(old_symbols);
+    } else {
+        pdebug(DEBUG_WARN, "Unable to read the symbol table again, using the tag name.");
+    }
+
+    return 1;
+}
+
+
+/*
+ * symbols_size_tag
+ *
+ * Called by the tag status function while a Logix tag created without
+ * elem_size has no data.  The element size comes from the base tag's
+ * entry.  Without elem_count, the whole tag is read, or one element if
+ * the name has an index.  Tags that name a member of a UDT need elem_size.
+ *
+ * Returns PLCTAG_STATUS_PENDING until the table is in, then
+ * PLCTAG_STATUS_OK or the error the tag failed with.
+ */
+int symbols_size_tag(ab_tag_p tag)
+{
+    ab_symbol_p symbol = NULL;
+    int count = 1;
+    int rest = 0;
+    int rc = tag->status;
+
+    if(rc != PLCTAG_STATUS_OK) {
+        return rc;
+    }
+
+    if((rc = symbols_wait(tag)) == PLCTAG_STATUS_PENDING) {
+        return rc;
+    }
+
+    if(rc == PLCTAG_STATUS_OK) {
+        rc = symbols_find_base(tag, &symbol, &rest);
+    }
+
+    if(rc == PLCTAG_STATUS_OK && rest < tag->encoded_name_size) {
+        /* only indexes can follow the base tag. */
+        for(int pos = rest; pos < tag->encoded_name_size && rc == PLCTAG_STATUS_OK; ) {
+            switch(tag->encoded_name[pos]) {
+                case 0x28: pos += 2; break;
+                case 0x29: pos += 4; break;
+                case 0x2A: pos += 6; break;
+                default:
+                    pdebug(DEBUG_WARN, "Tags that name a member need elem_size!");
+                    rc = PLCTAG_ERR_BAD_PARAM;
+                    break;
+            }
+        }
+    } else if(rc == PLCTAG_STATUS_OK && !tag->elem_count) {
+        for(int i=0; i < 3 && symbol->dims[i] && rc == PLCTAG_STATUS_OK; i++) {
+            if(symbol->dims[i] > (uint32_t)(INT_MAX / count)) {
+                pdebug(DEBUG_WARN, "PLC gave array dimensions that are too large!");
+                rc = PLCTAG_ERR_BAD_REPLY;
+            } else {
+                count *= (int)symbol->dims[i];
+            }
+        }
+    }
+
+    if(rc == PLCTAG_STATUS_OK && !symbol->elem_size) {
+        pdebug(DEBUG_WARN, "PLC did not give an element size!");
+        rc = PLCTAG_ERR_BAD_REPLY;
+    }
+
+    if(rc == PLCTAG_STATUS_OK && (tag->elem_count ? tag->elem_count : count) > INT_MAX / symbol->elem_size) {
+        pdebug(DEBUG_WARN, "Tag would be larger than the library can hold!");
+        rc = PLCTAG_ERR_TOO_LARGE;
+    }
+
+    if(rc == PLCTAG_STATUS_OK) {
+        tag->elem_size = symbol->elem_size;
+
+        if(!tag->elem_count) {
+            tag->elem_count = count;
+        }
+
+        tag->data = (uint8_t*)mem_alloc(tag->elem_count * tag->elem_size);
+
+        if(tag->data) {
+            tag->size = tag->elem_count * tag->elem_size;
+            pdebug(DEBUG_DETAIL, "Tag has %d elements of %d bytes.", tag->elem_count, tag->elem_size);
+        } else {
+            pdebug(DEBUG_WARN, "Unable to allocate tag data!");
+            rc = PLCTAG_ERR_NO_MEM;
+        }
+    }
+
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to find the size of the tag (%s)!", plc_tag_decode_error(rc));
+        tag->status = rc;
+        tag->held_op = TAG_OP_NONE;
+    }
+
+    return rc;
+}
+
+
+/* browse tags have nothing to send, the read waits for the table. */
+int symbols_browse_read_start(ab_tag_p tag)
+{
+    tag->read_in_progress = 1;
+
+    return symbols_browse_status(tag);
+}
+
+
+/*
+ * symbols_browse_status
+ *
+ * A read of a browse tag finishes when the symbol table is in.  The tag
+ * data is then resized to hold every controller scope tag, in instance
+ * order.  Each one is
+ *
+ * uint32_t instance ID
+ * uint16_t type
+ * uint16_t element size in bytes
+ * uint32_t[3] array dimensions, zero where not used
+ * uint16_t name length
+ * the name, not zero terminated
+ *
+ * all little endian.  The table is read once per session, so to see tags
+ * added to the PLC later, destroy the tags that use it and create them again.
+ */
+int symbols_browse_status(ab_tag_p tag)
+{
+    int rc = tag->session->status;
+
+    if(!tag->read_in_progress) {
+        return (rc == PLCTAG_STATUS_OK ? tag->status : rc);
+    }
+
+    if((rc = symbols_wait(tag)) == PLCTAG_STATUS_PENDING) {
+        return rc;
+    }
+
+    tag->read_in_progress = 0;
+
+    if(rc == PLCTAG_STATUS_OK) {
+        rc = symbols_browse_fill(tag);
+    } else {
+        pdebug(DEBUG_WARN, "Unable to read the symbol table (%s)!", plc_tag_decode_error(rc));
+    }
+
+    return rc;
+}
+
+
+
+
+/*
+ * Find the table for the path, or create it and start reading it.
+ *
+ * You must hold the session mutex before calling this!
+ */
+static ab_symbols_p symbols_find_or_create_unsafe(const char *path, ab_tag_p tag)
+{
+    ab_symbols_p symbols = session_find_symbols_unsafe(tag->session, path);
+    int rc;
+
+    if(symbols) {
+        pdebug(DEBUG_INFO, "Reusing existing symbol table.");
+        return symbols;
+    }
+
+    symbols = symbols_create_unsafe(path, tag);
+
+    if(!symbols) {
+        return NULL;
+    }
+
+    /* under the mutex, so the IO thread never sees the table without its request. */
+    rc = symbols_start_max(symbols);
+
+    if(rc == PLCTAG_STATUS_PENDING) {
+        symbols->session->symbols_loading++;
+    } else {
+        /* tags fall back to their names, or fail if they need a size. */
+        pdebug(DEBUG_WARN, "Unable to start reading the symbol table!");
+        atomic_int_store(&symbols->status, rc);
+    }
+
+    return symbols;
+}
+
+
+/*
+ * Session list of symbol tables.
+ *
+ * You must hold the session mutex before calling any of these!
+ */
+
+static ab_symbols_p session_find_symbols_unsafe(ab_session_p session, const char *path)
+{
+    ab_symbols_p symbols = session->symbols;
+
+    while(symbols) {
+        /* skip any that are out of date or on their way out. */
+        if(!symbols->stale && str_cmp_i(symbols->path, path) == 0 && rc_inc(symbols)) {
+            break;
+        }
+
+        symbols = symbols->next;
+    }
+
+    return symbols;
+}
+
+
+static void session_remove_symbols_unsafe(ab_session_p session, ab_symbols_p symbols)
+{
+    ab_symbols_p *walker = &session->symbols;
+
+    while(*walker && *walker != symbols) {
+        walker = &((*walker)->next);
+    }
+
+    if(*walker) {
+        *walker = symbols->next;
+    }
+
+    symbols->next = NULL;
+}
+
+
+static ab_symbols_p symbols_create_unsafe(const char *path, ab_tag_p tag)
+{
+    ab_symbols_p symbols = (ab_symbols_p)rc_alloc(sizeof(struct ab_symbols_t), symbols_destroy);
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(!symbols) {
+        pdebug(DEBUG_ERROR, "Unable to allocate new symbol table!");
+        return NULL;
+    }
+
+    symbols->session = rc_inc(tag->session);
+    symbols->status = PLCTAG_STATUS_PENDING;
+
+    str_copy(&symbols->path[0], MAX_CONN_PATH, path);
+
+    /* the list is read with unconnected requests, routed like the tag's. */
+    mem_copy(symbols->conn_path, tag->conn_path, tag->conn_path_size);
+    symbols->conn_path_size = tag->conn_path_size;
+
+    symbols->next = symbols->session->symbols;
+    symbols->session->symbols = symbols;
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return symbols;
+}
+
+
+static void symbols_destroy(void *symbols_arg)
+{
+    ab_symbols_p symbols = symbols_arg;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(!symbols) {
+        pdebug(DEBUG_WARN, "Symbol table destructor called with null pointer!");
+        return;
+    }
+
+    critical_block(symbols->session->mutex) {
+        session_remove_symbols_unsafe(symbols->session, symbols);
+
+        /* the session drops the requests when it is done with them. */
+        if(symbols->status == PLCTAG_STATUS_PENDING) {
+            symbols_load_done_unsafe(symbols, PLCTAG_ERR_ABORT);
+        }
+
+        symbols_release_held_tags_unsafe(symbols);
+    }
+
+    if(symbols->entries) {
+        for(int i=0; i < vector_length(symbols->entries); i++) {
+            mem_free(vector_get(symbols->entries, i));
+        }
+
+        vector_destroy(symbols->entries);
+    }
+
+    if(symbols->buckets) {
+        mem_free(symbols->buckets);
+    }
+
+    rc_dec(symbols->session);
+
+    pdebug(DEBUG_INFO, "Done.");
+}
+
+
+/*
+ * symbols_wait
+ *
+ * Returns the table status.  While it is loading, the tag's done signal is
+ * put on the list woken when the table is in, so the blocking calls do not
+ * have to poll.
+ */
+static int symbols_wait(ab_tag_p tag)
+{
+    ab_symbols_p symbols = tag->symbols;
+    int rc = atomic_int_load(&symbols->status);
+
+    /* the usual case, no lock needed. */
+    if(rc != PLCTAG_STATUS_PENDING) {
+        return rc;
+    }
+
+    critical_block(symbols->session->mutex) {
+        rc = symbols->status;
+
+        if(rc != PLCTAG_STATUS_PENDING || tag->symbols_held || !tag->done) {
+            break;
+        }
+
+        if(!symbols->held_tags) {
+            symbols->held_tags = vector_create(8, 64); /* MAGIC */
+        }
+
+        if(symbols->held_tags && vector_put(symbols->held_tags, vector_length(symbols->held_tags), tag->done) == PLCTAG_STATUS_OK) {
+            rc_inc(tag->done);
+            tag->symbols_held = 1;
+        } else {
+            /* the tag still wakes up to check now and then. */
+            pdebug(DEBUG_WARN, "Unable to add tag to the symbol table wait list!");
+        }
+    }
+
+    return rc;
+}
+
+
+/* wake any tags waiting on the table and drop our references to them. */
+static void symbols_release_held_tags_unsafe(ab_symbols_p symbols)
+{
+    if(!symbols->held_tags) {
+        return;
+    }
+
+    for(int i=0; i < vector_length(symbols->held_tags); i++) {
+        tag_done_p done = vector_get(symbols->held_tags, i);
+
+        tag_done_signal(done);
+        rc_dec(done);
+    }
+
+    vector_destroy(symbols->held_tags);
+    symbols->held_tags = NULL;
+}
+
+
+/*
+ * Find the entry for the base tag, the first symbolic segment of the
+ * encoded name.  *rest is set to where the segments after it start.
+ * Program scope tags are not in the controller table.
+ */
+static int symbols_find_base(ab_tag_p tag, ab_symbol_p *symbol, int *rest)
+{
+    const char *name;
+    int name_len;
+
+    /* word count, 0x91 and the name length. */
+    if(tag->encoded_name_size < 3 || tag->encoded_name[1] != 0x91) {
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    name = (const char *)&tag->encoded_name[3];
+    name_len = tag->encoded_name[2];
+    *rest = 3 + name_len + (name_len & 0x01);
+
+    if(*rest > tag->encoded_name_size) {
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    for(int i=0; i < name_len; i++) {
+        if(name[i] == ':') {
+            pdebug(DEBUG_DETAIL, "Program scope tags are not in the controller symbol table.");
+            return PLCTAG_ERR_NOT_FOUND;
+        }
+    }
+
+    *symbol = symbols_find(tag->symbols, name, name_len);
+
+    return (*symbol ? PLCTAG_STATUS_OK : PLCTAG_ERR_NOT_FOUND);
+}
+
+
+/*
+ * symbols_send_request
+ *
+ * Wrap an embedded CIP request in an Unconnected Send and queue it.  Must
+ * be called with the session mutex held.
+ *
+ * Returns PLCTAG_STATUS_PENDING if the request was queued.
+ */
+static int symbols_send_request(ab_symbols_p symbols, uint8_t *embed, int embed_size, ab_request_p *req_out)
+{
+    eip_cip_uc_req *cip;
+    uint8_t *data;
+    ab_request_p req = NULL;
+    int rc = PLCTAG_STATUS_OK;
+
+    rc = request_create(&req, MAX_CIP_MSG_SIZE);
+
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to get new request.  rc=%d", rc);
+        return rc;
+    }
+
+    /* give up if the PLC does not answer. */
+    req->resp_timeout = SYMBOLS_PAGE_TIMEOUT;
+
+    cip = (eip_cip_uc_req *)(req->data);
+    data = (req->data) + sizeof(eip_cip_uc_req);
+
+    mem_copy(data, embed, embed_size);
+    data += embed_size;
+
+    /* routing, path size in words, a pad byte and the path. */
+    if(symbols->conn_path_size > 0) {
+        *data = (symbols->conn_path_size) / 2;
+        data++;
+        *data = 0;
+        data++;
+        mem_copy(data, symbols->conn_path, symbols->conn_path_size);
+        data += symbols->conn_path_size;
+    }
+
+    cip->encap_command = h2le16(AB_EIP_READ_RR_DATA);
+    cip->router_timeout = h2le16(1);
+
+    cip->cpf_item_count = h2le16(2);
+    cip->cpf_nai_item_type = h2le16(AB_EIP_ITEM_NAI);
+    cip->cpf_nai_item_length = h2le16(0);
+    cip->cpf_udi_item_type = h2le16(AB_EIP_ITEM_UDI);
+    cip->cpf_udi_item_length = h2le16(data - (uint8_t *)(&cip->cm_service_code));
+
+    /* Unconnected Send to the Connection Manager */
+    cip->cm_service_code = AB_EIP_CMD_UNCONNECTED_SEND;
+    cip->cm_req_path_size = 2;
+    cip->cm_req_path[0] = 0x20;
+    cip->cm_req_path[1] = 0x06;
+    cip->cm_req_path[2] = 0x24;
+    cip->cm_req_path[3] = 0x01;
+
+    cip->secs_per_tick = AB_EIP_SECS_PER_TICK;
+    cip->timeout_ticks = AB_EIP_TIMEOUT_TICKS;
+
+    cip->uc_cmd_length = h2le16(embed_size);
+
+    req->request_size = data - (req->data);
+    req->send_request = 1;
+
+    rc = session_add_request(symbols->session, req);
+
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to add request to session! rc=%d", rc);
+        rc_dec(req);
+        return rc;
+    }
+
+    *req_out = req;
+
+    return PLCTAG_STATUS_PENDING;
+}
+
+
+/* ask for the Max Instance attribute of the Symbol Object class. */
+static int symbols_start_max(ab_symbols_p symbols)
+{
+    uint8_t embed[] = { AB_EIP_CMD_CIP_GET_ATTR_SINGLE, 3, 0x20, AB_CIP_SYMBOL_CLASS, 0x24, 0x00, 0x30, 0x02 };
+
+    return symbols_send_request(symbols, embed, (int)sizeof(embed), &symbols->max_request);
+}
+
+
+/*
+ * The highest instance ID only decides how the list is split up.  If the
+ * PLC does not give it, the list is read as one range.
+ */
+static int symbols_check_max_unsafe(ab_symbols_p symbols)
+{
+    ab_request_p req = symbols->max_request;
+    eip_cip_uc_resp *resp = (eip_cip_uc_resp *)(req->data);
+    uint32_t max_instance = 0;
+
+    if(!req->resp_received) {
+        /* the session drops the request if the response does not come in time. */
+        if(!req->abort_request) {
+            return PLCTAG_STATUS_PENDING;
+        }
+
+        pdebug(DEBUG_WARN, "Timed out waiting for the symbol count!");
+        return PLCTAG_ERR_TIMEOUT;
+    }
+
+    if(le2h16(resp->encap_command) == AB_EIP_READ_RR_DATA
+       && le2h32(resp->encap_status) == AB_EIP_OK
+       && resp->reply_service == (AB_EIP_CMD_CIP_GET_ATTR_SINGLE | AB_EIP_CMD_CIP_OK)
+       && resp->status == AB_CIP_STATUS_OK) {
+        uint8_t *data = (req->data) + sizeof(eip_cip_uc_resp) + (resp->num_status_words * 2);
+        uint8_t *data_end = (req->data) + le2h16(resp->encap_length) + sizeof(eip_encap_t);
+
+        if(data_end - data >= 4) {
+            max_instance = le2h32(*((uint32_le *)data));
+        } else if(data_end - data >= 2) {
+            max_instance = le2h16(*((uint16_le *)data));
+        }
+    }
+
+    pdebug(DEBUG_DETAIL, "Highest symbol instance is %u.", (unsigned int)max_instance);
+
+    symbols->max_request = rc_dec(symbols->max_request);
+
+    return symbols_start_ranges(symbols, max_instance);
+}
+
+
+static int symbols_start_ranges(ab_symbols_p symbols, uint32_t max_instance)
+{
+    int num_ranges = (int)(max_instance / SYMBOLS_MIN_RANGE) + 1;
+    int rc = PLCTAG_STATUS_PENDING;
+
+    if(num_ranges > SYMBOLS_MAX_RANGES) {
+        num_ranges = SYMBOLS_MAX_RANGES;
+    }
+
+    /* the last range runs to the end of the list, wherever the PLC says that is. */
+    for(int i=0; i < num_ranges && rc == PLCTAG_STATUS_PENDING; i++) {
+        struct ab_symbols_range_t *range = &symbols->ranges[i];
+
+        range->next_instance = (uint32_t)(((uint64_t)max_instance + 1) * (uint64_t)i / (uint64_t)num_ranges);
+        range->end_instance = (i + 1 < num_ranges ? (uint32_t)(((uint64_t)max_instance + 1) * (uint64_t)(i + 1) / (uint64_t)num_ranges) : 0);
+
+        symbols->num_ranges++;
+
+        rc = symbols_start_page(symbols, range);
+    }
+
+    pdebug(DEBUG_DETAIL, "Reading the symbol list in %d ranges.", symbols->num_ranges);
+
+    return rc;
+}
+
+
+/*
+ * symbols_start_page
+ *
+ * Queue a Get_Instance_Attribute_List for the name, type, element size and
+ * dimensions of each Symbol Object instance from the next one in the range.
+ */
+static int symbols_start_page(ab_symbols_p symbols, struct ab_symbols_range_t *range)
+{
+    uint8_t embed[32]; /* MAGIC */
+    uint8_t *data = embed;
+
+    /* the last page is done, the response has been used. */
+    if(range->request) {
+        range->request = rc_dec(range->request);
+    }
+
+    *data++ = AB_EIP_CMD_CIP_LIST_INSTANCES;
+
+    if(range->next_instance <= 0xFFFF) {
+        *data++ = 3; /* path size in 16-bit words */
+        *data++ = 0x20;
+        *data++ = AB_CIP_SYMBOL_CLASS;
+        *data++ = 0x25;
+        *data++ = 0x00; /* pad */
+        *data++ = (uint8_t)(range->next_instance & 0xFF);
+        *data++ = (uint8_t)((range->next_instance >> 8) & 0xFF);
+    } else {
+        *data++ = 4; /* path size in 16-bit words */
+        *data++ = 0x20;
+        *data++ = AB_CIP_SYMBOL_CLASS;
+        *data++ = 0x26;
+        *data++ = 0x00; /* pad */
+        *data++ = (uint8_t)(range->next_instance & 0xFF);
+        *data++ = (uint8_t)((range->next_instance >> 8) & 0xFF);
+        *data++ = (uint8_t)((range->next_instance >> 16) & 0xFF);
+        *data++ = (uint8_t)((range->next_instance >> 24) & 0xFF);
+    }
+
+    /* attribute count, then 1 name, 2 type, 7 element size and 8 dimensions. */
+    *data++ = 4;
+    *data++ = 0;
+    *data++ = 1;
+    *data++ = 0;
+    *data++ = 2;
+    *data++ = 0;
+    *data++ = 7;
+    *data++ = 0;
+    *data++ = 8;
+    *data++ = 0;
+
+    return symbols_send_request(symbols, embed, (int)(data - embed), &range->request);
+}
+
+
+/* returns PLCTAG_STATUS_PENDING while the range has pages left, PLCTAG_STATUS_OK when it is done. */
+static int symbols_check_range_unsafe(ab_symbols_p symbols, struct ab_symbols_range_t *range)
+{
+    ab_request_p req = range->request;
+    int rc = PLCTAG_STATUS_OK;
+
+    if(!req->resp_received) {
+        if(!req->abort_request) {
+            return PLCTAG_STATUS_PENDING;
+        }
+
+        pdebug(DEBUG_WARN, "Timed out waiting for the symbol list!");
+        return PLCTAG_ERR_TIMEOUT;
+    }
+
+    rc = symbols_read_page(symbols, range, req);
+
+    if(rc == PLCTAG_STATUS_PENDING) {
+        rc = symbols_start_page(symbols, range);
+    } else if(rc == PLCTAG_STATUS_OK) {
+        range->request = rc_dec(range->request);
+    }
+
+    return rc;
+}
+
+
+/*
+ * symbols_read_page
+ *
+ * Add the entries in a page of the list.  Each one is the instance ID,
+ * the name with a 16-bit length, the type, the element size and three
+ * 32-bit dimensions.  Entries past the end of the range belong to the
+ * next range.
+ *
+ * Returns PLCTAG_STATUS_PENDING if the range has more to read.
+ */
+static int symbols_read_page(ab_symbols_p symbols, struct ab_symbols_range_t *range, ab_request_p req)
+{
+    eip_cip_uc_resp *resp = (eip_cip_uc_resp *)(req->data);
+    uint8_t *data = (req->data) + sizeof(eip_cip_uc_resp);
+    uint8_t *data_end = (req->data) + le2h16(resp->encap_length) + sizeof(eip_encap_t);
+    uint32_t instance = 0;
+    int count = 0;
+
+    if(le2h16(resp->encap_command) != AB_EIP_READ_RR_DATA) {
+        pdebug(DEBUG_WARN, "Unexpected EIP packet type received: %d!", resp->encap_command);
+        return PLCTAG_ERR_BAD_DATA;
+    }
+
+    if(le2h32(resp->encap_status) != AB_EIP_OK) {
+        pdebug(DEBUG_WARN, "EIP command failed, response code: %d", le2h32(resp->encap_status));
+        return PLCTAG_ERR_REMOTE_ERR;
+    }
+
+    if(resp->reply_service != (AB_EIP_CMD_CIP_LIST_INSTANCES | AB_EIP_CMD_CIP_OK)) {
+        pdebug(DEBUG_WARN, "CIP response reply service unexpected: %d", resp->reply_service);
+        return PLCTAG_ERR_BAD_DATA;
+    }
+
+    if(resp->status != AB_CIP_STATUS_OK && resp->status != AB_CIP_STATUS_FRAG) {
+        pdebug(DEBUG_WARN, "Symbol list failed with status: 0x%x %s", resp->status, decode_cip_error_short((uint8_t *)&resp->status));
+        return decode_cip_error_code((uint8_t *)&resp->status);
+    }
+
+    data += resp->num_status_words * 2;
+
+    while(data < data_end) {
+        int name_len;
+
+        if(data_end - data < 6) {
+            pdebug(DEBUG_WARN, "Symbol list entry is cut off!");
+            return PLCTAG_ERR_BAD_DATA;
+        }
+
+        instance = le2h32(*((uint32_le *)data));
+        name_len = le2h16(*((uint16_le *)(data + 4)));
+
+        /* type, element size and dimensions follow the name. */
+        if(data_end - data < 6 + name_len + 16) {
+            pdebug(DEBUG_WARN, "Symbol list entry is cut off!");
+            return PLCTAG_ERR_BAD_DATA;
+        }
+
+        if(range->end_instance && instance >= range->end_instance) {
+            return PLCTAG_STATUS_OK;
+        }
+
+        if(symbols_add(symbols, instance, data + 4, name_len) != PLCTAG_STATUS_OK) {
+            return PLCTAG_ERR_NO_MEM;
+        }
+
+        data += 6 + name_len + 16;
+        count++;
+    }
+
+    if(resp->status == AB_CIP_STATUS_FRAG) {
+        /* a page with nothing in it would never end. */
+        if(!count) {
+            pdebug(DEBUG_WARN, "PLC has more symbols but sent none!");
+            return PLCTAG_ERR_BAD_DATA;
+        }
+
+        range->next_instance = instance + 1;
+
+        if(!range->end_instance || range->next_instance < range->end_instance) {
+            return PLCTAG_STATUS_PENDING;
+        }
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/* the table is loaded or failed, wake the tags waiting for it. */
+static void symbols_load_done_unsafe(ab_symbols_p symbols, int status)
+{
+    if(symbols->max_request) {
+        symbols->max_request->abort_request = 1;
+        symbols->max_request = rc_dec(symbols->max_request);
+    }
+
+    for(int i=0; i < symbols->num_ranges; i++) {
+        if(symbols->ranges[i].request) {
+            symbols->ranges[i].request->abort_request = 1;
+            symbols->ranges[i].request = rc_dec(symbols->ranges[i].request);
+        }
+    }
+
+    symbols->session->symbols_loading--;
+
+    if(status == PLCTAG_STATUS_OK) {
+        symbols_sort(symbols);
+        pdebug(DEBUG_INFO, "Symbol table has %d tags.", (symbols->entries ? vector_length(symbols->entries) : 0));
+    } else {
+        pdebug(DEBUG_WARN, "Unable to read the symbol table (%s)!", plc_tag_decode_error(status));
+    }
+
+    /* tags look at the table without the lock once they see this. */
+    atomic_int_store(&symbols->status, status);
+
+    symbols_release_held_tags_unsafe(symbols);
+}
+
+
+/* entry points at the name length, the name and the rest of the attributes follow. */
+static int symbols_add(ab_symbols_p symbols, uint32_t instance, uint8_t *entry, int name_len)
+{
+    ab_symbol_p symbol;
+    uint8_t *data = entry + 2 + name_len;
+    uint32_t bucket;
+
+    /* nothing could look it up anyway. */
+    if(name_len <= 0 || name_len >= MAX_TAG_NAME) {
+        return PLCTAG_STATUS_OK;
+    }
+
+    if(!symbols->entries) {
+        symbols->entries = vector_create(256, 4096); /* MAGIC */
+
+        if(!symbols->entries) {
+            pdebug(DEBUG_ERROR, "Unable to allocate symbol table entries!");
+            return PLCTAG_ERR_NO_MEM;
+        }
+    }
+
+    /* keep the load factor at two or less. */
+    if(vector_length(symbols->entries) >= symbols->num_buckets * 2) {
+        symbols_grow(symbols);
+
+        if(!symbols->buckets) {
+            return PLCTAG_ERR_NO_MEM;
+        }
+    }
+
+    symbol = mem_alloc((int)sizeof(struct ab_symbol_t) + name_len + 1);
+
+    if(!symbol) {
+        pdebug(DEBUG_ERROR, "Unable to allocate symbol table entry!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    symbol->instance = instance;
+    symbol->name_len = name_len;
+    symbol->name = (char *)(symbol + 1);
+    mem_copy(symbol->name, entry + 2, name_len);
+    symbol->name_hash = symbols_hash(symbol->name, name_len);
+
+    symbol->type = le2h16(*((uint16_le *)data));
+    data += sizeof(uint16_le);
+    symbol->elem_size = le2h16(*((uint16_le *)data));
+    data += sizeof(uint16_le);
+
+    for(int i=0; i < 3; i++) {
+        symbol->dims[i] = le2h32(*((uint32_le *)data));
+        data += sizeof(uint32_le);
+    }
+
+    if(vector_put(symbols->entries, vector_length(symbols->entries), symbol) != PLCTAG_STATUS_OK) {
+        mem_free(symbol);
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    bucket = symbol->name_hash & (uint32_t)(symbols->num_buckets - 1);
+    symbol->next = symbols->buckets[bucket];
+    symbols->buckets[bucket] = symbol;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/* the ranges come in side by side, put the entries back in instance order. */
+static void symbols_sort(ab_symbols_p symbols)
+{
+    int count = (symbols->entries ? vector_length(symbols->entries) : 0);
+    ab_symbol_p *sorted;
+
+    if(count < 2) {
+        return;
+    }
+
+    sorted = mem_alloc((int)sizeof(ab_symbol_p) * count);
+
+    if(!sorted) {
+        pdebug(DEBUG_WARN, "Unable to sort the symbol table!");
+        return;
+    }
+
+    for(int i=0; i < count; i++) {
+        sorted[i] = vector_get(symbols->entries, i);
+    }
+
+    qsort(sorted, (size_t)count, sizeof(ab_symbol_p), symbols_compare);
+
+    for(int i=0; i < count; i++) {
+        vector_put(symbols->entries, i, sorted[i]);
+    }
+
+    mem_free(sorted);
+}
+
+
+static int symbols_compare(const void *first, const void *second)
+{
+    uint32_t first_instance = (*(const ab_symbol_p *)first)->instance;
+    uint32_t second_instance = (*(const ab_symbol_p *)second)->instance;
+
+    return (first_instance > second_instance) - (first_instance < second_instance);
+}
+
+
+/* double the hash table.  The table size is always a power of two. */
+static void symbols_grow(ab_symbols_p symbols)
+{
+    int new_num_buckets = (symbols->num_buckets ? symbols->num_buckets * 2 : SYMBOLS_MIN_BUCKETS);
+    ab_symbol_p *new_buckets = mem_alloc((int)sizeof(ab_symbol_p) * new_num_buckets);
+
+    if(!new_buckets) {
+        /* we can live with longer chains. */
+        pdebug(DEBUG_WARN, "Unable to grow the symbol table to %d buckets!", new_num_buckets);
+        return;
+    }
+
+    for(int i=0; i < symbols->num_buckets; i++) {
+        ab_symbol_p symbol = symbols->buckets[i];
+
+        while(symbol) {
+            ab_symbol_p next = symbol->next;
+            uint32_t bucket = symbol->name_hash & (uint32_t)(new_num_buckets - 1);
+
+            symbol->next = new_buckets[bucket];
+            new_buckets[bucket] = symbol;
+
+            symbol = next;
+        }
+    }
+
+    if(symbols->buckets) {
+        mem_free(symbols->buckets);
+    }
+
+    symbols->buckets = new_buckets;
+    symbols->num_buckets = new_num_buckets;
+}
+
+
+/* hash of the lower case name, so lookups do not care about case. */
+static uint32_t symbols_hash(const char *name, int name_len)
+{
+    uint8_t lower[MAX_TAG_NAME];
+
+    for(int i=0; i < name_len; i++) {
+        lower[i] = (uint8_t)tolower((unsigned char)name[i]);
+    }
+
+    return hash(lower, (size_t)name_len, 0);
+}
+
+
+/* lay the table out in the tag data, see symbols_browse_status(). */
+static int symbols_browse_fill(ab_tag_p tag)
+{
+    vector_p entries = tag->symbols->entries;
+    int count = (entries ? vector_length(entries) : 0);
+    int size = 0;
+    uint8_t *buf = NULL;
+    uint8_t *data;
+
+    for(int i=0; i < count; i++) {
+        ab_symbol_p symbol = vector_get(entries, i);
+
+        size += SYMBOLS_BROWSE_ENTRY_HEADER + symbol->name_len;
+    }
+
+    if(size && !(buf = (uint8_t*)mem_alloc(size))) {
+        pdebug(DEBUG_WARN, "Unable to allocate %d bytes for the tag list!", size);
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    data = buf;
+
+    for(int i=0; i < count; i++) {
+        ab_symbol_p symbol = vector_get(entries, i);
+
+        *((uint32_le *)data) = h2le32(symbol->instance);
+        data += sizeof(uint32_le);
+        *((uint16_le *)data) = h2le16(symbol->type);
+        data += sizeof(uint16_le);
+        *((uint16_le *)data) = h2le16(symbol->elem_size);
+        data += sizeof(uint16_le);
+
+        for(int j=0; j < 3; j++) {
+            *((uint32_le *)data) = h2le32(symbol->dims[j]);
+            data += sizeof(uint32_le);
+        }
+
+        *((uint16_le *)data) = h2le16((uint16_t)symbol->name_len);
+        data += sizeof(uint16_le);
+        mem_copy(data, symbol->name, symbol->name_len);
+        data += symbol->name_len;
+    }
+
+    if(tag->data) {
+        mem_free(tag->data);
+    }
+
+    tag->data = buf;
+    tag->size = size;
+    tag->elem_count = count;
+
+    pdebug(DEBUG_DETAIL, "Tag list has %d tags in %d bytes.", count, size);
+
+    return PLCTAG_STATUS_OK;
+}
@@ -0,0 +1,120 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Library General Public License for more details.                  *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*
+ * symbols.h
+ *
+ * The controller's symbol table, read once per session and path from the
+ * Symbol Object (class 0x6B).  Tags use it to send the instance ID of
+ * their base tag instead of its name and to find their size, and browse
+ * tags return it.
+ */
+
+#ifndef __AB_SYMBOLS_H__
+#define __AB_SYMBOLS_H__
+
+
+#include <platform.h>
+#include <ab/ab_common.h>
+#include <util/attr.h>
+#include <util/vector.h>
+#include <ab/session.h>
+#include <ab/tag.h>
+
+
+#define SYMBOLS_PAGE_TIMEOUT (5000)
+#define SYMBOLS_MIN_BUCKETS (64)
+
+/*
+ * The list is read in ranges of instance IDs, each with its own page
+ * request in flight.  Small tables are not split as far.
+ */
+#define SYMBOLS_MAX_RANGES (8)
+#define SYMBOLS_MIN_RANGE (256)
+
+/* reading a Logix tag with this name gets the PLC's tag list, see symbols_browse_status(). */
+#define SYMBOLS_BROWSE_NAME "@tags"
+
+/* each tag in the list is the instance, type, element size, three dimensions and the name length, then the name. */
+#define SYMBOLS_BROWSE_ENTRY_HEADER (22)
+
+typedef struct ab_symbol_t *ab_symbol_p;
+
+/* one controller scope tag. */
+struct ab_symbol_t {
+    ab_symbol_p next; /* hash chain */
+    uint32_t name_hash;
+    uint32_t instance;
+    uint16_t type;
+    uint16_t elem_size;
+    uint32_t dims[3];
+    int name_len;
+    char *name; /* stored after the struct */
+};
+
+struct ab_symbols_range_t {
+    ab_request_p request;
+    uint32_t next_instance;
+    uint32_t end_instance; /* first instance of the next range, zero for the last range */
+};
+
+struct ab_symbols_t {
+    ab_symbols_p next;
+
+    char path[MAX_CONN_PATH];
+
+    ab_session_p session;
+
+    /* routing for the unconnected requests */
+    uint8_t conn_path[MAX_CONN_PATH];
+    uint8_t conn_path_size;
+
+    /* PLCTAG_STATUS_PENDING until the whole list is in, see atomic_int_load() and atomic_int_store(). */
+    volatile int status;
+
+    /* the PLC's tags changed, new tags read the table again.  Under the session mutex. */
+    int stale;
+
+    /* the IO thread moves these along, the highest instance ID first, then the ranges. */
+    ab_request_p max_request;
+    struct ab_symbols_range_t ranges[SYMBOLS_MAX_RANGES];
+    int num_ranges;
+
+    /* done signals of tags waiting for the table. */
+    vector_p held_tags;
+
+    /* entries in instance order, and hashed by name. */
+    vector_p entries;
+    ab_symbol_p *buckets;
+    int num_buckets;
+};
+
+
+extern int symbols_find_or_create(ab_tag_p tag, attr attribs);
+extern int symbols_check_load_unsafe(ab_symbols_p symbols);
+extern ab_symbol_p symbols_find(ab_symbols_p symbols, const char *name, int name_len);
+extern int symbols_encode_tag_name(ab_tag_p tag);
+extern int symbols_path_error(ab_tag_p tag, uint8_t cip_status);
+extern int symbols_size_tag(ab_tag_p tag);
+extern int symbols_browse_read_start(ab_tag_p tag);
+extern int symbols_browse_status(ab_tag_p tag);
+
+
+#endif
@@ -65,6 +65,16 @@ struct ab_tag_t {
     uint8_t encoded_name[MAX_TAG_NAME];
     int encoded_name_size;
 
+    /* the PLC's symbol table, used to swap the base name for its instance ID, see symbols_encode_tag_name() */
+    ab_symbols_p symbols;
+    int symbols_checked;
+    int symbols_held; /* done signal is on the table's wait list */
+    uint8_t symbolic_name[MAX_TAG_NAME]; /* the name encoding while the instance ID is used */
+    int symbolic_name_size;
+    int symbols_reloaded; /* a path error had the table read again, see symbols_path_error() */
+    int use_instance_id;
+    int browse; /* reads return the tag list, see symbols_browse_status() */
+
     const char *read_group;
 
     /* the connection IOI path */
@@ -83,6 +93,10 @@ struct ab_tag_t {
     int elem_count;
     int elem_size;
 
+    /* let the IO thread pack small reads or writes of this tag with others, see session_coalesce_unsafe() */
+    int coalesce_reads;
+    int coalesce_writes;
+
     /* requests */
     int pre_write_read;
     int first_read;
@@ -97,7 +111,21 @@ struct ab_tag_t {
     /* flags for operations */
     int read_in_progress;
     int write_in_progress;
+    int held_op; /* TAG_OP_READ or TAG_OP_WRITE waiting for the connection to open or the tag size */
     /*int connect_in_progress;*/
+
+    /* read groups, see multi_tag_read_start() */
+    vector_p group_reqs; /* for each request of a group read, the tags it reads */
+    int64_t group_read_stamp; /* when this tag's group read started */
+
+    /* group reads started by other tags leave this tag's data here, protected by group_mutex */
+    mutex_p group_mutex;
+    int group_fresh;
+    int64_t group_write_stamp; /* when this tag last started or finished a write */
+    int group_status;
+    uint8_t *group_data;
+    uint8_t group_type_info[MAX_TAG_TYPE_INFO];
+    int group_type_info_size;
 };
 
 
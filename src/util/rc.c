@@ -55,8 +55,7 @@ struct cleanup_t {
  */
 
 struct refcount_t {
-    lock_t lock;
-    int count;
+    volatile int count;  /* only changed with atomic_int_cas(), see rc_inc() */
     const char *function_name;
     int line_num;
     //cleanup_p cleaners;
@@ -107,7 +106,6 @@ void *rc_alloc_impl(const char *func, int line_num, int data_size, rc_cleanup_fu
     }
 
     rc->count = 1;  /* start with a reference count. */
-    rc->lock = LOCK_INIT;
 
     rc->cleanup_func = cleaner_func;
 
@@ -225,23 +223,23 @@ void *rc_inc_impl(const char *func, int line_num, void *data)
     /* get the refcount structure. */
     rc = ((refcount_p)data) - 1;
 
-    /* loop until we get the lock */
-    while (!lock_acquire(&rc->lock)) {
-        ; /* do nothing, just spin */
+    /*
+     * Only count up from a live count.  Once it reaches zero the cleanup
+     * has started and the reference cannot come back.  No lock, so taking
+     * a reference does not spin behind other threads doing the same.
+     */
+    do {
+        count = rc->count;
+    } while(count > 0 && !atomic_int_cas(&rc->count, count, count + 1));
+
+    if(count > 0) {
+        count++;
+        result = data;
+    } else {
+        pdebug(DEBUG_WARN,"Reference is invalid!");
+        result = NULL;
     }
 
-        if(rc->count > 0) {
-            rc->count++;
-            count = rc->count;
-            result = data;
-        } else {
-            pdebug(DEBUG_WARN,"Reference is invalid!");
-            result = NULL;
-        }
-
-    /* release the lock so that other things can get to it. */
-    lock_release(&rc->lock);
-
     if(!result) {
         pdebug(DEBUG_WARN,"Invalid ref from call at %s line %d!  Unable to take strong reference.", func, line_num);
     } else {
@@ -281,21 +279,17 @@ void *rc_dec_impl(const char *func, int line_num, void *data)
     /* get the refcount structure. */
     rc = ((refcount_p)data) - 1;
 
-    /* loop until we get the lock */
-    while (!lock_acquire(&rc->lock)) {
-        ; /* do nothing, just spin */
-    }
-
-        if(rc->count > 0) {
-            rc->count--;
-            count = rc->count;
-        } else {
-            pdebug(DEBUG_WARN,"Reference is invalid!");
-            invalid = 1;
-        }
+    /* the same as rc_inc(), never count down past zero. */
+    do {
+        count = rc->count;
+    } while(count > 0 && !atomic_int_cas(&rc->count, count, count - 1));
 
-    /* release the lock so that other things can get to it. */
-    lock_release(&rc->lock);
+    if(count > 0) {
+        count--;
+    } else {
+        pdebug(DEBUG_WARN,"Reference is invalid!");
+        invalid = 1;
+    }
 
     pdebug(DEBUG_DETAIL,"Ref count is %d for %p.", count, data);
 
@@ -333,8 +327,10 @@ void refcount_cleanup(refcount_p rc)
 //        cleanup_entry_destroy(entry);
 //    }
 
-    /* call the clean up function */
-    rc->cleanup_func((void *)(rc+1));
+    /* call the clean up function, plain buffers do not have one. */
+    if(rc->cleanup_func) {
+        rc->cleanup_func((void *)(rc+1));
+    }
 
     /* finally done. */
     mem_free(rc);
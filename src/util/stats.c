@@ -0,0 +1,95 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Library General Public License for more details.                  *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <stdint.h>
+#include <lib/libplctag.h>
+#include <platform.h>
+#include <util/debug.h>
+#include <util/stats.h>
+
+
+/* these must be in the same order as stat_id_t */
+static const char *stat_names[STAT_NUM_STATS] = {
+    "send_syscalls",
+    "send_packets",
+    "recv_syscalls",
+    "recv_packets",
+    "request_pool_hits",
+    "request_pool_misses",
+    "coalesced_packets",
+    "coalesced_requests",
+    "instance_id_tags"
+};
+
+/*
+ * Every IO thread bumps these on each send and receive, so each thread
+ * adds to its own copy, on its own cache lines, and reading one adds
+ * the copies up.
+ */
+#define STAT_SHARDS (16)
+#define STAT_CACHE_LINE (64)
+
+static struct {
+    volatile int64_t values[STAT_NUM_STATS];
+    uint8_t pad[STAT_CACHE_LINE]; /* no two copies share a line, however the array is aligned */
+} stat_shards[STAT_SHARDS];
+
+
+
+void stat_add(stat_id_t stat, int64_t amount)
+{
+    if(stat < 0 || stat >= STAT_NUM_STATS) {
+        return;
+    }
+
+    atomic_add64(&stat_shards[thread_slot() % STAT_SHARDS].values[stat], amount);
+}
+
+
+
+/*
+ * stat_get
+ *
+ * Look up a counter by name.  Returns PLCTAG_ERR_NOT_FOUND if there is
+ * no counter by that name.
+ */
+int stat_get(const char *name, int64_t *value)
+{
+    if(!name || !value) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    for(int i=0; i < STAT_NUM_STATS; i++) {
+        if(str_cmp(name, stat_names[i]) == 0) {
+            *value = 0;
+
+            /* adding zero gives us an atomic read on every platform. */
+            for(int shard=0; shard < STAT_SHARDS; shard++) {
+                *value += atomic_add64(&stat_shards[shard].values[i], 0);
+            }
+
+            return PLCTAG_STATUS_OK;
+        }
+    }
+
+    pdebug(DEBUG_WARN, "No statistic named %s.", name);
+
+    return PLCTAG_ERR_NOT_FOUND;
+}
@@ -0,0 +1,46 @@
+/***************************************************************************
+ *   Copyright (C) 2018 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Library General Public License for more details.                  *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*
+ * stats.h
+ *
+ * Library wide counters for measuring what the IO code is doing.  They
+ * are cheap enough to leave on all the time.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+typedef enum {
+    STAT_SEND_SYSCALLS = 0,
+    STAT_SEND_PACKETS,
+    STAT_RECV_SYSCALLS,
+    STAT_RECV_PACKETS,
+    STAT_REQUEST_POOL_HITS,
+    STAT_REQUEST_POOL_MISSES,
+    STAT_COALESCED_PACKETS,
+    STAT_COALESCED_REQUESTS,
+    STAT_INSTANCE_ID_TAGS,
+    STAT_NUM_STATS
+} stat_id_t;
+
+extern void stat_add(stat_id_t stat, int64_t amount);
+extern int stat_get(const char *name, int64_t *value);